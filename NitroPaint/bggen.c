@@ -339,6 +339,39 @@ static void BgiTdlReset(BgTileDiffList *list) {
 	list->minDiff = 1e32;
 }
 
+//palettes kept detached from a reduction context between tiles, so that each palette is loaded once
+//and keeps its color lookup cache.
+typedef struct BgiPaletteSet_ {
+	RxPalette *palettes[16];      // detached palettes
+	int current;                  // palette attached to the reduction, or -1
+} BgiPaletteSet;
+
+static void BgiPaletteSetInit(BgiPaletteSet *set) {
+	memset(set->palettes, 0, sizeof(set->palettes));
+	set->current = -1;
+}
+
+static void BgiPaletteSetSelect(RxReduction *reduction, BgiPaletteSet *set, int iPalette, const COLOR32 *pltt, unsigned int nColors) {
+	if (set->current == iPalette) return;
+
+	if (set->current != -1) set->palettes[set->current] = RxPaletteDetach(reduction);
+	if (set->palettes[iPalette] != NULL) {
+		RxPaletteAttach(reduction, set->palettes[iPalette]);
+		set->palettes[iPalette] = NULL;
+	} else {
+		RxPaletteLoad(reduction, pltt, nColors);
+	}
+	set->current = iPalette;
+}
+
+static void BgiPaletteSetFree(BgiPaletteSet *set) {
+	//the attached palette is freed with the reduction context.
+	for (int i = 0; i < 16; i++) {
+		RxPaletteDestroy(set->palettes[i]);
+		set->palettes[i] = NULL;
+	}
+}
+
 static inline int BgiGetDiffEntry(int row, int col, int dim) {
 	//we simulate a symmetric matrix (with a zeroed diagonal) using half the memory of one. 
 	//this creates a buffer ordered like:
@@ -382,6 +415,8 @@ int BgPerformCharacterCompression(
 	unsigned char *flips = (unsigned char *) calloc(nTiles * nTiles, 1); //how must each tile be manipulated to best match its partner
 
 	RxReduction *reduction = RxNew(balance);
+	BgiPaletteSet paletteSet;
+	BgiPaletteSetInit(&paletteSet);
 	for (unsigned int i = 0; i < nTiles; i++) {
 		BgTile *t1 = &tiles[i];
 		for (unsigned int j = 0; j < i; j++) {
@@ -537,7 +572,7 @@ int BgPerformCharacterCompression(
 
 		//now, match colors to indices.
 		const COLOR32 *pal = palette + (bestPalette << nBits);
-		RxPaletteLoad(reduction, pal + paletteOffset - !!paletteOffset, paletteSize + !!paletteOffset);
+		BgiPaletteSetSelect(reduction, &paletteSet, bestPalette, pal + paletteOffset - !!paletteOffset, paletteSize + !!paletteOffset);
 
 		int idxs[64];
 		RxReduceImage(reduction, tile->px, idxs, 8, 8,
@@ -564,6 +599,7 @@ int BgPerformCharacterCompression(
 		tiles[i].charNo = tiles[tiles[i].masterTile].charNo;
 	}
 
+	BgiPaletteSetFree(&paletteSet);
 	RxFree(reduction);
 	return nChars;
 }
@@ -584,6 +620,9 @@ void BgSetupTiles(
 	RxReduction *reduction = RxNew(balance);
 	RxApplyFlags(reduction, RX_FLAG_ALPHA_MODE_RESERVE);
 
+	BgiPaletteSet paletteSet;
+	BgiPaletteSetInit(&paletteSet);
+
 	if (!dither) diffuse = 0.0f;
 
 	unsigned int effectivePaletteOffset = paletteOffset;
@@ -615,7 +654,7 @@ void BgSetupTiles(
 
 		//match colors
 		const COLOR32 *pal = palette + (bestPalette << nBits);
-		RxPaletteLoad(reduction, pal + effectivePaletteOffset - 1, effectivePaletteSize + 1);
+		BgiPaletteSetSelect(reduction, &paletteSet, bestPalette, pal + effectivePaletteOffset - 1, effectivePaletteSize + 1);
 
 		//reduce the tile graphics. Subtract 1 from the effective offset for the placeholder transparent entry
 		//(we will always have space for this). Reduction producing a color index 0 will be taken to be
@@ -642,6 +681,7 @@ void BgSetupTiles(
 		tile->palette = bestPalette;
 		tile->charNo = i;
 	}
+	BgiPaletteSetFree(&paletteSet);
 	RxFree(reduction);
 }
 
@@ -1198,6 +1238,8 @@ void BgReplaceSection(NCLR *nclr, NCGR *ncgr, NSCR *nscr, COLOR32 *px, int width
 	//create dummy reduction to setup parameters for color matching
 	unsigned int nColsPalette = paletteSize - !paletteOffset;
 	RxReduction *reduction = RxNew(&balanceSetting);
+	BgiPaletteSet paletteSet;
+	BgiPaletteSetInit(&paletteSet);
 
 	//generate an nPalettes color palette
 	if (newPalettes) {
@@ -1288,7 +1330,7 @@ void BgReplaceSection(NCLR *nclr, NCGR *ncgr, NSCR *nscr, COLOR32 *px, int width
 					int idxs[64];
 					unsigned char *chr = ncgr->tiles[charIndex];
 					COLOR32 *thisPalette = pals + palIndex * maxPaletteSize + paletteOffset - !!paletteOffset;
-					RxPaletteLoad(reduction, thisPalette, paletteSize + !!paletteOffset);
+					BgiPaletteSetSelect(reduction, &paletteSet, palIndex, thisPalette, paletteSize + !!paletteOffset);
 					RxReduceImage(reduction, tile->px, idxs, 8, 8,
 						RX_FLAG_ALPHA_MODE_RESERVE | RX_FLAG_PRESERVE_ALPHA | RX_FLAG_NO_ALPHA_DITHER, dither ? diffuse : 0.0f);
 
@@ -1419,7 +1461,7 @@ void BgReplaceSection(NCLR *nclr, NCGR *ncgr, NSCR *nscr, COLOR32 *px, int width
 
 						int idxs[64];
 						COLOR32 *thisPal = pals + leastIndex * maxPaletteSize + paletteOffset - !!paletteOffset;
-						RxPaletteLoad(reduction, thisPal, paletteSize + !!paletteOffset);
+						BgiPaletteSetSelect(reduction, &paletteSet, leastIndex, thisPal, paletteSize + !!paletteOffset);
 						RxReduceImage(reduction, block, idxs, 8, 8,
 							RX_FLAG_ALPHA_MODE_RESERVE | RX_FLAG_PRESERVE_ALPHA | RX_FLAG_NO_ALPHA_DITHER, dither ? diffuse : 0.0f);
 
@@ -1468,6 +1510,7 @@ void BgReplaceSection(NCLR *nclr, NCGR *ncgr, NSCR *nscr, COLOR32 *px, int width
 	}
 
 	RxMemFree(palsYiq);
+	BgiPaletteSetFree(&paletteSet);
 	RxFree(reduction);
 	RxMemFree(blocks);
 	free(pals);
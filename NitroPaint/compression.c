@@ -1,15 +1,30 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
 
 #include "compression.h"
 #include "bstream.h"
 #include "struct.h"
+#include "thread.h"
 
 #ifdef _MSC_VER
 #define inline __inline
 #endif
 
+//match length kernels for x86, selected at runtime
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CX_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CX_TARGET(x)
+#else
+#include <x86intrin.h>
+#include <cpuid.h>
+#define CX_TARGET(x)  __attribute__((target(x)))
+#endif
+#endif
+
 #ifdef _MSC_VER
 #ifdef _DEBUG
 #define CX_ASSERT(x)  if (!(x))__debugbreak()
@@ -49,8 +64,147 @@ static uint32_t CxiByteSwap(uint32_t x) {
 		| ((x & 0x000000FF) << 24);
 }
 
+// ----- Match length kernels
+
+typedef unsigned int (*CxiCompareProc) (const unsigned char *b1, const unsigned char *b2, unsigned int nMax);
+
+static inline unsigned int CxiCountTrailingZeros(uint32_t x) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, x);
+	return index;
+#else
+	return __builtin_ctz(x);
+#endif
+}
+
+static unsigned int CxiCompareMemoryScalar(const unsigned char *b1, const unsigned char *b2, unsigned int nMax) {
+	//compare a word at a time. The first differing byte is the lowest nonzero byte of the XOR.
+	unsigned int nSame = 0;
+	while (nMax - nSame >= 4) {
+		uint32_t w1, w2;
+		memcpy(&w1, b1 + nSame, 4);
+		memcpy(&w2, b2 + nSame, 4);
+		if (w1 != w2) return nSame + CxiCountTrailingZeros(w1 ^ w2) / 8;
+		nSame += 4;
+	}
+
+	while (nSame < nMax && b1[nSame] == b2[nSame]) nSame++;
+	return nSame;
+}
+
+#ifdef CX_X86
+
+CX_TARGET("sse2")
+static unsigned int CxiCompareMemorySse2(const unsigned char *b1, const unsigned char *b2, unsigned int nMax) {
+	//compare 16 bytes at a time. A clear bit in the comparison mask marks a differing byte.
+	unsigned int nSame = 0;
+	while (nMax - nSame >= 16) {
+		__m128i v1 = _mm_loadu_si128((const __m128i *) (b1 + nSame));
+		__m128i v2 = _mm_loadu_si128((const __m128i *) (b2 + nSame));
+		unsigned int diff = _mm_movemask_epi8(_mm_cmpeq_epi8(v1, v2)) ^ 0xFFFF;
+		if (diff) return nSame + CxiCountTrailingZeros(diff);
+		nSame += 16;
+	}
+	return nSame + CxiCompareMemoryScalar(b1 + nSame, b2 + nSame, nMax - nSame);
+}
+
+CX_TARGET("avx2")
+static unsigned int CxiCompareMemoryAvx2(const unsigned char *b1, const unsigned char *b2, unsigned int nMax) {
+	//compare 32 bytes at a time
+	unsigned int nSame = 0;
+	while (nMax - nSame >= 32) {
+		__m256i v1 = _mm256_loadu_si256((const __m256i *) (b1 + nSame));
+		__m256i v2 = _mm256_loadu_si256((const __m256i *) (b2 + nSame));
+		uint32_t diff = ((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, v2))) ^ 0xFFFFFFFF;
+		if (diff) return nSame + CxiCountTrailingZeros(diff);
+		nSame += 32;
+	}
+	return nSame + CxiCompareMemorySse2(b1 + nSame, b2 + nSame, nMax - nSame);
+}
+
+static int CxiGetSupportedMatchKernel(void) {
+	unsigned int info[4], xcr0 = 0;
+#ifdef _MSC_VER
+	__cpuidex((int *) info, 1, 0);
+#else
+	__cpuid_count(1, 0, info[0], info[1], info[2], info[3]);
+#endif
+	if (!((info[3] >> 26) & 1)) return CX_MATCH_KERNEL_SCALAR;
+
+	//AVX2 also needs the OS to save the YMM registers
+	int osxsave = (info[2] >> 27) & 1, avx = (info[2] >> 28) & 1;
+	if (!osxsave || !avx) return CX_MATCH_KERNEL_SSE2;
+#ifdef _MSC_VER
+	xcr0 = (unsigned int) _xgetbv(0);
+#else
+	__asm__ ("xgetbv" : "=a" (xcr0) : "c" (0) : "edx");
+#endif
+	if ((xcr0 & 6) != 6) return CX_MATCH_KERNEL_SSE2;
+
+#ifdef _MSC_VER
+	__cpuidex((int *) info, 7, 0);
+#else
+	__cpuid_count(7, 0, info[0], info[1], info[2], info[3]);
+#endif
+	return ((info[1] >> 5) & 1) ? CX_MATCH_KERNEL_AVX2 : CX_MATCH_KERNEL_SSE2;
+}
+
+#else // CX_X86
+
+static int CxiGetSupportedMatchKernel(void) {
+	return CX_MATCH_KERNEL_SCALAR;
+}
+
+#endif // CX_X86
+
+//the match length kernel selected, or CX_MATCH_KERNEL_AUTO until the first search selects one. It is
+//only accessed through the Th atomics, since searches on several threads may select it at once.
+static volatile long sCxiMatchKernel = CX_MATCH_KERNEL_AUTO;
+
+static int CxiResolveMatchKernel(int kernel) {
+	int supported = CxiGetSupportedMatchKernel();
+	if (kernel == CX_MATCH_KERNEL_AUTO || kernel > supported) kernel = supported;
+	if (kernel < CX_MATCH_KERNEL_SCALAR) kernel = CX_MATCH_KERNEL_SCALAR;
+	return kernel;
+}
+
+int CxSetMatchKernel(int kernel) {
+	kernel = CxiResolveMatchKernel(kernel);
+	ThAtomicStore(&sCxiMatchKernel, kernel);
+	return kernel;
+}
+
+static CxiCompareProc CxiGetCompareProc(void) {
+	//gets the function counting the matching bytes at the start of two buffers, up to nMax. A search
+	//gets it once when it starts, so that it keeps one kernel even if another is selected meanwhile.
+	int kernel = (int) ThAtomicLoad(&sCxiMatchKernel);
+	if (kernel == CX_MATCH_KERNEL_AUTO) {
+		//racing first searches store the same kernel
+		kernel = CxiResolveMatchKernel(CX_MATCH_KERNEL_AUTO);
+		ThAtomicStore(&sCxiMatchKernel, kernel);
+	}
+
+	switch (kernel) {
+#ifdef CX_X86
+		case CX_MATCH_KERNEL_AVX2:
+			return CxiCompareMemoryAvx2;
+		case CX_MATCH_KERNEL_SSE2:
+			return CxiCompareMemorySse2;
+#endif
+		default:
+			return CxiCompareMemoryScalar;
+	}
+}
+
+
 // ----- Common LZ subroutines
 
+#define CX_ULTRA_MAX_CANDIDATES         8   // maximum match candidates kept per position for optimal parsing
+#define CX_ULTRA_CANDIDATE_BUDGET 0x1000000  // maximum total match candidates kept for optimal parsing
+#define CX_ULTRA_MAX_PASSES             4   // maximum cost model refinement passes for optimal parsing
+#define CX_MATCH_CHUNK_SIZE       0x10000   // size of an input chunk in parallel match finding
+
 //struct for mapping an LZ graph
 typedef struct CxiLzNode_ {
 	uint32_t distance : 15;    // distance of node if reference
@@ -58,6 +212,12 @@ typedef struct CxiLzNode_ {
 	uint32_t weight;           // weight of node
 } CxiLzNode;
 
+//struct for a match candidate at a position in the input
+typedef struct CxiLzCandidate_ {
+	uint32_t distance : 15;    // distance of match
+	uint32_t length   : 17;    // length of match
+} CxiLzCandidate;
+
 //struct for representing tokenized LZ data
 typedef struct CxiLzToken_ {
 	uint8_t isReference;
@@ -70,7 +230,8 @@ typedef struct CxiLzToken_ {
 	};
 } CxiLzToken;
 
-//struct for keeping track of LZ sliding window
+//struct for keeping track of LZ sliding window. The hash heads and chain hold absolute buffer
+//positions, so that sliding the window does not require adjusting every hash bucket.
 typedef struct CxiLzState_ {
 	const unsigned char *buffer;
 	unsigned int size;
@@ -79,8 +240,9 @@ typedef struct CxiLzState_ {
 	unsigned int maxLength;
 	unsigned int minDistance;
 	unsigned int maxDistance;
-	unsigned int symLookup[512];
-	unsigned int *chain;
+	unsigned int hashHead[512];  // position of the most recent occurrence of each hash
+	unsigned int *chain;         // ring buffer of previous occurrence positions, indexed by position
+	CxiCompareProc compareMemory; // match length kernel
 } CxiLzState;
 
 static unsigned int CxiLzHash3(const unsigned char *p) {
@@ -98,10 +260,11 @@ static void CxiLzStateInit(CxiLzState *state, const unsigned char *buffer, unsig
 	state->maxLength = maxLength;
 	state->minDistance = minDistance;
 	state->maxDistance = maxDistance;
+	state->compareMemory = CxiGetCompareProc();
 
 	for (unsigned int i = 0; i < 512; i++) {
-		//init symbol lookup to empty
-		state->symLookup[i] = UINT_MAX;
+		//init hash heads to empty
+		state->hashHead[i] = UINT_MAX;
 	}
 
 	state->chain = (unsigned int *) calloc(state->maxDistance, sizeof(unsigned int));
@@ -114,20 +277,23 @@ static void CxiLzStateFree(CxiLzState *state) {
 	free(state->chain);
 }
 
-static unsigned int CxiLzStateGetChainIndex(CxiLzState *state, unsigned int index) {
-	return (state->pos - index) % state->maxDistance;
-}
-
-static unsigned int CxiLzStateGetChain(CxiLzState *state, int index) {
-	unsigned int chainIndex = CxiLzStateGetChainIndex(state, index);
+static unsigned int CxiLzStateGetHead(CxiLzState *state) {
+	//get the distance back to the most recent occurrence of the hash of the current position.
+	unsigned int head = state->hashHead[CxiLzHash3(state->buffer + state->pos)];
+	if (head == UINT_MAX) return UINT_MAX;
+	if ((state->pos - head) > state->maxDistance) return UINT_MAX; // slid out of the window
 
-	return state->chain[chainIndex];
+	return state->pos - head;
 }
 
-static void CxiLzStatePutChain(CxiLzState *state, unsigned int index, unsigned int data) {
-	unsigned int chainIndex = CxiLzStateGetChainIndex(state, index);
+static unsigned int CxiLzStateGetChain(CxiLzState *state, unsigned int index) {
+	//get the distance from the position index bytes back to the previous occurrence of its hash.
+	//The chain entry for a position is valid for as long as it remains in the window.
+	unsigned int chainPos = state->pos - index;
+	unsigned int prev = state->chain[chainPos % state->maxDistance];
+	if (prev == UINT_MAX) return UINT_MAX;
 
-	state->chain[chainIndex] = data;
+	return chainPos - prev;
 }
 
 static void CxiLzStateSlideByte(CxiLzState *state) {
@@ -135,30 +301,11 @@ static void CxiLzStateSlideByte(CxiLzState *state) {
 
 	//only update search structures when we have enough space left to necessitate searching.
 	if ((state->size - state->pos) >= 3) {
-		//fetch next 3 bytes' hash
+		//link the current position to the previous occurrence of its hash and make it the new
+		//head of the hash chain.
 		unsigned int next = CxiLzHash3(state->buffer + state->pos);
-
-		//get the distance back to the next byte before sliding. If it exists in the window,
-		//we'll have nextDelta less than UINT_MAX. We'll take this first occurrence and it 
-		//becomes the offset from the current byte. Bear in mind the chain is 0-indexed starting
-		//at a distance of 1. 
-		unsigned int nextDelta = state->symLookup[next];
-		if (nextDelta != UINT_MAX) {
-			nextDelta++;
-			if (nextDelta >= state->maxDistance) {
-				nextDelta = UINT_MAX;
-			}
-		}
-		CxiLzStatePutChain(state, 0, nextDelta);
-
-		//increment symbol lookups
-		for (int i = 0; i < 512; i++) {
-			if (state->symLookup[i] != UINT_MAX) {
-				state->symLookup[i]++;
-				if (state->symLookup[i] > state->maxDistance) state->symLookup[i] = UINT_MAX;
-			}
-		}
-		state->symLookup[next] = 0; // update entry for the current byte to the start of the chain
+		state->chain[state->pos % state->maxDistance] = state->hashHead[next];
+		state->hashHead[next] = state->pos;
 	}
 
 	state->pos++;
@@ -168,17 +315,6 @@ static void CxiLzStateSlide(CxiLzState *state, unsigned int nSlide) {
 	while (nSlide--) CxiLzStateSlideByte(state);
 }
 
-static unsigned int CxiCompareMemory(const unsigned char *b1, const unsigned char *b2, unsigned int nMax) {
-	//compare nAbsoluteMax bytes, do not perform any looping.
-	unsigned int nSame = 0;
-	while (nMax > 0) {
-		if (*(b1++) != *(b2++)) break;
-		nMax--;
-		nSame++;
-	}
-	return nSame;
-}
-
 static int CxiLzConfirmMatch(const unsigned char *buffer, unsigned int size, unsigned int pos, unsigned int distance, unsigned int length) {
 	(void) size;
 
@@ -193,14 +329,13 @@ static unsigned int CxiLzSearch(CxiLzState *state, unsigned int *pDistance) {
 		return 1;
 	}
 
-	unsigned int firstMatch = state->symLookup[CxiLzHash3(state->buffer + state->pos)];
-	if (firstMatch == UINT_MAX) {
+	unsigned int distance = CxiLzStateGetHead(state);
+	if (distance == UINT_MAX) {
 		//return byte literal
 		*pDistance = 0;
 		return 1;
 	}
 
-	unsigned int distance = firstMatch + 1;
 	unsigned int bestLength = 1, bestDistance = 0;
 
 	unsigned int nMaxCompare = state->maxLength;
@@ -211,7 +346,7 @@ static unsigned int CxiLzSearch(CxiLzState *state, unsigned int *pDistance) {
 	while (distance <= state->maxDistance) {
 		//check only if distance is at least minDistance
 		if (distance >= state->minDistance) {
-			unsigned int matchLen = CxiCompareMemory(curp - distance, curp, nMaxCompare);
+			unsigned int matchLen = state->compareMemory(curp - distance, curp, nMaxCompare);
 
 			if (matchLen > bestLength) {
 				bestLength = matchLen;
@@ -247,9 +382,10 @@ static unsigned int CxiSearchLZ(const unsigned char *buffer, unsigned int size,
 	if (nMaxCompare > nBytesLeft) nMaxCompare = nBytesLeft;
 
 	//begin searching backwards.
+	CxiCompareProc compareMemory = CxiGetCompareProc();
 	unsigned int bestLength = 0, bestDistance = 0;
 	for (unsigned int i = minDistance; i <= maxDistance; i++) {
-		unsigned int nMatched = CxiCompareMemory(buffer + curpos - i, buffer + curpos, nMaxCompare);
+		unsigned int nMatched = compareMemory(buffer + curpos - i, buffer + curpos, nMaxCompare);
 		if (nMatched > bestLength) {
 			bestLength = nMatched;
 			bestDistance = i;
@@ -261,6 +397,152 @@ static unsigned int CxiSearchLZ(const unsigned char *buffer, unsigned int size,
 	return bestLength;
 }
 
+static unsigned int CxiLzSearchCandidates(CxiLzState *state, CxiLzCandidate *candidates, unsigned int nMaxCandidates) {
+	//collect the matches that are longer than every match at a nearer distance. The candidates are
+	//output in order of increasing length and distance. When the candidate buffer fills, the last
+	//slot is overwritten so that the longest match is always kept.
+	unsigned int nBytesLeft = state->size - state->pos;
+	if (nBytesLeft < 3 || nBytesLeft < state->minLength) return 0;
+
+	unsigned int distance = CxiLzStateGetHead(state);
+	if (distance == UINT_MAX) return 0;
+
+	unsigned int nMaxCompare = state->maxLength;
+	if (nMaxCompare > nBytesLeft) nMaxCompare = nBytesLeft;
+
+	unsigned int nCandidates = 0, bestLength = state->minLength - 1;
+	const unsigned char *curp = state->buffer + state->pos;
+	while (distance <= state->maxDistance) {
+		if (distance >= state->minDistance) {
+			unsigned int matchLen = state->compareMemory(curp - distance, curp, nMaxCompare);
+
+			if (matchLen > bestLength) {
+				if (nCandidates < nMaxCandidates) nCandidates++;
+				candidates[nCandidates - 1].length = matchLen;
+				candidates[nCandidates - 1].distance = distance;
+
+				bestLength = matchLen;
+				if (bestLength == nMaxCompare) break;
+			}
+		}
+
+		if (distance == state->maxDistance) break;
+		unsigned int next = CxiLzStateGetChain(state, distance);
+		if (next == UINT_MAX) break;
+		distance += next;
+	}
+
+	return nCandidates;
+}
+
+//struct for finding longest matches over chunks of the input on multiple workers
+typedef struct CxiLzMatchWork_ {
+	const unsigned char *buffer;
+	unsigned int size;
+	unsigned int minLength;
+	unsigned int maxLength;
+	unsigned int minDistance;
+	unsigned int maxDistance;
+	CxiLzNode *nodes;
+	CxiCompareProc compareMemory;
+	unsigned int nChunks;
+	volatile long nextChunk;
+} CxiLzMatchWork;
+
+static void CxiLzFindMatchesInChunk(CxiLzMatchWork *work, unsigned int start, unsigned int end) {
+	//the chain holds exactly one window of positions, so priming the state with the window
+	//preceding the chunk gives the same searches as sliding over the whole input.
+	unsigned int primeStart = (start > work->maxDistance) ? (start - work->maxDistance) : 0;
+
+	CxiLzState state;
+	CxiLzStateInit(&state, work->buffer, work->size, work->minLength, work->maxLength, work->minDistance, work->maxDistance);
+	state.compareMemory = work->compareMemory;
+	state.pos = primeStart;
+	CxiLzStateSlide(&state, start - primeStart);
+
+	for (unsigned int pos = start; pos < end; pos++) {
+		unsigned int dst;
+		unsigned int len = CxiLzSearch(&state, &dst);
+
+		//store longest found match
+		work->nodes[pos].length = len;
+		work->nodes[pos].distance = dst;
+		CxiLzStateSlide(&state, 1);
+	}
+	CxiLzStateFree(&state);
+}
+
+static void CxiLzFindMatchesWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) iWorker;
+	(void) nWorkers;
+
+	CxiLzMatchWork *work = (CxiLzMatchWork *) param;
+	while (1) {
+		unsigned int iChunk = (unsigned int) ThAtomicIncrement(&work->nextChunk) - 1;
+		if (iChunk >= work->nChunks) break;
+
+		unsigned int start = iChunk * CX_MATCH_CHUNK_SIZE;
+		unsigned int end = start + CX_MATCH_CHUNK_SIZE;
+		if (end > work->size) end = work->size;
+		CxiLzFindMatchesInChunk(work, start, end);
+	}
+}
+
+static void CxiLzFindLongestMatches(const unsigned char *buffer, unsigned int size, unsigned int minLength, unsigned int maxLength, unsigned int minDistance, unsigned int maxDistance, unsigned int nThreads, CxiLzNode *nodes) {
+	//find the longest match at every position of the input. Each chunk of the input only depends on
+	//the window before it, so chunks are searched in parallel on up to nThreads threads.
+	CxiLzMatchWork work;
+	work.buffer = buffer;
+	work.size = size;
+	work.minLength = minLength;
+	work.maxLength = maxLength;
+	work.minDistance = minDistance;
+	work.maxDistance = maxDistance;
+	work.nodes = nodes;
+	work.compareMemory = CxiGetCompareProc(); // selected before the workers start, so every chunk uses it
+	work.nChunks = (size + CX_MATCH_CHUNK_SIZE - 1) / CX_MATCH_CHUNK_SIZE;
+	work.nextChunk = 0;
+
+	unsigned int nWorkers = nThreads;
+	if (nWorkers > work.nChunks) nWorkers = work.nChunks;
+	ThRunWorkers(CxiLzFindMatchesWorker, &work, nWorkers);
+}
+
+static inline void CxiLzCopyReference(unsigned char *dest, unsigned int offs, unsigned int len, unsigned int avail) {
+	const unsigned char *src = dest - offs;
+	if (offs >= 8) {
+		//copy in 8-byte words. Each word is read from already written output even when the reference
+		//overlaps itself. When avail allows, up to 7 bytes past the reference are written, which later
+		//tokens overwrite. Otherwise the tail is copied by byte.
+		unsigned int nWords = (((len + 7) & ~7) <= avail) ? len : (len & ~7);
+		unsigned int i;
+		for (i = 0; i < nWords; i += 8) {
+			memcpy(dest + i, src + i, 8);
+		}
+		for (; i < len; i++) {
+			dest[i] = src[i];
+		}
+	} else if (offs == 1) {
+		//run of one byte
+		memset(dest, *src, len);
+	} else if (len < 32) {
+		//short reference
+		for (unsigned int i = 0; i < len; i++) {
+			dest[i] = src[i];
+		}
+	} else {
+		//the output repeats with a period of offs. Each copy from the start of the pattern doubles the
+		//span that may be copied without overlap.
+		unsigned int span = offs;
+		while (len > 0) {
+			unsigned int n = (span < len) ? span : len;
+			memcpy(dest, src, n);
+			dest += n;
+			len -= n;
+			span += n;
+		}
+	}
+}
 
 // ----- Bit reader routines
 
@@ -619,28 +901,13 @@ static inline unsigned int CxiLzTokenCost(unsigned int length) {
 }
 
 
-unsigned char *CxCompressLZ(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
-	CxiLzState state;
-	CxiLzStateInit(&state, buffer, size, LZ_MIN_LENGTH, LZ_MAX_LENGTH, LZ_MIN_SAFE_DISTANCE, LZ_MAX_DISTANCE);
-
+static unsigned char *CxiCompressLZ(const unsigned char *buffer, unsigned int size, unsigned int nThreads, unsigned int *compressedSize) {
 	//create node list and fill in the maximum string reference sizes
 	CxiLzNode *nodes = (CxiLzNode *) calloc(size, sizeof(CxiLzNode));
-	unsigned int pos = 0;
-	while (pos < size) {
-		unsigned int dst;
-		unsigned int len = CxiLzSearch(&state, &dst);
-
-		//store longest found match
-		nodes[pos].length = len;
-		nodes[pos].distance = dst;
-
-		pos++;
-		CxiLzStateSlide(&state, 1);
-	}
-	CxiLzStateFree(&state);
+	CxiLzFindLongestMatches(buffer, size, LZ_MIN_LENGTH, LZ_MAX_LENGTH, LZ_MIN_SAFE_DISTANCE, LZ_MAX_DISTANCE, nThreads, nodes);
 
 	//work backwards from the end of file
-	pos = size;
+	unsigned int pos = size;
 	while (pos--) {
 		//get node at pos
 		CxiLzNode *node = nodes + pos;
@@ -729,7 +996,11 @@ unsigned char *CxCompressLZ(const unsigned char *buffer, unsigned int size, unsi
 	return CxiShrink(buf, outSize); //reduce buffer size
 }
 
-unsigned char *CxDecompressLZ(const unsigned char *buffer, unsigned int size, unsigned int *uncompressedSize){
+unsigned char *CxCompressLZ(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
+	return CxiCompressLZ(buffer, size, ThGetProcessorCount(), compressedSize);
+}
+
+static unsigned char *CxiDecompressLZ(const unsigned char *buffer, unsigned int size, unsigned int *uncompressedSize, unsigned int *pSrcEnd) {
 	if (size < 4) return NULL;
 
 	//find the length of the decompressed buffer.
@@ -740,37 +1011,56 @@ unsigned char *CxDecompressLZ(const unsigned char *buffer, unsigned int size, un
 	if (result == NULL) return NULL;
 	*uncompressedSize = length;
 
-	//initialize variables
+	//initialize variables. Source and destination bounds are checked once per token.
 	uint32_t offset = 4;
 	uint32_t dstOffset = 0;
-	while (1) {
+	while (dstOffset < length) {
+		if (offset >= size) goto Error;
 		uint8_t head = buffer[offset];
 		offset++;
+
+		//a group of 8 literals is copied at once
+		if (head == 0 && (size - offset) >= 8 && (length - dstOffset) >= 8) {
+			memcpy(result + dstOffset, buffer + offset, 8);
+			dstOffset += 8, offset += 8;
+			continue;
+		}
+
 		//loop 8 times
-		for (int i = 0; i < 8; i++) {
+		for (int i = 0; i < 8 && dstOffset < length; i++) {
 			int flag = head >> 7;
 			head <<= 1;
 
 			if (!flag) {
+				if (offset >= size) goto Error;
 				result[dstOffset] = buffer[offset];
 				dstOffset++, offset++;
-				if(dstOffset == length) return result;
 			} else {
+				if ((size - offset) < 2) goto Error;
 				uint8_t high = buffer[offset++];
 				uint8_t low = buffer[offset++];
 
 				//length of uncompressed chunk and offset
 				uint32_t offs = (((high & 0xF) << 8) | low) + 1;
 				uint32_t len = (high >> 4) + 3;
-				for (uint32_t j = 0; j < len; j++) {
-					result[dstOffset] = result[dstOffset - offs];
-					dstOffset++;
-					if(dstOffset == length) return result;
-				}
+				if (offs > dstOffset) goto Error;
+				if (len > (length - dstOffset)) len = length - dstOffset;
+
+				CxiLzCopyReference(result + dstOffset, offs, len, length - dstOffset);
+				dstOffset += len;
 			}
 		}
 	}
+	if (pSrcEnd != NULL) *pSrcEnd = offset;
 	return result;
+
+Error:
+	free(result);
+	return NULL;
+}
+
+unsigned char *CxDecompressLZ(const unsigned char *buffer, unsigned int size, unsigned int *uncompressedSize) {
+	return CxiDecompressLZ(buffer, size, uncompressedSize, NULL);
 }
 
 int CxIsCompressedLZ(const unsigned char *buffer, unsigned int size) {
@@ -831,8 +1121,8 @@ unsigned char *CxDecompressLZHeader(const unsigned char *buffer, unsigned int si
 	return CxDecompressLZ(buffer + 4, size - 4, uncompressedSize);
 }
 
-unsigned char *CxCompressLZHeader(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
-	char *compressed = CxCompressLZ(buffer, size, compressedSize);
+static unsigned char *CxiCompressLZHeader(const unsigned char *buffer, unsigned int size, unsigned int nThreads, unsigned int *compressedSize) {
+	char *compressed = CxiCompressLZ(buffer, size, nThreads, compressedSize);
 	if (compressed == NULL) return NULL;
 	*compressedSize += 4;
 	compressed = realloc(compressed, *compressedSize);
@@ -844,6 +1134,10 @@ unsigned char *CxCompressLZHeader(const unsigned char *buffer, unsigned int size
 	return compressed;
 }
 
+unsigned char *CxCompressLZHeader(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
+	return CxiCompressLZHeader(buffer, size, ThGetProcessorCount(), compressedSize);
+}
+
 int CxIsFilteredLZHeader(const unsigned char *buffer, unsigned int size) {
 	if (size < 8) return 0;
 	if (buffer[0] != 'L' || buffer[1] != 'Z' || buffer[2] != '7' || buffer[3] != '7') return 0;
@@ -887,28 +1181,13 @@ static inline unsigned int CxiLzxTokenCost(unsigned int length) {
 }
 
 
-unsigned char *CxCompressLZX(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
-	CxiLzState state;
-	CxiLzStateInit(&state, buffer, size, LZX_MIN_LENGTH, LZX_MAX_LENGTH_3, LZX_MIN_SAFE_DISTANCE, LZX_MAX_DISTANCE);
-
+static unsigned char *CxiCompressLZX(const unsigned char *buffer, unsigned int size, unsigned int nThreads, unsigned int *compressedSize) {
 	//create node list and fill in the maximum string reference sizes
 	CxiLzNode *nodes = (CxiLzNode *) calloc(size, sizeof(CxiLzNode));
-	unsigned int pos = 0;
-	while (pos < size) {
-		unsigned int dst;
-		unsigned int len = CxiLzSearch(&state, &dst);
-
-		//store longest found match
-		nodes[pos].length = len;
-		nodes[pos].distance = dst;
-
-		pos++;
-		CxiLzStateSlide(&state, 1);
-	}
-	CxiLzStateFree(&state);
+	CxiLzFindLongestMatches(buffer, size, LZX_MIN_LENGTH, LZX_MAX_LENGTH_3, LZX_MIN_SAFE_DISTANCE, LZX_MAX_DISTANCE, nThreads, nodes);
 
 	//work backwards from the end of file
-	pos = size;
+	unsigned int pos = size;
 	while (pos--) {
 		//get node at pos
 		CxiLzNode *node = nodes + pos;
@@ -1012,7 +1291,11 @@ unsigned char *CxCompressLZX(const unsigned char *buffer, unsigned int size, uns
 	return CxiShrink(buf, outSize); // reduce buffer size
 }
 
-unsigned char *CxDecompressLZX(const unsigned char *buffer, unsigned int size, unsigned int *uncompressedSize) {
+unsigned char *CxCompressLZX(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
+	return CxiCompressLZX(buffer, size, ThGetProcessorCount(), compressedSize);
+}
+
+static unsigned char *CxiDecompressLZX(const unsigned char *buffer, unsigned int size, unsigned int *uncompressedSize, unsigned int *pSrcEnd) {
 	//decompress the input buffer. 
 	if (size < 4) return NULL;
 
@@ -1024,23 +1307,32 @@ unsigned char *CxDecompressLZX(const unsigned char *buffer, unsigned int size, u
 	if (result == NULL) return NULL;
 	*uncompressedSize = length;
 
-	//initialize variables
+	//initialize variables. Source and destination bounds are checked once per token.
 	uint32_t offset = 4;
 	uint32_t dstOffset = 0;
-	while (1) {
+	while (dstOffset < length) {
+		if (offset >= size) goto Error;
 		uint8_t head = buffer[offset];
 		offset++;
 
+		//a group of 8 literals is copied at once
+		if (head == 0 && (size - offset) >= 8 && (length - dstOffset) >= 8) {
+			memcpy(result + dstOffset, buffer + offset, 8);
+			dstOffset += 8, offset += 8;
+			continue;
+		}
+
 		//loop 8 times
-		for (int i = 0; i < 8; i++) {
+		for (int i = 0; i < 8 && dstOffset < length; i++) {
 			int flag = head >> 7;
 			head <<= 1;
 
 			if (!flag) {
+				if (offset >= size) goto Error;
 				result[dstOffset] = buffer[offset];
 				dstOffset++, offset++;
-				if (dstOffset == length) return result;
 			} else {
+				if ((size - offset) < 2) goto Error;
 				uint8_t high = buffer[offset++];
 				uint8_t low = buffer[offset++];
 				uint8_t low2, low3;
@@ -1049,11 +1341,13 @@ unsigned char *CxDecompressLZX(const unsigned char *buffer, unsigned int size, u
 				uint32_t len = 0, offs = 0;
 				switch (mode) {
 					case 0:
+						if ((size - offset) < 1) goto Error;
 						low2 = buffer[offset++];
 						len = ((high << 4) | (low >> 4)) + 0x11; //8-bit length +0x11
 						offs = (((low & 0xF) << 8) | low2) + 1; //12-bit offset
 						break;
 					case 1:
+						if ((size - offset) < 2) goto Error;
 						low2 = buffer[offset++];
 						low3 = buffer[offset++];
 						len = (((high & 0xF) << 12) | (low << 4) | (low2 >> 4)) + 0x111; //16-bit length +0x111
@@ -1066,15 +1360,24 @@ unsigned char *CxDecompressLZX(const unsigned char *buffer, unsigned int size, u
 				}
 
 				//write back
-				for (uint32_t j = 0; j < len; j++) {
-					result[dstOffset] = result[dstOffset - offs];
-					dstOffset++;
-					if (dstOffset == length) return result;
-				}
+				if (offs > dstOffset) goto Error;
+				if (len > (length - dstOffset)) len = length - dstOffset;
+
+				CxiLzCopyReference(result + dstOffset, offs, len, length - dstOffset);
+				dstOffset += len;
 			}
 		}
 	}
+	if (pSrcEnd != NULL) *pSrcEnd = offset;
 	return result;
+
+Error:
+	free(result);
+	return NULL;
+}
+
+unsigned char *CxDecompressLZX(const unsigned char *buffer, unsigned int size, unsigned int *uncompressedSize) {
+	return CxiDecompressLZX(buffer, size, uncompressedSize, NULL);
 }
 
 unsigned char *CxAdvanceLZX(const unsigned char *buffer, unsigned int size) {
@@ -2389,14 +2692,13 @@ static unsigned int CxiMvdkSearchLZzestrictedFast(CxiLzState *state, CxiHuffCode
 		return 1;
 	}
 
-	unsigned int firstMatch = state->symLookup[CxiLzHash3(state->buffer + state->pos)];
-	if (firstMatch == UINT_MAX) {
+	unsigned int distance = CxiLzStateGetHead(state);
+	if (distance == UINT_MAX) {
 		//return byte literal
 		*pDistance = 0;
 		return 1;
 	}
 
-	unsigned int distance = firstMatch + 1;
 	unsigned int bestLength = 1, bestDistance = 0;
 
 	//the longest string we can match, including repetition by overwriting the source.
@@ -2414,7 +2716,7 @@ static unsigned int CxiMvdkSearchLZzestrictedFast(CxiLzState *state, CxiHuffCode
 			if (curDeflateIndex == -1) break;
 
 			if (distanceCodes[curDeflateIndex].length > 0) {
-				unsigned int matchLen = CxiCompareMemory(curp - distance, curp, nMaxCompare);
+				unsigned int matchLen = state->compareMemory(curp - distance, curp, nMaxCompare);
 
 				if (matchLen > bestLength) {
 					bestLength = matchLen;
@@ -2871,10 +3173,10 @@ unsigned char *CxDecompressMvDK(const unsigned char *buffer, unsigned int size,
 	return NULL;
 }
 
-unsigned char *CxCompressMvDK(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
+static unsigned char *CxiCompressMvDK(const unsigned char *buffer, unsigned int size, unsigned int nThreads, unsigned int *compressedSize) {
 	unsigned int dummySize = size + 4;
 	unsigned int lzSize, rlSize, dfSize;
-	unsigned char *lz = CxCompressLZ(buffer, size, &lzSize);
+	unsigned char *lz = CxiCompressLZ(buffer, size, nThreads, &lzSize);
 	unsigned char *rl = CxCompressRL(buffer, size, &rlSize);
 	unsigned char *df = CxiCompressMvdkDeflate(buffer, size, &dfSize);
 
@@ -2910,6 +3212,10 @@ unsigned char *CxCompressMvDK(const unsigned char *buffer, unsigned int size, un
 	return dummy;
 }
 
+unsigned char *CxCompressMvDK(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
+	return CxiCompressMvDK(buffer, size, ThGetProcessorCount(), compressedSize);
+}
+
 
 // ----- VLX Routines
 
@@ -3476,9 +3782,17 @@ Error:
 	return NULL;
 }
 
-unsigned char *CxCompressAsh(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
-	int nSymBits = 9, nDstBits = 11;
+static void CxiHuffGetCodeLengths(const CxiHuffNode *tree, uint8_t *lengths, unsigned int depth) {
+	if (ISLEAF(tree)) {
+		lengths[tree->sym] = depth;
+		return;
+	}
+
+	CxiHuffGetCodeLengths(tree->left, lengths, depth + 1);
+	CxiHuffGetCodeLengths(tree->right, lengths, depth + 1);
+}
 
+static unsigned char *CxiAshWriteTokens(const CxiLzToken *tokens, unsigned int nTokens, unsigned int size, int nSymBits, int nDstBits, uint8_t *symLengths, uint8_t *dstLengths, unsigned int *compressedSize) {
 	int nSymNodes = (1 << nSymBits);
 	int nDstNodes = (1 << nDstBits);
 	CxiHuffNode *symNodes = (CxiHuffNode *) calloc(nSymNodes * 2, sizeof(CxiHuffNode));
@@ -3487,13 +3801,9 @@ unsigned char *CxCompressAsh(const unsigned char *buffer, unsigned int size, uns
 	for (int i = 0; i < nSymNodes; i++) symNodes[i].sym = i;
 	for (int i = 0; i < nDstNodes; i++) dstNodes[i].sym = i;
 
-	//tokenize
-	unsigned int nTokens = 0;
-	CxiLzToken *tokens = CxiAshTokenize(buffer, size, nSymBits, nDstBits, &nTokens);
-
 	//construct frequency distribution
 	for (unsigned int i = 0; i < nTokens; i++) {
-		CxiLzToken *token = &tokens[i];
+		const CxiLzToken *token = &tokens[i];
 		if (token->isReference) {
 			symNodes[token->length - 3 + 0x100].freq++;
 			dstNodes[token->distance - 1].freq++;
@@ -3506,6 +3816,16 @@ unsigned char *CxCompressAsh(const unsigned char *buffer, unsigned int size, uns
 	CxiHuffmanConstructTree(symNodes, nSymNodes, 2);
 	CxiHuffmanConstructTree(dstNodes, nDstNodes, 2);
 
+	//output code lengths for parsing. Symbols not in the tree have length 0.
+	if (symLengths != NULL) {
+		memset(symLengths, 0, nSymNodes);
+		CxiHuffGetCodeLengths(symNodes, symLengths, 0);
+	}
+	if (dstLengths != NULL) {
+		memset(dstLengths, 0, nDstNodes);
+		CxiHuffGetCodeLengths(dstNodes, dstLengths, 0);
+	}
+
 	//init streams
 	CxiBitWriter symStream, dstStream;
 	CxiBitWriterInit(&symStream);
@@ -3517,7 +3837,7 @@ unsigned char *CxCompressAsh(const unsigned char *buffer, unsigned int size, uns
 
 	//write data stream
 	for (unsigned int i = 0; i < nTokens; i++) {
-		CxiLzToken *token = &tokens[i];
+		const CxiLzToken *token = &tokens[i];
 
 		if (token->isReference) {
 			CxiHuffmanWriteSymbol(&symStream, token->length - 3 + 0x100, symNodes);
@@ -3526,7 +3846,6 @@ unsigned char *CxCompressAsh(const unsigned char *buffer, unsigned int size, uns
 			CxiHuffmanWriteSymbol(&symStream, token->symbol, symNodes);
 		}
 	}
-	free(tokens);
 	free(symNodes);
 	free(dstNodes);
 
@@ -3560,46 +3879,208 @@ unsigned char *CxCompressAsh(const unsigned char *buffer, unsigned int size, uns
 	return out;
 }
 
-unsigned char *CxDecompressAsh(const unsigned char *buffer, unsigned int size, unsigned int *uncompressedSize) {
-	int symBits = 9, distBits = 11;
-	uint32_t uncompSize = BigToLittle32(*(uint32_t *) (buffer + 4)) & 0x00FFFFFF;
-	uint32_t outSize = uncompSize;
-
-	uint8_t *outbuf = calloc(uncompSize, 1);
-	uint8_t *destp = outbuf;
-
-	CxiBitReader reader, reader2;
-	CxiBitReaderInit(&reader, buffer + BigToLittle32(*(const uint32_t *) (buffer + 0x8)), buffer + size, 1, 1);
-	CxiBitReaderInit(&reader2, buffer + 0xC, buffer + size, 1, 1);
+static unsigned int CxiAshCodeCost(const uint8_t *lengths, unsigned int sym, unsigned int missingCost) {
+	//symbols absent from the current tree are estimated, since they would be added on the next pass.
+	unsigned int len = lengths[sym];
+	return len ? len : missingCost;
+}
 
-	uint32_t symMax = (1 << symBits);
-	uint32_t distMax = (1 << distBits);
+static CxiLzToken *CxiAshTokenizeOptimal(const unsigned char *buffer, unsigned int size, const CxiLzCandidate *candidates, const uint8_t *nCandidates, unsigned int nMaxCandidates, int nSymBits, int nDstBits, const uint8_t *symLengths, const uint8_t *dstLengths, unsigned int *pnTokens) {
+	uint32_t *costs = (uint32_t *) calloc(size + 1, sizeof(uint32_t));
+	CxiLzCandidate *path = (CxiLzCandidate *) calloc(size, sizeof(CxiLzCandidate));
+	if (costs == NULL || path == NULL) {
+		free(costs);
+		free(path);
+		return NULL;
+	}
 
-	//HACK, pointer to RAM
-	uint32_t *symLeftTree = calloc(2 * symMax - 1, sizeof(uint32_t));
-	uint32_t *symRightTree = calloc(2 * symMax - 1, sizeof(uint32_t));
-	uint32_t *distLeftTree = calloc(2 * distMax - 1, sizeof(uint32_t));
-	uint32_t *distRightTree = calloc(2 * distMax - 1, sizeof(uint32_t));
+	//cost estimate for symbols not currently present in a tree
+	unsigned int symMissing = 0, dstMissing = 0;
+	for (int i = 0; i < (1 << nSymBits); i++) if (symLengths[i] > symMissing) symMissing = symLengths[i];
+	for (int i = 0; i < (1 << nDstBits); i++) if (dstLengths[i] > dstMissing) dstMissing = dstLengths[i];
+	symMissing++;
+	dstMissing++;
 
-	uint32_t symRoot, distRoot;
-	symRoot = CxAshReadTree(&reader2, symBits, symLeftTree, symRightTree);
-	distRoot = CxAshReadTree(&reader, distBits, distLeftTree, distRightTree);
+	//find the shortest path from each position to the end of the input, working backwards.
+	costs[size] = 0;
+	unsigned int pos = size;
+	while (pos--) {
+		//literal
+		unsigned int bestCost = CxiAshCodeCost(symLengths, buffer[pos], symMissing) + costs[pos + 1];
+		unsigned int bestLength = 1, bestDistance = 0;
+
+		//a match of a given length may use any candidate at least that long. Candidates are ordered
+		//by increasing length, so walk them from longest to shortest tracking the cheapest distance.
+		const CxiLzCandidate *posCandidates = candidates + pos * nMaxCandidates;
+		unsigned int nPosCandidates = nCandidates[pos];
+		unsigned int dstCost = UINT_MAX, dstBest = 0;
+		for (int i = (int) nPosCandidates - 1; i >= 0; i--) {
+			unsigned int thisCost = CxiAshCodeCost(dstLengths, posCandidates[i].distance - 1, dstMissing);
+			if (thisCost <= dstCost) {
+				dstCost = thisCost;
+				dstBest = posCandidates[i].distance;
+			}
 
-	//main uncompress loop
-	do {
-		uint32_t sym = symRoot;
-		while (sym >= symMax) {
-			if (!CxiBitReaderReadBit(&reader2)) {
-				sym = symLeftTree[sym];
-			} else {
-				sym = symRightTree[sym];
+			unsigned int minLength = (i > 0) ? (posCandidates[i - 1].length + 1) : 3;
+			for (unsigned int len = posCandidates[i].length; len >= minLength; len--) {
+				unsigned int cost = CxiAshCodeCost(symLengths, len - 3 + 0x100, symMissing) + dstCost + costs[pos + len];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestLength = len;
+					bestDistance = dstBest;
+				}
 			}
 		}
 
-		if (sym < 0x100) {
-			*(destp++) = sym;
-			uncompSize--;
-		} else {
+		costs[pos] = bestCost;
+		path[pos].length = bestLength;
+		path[pos].distance = bestDistance;
+	}
+	free(costs);
+
+	//follow the path forwards to produce tokens
+	StList tokenBuffer;
+	StStatus s = StListCreateInline(&tokenBuffer, CxiLzToken, NULL);
+	if (!ST_SUCCEEDED(s)) {
+		free(path);
+		return NULL;
+	}
+
+	pos = 0;
+	while (pos < size) {
+		CxiLzToken token;
+		if (path[pos].length >= 3) {
+			token.isReference = 1;
+			token.length = path[pos].length;
+			token.distance = path[pos].distance;
+		} else {
+			token.isReference = 0;
+			token.symbol = buffer[pos];
+		}
+
+		s = StListAdd(&tokenBuffer, &token);
+		if (!ST_SUCCEEDED(s)) {
+			free(path);
+			StListFree(&tokenBuffer);
+			return NULL;
+		}
+		pos += path[pos].length;
+	}
+	free(path);
+
+	*pnTokens = tokenBuffer.length;
+	return (CxiLzToken *) tokenBuffer.buffer;
+}
+
+static unsigned char *CxiCompressAshUltra(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
+	int nSymBits = 9, nDstBits = 11;
+	uint8_t symLengths[1 << 9], dstLengths[1 << 11];
+
+	//start from the greedy parse. Its Huffman code lengths seed the cost model of the first pass.
+	unsigned int nTokens = 0;
+	CxiLzToken *tokens = CxiAshTokenize(buffer, size, nSymBits, nDstBits, &nTokens);
+	if (tokens == NULL) return NULL;
+
+	unsigned int bestSize;
+	unsigned char *best = CxiAshWriteTokens(tokens, nTokens, size, nSymBits, nDstBits, symLengths, dstLengths, &bestSize);
+	free(tokens);
+
+	//gather match candidates once, since they do not depend on the cost model. Large inputs keep
+	//fewer candidates per position to bound memory use.
+	unsigned int nMaxCandidates = CX_ULTRA_MAX_CANDIDATES;
+	while (nMaxCandidates > 1 && (size_t) size * nMaxCandidates > CX_ULTRA_CANDIDATE_BUDGET) nMaxCandidates /= 2;
+
+	CxiLzCandidate *candidates = (CxiLzCandidate *) calloc((size_t) size * nMaxCandidates, sizeof(CxiLzCandidate));
+	uint8_t *nCandidates = (uint8_t *) calloc(size, sizeof(uint8_t));
+	if (candidates == NULL || nCandidates == NULL) goto Done;
+
+	CxiLzState state;
+	CxiLzStateInit(&state, buffer, size, 3, (1 << nSymBits) - 1 - 0x100 + 3, 1, (1 << nDstBits));
+	for (unsigned int pos = 0; pos < size; pos++) {
+		nCandidates[pos] = CxiLzSearchCandidates(&state, candidates + pos * nMaxCandidates, nMaxCandidates);
+		CxiLzStateSlide(&state, 1);
+	}
+	CxiLzStateFree(&state);
+
+	//alternate between parsing against the current code lengths and rebuilding the trees from the
+	//new parse, until the output stops shrinking.
+	for (int i = 0; i < CX_ULTRA_MAX_PASSES; i++) {
+		tokens = CxiAshTokenizeOptimal(buffer, size, candidates, nCandidates, nMaxCandidates, nSymBits, nDstBits, symLengths, dstLengths, &nTokens);
+		if (tokens == NULL) break;
+
+		unsigned int outSize;
+		unsigned char *out = CxiAshWriteTokens(tokens, nTokens, size, nSymBits, nDstBits, symLengths, dstLengths, &outSize);
+		free(tokens);
+
+		if (outSize >= bestSize) {
+			free(out);
+			break;
+		}
+		free(best);
+		best = out;
+		bestSize = outSize;
+	}
+
+Done:
+	free(candidates);
+	free(nCandidates);
+	*compressedSize = bestSize;
+	return best;
+}
+
+unsigned char *CxCompressAsh(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
+	int nSymBits = 9, nDstBits = 11;
+
+	//tokenize
+	unsigned int nTokens = 0;
+	CxiLzToken *tokens = CxiAshTokenize(buffer, size, nSymBits, nDstBits, &nTokens);
+	if (tokens == NULL) return NULL;
+
+	unsigned char *out = CxiAshWriteTokens(tokens, nTokens, size, nSymBits, nDstBits, NULL, NULL, compressedSize);
+	free(tokens);
+	return out;
+}
+
+unsigned char *CxDecompressAsh(const unsigned char *buffer, unsigned int size, unsigned int *uncompressedSize) {
+	int symBits = 9, distBits = 11;
+	uint32_t uncompSize = BigToLittle32(*(uint32_t *) (buffer + 4)) & 0x00FFFFFF;
+	uint32_t outSize = uncompSize;
+
+	uint8_t *outbuf = calloc(uncompSize, 1);
+	uint8_t *destp = outbuf;
+
+	CxiBitReader reader, reader2;
+	CxiBitReaderInit(&reader, buffer + BigToLittle32(*(const uint32_t *) (buffer + 0x8)), buffer + size, 1, 1);
+	CxiBitReaderInit(&reader2, buffer + 0xC, buffer + size, 1, 1);
+
+	uint32_t symMax = (1 << symBits);
+	uint32_t distMax = (1 << distBits);
+
+	//HACK, pointer to RAM
+	uint32_t *symLeftTree = calloc(2 * symMax - 1, sizeof(uint32_t));
+	uint32_t *symRightTree = calloc(2 * symMax - 1, sizeof(uint32_t));
+	uint32_t *distLeftTree = calloc(2 * distMax - 1, sizeof(uint32_t));
+	uint32_t *distRightTree = calloc(2 * distMax - 1, sizeof(uint32_t));
+
+	uint32_t symRoot, distRoot;
+	symRoot = CxAshReadTree(&reader2, symBits, symLeftTree, symRightTree);
+	distRoot = CxAshReadTree(&reader, distBits, distLeftTree, distRightTree);
+
+	//main uncompress loop
+	do {
+		uint32_t sym = symRoot;
+		while (sym >= symMax) {
+			if (!CxiBitReaderReadBit(&reader2)) {
+				sym = symLeftTree[sym];
+			} else {
+				sym = symRightTree[sym];
+			}
+		}
+
+		if (sym < 0x100) {
+			*(destp++) = sym;
+			uncompSize--;
+		} else {
 			uint32_t distsym = distRoot;
 			while (distsym >= distMax) {
 				if (!CxiBitReaderReadBit(&reader)) {
@@ -4175,6 +4656,45 @@ static void CxiPcExploreRL(
 	}
 }
 
+//
+// Match candidates gathered by exploration, reused by every optimization pass.
+//
+typedef struct CxiPcMatches_ {
+	CxiLzCandidate *candidates;      // per position, the matches longer than every nearer match
+	uint8_t        *nCandidates;     // number of candidates per position
+	unsigned int    nMaxCandidates;  // number of candidates kept per position
+	uint16_t       *shortDistance;   // distance of the nearest 2-byte match within 256 bytes, or 0
+} CxiPcMatches;
+
+//
+// Find the nearest distance of a match of at least the given length.
+//
+static unsigned int CxiPcFindNearestDistance(
+	const CxiPcMatches  *matches,  // The match candidates.
+	const unsigned char *buffer,   // The input buffer.
+	unsigned int         size,     // The input buffer size.
+	unsigned int         pos,      // The position of the match.
+	unsigned int         length    // The length of the match (at least 3).
+) {
+	const CxiLzCandidate *candidates = matches->candidates + (size_t) pos * matches->nMaxCandidates;
+	unsigned int nCandidates = matches->nCandidates[pos];
+
+	for (unsigned int i = 0; i < nCandidates; i++) {
+		if (candidates[i].length < length) continue;
+
+		//the last slot is overwritten when a position has more candidates than fit, so a nearer
+		//match may lie between it and the slot before it.
+		if (i == matches->nMaxCandidates - 1) {
+			unsigned int start = i > 0 ? (candidates[i - 1].distance + 1) : PUCRUNCH_MIN_DISTANCE;
+			for (unsigned int checkDistance = start; checkDistance < candidates[i].distance; checkDistance++) {
+				if (CxiLzConfirmMatch(buffer, size, pos, checkDistance, length)) return checkDistance;
+			}
+		}
+		return candidates[i].distance;
+	}
+	return 0;
+}
+
 //
 // Explores the input buffer to find the longest repeating byte sequences and LZ string matches.
 //
@@ -4183,39 +4703,50 @@ static void CxiPcExploreLzRl(
 	unsigned int         size,       // The input size
 	unsigned int         maxWindow,  // The maximum LZ search window
 	CxiLzNode           *nodes,      // The output LZ node array
-	uint16_t            *rlLens      // The output RL length array
+	uint16_t            *rlLens,     // The output RL length array
+	CxiPcMatches        *matches     // The output match candidates
 ) {
 	CxiLzState state;
 	CxiLzStateInit(&state, buffer, size, 2, 256, PUCRUNCH_MIN_DISTANCE, maxWindow);
 
+	//most recent position of each 2-byte sequence, for finding short matches
+	unsigned int *lastPair = (unsigned int *) malloc(0x10000 * sizeof(unsigned int));
+	for (unsigned int i = 0; i < 0x10000; i++) lastPair[i] = UINT_MAX;
+
 	//run forwards pass for exploration
-	unsigned int pos = 0;
-	while (pos < size) {
-		//search LZ
-		unsigned int distance;
-		unsigned int length = CxiLzSearch(&state, &distance);
-		nodes[pos].length = length;
-		nodes[pos].distance = distance;
+	for (unsigned int pos = 0; pos < size; pos++) {
+		//gather LZ candidates. The last is the longest match.
+		CxiLzCandidate *candidates = matches->candidates + (size_t) pos * matches->nMaxCandidates;
+		unsigned int nCandidates = CxiLzSearchCandidates(&state, candidates, matches->nMaxCandidates);
+		matches->nCandidates[pos] = nCandidates;
+
+		nodes[pos].length = 1;
+		nodes[pos].distance = 0;
 		nodes[pos].weight = 0;
+		if (nCandidates > 0) {
+			nodes[pos].length = candidates[nCandidates - 1].length;
+			nodes[pos].distance = candidates[nCandidates - 1].distance;
+		}
 
-		//if there was no LZ match, search for any 2-byte matches.
-		if (nodes[pos].length < 2 && (pos + 1) < size) {
-
-			const unsigned char *src = buffer + pos;
-			for (unsigned int i = PUCRUNCH_MIN_DISTANCE; i <= 256 && i <= pos; i++) {
-				const unsigned char *src2 = buffer + pos - i;
-				if (src[0] == src2[0] && src[1] == src2[1]) {
-					//found 2-byte
-					nodes[pos].length = 2;
-					nodes[pos].distance = i;
-				}
+		//find the nearest 2-byte match
+		matches->shortDistance[pos] = 0;
+		if ((pos + 1) < size) {
+			unsigned int pair = (buffer[pos] << 8) | buffer[pos + 1];
+			if (lastPair[pair] != UINT_MAX && (pos - lastPair[pair]) <= 256) {
+				matches->shortDistance[pos] = pos - lastPair[pair];
 			}
+			lastPair[pair] = pos;
+		}
 
+		//if there was no longer LZ match, use the 2-byte match (which must be within 256 bytes).
+		if (nodes[pos].length <= 2) {
+			nodes[pos].length = matches->shortDistance[pos] ? 2 : 1;
+			nodes[pos].distance = matches->shortDistance[pos];
 		}
 
 		CxiLzStateSlide(&state, 1);
-		pos++;
 	}
+	free(lastPair);
 
 	//explore RL
 	CxiPcExploreRL(buffer, size, rlLens);
@@ -4274,10 +4805,12 @@ static void CxiPcGraphOptimize(
 	unsigned int         size,      // The input buffer size.
 	CxiLzNode           *nodes,     // The node array.
 	const uint16_t      *rlLens,    // The input RL length buffer.
+	const CxiPcMatches  *matches,   // The match candidates.
 	unsigned int         escBits,   // The number of escape bits.
 	unsigned int         nLzExtra,  // The number of extra low LZ bits.
 	const unsigned char *freqTbl,   // The RL high-frequency table.
-	unsigned int         nFreqTbl   // The RL high-frequency table size.
+	unsigned int         nFreqTbl,  // The RL high-frequency table size.
+	int                  exhaustive // Check every match and run length at its nearest distance.
 ) {
 	//calculate the cost of each byte literal for use by RL. This makes the RL optimization
 	//much faster.
@@ -4302,52 +4835,56 @@ static void CxiPcGraphOptimize(
 		unsigned int cost = CxiPcCalcNodeCost(node, rlByteCosts[buffer[pos]], escBits, 8 + nLzExtra);
 		if ((pos + node->length) < size) cost += nodes[pos + node->length].weight;
 
-		//check LZ.
+		//check LZ. Shorter lengths are costed at the nearest distance they match at. Unless exhaustive,
+		//only the longest of a run of lengths with the same token cost is checked, since it usually
+		//leaves the cheapest remainder, and the nearest distance is taken from the candidates, which
+		//can miss nearer matches at a position with more candidates than fit.
 		if (node->length > 1) {
-			unsigned int initLength = node->length, checkLength = node->length;
-			while (--checkLength > 1) {
-				unsigned int effectiveDistance = node->distance;
-
-				//check checkLength==2: must also check distance is within range
-				if (checkLength == 2 && node->distance > 256) {
-					//check for in-range distances here (TODO: separate hash table perhaps?)
-					unsigned int matchDistance = UINT_MAX;
-					for (unsigned int checkDistance = PUCRUNCH_MIN_DISTANCE; checkDistance <= 256 && checkDistance <= pos; checkDistance++) {
-						const unsigned char *src = buffer + pos - checkDistance;
-						if (src[0] == buffer[pos] && src[1] == buffer[pos + 1]) {
-							//found
-							matchDistance = checkDistance;
-							break;
-						}
+			const CxiLzCandidate *candidates = matches->candidates + (size_t) pos * matches->nMaxCandidates;
+			unsigned int iCandidate = matches->nCandidates[pos];
+			unsigned int initLength = node->length, initDistance = node->distance;
+			unsigned int lastLzCost = CxiPcCalcLzCost(escBits, 8 + nLzExtra, initLength, initDistance);
+
+			for (unsigned int checkLength = initLength - 1; checkLength > 1; checkLength--) {
+				unsigned int checkDistance = initDistance;
+
+				if (checkLength == 2) {
+					//check checkLength==2: must also check distance is within range
+					if (initDistance > 256) {
+						if (matches->shortDistance[pos] == 0) break; // no match
+						checkDistance = matches->shortDistance[pos];
 					}
-					if (matchDistance == UINT_MAX) break; // no match
-
-					//else, update the effective distance for this iteration
-					effectiveDistance = matchDistance;
+				} else if (exhaustive) {
+					//nearest distance, also searching between the candidates where they overflowed
+					unsigned int nearest = CxiPcFindNearestDistance(matches, buffer, size, pos, checkLength);
+					if (nearest != 0) checkDistance = nearest;
+				} else {
+					//nearest candidate still at least this long
+					while (iCandidate > 1 && candidates[iCandidate - 2].length >= checkLength) iCandidate--;
+					if (iCandidate > 0) checkDistance = candidates[iCandidate - 1].distance;
 				}
 
 				//get next cost (test)
-				unsigned int testCost = CxiPcCalcLzCost(escBits, 8 + nLzExtra, checkLength, effectiveDistance);
+				unsigned int lzCost = CxiPcCalcLzCost(escBits, 8 + nLzExtra, checkLength, checkDistance);
+				if (!exhaustive && lzCost == lastLzCost) continue;
+				lastLzCost = lzCost;
+
+				unsigned int testCost = lzCost;
 				if ((pos + checkLength) < size) testCost += nodes[pos + checkLength].weight;
 
 				if (testCost < cost) {
 					//update best
 					cost = testCost;
 					node->length = checkLength;
-					node->distance = effectiveDistance;
+					node->distance = checkDistance;
 				}
 			}
 
 			if (node->length < initLength && node->length > 2) {
 				//try reducing the distance of match (ONLY for long matches: short matches do not
 				//benefit from distance reduction, and we may have had to do it for them earlier anyway)
-				for (unsigned int checkDistance = PUCRUNCH_MIN_DISTANCE; checkDistance < node->distance; checkDistance++) {
-					if (CxiLzConfirmMatch(buffer, size, pos, checkDistance, node->length)) {
-						//found
-						node->distance = checkDistance;
-						break;
-					}
-				}
+				unsigned int nearest = CxiPcFindNearestDistance(matches, buffer, size, pos, node->length);
+				if (nearest != 0 && nearest < node->distance) node->distance = nearest;
 			}
 		}
 
@@ -4368,7 +4905,7 @@ static void CxiPcGraphOptimize(
 				checkLength--;
 
 				//HACK: checking only one RL length (not really necessary to check them all in practice)
-				break;
+				if (!exhaustive) break;
 			}
 		}
 
@@ -4565,12 +5102,42 @@ static unsigned char *CxiPcWriteCompression(
 	comp[7] = escBits;
 	memcpy(comp + 8, freqTbl, nFreqTbl);
 	memcpy(comp + 8 + nFreqTbl, bits, bitsSize);
+	free(bits);
 
 	*pOutSize = complen;
 	return comp;
 }
 
-unsigned char *CxCompressPuCrunch(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
+//
+// Parses the input for a number of escape bits, and writes the compressed output.
+//
+static unsigned char *CxiPcCompressWithEscapeBits(
+	const unsigned char *buffer,      // The input buffer.
+	unsigned int         size,        // The input buffer size.
+	const CxiLzNode     *nodes,       // The explored node array.
+	CxiLzNode           *parse,       // The node array to parse into.
+	const uint16_t      *rlLens,      // The RL length array.
+	const CxiPcMatches  *matches,     // The match candidates.
+	unsigned int         escBits,     // The number of escape bits.
+	unsigned int         nLzExtra,    // The number of extra low LZ bits.
+	unsigned char       *freqTbl,     // The RL high-frequency table (updated by the parse).
+	unsigned int        *pnFreqTbl,   // The RL high-frequency table size (updated by the parse).
+	int                  exhaustive,  // Check every match and run length at its nearest distance.
+	unsigned int        *pOutSize     // The output size.
+) {
+	//run 2 passes, rebuilding the RL table from each.
+	for (unsigned int j = 0; j < 2; j++) {
+		memcpy(parse, nodes, size * sizeof(CxiLzNode));
+
+		//run backwards pass for node collapse
+		CxiPcGraphOptimize(buffer, size, parse, rlLens, matches, escBits, nLzExtra, freqTbl, *pnFreqTbl, exhaustive);
+		*pnFreqTbl = CxiPcCreateRlTable(buffer, size, parse, freqTbl);
+	}
+
+	return CxiPcWriteCompression(buffer, size, parse, escBits, nLzExtra, freqTbl, *pnFreqTbl, pOutSize);
+}
+
+static unsigned char *CxiCompressPuCrunch(const unsigned char *buffer, unsigned int size, int exhaustive, unsigned int *compressedSize) {
 	//get max LZ extra bits
 	unsigned int maxWindow = 0xFE00, maxLzExtra = 0;
 	while (maxWindow < size && maxLzExtra < 8) {
@@ -4584,82 +5151,640 @@ unsigned char *CxCompressPuCrunch(const unsigned char *buffer, unsigned int size
 	//HACK: our internal structs are not big enough for the full sizes
 	if (maxWindow > 0x7FFF) maxWindow = 0x7FFF;
 
+	//gather match candidates once. Large inputs keep fewer candidates per position to bound memory use.
+	CxiPcMatches matches;
+	matches.nMaxCandidates = CX_ULTRA_MAX_CANDIDATES;
+	while (matches.nMaxCandidates > 1 && (size_t) size * matches.nMaxCandidates > CX_ULTRA_CANDIDATE_BUDGET) matches.nMaxCandidates /= 2;
+	matches.candidates = (CxiLzCandidate *) calloc((size_t) size * matches.nMaxCandidates, sizeof(CxiLzCandidate));
+	matches.nCandidates = (uint8_t *) calloc(size, sizeof(uint8_t));
+	matches.shortDistance = (uint16_t *) calloc(size, sizeof(uint16_t));
+
 	CxiLzNode *nodes = (CxiLzNode *) calloc(size, sizeof(CxiLzNode));  // buffer for LZ matches
+	CxiLzNode *parse = (CxiLzNode *) calloc(size, sizeof(CxiLzNode));  // buffer for parsing
 	uint16_t *rlLens = (uint16_t *) calloc(size, sizeof(uint16_t));    // buffer for RL matches
-	CxiPcExploreLzRl(buffer, size, maxWindow, nodes, rlLens);
+	CxiPcExploreLzRl(buffer, size, maxWindow, nodes, rlLens, &matches);
 
-	//we will try this from 0-8 to find the best value. We do this after exploration.
-	unsigned char freqTbl[32] = { 0 };
-	unsigned int nFreqTbl = 0;
+	//the greedy parse builds the RL table for the first pass. It does not depend on the escape bits.
+	unsigned char greedyFreqTbl[32] = { 0 };
+	memcpy(parse, nodes, size * sizeof(CxiLzNode));
+	CxiPcGraphOptimizeGreedy(buffer, size, parse, rlLens);
+	unsigned int nGreedyFreqTbl = CxiPcCreateRlTable(buffer, size, parse, greedyFreqTbl);
+
+	unsigned char freqTbl[32];
+	unsigned int nFreqTbl;
 
 	unsigned int bestCompSize = UINT_MAX;
 	unsigned char *bestComp = NULL;
-	for (unsigned int i = 0; i <= 2; i++) {
-		unsigned int escBits = i;
-		memset(freqTbl, 0, sizeof(freqTbl));
+	if (exhaustive) {
+		//parse for each escape bit count from 0-2.
+		for (unsigned int escBits = 0; escBits <= 2; escBits++) {
+			memcpy(freqTbl, greedyFreqTbl, sizeof(freqTbl));
+			nFreqTbl = nGreedyFreqTbl;
+
+			unsigned int compSize;
+			unsigned char *comp = CxiPcCompressWithEscapeBits(buffer, size, nodes, parse, rlLens, &matches, escBits, nLzExtra, freqTbl, &nFreqTbl, exhaustive, &compSize);
+			if (compSize < bestCompSize) {
+				//new best
+				free(bestComp);
+				bestCompSize = compSize;
+				bestComp = comp;
+			} else {
+				free(comp);
+			}
+		}
+	} else {
+		//estimate the escape bit count by writing out a single parse for no escape bits with each
+		//count. The best count is parsed for again only when it is not the one parsed for.
+		unsigned int bestEscBits = 0;
+		memcpy(freqTbl, greedyFreqTbl, sizeof(freqTbl));
+		nFreqTbl = nGreedyFreqTbl;
+		bestComp = CxiPcCompressWithEscapeBits(buffer, size, nodes, parse, rlLens, &matches, 0, nLzExtra, freqTbl, &nFreqTbl, exhaustive, &bestCompSize);
+
+		for (unsigned int escBits = 1; escBits <= 2; escBits++) {
+			unsigned int compSize;
+			unsigned char *comp = CxiPcWriteCompression(buffer, size, parse, escBits, nLzExtra, freqTbl, nFreqTbl, &compSize);
+			if (compSize < bestCompSize) {
+				free(bestComp);
+				bestCompSize = compSize;
+				bestComp = comp;
+				bestEscBits = escBits;
+			} else {
+				free(comp);
+			}
+		}
 
-		//run 2-pass: one graph optimize to build the RL table, then one more optimize.
-		{
-			CxiLzNode *nodesCopy = (CxiLzNode *) calloc(size, sizeof(CxiLzNode));
-			memcpy(nodesCopy, nodes, size * sizeof(CxiLzNode));
+		if (bestEscBits != 0) {
+			memcpy(freqTbl, greedyFreqTbl, sizeof(freqTbl));
+			nFreqTbl = nGreedyFreqTbl;
 
-			CxiPcGraphOptimizeGreedy(buffer, size, nodesCopy, rlLens);
-			nFreqTbl = CxiPcCreateRlTable(buffer, size, nodesCopy, freqTbl);
+			unsigned int compSize;
+			unsigned char *comp = CxiPcCompressWithEscapeBits(buffer, size, nodes, parse, rlLens, &matches, bestEscBits, nLzExtra, freqTbl, &nFreqTbl, exhaustive, &compSize);
+			if (compSize < bestCompSize) {
+				free(bestComp);
+				bestCompSize = compSize;
+				bestComp = comp;
+			} else {
+				free(comp);
+			}
+		}
+	}
+
+	free(rlLens);
+	free(parse);
+	free(nodes);
+	free(matches.candidates);
+	free(matches.nCandidates);
+	free(matches.shortDistance);
 
-			free(nodesCopy);
+	*compressedSize = bestCompSize;
+	return bestComp;
+}
+
+unsigned char *CxCompressPuCrunch(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize) {
+	return CxiCompressPuCrunch(buffer, size, 0, compressedSize);
+}
+
+
+
+// ----- Streaming decoder
+
+int CxDecoderInit(CxDecoder *decoder, int type) {
+	memset(decoder, 0, sizeof(*decoder));
+	decoder->type = type;
+	decoder->status = CX_DECODER_RUNNING;
+
+	switch (type) {
+		case COMPRESSION_LZ77:
+		case COMPRESSION_LZ11:
+		case COMPRESSION_RLE:
+		case COMPRESSION_HUFFMAN_4:
+		case COMPRESSION_HUFFMAN_8:
+		case COMPRESSION_DIFF8:
+		case COMPRESSION_DIFF16:
+			return 1;
+	}
+
+	decoder->status = CX_DECODER_ERROR;
+	return 0;
+}
+
+void CxDecoderFeed(CxDecoder *decoder, const unsigned char *src, unsigned int size) {
+	decoder->src = src;
+	decoder->srcSize = size;
+	decoder->srcPos = 0;
+}
+
+static int CxiDecoderPeekByte(CxDecoder *decoder, unsigned char *pByte) {
+	if (decoder->nStaged > 0) {
+		*pByte = decoder->stage[0];
+		return 1;
+	}
+	if (decoder->srcPos >= decoder->srcSize) return 0;
+
+	*pByte = decoder->src[decoder->srcPos];
+	return 1;
+}
+
+static const unsigned char *CxiDecoderGetBytes(CxDecoder *decoder, unsigned int n) {
+	//read directly from the input chunk when possible
+	if (decoder->nStaged == 0 && (decoder->srcSize - decoder->srcPos) >= n) {
+		const unsigned char *p = decoder->src + decoder->srcPos;
+		decoder->srcPos += n;
+		return p;
+	}
+
+	//stage bytes that span chunks. Returns NULL when more input is needed.
+	while (decoder->nStaged < n) {
+		if (decoder->srcPos >= decoder->srcSize) return NULL;
+		decoder->stage[decoder->nStaged++] = decoder->src[decoder->srcPos++];
+	}
+	decoder->nStaged = 0;
+	return decoder->stage;
+}
+
+static int CxiDecoderReadHeader(CxDecoder *decoder) {
+	if (decoder->type == COMPRESSION_HUFFMAN_4 || decoder->type == COMPRESSION_HUFFMAN_8) {
+		//the Huffman tree follows the header
+		if (decoder->treeSize == 0) {
+			const unsigned char *p = CxiDecoderGetBytes(decoder, 5);
+			if (p == NULL) return 0;
+
+			if ((p[0] != 0x24 && p[0] != 0x28) || ((p[0] & 0xF) == 4) != (decoder->type == COMPRESSION_HUFFMAN_4)) {
+				decoder->status = CX_DECODER_ERROR;
+				return 0;
+			}
+			decoder->uncompSize = (p[1] | (p[2] << 8) | (p[3] << 16));
+			decoder->symBits = p[0] & 0xF;
+			decoder->treeSize = (p[4] + 1) << 1;
+			decoder->tree[0] = p[4];
+			decoder->nTreeRead = 1;
+			decoder->treePos = 1;
 		}
+		while (decoder->nTreeRead < decoder->treeSize) {
+			if (decoder->srcPos >= decoder->srcSize) return 0;
+			decoder->tree[decoder->nTreeRead++] = decoder->src[decoder->srcPos++];
+		}
+	} else {
+		const unsigned char *p = CxiDecoderGetBytes(decoder, 4);
+		if (p == NULL) return 0;
+
+		unsigned char head = 0;
+		switch (decoder->type) {
+			case COMPRESSION_LZ77:  head = 0x10; break;
+			case COMPRESSION_LZ11:  head = 0x11; break;
+			case COMPRESSION_RLE:   head = 0x30; break;
+			case COMPRESSION_DIFF8: head = 0x80; break;
+			case COMPRESSION_DIFF16:head = 0x81; break;
+		}
+		if (p[0] != head) {
+			decoder->status = CX_DECODER_ERROR;
+			return 0;
+		}
+		decoder->uncompSize = (p[1] | (p[2] << 8) | (p[3] << 16));
+	}
 
-		CxiLzNode *nodesCopy = (CxiLzNode *) calloc(size, sizeof(CxiLzNode));
-		for (unsigned int j = 0; j < 2; j++) {
-			memcpy(nodesCopy, nodes, size * sizeof(CxiLzNode));
+	decoder->headerRead = 1;
+	return 1;
+}
+
+static void CxiDecoderCopyReference(CxDecoder *decoder, unsigned char *dest, unsigned int nOut, unsigned int len) {
+	unsigned int dist = decoder->copyDistance;
+
+	//bytes output by previous calls come from the history window
+	while (len > 0 && dist > nOut) {
+		dest[nOut] = decoder->window[(decoder->nWritten + nOut - dist) % CX_DECODER_WINDOW_SIZE];
+		nOut++;
+		len--;
+	}
+
+	//the caller's buffer is not written past the reference, since the call may end before later
+	//tokens overwrite it.
+	if (len > 0) CxiLzCopyReference(dest + nOut, dist, len, len);
+}
 
-			//run backwards pass for node collapse
-			CxiPcGraphOptimize(buffer, size, nodesCopy, rlLens, escBits, nLzExtra, freqTbl, nFreqTbl);
-			nFreqTbl = CxiPcCreateRlTable(buffer, size, nodesCopy, freqTbl);
+static void CxiDecoderUpdateWindow(CxDecoder *decoder, const unsigned char *dest, unsigned int nOut) {
+	//keep the most recent output for references made in later calls
+	unsigned int start = (nOut > CX_DECODER_WINDOW_SIZE) ? (nOut - CX_DECODER_WINDOW_SIZE) : 0;
+	while (start < nOut) {
+		unsigned int winPos = (decoder->nWritten + start) % CX_DECODER_WINDOW_SIZE;
+		unsigned int n = CX_DECODER_WINDOW_SIZE - winPos;
+		if (n > (nOut - start)) n = nOut - start;
+
+		memcpy(decoder->window + winPos, dest + start, n);
+		start += n;
+	}
+}
+
+static unsigned int CxiDecoderDrainLZ(CxDecoder *decoder, unsigned char *dest, unsigned int size) {
+	unsigned int nOut = 0;
+	while (nOut < size) {
+		//continue a pending reference
+		if (decoder->copyLength > 0) {
+			unsigned int len = decoder->copyLength;
+			if (len > (size - nOut)) len = size - nOut;
+
+			CxiDecoderCopyReference(decoder, dest, nOut, len);
+			nOut += len;
+			decoder->copyLength -= len;
+			continue;
 		}
 
-		//compress
-		unsigned int compSize;
-		unsigned char *comp = CxiPcWriteCompression(buffer, size, nodesCopy, escBits, nLzExtra, freqTbl, nFreqTbl, &compSize);
-		free(nodesCopy);
+		if (decoder->nFlags == 0) {
+			const unsigned char *p = CxiDecoderGetBytes(decoder, 1);
+			if (p == NULL) break;
 
-		if (compSize < bestCompSize) {
-			//new best
-			free(bestComp);
-			bestCompSize = compSize;
-			bestComp = comp;
+			decoder->flags = *p;
+			decoder->nFlags = 8;
 		}
+
+		if (!(decoder->flags & 0x80)) {
+			//literal
+			const unsigned char *p = CxiDecoderGetBytes(decoder, 1);
+			if (p == NULL) break;
+
+			dest[nOut++] = *p;
+		} else {
+			//reference. LZ11 tokens are 2 to 4 bytes depending on the first nybble.
+			unsigned int tokenSize = 2;
+			unsigned char high;
+			if (!CxiDecoderPeekByte(decoder, &high)) break;
+			if (decoder->type == COMPRESSION_LZ11) {
+				switch (high >> 4) {
+					case 0: tokenSize = 3; break;
+					case 1: tokenSize = 4; break;
+				}
+			}
+
+			const unsigned char *p = CxiDecoderGetBytes(decoder, tokenSize);
+			if (p == NULL) break;
+
+			unsigned int len, offs;
+			if (decoder->type == COMPRESSION_LZ77) {
+				len = (p[0] >> 4) + 3;
+				offs = (((p[0] & 0xF) << 8) | p[1]) + 1;
+			} else {
+				switch (p[0] >> 4) {
+					case 0:
+						len = ((p[0] << 4) | (p[1] >> 4)) + 0x11;
+						offs = (((p[1] & 0xF) << 8) | p[2]) + 1;
+						break;
+					case 1:
+						len = (((p[0] & 0xF) << 12) | (p[1] << 4) | (p[2] >> 4)) + 0x111;
+						offs = (((p[2] & 0xF) << 8) | p[3]) + 1;
+						break;
+					default:
+						len = (p[0] >> 4) + 1;
+						offs = (((p[0] & 0xF) << 8) | p[1]) + 1;
+						break;
+				}
+			}
+
+			//references may not precede the start of the output
+			if (offs > (decoder->nWritten + nOut)) {
+				decoder->status = CX_DECODER_ERROR;
+				break;
+			}
+			decoder->copyDistance = offs;
+			decoder->copyLength = len;
+		}
+
+		decoder->flags <<= 1;
+		decoder->nFlags--;
 	}
+	return nOut;
+}
 
-	free(rlLens);
-	free(nodes);
+static unsigned int CxiDecoderDrainRL(CxDecoder *decoder, unsigned char *dest, unsigned int size) {
+	unsigned int nOut = 0;
+	while (nOut < size) {
+		//continue a pending chunk
+		if (decoder->copyLength > 0) {
+			unsigned int len = decoder->copyLength;
+			if (len > (size - nOut)) len = size - nOut;
 
-	*compressedSize = bestCompSize;
-	return bestComp;
+			if (decoder->isRun) {
+				memset(dest + nOut, decoder->runByte, len);
+			} else {
+				//uncompressed bytes are copied straight from the input
+				unsigned int nAvail = decoder->srcSize - decoder->srcPos;
+				if (nAvail == 0) break;
+				if (len > nAvail) len = nAvail;
+
+				memcpy(dest + nOut, decoder->src + decoder->srcPos, len);
+				decoder->srcPos += len;
+			}
+			nOut += len;
+			decoder->copyLength -= len;
+			continue;
+		}
+
+		unsigned char head;
+		if (!CxiDecoderPeekByte(decoder, &head)) break;
+
+		const unsigned char *p = CxiDecoderGetBytes(decoder, (head & 0x80) ? 2 : 1);
+		if (p == NULL) break;
+
+		decoder->isRun = head >> 7;
+		if (decoder->isRun) {
+			decoder->copyLength = (head & 0x7F) + 3;
+			decoder->runByte = p[1];
+		} else {
+			decoder->copyLength = (head & 0x7F) + 1;
+		}
+	}
+	return nOut;
+}
+
+static unsigned int CxiDecoderDrainHuffman(CxDecoder *decoder, unsigned char *dest, unsigned int size) {
+	unsigned int nOut = 0;
+	while (nOut < size) {
+		//bits are read from 32-bit words, most significant bit first
+		if (decoder->nBits == 0) {
+			const unsigned char *p = CxiDecoderGetBytes(decoder, 4);
+			if (p == NULL) break;
+
+			decoder->bits = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+			decoder->nBits = 32;
+		}
+
+		unsigned int lr = decoder->bits >> 31;
+		decoder->bits <<= 1;
+		decoder->nBits--;
+
+		unsigned char thisNode = decoder->tree[decoder->treePos];
+		unsigned int thisNodeOffs = ((thisNode & 0x3F) + 1) << 1;
+		decoder->treePos = (decoder->treePos & ~1) + thisNodeOffs + lr;
+		if (decoder->treePos >= decoder->treeSize) {
+			decoder->status = CX_DECODER_ERROR;
+			break;
+		}
+
+		if (thisNode & (0x80 >> lr)) {
+			//leaf node. 4-bit symbols are packed starting with the low nybble.
+			unsigned char sym = decoder->tree[decoder->treePos];
+			decoder->treePos = 1;
+
+			if (decoder->symBits == 8) {
+				dest[nOut++] = sym;
+			} else if (!decoder->nPending) {
+				decoder->last = sym & 0xF;
+				decoder->nPending = 1;
+			} else {
+				dest[nOut++] = decoder->last | (sym << 4);
+				decoder->nPending = 0;
+			}
+		}
+	}
+	return nOut;
+}
+
+static unsigned int CxiDecoderDrainDiff(CxDecoder *decoder, unsigned char *dest, unsigned int size) {
+	unsigned int nOut = 0;
+	if (decoder->type == COMPRESSION_DIFF8) {
+		unsigned int nAvail = decoder->srcSize - decoder->srcPos;
+		if (size > nAvail) size = nAvail;
+
+		const unsigned char *src = decoder->src + decoder->srcPos;
+		unsigned char last = (unsigned char) decoder->last;
+		for (nOut = 0; nOut < size; nOut++) {
+			last += src[nOut];
+			dest[nOut] = last;
+		}
+		decoder->last = last;
+		decoder->srcPos += nOut;
+		return nOut;
+	}
+
+	while (nOut < size) {
+		//16-bit units are output low byte first
+		if (decoder->nPending) {
+			dest[nOut++] = (unsigned char) (decoder->last >> 8);
+			decoder->nPending = 0;
+			continue;
+		}
+
+		const unsigned char *p = CxiDecoderGetBytes(decoder, 2);
+		if (p == NULL) break;
+
+		decoder->last = (decoder->last + (p[0] | (p[1] << 8))) & 0xFFFF;
+		dest[nOut++] = (unsigned char) decoder->last;
+		decoder->nPending = 1;
+	}
+	return nOut;
+}
+
+unsigned int CxDecoderDrain(CxDecoder *decoder, unsigned char *dest, unsigned int size) {
+	if (decoder->status != CX_DECODER_RUNNING) return 0;
+	if (!decoder->headerRead && !CxiDecoderReadHeader(decoder)) return 0;
+
+	//do not output past the uncompressed size
+	unsigned int nRemaining = decoder->uncompSize - decoder->nWritten;
+	if (size > nRemaining) size = nRemaining;
+
+	unsigned int nOut = 0;
+	switch (decoder->type) {
+		case COMPRESSION_LZ77:
+		case COMPRESSION_LZ11:
+			nOut = CxiDecoderDrainLZ(decoder, dest, size);
+			CxiDecoderUpdateWindow(decoder, dest, nOut);
+			break;
+		case COMPRESSION_RLE:
+			nOut = CxiDecoderDrainRL(decoder, dest, size);
+			break;
+		case COMPRESSION_HUFFMAN_4:
+		case COMPRESSION_HUFFMAN_8:
+			nOut = CxiDecoderDrainHuffman(decoder, dest, size);
+			break;
+		case COMPRESSION_DIFF8:
+		case COMPRESSION_DIFF16:
+			nOut = CxiDecoderDrainDiff(decoder, dest, size);
+			break;
+	}
+
+	decoder->nWritten += nOut;
+	if (decoder->status == CX_DECODER_RUNNING && decoder->nWritten == decoder->uncompSize) {
+		decoder->status = CX_DECODER_DONE;
+	}
+	return nOut;
+}
+
+int CxDecoderFinish(CxDecoder *decoder, unsigned int *uncompressedSize) {
+	if (uncompressedSize != NULL) *uncompressedSize = decoder->nWritten;
+	return decoder->status == CX_DECODER_DONE;
 }
 
 
 
 // ----- Generic Routines
 
+//an LZ77 flag byte and 8 references (17 bytes) decode to at most 144 bytes
+static int CxiLzSizeIsPlausible(uint32_t length, unsigned int size) {
+	return length > 0 && ((length / 144) * 17 + 4) <= size;
+}
+
+static int CxiProbeLZHeader(const unsigned char *buffer, unsigned int size) {
+	if (size < 8) return 0;
+	if (buffer[0] != 'L' || buffer[1] != 'Z' || buffer[2] != '7' || buffer[3] != '7' || buffer[4] != 0x10) return 0;
+	return CxiLzSizeIsPlausible((*(uint32_t *) (buffer + 4)) >> 8, size - 4);
+}
+
+static int CxiProbeLZ(const unsigned char *buffer, unsigned int size) {
+	if (size < 5 || buffer[0] != 0x10) return 0;
+	return CxiLzSizeIsPlausible((*(uint32_t *) buffer) >> 8, size);
+}
+
+//an LZ11 flag byte and 8 longest references (33 bytes) decode to at most 8 * 0x10110 bytes
+static int CxiLzxSizeIsPlausible(uint32_t length, unsigned int size) {
+	return length > 0 && ((length / (8 * 0x10110)) * 33 + 4) <= size;
+}
+
+static int CxiProbeLZX(const unsigned char *buffer, unsigned int size) {
+	if (size < 5 || buffer[0] != 0x11) return 0;
+
+	//the first token can only be a literal, since there is no data to reference yet
+	if (buffer[4] & 0x80) return 0;
+	return CxiLzxSizeIsPlausible((*(uint32_t *) buffer) >> 8, size);
+}
+
+static int CxiProbeLZXComp(const unsigned char *buffer, unsigned int size) {
+	if (size < 0x14) return 0;
+
+	uint32_t magic = *(uint32_t *) buffer;
+	if (magic != 'COMP' && magic != 'PMOC') return 0;
+
+	uint32_t nSegments = *(uint32_t *) (buffer + 0x8);
+	return nSegments > 0 && nSegments <= (size - 0x10) / 4;
+}
+
+static int CxiProbeHuffman(const unsigned char *buffer, unsigned int size, unsigned char head) {
+	return size >= 5 && buffer[0] == head;
+}
+
+static int CxiProbePuCrunch(const unsigned char *buffer, unsigned int size) {
+	if (size < 8 || buffer[0] != 0x60) return 0;
+
+	unsigned int freqTblSize = buffer[4];
+	if (freqTblSize > (size - 8)) return 0;
+	if ((freqTblSize & 3) || (freqTblSize > 0x20) || (freqTblSize == 0)) return 0;
+	return buffer[7] <= 8 && buffer[6] <= 24;
+}
+
+static int CxiProbeMvDK(const unsigned char *buffer, unsigned int size) {
+	if (size < 4) return 0;
+
+	uint32_t uncompSize = (*(uint32_t *) buffer) >> 2;
+	switch (CxiMvdkGetCompressionType(buffer, size)) {
+		case MVDK_DUMMY:
+			return CxIsCompressedMvDK(buffer, size);
+		case MVDK_LZ:
+			//validated as an LZ77 stream with a 24-bit size
+			return CxiLzSizeIsPlausible(uncompSize & 0xFFFFFF, size);
+	}
+	return 1;
+}
+
+static int CxiProbeVlx(const unsigned char *buffer, unsigned int size) {
+	if (size < 1 || (buffer[0] & 0xF0)) return 0;
+
+	unsigned int lenlen = buffer[0] & 0xF;
+	switch (lenlen) {
+		case 1: if (size < 3) return 0; break;
+		case 2: if (size < 4) return 0; break;
+		case 4: if (size < 6 || buffer[4] != 0) return 0; break;
+		default: return 0;
+	}
+
+	//tree header
+	unsigned int hi4 = buffer[lenlen + 1] >> 4, lo4 = buffer[lenlen + 1] & 0xF;
+	if (hi4 > 12 || lo4 > 12) return 0;
+	return (lenlen + 2 + (hi4 + lo4) * 2) <= size;
+}
+
+static int CxiProbeAsh(const unsigned char *buffer, unsigned int size) {
+	if (size < 0xC) return 0;
+	if (memcmp(buffer, "ASH", 3) != 0) return 0;
+
+	uint32_t offsDist = BigToLittle32(*(const uint32_t *) (buffer + 0x8));
+	return offsDist >= 0xC && offsDist < size;
+}
+
+static int CxiGetCandidateTypes(const unsigned char *buffer, unsigned int size, int *types) {
+	//check only the headers of each format. The candidates are returned in order of precedence.
+	int nTypes = 0;
+	if (CxiProbeLZHeader(buffer, size)) types[nTypes++] = COMPRESSION_LZ77_HEADER;
+	if (CxiProbeLZ(buffer, size)) types[nTypes++] = COMPRESSION_LZ77;
+	if (CxiProbeLZX(buffer, size)) types[nTypes++] = COMPRESSION_LZ11;
+	if (CxiProbeLZXComp(buffer, size)) types[nTypes++] = COMPRESSION_LZ11_COMP_HEADER;
+	if (size >= 4 && buffer[0] == 0x30) types[nTypes++] = COMPRESSION_RLE;
+	if (CxiProbeHuffman(buffer, size, 0x24)) types[nTypes++] = COMPRESSION_HUFFMAN_4;
+	if (CxiProbeHuffman(buffer, size, 0x28)) types[nTypes++] = COMPRESSION_HUFFMAN_8;
+	if (CxIsFilteredDiff8(buffer, size)) types[nTypes++] = COMPRESSION_DIFF8;
+	if (CxIsFilteredDiff16(buffer, size)) types[nTypes++] = COMPRESSION_DIFF16;
+	if (CxiProbePuCrunch(buffer, size)) types[nTypes++] = COMPRESSION_PUCRUNCH;
+	if (CxiProbeMvDK(buffer, size)) types[nTypes++] = COMPRESSION_MVDK;
+	if (CxiProbeVlx(buffer, size)) types[nTypes++] = COMPRESSION_VLX;
+	if (CxiProbeAsh(buffer, size)) types[nTypes++] = COMPRESSION_ASH;
+	return nTypes;
+}
+
+static unsigned char *CxiDecompressValidated(const unsigned char *buffer, unsigned int size, int type, unsigned int *uncompressedSize, int *pValid) {
+	unsigned int srcEnd = 0;
+	unsigned char *out = NULL;
+	switch (type) {
+		case COMPRESSION_LZ77_HEADER:
+			buffer += 4;
+			size -= 4;
+			//fall through
+		case COMPRESSION_LZ77:
+			out = CxiDecompressLZ(buffer, size, uncompressedSize, &srcEnd);
+			break;
+		case COMPRESSION_LZ11:
+			out = CxiDecompressLZX(buffer, size, uncompressedSize, &srcEnd);
+			break;
+		default:
+			//formats without a self-validating decoder are validated first
+			if (!CxIsCompressed(buffer, size, type)) return NULL;
+			*pValid = 1;
+			return CxDecompress(buffer, size, type, uncompressedSize);
+	}
+
+	//LZ streams are valid when fully decoded with up to 7 bytes of padding
+	if (out != NULL && (size - srcEnd) > 7) {
+		free(out);
+		out = NULL;
+	}
+	*pValid = out != NULL;
+	return out;
+}
+
 int CxGetCompressionType(const unsigned char *buffer, unsigned int size) {
-	if (CxIsFilteredLZHeader(buffer, size)) return COMPRESSION_LZ77_HEADER;
-	if (CxIsCompressedLZ(buffer, size)) return COMPRESSION_LZ77;
-	if (CxIsCompressedLZX(buffer, size)) return COMPRESSION_LZ11;
-	if (CxIsCompressedLZXComp(buffer, size)) return COMPRESSION_LZ11_COMP_HEADER;
-	if (CxIsCompressedRL(buffer, size)) return COMPRESSION_RLE;
-	if (CxIsCompressedHuffman4(buffer, size)) return COMPRESSION_HUFFMAN_4;
-	if (CxIsCompressedHuffman8(buffer, size)) return COMPRESSION_HUFFMAN_8;
-	if (CxIsFilteredDiff8(buffer, size)) return COMPRESSION_DIFF8;
-	if (CxIsFilteredDiff16(buffer, size)) return COMPRESSION_DIFF16;
-	if (CxIsCompressedPuCrunch(buffer, size)) return COMPRESSION_PUCRUNCH;
-	if (CxIsCompressedMvDK(buffer, size)) return COMPRESSION_MVDK;
-	if (CxIsCompressedVlx(buffer, size)) return COMPRESSION_VLX;
-	if (CxIsCompressedAsh(buffer, size)) return COMPRESSION_ASH;
+	int types[COMPRESSION_MAX];
+	int nTypes = CxiGetCandidateTypes(buffer, size, types);
 
+	for (int i = 0; i < nTypes; i++) {
+		if (CxIsCompressed(buffer, size, types[i])) return types[i];
+	}
 	return COMPRESSION_NONE;
 }
 
+unsigned char *CxDecompressAuto(const unsigned char *buffer, unsigned int size, int *pType, unsigned int *uncompressedSize) {
+	int types[COMPRESSION_MAX];
+	int nTypes = CxiGetCandidateTypes(buffer, size, types);
+
+	for (int i = 0; i < nTypes; i++) {
+		//the first valid candidate is the type, even if it then fails to decompress
+		int valid = 0;
+		unsigned char *out = CxiDecompressValidated(buffer, size, types[i], uncompressedSize, &valid);
+		if (valid) {
+			*pType = types[i];
+			return out;
+		}
+	}
+
+	*pType = COMPRESSION_NONE;
+	return NULL;
+}
+
 int CxIsCompressed(const unsigned char *buffer, unsigned int size, int type) {
 	switch (type) {
 		case COMPRESSION_NONE             : return 1;
@@ -4718,7 +5843,11 @@ unsigned char *CxDecompress(const unsigned char *buffer, unsigned int size, int
 	return NULL;
 }
 
-unsigned char *CxCompress(const unsigned char *buffer, unsigned int size, int compression, unsigned int *compressedSize) {
+static unsigned char *CxiCompress(const unsigned char *buffer, unsigned int size, int compression, unsigned int nThreads, unsigned int *compressedSize) {
+	//nThreads limits the threads the LZ codecs find matches on
+	int level = compression & COMPRESSION_LEVEL_MASK;
+	compression &= COMPRESSION_TYPE_MASK;
+
 	switch (compression) {
 		case COMPRESSION_NONE:
 		{
@@ -4728,9 +5857,9 @@ unsigned char *CxCompress(const unsigned char *buffer, unsigned int size, int co
 			return copy;
 		}
 		case COMPRESSION_LZ77:
-			return CxCompressLZ(buffer, size, compressedSize);
+			return CxiCompressLZ(buffer, size, nThreads, compressedSize);
 		case COMPRESSION_LZ11:
-			return CxCompressLZX(buffer, size, compressedSize);
+			return CxiCompressLZX(buffer, size, nThreads, compressedSize);
 		case COMPRESSION_LZ11_COMP_HEADER:
 			return CxCompressLZXComp(buffer, size, compressedSize);
 		case COMPRESSION_HUFFMAN_4:
@@ -4738,7 +5867,7 @@ unsigned char *CxCompress(const unsigned char *buffer, unsigned int size, int co
 		case COMPRESSION_HUFFMAN_8:
 			return CxCompressHuffman8(buffer, size, compressedSize);
 		case COMPRESSION_LZ77_HEADER:
-			return CxCompressLZHeader(buffer, size, compressedSize);
+			return CxiCompressLZHeader(buffer, size, nThreads, compressedSize);
 		case COMPRESSION_RLE:
 			return CxCompressRL(buffer, size, compressedSize);
 		case COMPRESSION_DIFF8:
@@ -4746,13 +5875,187 @@ unsigned char *CxCompress(const unsigned char *buffer, unsigned int size, int co
 		case COMPRESSION_DIFF16:
 			return CxFilterDiff16(buffer, size, compressedSize);
 		case COMPRESSION_MVDK:
-			return CxCompressMvDK(buffer, size, compressedSize);
+			return CxiCompressMvDK(buffer, size, nThreads, compressedSize);
 		case COMPRESSION_VLX:
 			return CxCompressVlx(buffer, size, compressedSize);
 		case COMPRESSION_ASH:
+			if (level == COMPRESSION_LEVEL_ULTRA) return CxiCompressAshUltra(buffer, size, compressedSize);
 			return CxCompressAsh(buffer, size, compressedSize);
 		case COMPRESSION_PUCRUNCH:
+			if (level == COMPRESSION_LEVEL_ULTRA) return CxiCompressPuCrunch(buffer, size, 1, compressedSize);
 			return CxCompressPuCrunch(buffer, size, compressedSize);
+		case COMPRESSION_AUTO:
+			return CxCompressBest(buffer, size, COMPRESSION_AUTO_MASK, NULL, compressedSize);
 	}
 	return NULL;
 }
+
+unsigned char *CxCompress(const unsigned char *buffer, unsigned int size, int compression, unsigned int *compressedSize) {
+	return CxiCompress(buffer, size, compression, ThGetProcessorCount(), compressedSize);
+}
+
+
+// ----- Best-of compression
+
+typedef struct CxiBestWork_ {
+	const unsigned char *buffer;
+	unsigned int size;
+	int order[COMPRESSION_MAX];             // codecs to try, in the order they're started
+	unsigned int nCodecs;
+	volatile long nextCodec;
+	unsigned int nProcessors;
+	volatile long long nActive;             // number of workers that haven't run out of codecs
+	volatile long bestSize;                 // size of some finished result (-1 if none yet)
+	unsigned char *results[COMPRESSION_MAX];
+	unsigned int resultSizes[COMPRESSION_MAX];
+} CxiBestWork;
+
+//codecs are started fast and usually effective first, so that the bounds of the ones after can cut
+//them off early.
+static const int sCxiBestOrder[] = {
+	COMPRESSION_LZ77,
+	COMPRESSION_RLE,
+	COMPRESSION_HUFFMAN_8,
+	COMPRESSION_HUFFMAN_4,
+	COMPRESSION_LZ11,
+	COMPRESSION_LZ77_HEADER,
+	COMPRESSION_LZ11_COMP_HEADER,
+	COMPRESSION_ASH,
+	COMPRESSION_MVDK,
+	COMPRESSION_VLX,
+	COMPRESSION_PUCRUNCH,
+	COMPRESSION_DIFF8,
+	COMPRESSION_DIFF16,
+	COMPRESSION_NONE
+};
+
+static unsigned int CxiHuffmanSizeBound(const unsigned char *buffer, unsigned int size, int nBits) {
+	//a prefix code can't beat the order-0 entropy of the input, and spends at least 1 bit per symbol
+	unsigned int freq[256] = { 0 };
+	unsigned int nSym = size;
+	if (nBits == 8) {
+		for (unsigned int i = 0; i < size; i++) freq[buffer[i]]++;
+	} else {
+		for (unsigned int i = 0; i < size; i++) {
+			freq[buffer[i] & 0xF]++;
+			freq[buffer[i] >> 4]++;
+		}
+		nSym = size * 2;
+	}
+
+	double bits = 0.0;
+	for (unsigned int i = 0; i < 256; i++) {
+		if (freq[i]) bits -= freq[i] * log((double) freq[i] / nSym);
+	}
+	bits /= log(2.0);
+	if (bits < nSym) bits = nSym;
+
+	//leave a byte of slack for rounding
+	unsigned int bytes = (unsigned int) (bits / 8.0);
+	return 4 + (bytes > 0 ? bytes - 1 : 0);
+}
+
+static unsigned int CxiCompressedSizeBound(const unsigned char *buffer, unsigned int size, int type) {
+	//a lower bound on the compressed size. A codec whose bound exceeds a finished result can't win.
+	switch (type) {
+		case COMPRESSION_NONE:
+			return size;
+		case COMPRESSION_DIFF8:
+		case COMPRESSION_DIFF16:
+			return size + 4;
+		case COMPRESSION_RLE:
+			//a run of up to 130 bytes takes 2 bytes
+			return 4 + 2 * ((size + 129) / 130);
+		case COMPRESSION_LZ77:
+		case COMPRESSION_LZ77_HEADER:
+			//a reference of up to 18 bytes takes 17 bits
+			return 4 + (unsigned int) (((uint64_t) size * 17) / (18 * 8));
+		case COMPRESSION_HUFFMAN_4:
+			return CxiHuffmanSizeBound(buffer, size, 4);
+		case COMPRESSION_HUFFMAN_8:
+			return CxiHuffmanSizeBound(buffer, size, 8);
+	}
+	return 4;
+}
+
+static void CxiCompressBestWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) iWorker;
+	(void) nWorkers;
+
+	CxiBestWork *work = (CxiBestWork *) param;
+	while (1) {
+		unsigned int iCodec = (unsigned int) ThAtomicIncrement(&work->nextCodec) - 1;
+		if (iCodec >= work->nCodecs) {
+			ThAtomicAdd64(&work->nActive, -1);
+			break;
+		}
+
+		//skip codecs that can't beat a result we already have. Finished sizes are published without
+		//a compare-exchange, so a racing worker may publish a larger one; the check stays correct
+		//since every published size was reached by some codec.
+		int type = work->order[iCodec];
+		long best = ThAtomicLoad(&work->bestSize);
+		if (best >= 0 && CxiCompressedSizeBound(work->buffer, work->size, type) > (unsigned long) best) continue;
+
+		//a codec that finds matches on threads of its own gets an even share of the processors among the
+		//workers still running codecs. Workers only drop out, so the shares never add up to more than the
+		//processors.
+		long long nActive = ThAtomicAdd64(&work->nActive, 0);
+		unsigned int nThreads = work->nProcessors / (unsigned int) nActive;
+		if (nThreads < 1) nThreads = 1;
+
+		unsigned int compSize;
+		unsigned char *comp = CxiCompress(work->buffer, work->size, type, nThreads, &compSize);
+		if (comp == NULL) continue;
+
+		best = ThAtomicLoad(&work->bestSize);
+		if (best >= 0 && compSize > (unsigned long) best) {
+			//lost already
+			free(comp);
+			continue;
+		}
+		ThAtomicStore(&work->bestSize, (long) compSize);
+		work->results[type] = comp;
+		work->resultSizes[type] = compSize;
+	}
+}
+
+unsigned char *CxCompressBest(const unsigned char *buffer, unsigned int size, unsigned int allowedMask, int *pType, unsigned int *compressedSize) {
+	CxiBestWork work;
+	memset(&work, 0, sizeof(work));
+	work.buffer = buffer;
+	work.size = size;
+	work.bestSize = -1;
+
+	for (unsigned int i = 0; i < sizeof(sCxiBestOrder) / sizeof(sCxiBestOrder[0]); i++) {
+		int type = sCxiBestOrder[i];
+		if (allowedMask & COMPRESSION_MASK(type)) work.order[work.nCodecs++] = type;
+	}
+
+	work.nProcessors = ThGetProcessorCount();
+	unsigned int nWorkers = work.nProcessors;
+	if (nWorkers > work.nCodecs) nWorkers = work.nCodecs;
+	work.nActive = nWorkers;
+	if (nWorkers > 0) ThRunWorkers(CxiCompressBestWorker, &work, nWorkers);
+
+	//pick the smallest result, breaking ties by the lowest type so the choice doesn't depend on which
+	//codec finished first.
+	int bestType = -1;
+	for (int i = 0; i < COMPRESSION_MAX; i++) {
+		if (work.results[i] == NULL) continue;
+		if (bestType == -1 || work.resultSizes[i] < work.resultSizes[bestType]) bestType = i;
+	}
+	for (int i = 0; i < COMPRESSION_MAX; i++) {
+		if (i != bestType) free(work.results[i]);
+	}
+
+	if (bestType == -1) {
+		if (pType != NULL) *pType = COMPRESSION_NONE;
+		*compressedSize = 0;
+		return NULL;
+	}
+
+	if (pType != NULL) *pType = bestType;
+	*compressedSize = work.resultSizes[bestType];
+	return work.results[bestType];
+}
@@ -15,6 +15,19 @@
 #define COMPRESSION_ASH              12
 #define COMPRESSION_PUCRUNCH         13
 #define COMPRESSION_MAX              14 // max+1
+#define COMPRESSION_AUTO             0xFF // smallest of the COMPRESSION_AUTO_MASK types
+
+#define COMPRESSION_TYPE_MASK    0x00FF // mask of the compression type passed to CxCompress
+#define COMPRESSION_LEVEL_MASK   0x0F00 // mask of the compression level passed to CxCompress
+#define COMPRESSION_LEVEL_NORMAL 0x0000 // default compression level
+#define COMPRESSION_LEVEL_ULTRA  0x0100 // slower compression with optimal parsing, where supported
+
+#define COMPRESSION_MASK(t)      (1 << (t)) // bit of a compression type in a CxCompressBest mask
+
+//types tried by COMPRESSION_AUTO: the common formats decompressed by the BIOS and SDK
+#define COMPRESSION_AUTO_MASK    (COMPRESSION_MASK(COMPRESSION_LZ77) | COMPRESSION_MASK(COMPRESSION_LZ11) | \
+                                  COMPRESSION_MASK(COMPRESSION_HUFFMAN_4) | COMPRESSION_MASK(COMPRESSION_HUFFMAN_8) | \
+                                  COMPRESSION_MASK(COMPRESSION_RLE))
 
 
 
@@ -90,9 +103,60 @@ unsigned char *CxCompressMvDK(const unsigned char *buffer, unsigned int size, un
 unsigned char *CxCompressVlx(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize);
 unsigned char *CxCompressAsh(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize);
 unsigned char *CxCompressPuCrunch(const unsigned char *buffer, unsigned int size, unsigned int *compressedSize);
+
+
+/******************************************************************************\
+*
+* Compresses a buffer with the specified compression type and returns a pointer
+* to an allocated buffer holding the compressed data. A compression level may
+* be combined with the compression type. COMPRESSION_LEVEL_ULTRA searches every
+* match candidate per position and optimally parses the input against the
+* codec's entropy coding (ASH), or checks every match and run length at its
+* nearest distance and every escape bit count instead of estimating them
+* (PuCrunch); codecs whose token costs do not
+* depend on the match distance (LZ77, LZ11) are already optimally parsed at the
+* normal level and ignore it. COMPRESSION_AUTO compresses with the smallest of the
+* COMPRESSION_AUTO_MASK types (see CxCompressBest).
+*
+* Parameters:
+*	buffer					the buffer to compress
+*	size					size of the buffer
+*	compression				the compression type, optionally with a level
+*	compressedSize			pointer that receives the compressed size
+*
+* Returns:
+*	A pointer to the compressed buffer on success, or NULL on failure.
+*
+\******************************************************************************/
 unsigned char *CxCompress(const unsigned char *buffer, unsigned int size, int compression, unsigned int *compressedSize);
 
 
+/******************************************************************************\
+*
+* Compresses a buffer with each allowed compression type and returns the
+* smallest result. The codecs run concurrently, and a codec is skipped when a
+* lower bound on its output size can't beat a result that has already finished.
+* A codec is not interrupted once it has started, so the bound only skips the
+* codecs started after another has finished, when there are fewer processors
+* than codecs. Codecs that search with several threads of their own get an even
+* share of the processors among the workers still running codecs. Ties go to
+* the lowest compression type, so the result does not depend on the order
+* codecs finish in.
+*
+* Parameters:
+*	buffer					the buffer to compress
+*	size					size of the buffer
+*	allowedMask				COMPRESSION_MASK bits of the types to try
+*	pType					pointer that receives the chosen type (may be NULL)
+*	compressedSize			pointer that receives the compressed size
+*
+* Returns:
+*	A pointer to the compressed buffer on success, or NULL on failure.
+*
+\******************************************************************************/
+unsigned char *CxCompressBest(const unsigned char *buffer, unsigned int size, unsigned int allowedMask, int *pType, unsigned int *compressedSize);
+
+
 /******************************************************************************\
 *
 * Determines whether the input buffer contains valid compressed data.
@@ -137,3 +201,163 @@ int CxIsCompressed(const unsigned char *buffer, unsigned int size, int type);
 *
 \******************************************************************************/
 int CxGetCompressionType(const unsigned char *buffer, unsigned int size);
+
+
+/******************************************************************************\
+*
+* Identifies the type of compression on the data in a buffer and decompresses
+* it. The candidate types are first narrowed down by their headers, and the
+* data is then validated by decompressing it, so that it is only decompressed
+* once. The type returned is the same as CxGetCompressionType would return.
+*
+* Parameters:
+*	buffer					the buffer to decompress
+*	size					the size of the buffer
+*	pType					pointer that receives the compression type
+*	uncompressedSize		pointer that receives the uncompressed size
+*
+* Returns:
+*	A pointer to the decompressed data, or NULL if the buffer is not
+*	compressed. In that case, pType receives COMPRESSION_NONE. If the data
+*	is identified but cannot be decompressed, NULL is returned and pType
+*	receives the identified type.
+*
+\******************************************************************************/
+unsigned char *CxDecompressAuto(const unsigned char *buffer, unsigned int size, int *pType, unsigned int *uncompressedSize);
+
+
+//----- Match length kernels
+
+#define CX_MATCH_KERNEL_AUTO   0      // best kernel supported by the processor
+#define CX_MATCH_KERNEL_SCALAR 1      // portable, 4 bytes per step
+#define CX_MATCH_KERNEL_SSE2   2      // 16 bytes per step
+#define CX_MATCH_KERNEL_AVX2   3      // 32 bytes per step
+
+/******************************************************************************\
+*
+* Selects the kernel the LZ match finders use to measure match lengths. The
+* best supported kernel is selected by default, so this is only needed to
+* compare kernels. A kernel the processor does not support is replaced by the
+* best one it does. The kernel applies to searches started afterward; a
+* compression already running keeps the kernel it started with.
+*
+* Parameters:
+*	kernel					the kernel to select
+*
+* Returns:
+*	The kernel selected.
+*
+\******************************************************************************/
+int CxSetMatchKernel(int kernel);
+
+
+//----- Streaming decoder
+
+#define CX_DECODER_WINDOW_SIZE 0x1000 // output history kept for LZ references
+
+#define CX_DECODER_RUNNING     0      // the decoder accepts input and output space
+#define CX_DECODER_DONE        1      // all uncompressed data has been output
+#define CX_DECODER_ERROR     (-1)     // the stream is malformed or of the wrong type
+
+typedef struct CxDecoder_ {
+	int type;                         // compression type
+	int status;                       // decoder status
+	int headerRead;                   // the header has been consumed
+	unsigned int uncompSize;          // uncompressed size (once the header has been consumed)
+	unsigned int nWritten;            // number of bytes output so far
+
+	const unsigned char *src;         // current input chunk
+	unsigned int srcSize;             // size of the current input chunk
+	unsigned int srcPos;              // read position in the current input chunk
+	unsigned char stage[8];           // input staged across chunk boundaries
+	unsigned int nStaged;             // number of bytes staged
+
+	unsigned char flags;              // LZ token flags
+	unsigned char nFlags;             // number of LZ token flags remaining
+	unsigned char isRun;              // RLE: the pending chunk is a run
+	unsigned char runByte;            // RLE: byte of the pending run
+	unsigned int copyLength;          // bytes remaining in the pending LZ reference or RLE chunk
+	unsigned int copyDistance;        // distance of the pending LZ reference
+
+	unsigned int bits;                // Huffman: bit buffer
+	unsigned int nBits;               // Huffman: number of bits buffered
+	unsigned int treeSize;            // Huffman: size of the tree in bytes
+	unsigned int nTreeRead;           // Huffman: number of tree bytes read
+	unsigned int treePos;             // Huffman: current tree node offset
+	unsigned int symBits;             // Huffman: bits per symbol
+	unsigned int nPending;            // Huffman, Diff16: a partial output byte is pending
+	unsigned int last;                // Huffman: pending nibble, Diff: last value
+
+	unsigned char tree[0x200];        // Huffman tree
+	unsigned char window[CX_DECODER_WINDOW_SIZE]; // LZ output history
+} CxDecoder;
+
+
+/******************************************************************************\
+*
+* Initializes a streaming decoder. Streaming decoders accept the compressed
+* data in chunks and write the uncompressed data to buffers supplied by the
+* caller, without holding the whole input or output in memory. The supported
+* types are LZ77, LZ11, RLE, Huffman and the Diff filters.
+*
+* Parameters:
+*	decoder					the decoder to initialize
+*	type					the compression type
+*
+* Returns:
+*	1 if the compression type is supported, or 0 otherwise.
+*
+\******************************************************************************/
+int CxDecoderInit(CxDecoder *decoder, int type);
+
+
+/******************************************************************************\
+*
+* Supplies the next chunk of compressed data to a streaming decoder. The chunk
+* is not copied and must stay valid until it has been consumed. A previous
+* chunk is fully consumed when CxDecoderDrain writes fewer bytes than requested
+* while the decoder is still running.
+*
+* Parameters:
+*	decoder					the decoder
+*	src						the chunk of compressed data
+*	size					the size of the chunk
+*
+\******************************************************************************/
+void CxDecoderFeed(CxDecoder *decoder, const unsigned char *src, unsigned int size);
+
+
+/******************************************************************************\
+*
+* Decodes as much of the input supplied so far as fits in the output buffer.
+* The header is consumed on the first call, after which the uncompressed size
+* is available in the decoder's uncompSize field. A size of 0 may be passed to
+* only consume the header. Bytes of the output buffer past the number returned
+* are not modified, so no padding is needed after the destination.
+*
+* Parameters:
+*	decoder					the decoder
+*	dest					the output buffer
+*	size					the size of the output buffer
+*
+* Returns:
+*	The number of bytes written to the output buffer.
+*
+\******************************************************************************/
+unsigned int CxDecoderDrain(CxDecoder *decoder, unsigned char *dest, unsigned int size);
+
+
+/******************************************************************************\
+*
+* Finishes decoding with a streaming decoder.
+*
+* Parameters:
+*	decoder					the decoder
+*	uncompressedSize		pointer that receives the number of bytes output
+*							(optional)
+*
+* Returns:
+*	1 if the whole stream was decoded, or 0 if it was truncated or malformed.
+*
+\******************************************************************************/
+int CxDecoderFinish(CxDecoder *decoder, unsigned int *uncompressedSize);
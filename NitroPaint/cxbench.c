@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "cxbench.h"
+#include "compression.h"
+#include "thread.h"
+
+#ifdef _WIN32
+#define PSAPI_VERSION 1
+#include <Windows.h>
+#include <Psapi.h>
+#include "io.h"
+#pragma comment(lib, "psapi.lib")
+#else
+#include <malloc.h>
+#endif
+
+
+static const char *const sCxBenchCodecNames[] = {
+	"None", "LZ77", "LZ11", "LZ11 COMP", "Huffman 4", "Huffman 8", "RLE", "Diff 8", "Diff 16",
+	"LZ77 Header", "MvDK", "VLX", "ASH", "PuCrunch"
+};
+
+static int CxiBenchGetMemoryUsage(size_t *pUsage) {
+	//returns 0 if memory use can't be measured
+#ifdef _WIN32
+	//committed private memory of the process
+	PROCESS_MEMORY_COUNTERS_EX counters = { 0 };
+	counters.cb = sizeof(counters);
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS *) &counters, sizeof(counters))) return 0;
+	*pUsage = counters.PrivateUsage;
+	return 1;
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	//bytes allocated from the heap
+	struct mallinfo2 info = mallinfo2();
+	*pUsage = info.uordblks + info.hblkhd;
+	return 1;
+#else
+	(void) pUsage;
+	return 0;
+#endif
+}
+
+
+typedef struct CxiBenchMemoryWork_ {
+	const unsigned char *buffer;
+	unsigned int size;
+	int type;
+	volatile long done;
+	size_t base;
+	size_t peak;                  // written by the sampling worker, read after the workers finish
+} CxiBenchMemoryWork;
+
+static void CxiBenchMemoryWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) nWorkers;
+
+	CxiBenchMemoryWork *work = (CxiBenchMemoryWork *) param;
+
+	if (iWorker == 0) {
+		//run the codec once
+		unsigned int compSize, uncompSize;
+		unsigned char *comp = CxCompress(work->buffer, work->size, work->type, &compSize);
+		if (comp != NULL) {
+			free(CxDecompress(comp, compSize, work->type, &uncompSize));
+			free(comp);
+		}
+		ThAtomicStore(&work->done, 1);
+	} else {
+		//sample memory use until the codec finishes
+		size_t peak = work->base;
+		while (!ThAtomicLoad(&work->done)) {
+			size_t usage;
+			if (CxiBenchGetMemoryUsage(&usage) && usage > peak) peak = usage;
+			ThYield();
+		}
+		work->peak = peak;
+	}
+}
+
+static int CxiBenchMeasureMemory(const unsigned char *buffer, unsigned int size, int type, size_t *pPeak) {
+	CxiBenchMemoryWork work = { 0 };
+	work.buffer = buffer;
+	work.size = size;
+	work.type = type;
+	if (!CxiBenchGetMemoryUsage(&work.base)) return 0;
+	work.peak = work.base;
+
+	//memory use is sampled on a second worker, separately from the timed runs. If the sampling
+	//thread can't be started, the measurement is unavailable.
+	if (ThRunWorkers(CxiBenchMemoryWorker, &work, 2) < 2) return 0;
+	*pPeak = work.peak - work.base;
+	return 1;
+}
+
+void CxBenchRunCodec(const unsigned char *buffer, unsigned int size, int type, CxBenchResult *result) {
+	memset(result, 0, sizeof(*result));
+	result->type = type;
+	result->size = size;
+
+	//time compression, repeating short runs
+	unsigned int compSize = 0;
+	unsigned char *comp = NULL;
+	unsigned int nRuns = 0;
+	double start = ThGetTime(), elapsed;
+	do {
+		free(comp);
+		comp = CxCompress(buffer, size, type, &compSize);
+		nRuns++;
+		elapsed = ThGetTime() - start;
+	} while (comp != NULL && elapsed < CX_BENCH_MIN_TIME);
+
+	if (comp == NULL) return;
+	result->compressedSize = compSize;
+	result->compressTime = elapsed / nRuns;
+
+	//time decompression
+	unsigned int uncompSize = 0;
+	unsigned char *uncomp = NULL;
+	nRuns = 0;
+	start = ThGetTime();
+	do {
+		free(uncomp);
+		uncomp = CxDecompress(comp, compSize, type, &uncompSize);
+		nRuns++;
+		elapsed = ThGetTime() - start;
+	} while (uncomp != NULL && elapsed < CX_BENCH_MIN_TIME);
+	result->decompressTime = elapsed / nRuns;
+
+	//check round trip
+	result->roundTrip = uncomp != NULL && uncompSize == size && memcmp(uncomp, buffer, size) == 0;
+	free(uncomp);
+	free(comp);
+
+	result->peakMemoryMeasured = CxiBenchMeasureMemory(buffer, size, type, &result->peakMemory);
+}
+
+
+static double CxiBenchThroughput(unsigned int size, double time) {
+	//megabytes of uncompressed data per second
+	if (time <= 0.0) return 0.0;
+	return size / time / 1000000.0;
+}
+
+static void CxiBenchWriteJsonString(FILE *fp, const char *str) {
+	fputc('\"', fp);
+	for (; *str; str++) {
+		unsigned char c = (unsigned char) *str;
+		if (c == '\"' || c == '\\') {
+			fprintf(fp, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(fp, "\\u%04x", c);
+		} else {
+			fputc(c, fp);
+		}
+	}
+	fputc('\"', fp);
+}
+
+void CxBenchWriteHeader(FILE *fp, int json) {
+	if (json) {
+		fprintf(fp, "[\n");
+	} else {
+		fprintf(fp, "file,codec,size,compressed_size,ratio,compress_mbps,decompress_mbps,peak_memory,round_trip\n");
+	}
+}
+
+void CxBenchWriteResult(FILE *fp, int json, int index, const char *name, const CxBenchResult *result) {
+	double ratio = result->size ? ((double) result->compressedSize / result->size) : 0.0;
+	double compRate = CxiBenchThroughput(result->size, result->compressTime);
+	double decompRate = CxiBenchThroughput(result->size, result->decompressTime);
+	const char *codec = sCxBenchCodecNames[result->type];
+
+	//peak memory is left empty (CSV) or null (JSON) when it wasn't measured
+	char peakMemory[16] = "";
+	if (result->peakMemoryMeasured) sprintf(peakMemory, "%u", (unsigned int) result->peakMemory);
+
+	if (json) {
+		if (index > 0) fprintf(fp, ",\n");
+		fprintf(fp, "\t{ \"file\": ");
+		CxiBenchWriteJsonString(fp, name);
+		fprintf(fp, ", \"codec\": \"%s\", \"size\": %u, \"compressed_size\": %u, \"ratio\": %.4f, "
+			"\"compress_mbps\": %.3f, \"decompress_mbps\": %.3f, \"peak_memory\": %s, \"round_trip\": %s }",
+			codec, result->size, result->compressedSize, ratio, compRate, decompRate,
+			result->peakMemoryMeasured ? peakMemory : "null", result->roundTrip ? "true" : "false");
+	} else {
+		//quote the file name
+		fputc('\"', fp);
+		for (; *name; name++) {
+			if (*name == '\"') fputc('\"', fp);
+			fputc(*name, fp);
+		}
+		fprintf(fp, "\",%s,%u,%u,%.4f,%.3f,%.3f,%s,%d\n", codec, result->size, result->compressedSize, ratio,
+			compRate, decompRate, peakMemory, result->roundTrip);
+	}
+}
+
+void CxBenchWriteFooter(FILE *fp, int json) {
+	if (json) fprintf(fp, "\n]\n");
+}
+
+
+//LZ family codecs, which spend most of their time measuring matches
+static const int sCxiBenchLzCodecs[] = {
+	COMPRESSION_LZ77, COMPRESSION_LZ11, COMPRESSION_LZ11_COMP_HEADER, COMPRESSION_LZ77_HEADER,
+	COMPRESSION_MVDK, COMPRESSION_ASH, COMPRESSION_PUCRUNCH
+};
+
+static const char *const sCxiBenchKernelNames[] = { "auto", "scalar", "sse2", "avx2" };
+
+static unsigned char *CxiBenchMakeTileData(unsigned int *pSize) {
+	//4bpp graphics built from runs of a few distinct tiles, like the background of a map
+	unsigned int nTiles = CX_BENCH_TILE_COUNT;
+	unsigned char *data = (unsigned char *) malloc(nTiles * 0x20);
+
+	unsigned char baseTiles[8][0x20];
+	uint32_t seed = 0x12345678;
+	for (unsigned int i = 0; i < 8; i++) {
+		for (unsigned int j = 0; j < 0x20; j++) {
+			seed = seed * 1103515245 + 12345;
+			baseTiles[i][j] = (unsigned char) (seed >> 16);
+		}
+	}
+
+	unsigned int i = 0;
+	while (i < nTiles) {
+		seed = seed * 1103515245 + 12345;
+		unsigned int tile = (seed >> 16) & 7, runLength = 1 + ((seed >> 20) & 0x1F);
+		for (unsigned int j = 0; j < runLength && i < nTiles; j++, i++) {
+			memcpy(data + i * 0x20, baseTiles[tile], 0x20);
+		}
+	}
+
+	*pSize = nTiles * 0x20;
+	return data;
+}
+
+int CxBenchRunMatchKernels(FILE *fp, int json) {
+	unsigned int size;
+	unsigned char *buffer = CxiBenchMakeTileData(&size);
+
+	CxBenchWriteHeader(fp, json);
+
+	int status = 0, index = 0;
+	for (int kernel = CX_MATCH_KERNEL_SCALAR; kernel <= CX_MATCH_KERNEL_AVX2; kernel++) {
+		//skip kernels the processor doesn't support
+		if (CxSetMatchKernel(kernel) != kernel) continue;
+
+		char name[32];
+		sprintf(name, "tiles (%s)", sCxiBenchKernelNames[kernel]);
+		for (unsigned int i = 0; i < sizeof(sCxiBenchLzCodecs) / sizeof(sCxiBenchLzCodecs[0]); i++) {
+			CxBenchResult result;
+			CxBenchRunCodec(buffer, size, sCxiBenchLzCodecs[i], &result);
+			CxBenchWriteResult(fp, json, index++, name, &result);
+			if (!result.roundTrip) status = 1;
+		}
+	}
+	CxSetMatchKernel(CX_MATCH_KERNEL_AUTO);
+
+	CxBenchWriteFooter(fp, json);
+	free(buffer);
+	return status;
+}
+
+
+
+#ifdef _WIN32
+
+FILE *CxBenchOpenOutput(const wchar_t *outPath, int *pJson) {
+	//write JSON for a .json path
+	unsigned int outPathLen = wcslen(outPath);
+	*pJson = outPathLen >= 5 && _wcsicmp(outPath + outPathLen - 5, L".json") == 0;
+	return _wfopen(outPath, L"w");
+}
+
+int CxBenchRunCorpus(const wchar_t *dir, const wchar_t *outPath) {
+	int json;
+	FILE *fp = CxBenchOpenOutput(outPath, &json);
+	if (fp == NULL) return 1;
+
+	CxBenchWriteHeader(fp, json);
+
+	//enumerate files in the directory
+	unsigned int dirLen = wcslen(dir);
+	wchar_t *pattern = (wchar_t *) calloc(dirLen + 3, sizeof(wchar_t));
+	memcpy(pattern, dir, dirLen * sizeof(wchar_t));
+	memcpy(pattern + dirLen, L"\\*", 3 * sizeof(wchar_t));
+
+	WIN32_FIND_DATAW findData;
+	HANDLE hFind = FindFirstFileW(pattern, &findData);
+	free(pattern);
+
+	int status = 0, index = 0;
+	if (hFind == INVALID_HANDLE_VALUE) status = 1;
+
+	while (hFind != INVALID_HANDLE_VALUE) {
+		if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+			unsigned int nameLen = wcslen(findData.cFileName);
+			wchar_t *path = (wchar_t *) calloc(dirLen + nameLen + 2, sizeof(wchar_t));
+			memcpy(path, dir, dirLen * sizeof(wchar_t));
+			path[dirLen] = L'\\';
+			memcpy(path + dirLen + 1, findData.cFileName, nameLen * sizeof(wchar_t));
+
+			unsigned int size;
+			unsigned char *buffer = (unsigned char *) IoReadWholeFile(path, &size);
+			free(path);
+
+			char name[MAX_PATH * 3];
+			WideCharToMultiByte(CP_UTF8, 0, findData.cFileName, -1, name, sizeof(name), NULL, NULL);
+
+			if (buffer == NULL) {
+				status = 1;
+			} else {
+				//run every codec
+				for (int type = COMPRESSION_NONE + 1; type < COMPRESSION_MAX; type++) {
+					CxBenchResult result;
+					CxBenchRunCodec(buffer, size, type, &result);
+					CxBenchWriteResult(fp, json, index++, name, &result);
+					if (!result.roundTrip) status = 1;
+				}
+				free(buffer);
+			}
+		}
+
+		if (!FindNextFileW(hFind, &findData)) {
+			FindClose(hFind);
+			hFind = INVALID_HANDLE_VALUE;
+		}
+	}
+
+	CxBenchWriteFooter(fp, json);
+	fclose(fp);
+	return status;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdio.h>
+
+//
+// Headless benchmark of the compression codecs. Each codec is run over a buffer to measure its
+// compression ratio, compression and decompression throughput, peak memory use, and whether the
+// data survives a round trip. Results are written as CSV or JSON so that they can be compared
+// from run to run.
+//
+
+#define CX_BENCH_MIN_TIME   0.25  // minimum time (seconds) spent timing each operation
+#define CX_BENCH_TILE_COUNT 2048  // number of tiles in the match kernel benchmark input
+
+
+typedef struct CxBenchResult_ {
+	int type;                     // compression type
+	unsigned int size;            // uncompressed size
+	unsigned int compressedSize;  // compressed size, or 0 if compression failed
+	double compressTime;          // seconds per compression
+	double decompressTime;        // seconds per decompression
+	size_t peakMemory;            // approximate peak memory growth while compressing and decompressing
+	int peakMemoryMeasured;       // peakMemory could be measured
+	int roundTrip;                // decompressed data matched the input
+} CxBenchResult;
+
+
+//
+// Benchmarks one codec on a buffer.
+//
+void CxBenchRunCodec(const unsigned char *buffer, unsigned int size, int type, CxBenchResult *result);
+
+//
+// Writes the benchmark results in CSV or JSON format. The header is written first, then each
+// result, then the footer. The name identifies the input and is UTF-8.
+//
+void CxBenchWriteHeader(FILE *fp, int json);
+void CxBenchWriteResult(FILE *fp, int json, int index, const char *name, const CxBenchResult *result);
+void CxBenchWriteFooter(FILE *fp, int json);
+
+//
+// Benchmarks the LZ family codecs with each match length kernel the processor supports, on
+// generated tile data made of long runs of repeated tiles. The input name of each result notes
+// the kernel. Returns 0 on success, or 1 if a codec failed its round trip.
+//
+int CxBenchRunMatchKernels(FILE *fp, int json);
+
+#ifdef _WIN32
+
+//
+// Opens a benchmark output file. JSON is to be written when the path ends in .json, and CSV
+// otherwise.
+//
+FILE *CxBenchOpenOutput(const wchar_t *outPath, int *pJson);
+
+//
+// Benchmarks every codec over each file in a directory and writes the results to a file. JSON
+// is written when the output path ends in .json, and CSV otherwise. Returns 0 on success, or 1
+// if the files could not be read or written or a codec failed its round trip.
+//
+int CxBenchRunCorpus(const wchar_t *dir, const wchar_t *outPath);
+
+#endif
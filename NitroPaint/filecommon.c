@@ -625,12 +625,17 @@ static int ObjiGuessPltChrScr(const unsigned char *ptr, unsigned int size) {
 	return FILE_TYPE_CHAR;
 }
 
-int ObjIdentify(unsigned char *file, unsigned int size, const wchar_t *path, int knownType, int *pCompression, int *pFormat) {
+int ObjIdentifyDecompress(unsigned char *file, unsigned int size, const wchar_t *path, int knownType, int *pCompression, int *pFormat, unsigned char **ppUncompressed, unsigned int *pUncompressedSize) {
 	unsigned char *buffer = file;
 	unsigned int bufferSize = size;
-	int compression = CxGetCompressionType(file, size);
-	if (compression != COMPRESSION_NONE) {
-		buffer = CxDecompress(file, size, compression, &bufferSize);
+	int compression;
+	unsigned char *uncomp = CxDecompressAuto(file, size, &compression, &bufferSize);
+	if (uncomp != NULL) {
+		buffer = uncomp;
+	} else {
+		//not compressed, or failed to decompress: identify the raw data
+		bufferSize = size;
+		compression = COMPRESSION_NONE;
 	}
 
 	int type = FILE_TYPE_INVALID;
@@ -685,24 +690,42 @@ int ObjIdentify(unsigned char *file, unsigned int size, const wchar_t *path, int
 	if (pCompression != NULL) *pCompression = compression;
 	if (pFormat != NULL) *pFormat = format;
 
-	if (buffer != file) {
-		free(buffer);
+	if (ppUncompressed != NULL) {
+		//pass ownership of the decompressed buffer to the caller
+		*ppUncompressed = uncomp;
+		if (pUncompressedSize != NULL) *pUncompressedSize = bufferSize;
+	} else {
+		free(uncomp);
 	}
 	return type;
 }
 
+int ObjIdentify(unsigned char *file, unsigned int size, const wchar_t *path, int knownType, int *pCompression, int *pFormat) {
+	return ObjIdentifyDecompress(file, size, path, knownType, pCompression, pFormat, NULL, NULL);
+}
+
 ObjHeader *ObjAutoReadFile(const wchar_t *path, int type) {
 	unsigned int size;
 	void *buf = IoReadWholeFile(path, &size);
 
 	int compression, format;
-	if (ObjIdentify(buf, size, path, type, &compression, &format) != type) {
+	unsigned char *uncomp;
+	unsigned int uncompSize;
+	if (ObjIdentifyDecompress(buf, size, path, type, &compression, &format, &uncomp, &uncompSize) != type) {
+		free(uncomp);
 		free(buf);
 		return NULL;
 	}
 
+	//read from the buffer decompressed during identification
 	ObjHeader *obj = NULL;
-	int status = ObjReadBuffer(&obj, buf, size, type, format, compression);
+	int status;
+	if (uncomp != NULL) {
+		status = ObjReadUncompressedBuffer(&obj, uncomp, uncompSize, type, format, compression);
+		free(uncomp);
+	} else {
+		status = ObjReadUncompressedBuffer(&obj, buf, size, type, format, compression);
+	}
 	free(buf);
 
 	if (!OBJ_SUCCEEDED(status)) {
@@ -730,13 +753,7 @@ unsigned short ObjComputeCrc16(const unsigned char *data, int length, unsigned s
 }
 
 
-int ObjReadBuffer(ObjHeader **ppObject, const unsigned char *buffer, unsigned int size, int type, int format, int compression) {
-	//check compression
-	if (!CxIsCompressed(buffer, size, compression)) {
-		*ppObject = NULL;
-		return OBJ_STATUS_INVALID;
-	}
-
+int ObjReadUncompressedBuffer(ObjHeader **ppObject, const unsigned char *buffer, unsigned int size, int type, int format, int compression) {
 	//get the type entry
 	ObjTypeEntry ent;
 	StMapGet(&sObjRegisteredTypes, &type, &ent);
@@ -745,22 +762,17 @@ int ObjReadBuffer(ObjHeader **ppObject, const unsigned char *buffer, unsigned in
 	ObjIdEntry fmtEntry;
 	ObjGetFormat(&fmtEntry, type, format);
 
-	//uncompress
-	unsigned int uncompSize;
-	unsigned char *uncomp = CxDecompress(buffer, size, compression, &uncompSize);
-
 	//allocate
 	ObjHeader *object = ObjAlloc(type, format);
 	if (object == NULL) {
-		free(uncomp);
+		*ppObject = NULL;
 		return OBJ_STATUS_NO_MEMORY;
 	}
 
 	object->compression = compression;
 
 	//read buffer
-	int status = fmtEntry.reader(object, (char *) uncomp, (int) uncompSize);
-	free(uncomp);
+	int status = fmtEntry.reader(object, (char *) buffer, (int) size);
 
 	if (!OBJ_SUCCEEDED(status)) {
 		//read failed
@@ -773,6 +785,26 @@ int ObjReadBuffer(ObjHeader **ppObject, const unsigned char *buffer, unsigned in
 	return OBJ_STATUS_SUCCESS;
 }
 
+int ObjReadBuffer(ObjHeader **ppObject, const unsigned char *buffer, unsigned int size, int type, int format, int compression) {
+	//check compression
+	if (!CxIsCompressed(buffer, size, compression)) {
+		*ppObject = NULL;
+		return OBJ_STATUS_INVALID;
+	}
+
+	//uncompress
+	unsigned int uncompSize;
+	unsigned char *uncomp = CxDecompress(buffer, size, compression, &uncompSize);
+	if (uncomp == NULL) {
+		*ppObject = NULL;
+		return OBJ_STATUS_NO_MEMORY;
+	}
+
+	int status = ObjReadUncompressedBuffer(ppObject, uncomp, uncompSize, type, format, compression);
+	free(uncomp);
+	return status;
+}
+
 int ObjReadFile(ObjHeader **ppObject, const wchar_t *name, int type, int format, int compression) {
 	unsigned int size;
 	void *buffer;
@@ -789,13 +821,14 @@ int ObjReadFile(ObjHeader **ppObject, const wchar_t *name, int type, int format,
 	ObjIdEntry fmtEntry;
 	ObjGetFormat(&fmtEntry, type, format);
 
-	int status;
-	int compType = CxGetCompressionType(buffer, size);
-	if (compType == COMPRESSION_NONE) {
+	int status, compType;
+	unsigned int decompressedSize;
+	void *decompressed = CxDecompressAuto(buffer, size, &compType, &decompressedSize);
+	if (decompressed == NULL) {
+		//not compressed, or failed to decompress: read the raw data
+		compType = COMPRESSION_NONE;
 		status = fmtEntry.reader(object, buffer, size);
 	} else {
-		unsigned int decompressedSize;
-		void *decompressed = CxDecompress(buffer, size, compType, &decompressedSize);
 		status = fmtEntry.reader(object, decompressed, decompressedSize);
 		free(decompressed);
 	}
@@ -847,6 +880,26 @@ int ObjWriteFile(ObjHeader *object, const wchar_t *name) {
 	return ioStatus ? (ioStatus + OBJ_STATUS_SYSERROR_START) : OBJ_STATUS_SUCCESS;
 }
 
+int ObjGetBestCompression(ObjHeader *object, unsigned int allowedMask) {
+	BSTREAM stream;
+	bstreamCreate(&stream, NULL, 0);
+	int status = ObjWrite(object, &stream);
+	if (!OBJ_SUCCEEDED(status)) {
+		bstreamFree(&stream);
+		return COMPRESSION_NONE;
+	}
+
+	unsigned int size;
+	unsigned char *buf = bstreamToByteArray(&stream, &size);
+
+	int type;
+	unsigned int compSize;
+	unsigned char *comp = CxCompressBest(buf, size, allowedMask, &type, &compSize);
+	free(comp);
+	free(buf);
+	return type;
+}
+
 void ObjLinkObjects(ObjHeader *to, ObjHeader *from) {
 	//if the from object is already linking an object, unlink it
 	if (from->link.to != NULL) {
@@ -255,6 +255,38 @@ int ObjIdentify(
 	int           *pFormat
 );
 
+// -----------------------------------------------------------------------------------------------
+// Name: ObjIdentifyDecompress
+//
+// Identify the type, format, and compression of a sequence of bytes, as with ObjIdentify. The
+// buffer decompressed during identification is returned to the caller, so that the object can be
+// read without decompressing the buffer again.
+//
+// Parameters:
+//   buffer             The input byte buffer
+//   size               The size of the input buffer
+//   path               The file path (if it exists)
+//   knownType          The type of object (optional)
+//   pCompression       The pointer to the validated compression format (optional)
+//   pFormat            The pointer to the validated format (optional)
+//   ppUncompressed     The pointer to receive the decompressed buffer, or NULL if the input is
+//                      not compressed. The caller must free this buffer. (optional)
+//   pUncompressedSize  The pointer to receive the size of the decompressed buffer (optional)
+//
+// Returns:
+//   The type ID of the format that validated the buffer, or FILE_TYPE_INVALID if none.
+// -----------------------------------------------------------------------------------------------
+int ObjIdentifyDecompress(
+	unsigned char  *buffer,
+	unsigned int    size,
+	const wchar_t  *path,
+	int             knownType,
+	int            *pCompression,
+	int            *pFormat,
+	unsigned char **ppUncompressed,
+	unsigned int   *pUncompressedSize
+);
+
 // -----------------------------------------------------------------------------------------------
 // Name: ObjIdentifyMultipleByType
 //
@@ -325,6 +357,32 @@ int ObjIdentifyEx(
 	int                 *pFormat
 );
 
+// -----------------------------------------------------------------------------------------------
+// Name: ObjReadUncompressedBuffer
+//
+// Reads an object from a byte buffer that has already been decompressed. The compression format
+// is recorded on the object.
+//
+// Parameters:
+//   ppObject      The pointer to receive the allocated object
+//   buffer        The decompressed byte buffer
+//   size          The size of the decompressed buffer
+//   type          The object type
+//   format        The file format
+//   compression   The compression format of the source data
+//
+// Returns:
+//   The status of the operation.
+// -----------------------------------------------------------------------------------------------
+int ObjReadUncompressedBuffer(
+	ObjHeader          **ppObject,
+	const unsigned char *buffer,
+	unsigned int         size,
+	int                  type,
+	int                  format,
+	int                  compression
+);
+
 // -----------------------------------------------------------------------------------------------
 // Name: ObjReadBuffer
 //
@@ -424,6 +482,23 @@ int ObjWriteFile(
 	const wchar_t *path
 );
 
+// -----------------------------------------------------------------------------------------------
+// Name: ObjGetBestCompression
+//
+// Writes an object and finds the compression type that compresses it smallest.
+//
+// Parameters:
+//   object        The object
+//   allowedMask   COMPRESSION_MASK bits of the types to try
+//
+// Returns:
+//   The compression type, or COMPRESSION_NONE if the object could not be written.
+// -----------------------------------------------------------------------------------------------
+int ObjGetBestCompression(
+	ObjHeader    *object,
+	unsigned int  allowedMask
+);
+
 
 
 
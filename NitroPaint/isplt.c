@@ -30,6 +30,7 @@
 
 #include "color.h"
 #include "palette.h"
+#include "thread.h"
 
 //optimize for speed rather than size
 #ifndef _DEBUG
@@ -57,6 +58,9 @@
 
 #define RX_LARGE_NUMBER             1e32 // constant to represent large color difference
 #define RX_SLAB_SIZE            0x100000 // slab size of allocator
+#define RX_ACCEL_LEAF_SIZE             8 // maximum number of colors in a leaf of the palette accelerator
+#define RX_VORONOI_CHUNK_MIN        8192 // minimum number of histogram entries per reclustering work chunk
+#define RX_VORONOI_CHUNK_MAX          32 // maximum number of reclustering work chunks
 #define INV_512    0.0019531250000000000 // 1.0/512.0
 #define INV_511    0.0019569471624266144 // 1.0/511.0
 #define INV_255    0.0039215686274509800 // 1.0/255.0
@@ -79,14 +83,15 @@ typedef struct RxPaletteMapEntry_ {
 } RxiPaletteMapEntry;
 
 typedef struct RxPaletteAccelNode_ {
-	struct RxPaletteAccelNode_ *pLeft;    // left pointer
-	struct RxPaletteAccelNode_ *pRight;   // right pointer
-	struct RxPaletteAccelNode_ *parent;   // parent node
-	RxiPaletteMapEntry *mid;               // mid color
+	struct RxPaletteAccelNode_ *pLeft;    // left pointer (NULL for leaves)
+	struct RxPaletteAccelNode_ *pRight;   // right pointer (NULL for leaves)
 	double splitVal;                      // value of split
+	double splitWeight;                   // weight of the split channel
 	unsigned int nCol;                    // number of colors this node
 	unsigned int start;                   // start index of color
 	unsigned int splitDir;                // split direction (Y,I,Q,A)
+	unsigned int slot;                    // leaves: first slot of the leaf's colors
+	unsigned int nSlots;                  // leaves: number of slots (colors padded to a multiple of 4)
 } RxiPaletteAccelNode;
 
 struct RxPalette_ {
@@ -94,18 +99,33 @@ struct RxPalette_ {
 	RxiPaletteAccelNode root;                          // the root node of the accelerator
 	RxiPaletteMapEntry *pltt;                          // palette mapping entries used by the accelerator
 	RxiPaletteAccelNode *nodebuf;                      // accelerator working memory
+	float *leafColors;                                // leaf colors, each channel of a leaf stored contiguously
+	unsigned int *leafIndices;                        // palette indices of the leaf colors
 
 	RxYiqColor plttSmall[16 * RX_PALETTE_MAX_COUNT];  // palette buffer used for small palettes
 	RxYiqColor *plttLarge;                            // pointer to palette buffer (heap allocated or pointer to small)
 	unsigned int nPltt;                               // number of palette colors loaded
 	RxAlphaMode alphaMode;                            // alpha processing mode used by the accelerator
+
+	unsigned short *cache;                            // RGB555 nearest-index cache (built on demand)
+	unsigned int nLookups;                            // number of RGB555 lookups made before the cache was built
+	double cacheWeights[4];                           // color weights the cache entries were computed with
 };
 
+#define RX_CONVERT_BATCH_SIZE             64 // number of pixels converted to YIQ at a time
+#define RX_PALETTE_CACHE_SIZE         0x8000 // number of entries in the RGB555 lookup cache
+#define RX_PALETTE_CACHE_EMPTY        0xFFFF // marks an unfilled lookup cache entry
+#define RX_PALETTE_CACHE_BLOCK          1024 // number of lookup cache entries filled by a worker at a time
+#define RX_PALETTE_CACHE_MIN_LOOKUPS    1024 // number of lookups on a palette before its cache is built
+
 
 static unsigned int RxiPaletteFindClosestColorOnAccel(RxReduction *reduction, RxPalette *accel, const RxYiqColor *color, double *outDiff);
+static unsigned int RxiPaletteFindClosestColorOnAccelEx(RxReduction *reduction, RxPalette *accel, const RxYiqColor *color, RxYiqColor *cpy, double *outDiff);
 static int RxiPaletteFindClosestColor(RxReduction *reduction, const RxYiqColor *palette, unsigned int nColors, const RxYiqColor *col, double *outDiff);
 static RxPalette *RxiPaletteAllocAndLoadYiqInternal(RxReduction *reduction, const RxYiqColor *pltt, unsigned int srcPitch, unsigned int nColors, RxAlphaMode alphaMode);
 static RxStatus RxiPaletteLoadYiq(RxReduction *reduction, const RxYiqColor *pltt, unsigned int srcPitch, unsigned int nColors, RxBool overrideMode);
+static unsigned int RxiPaletteLookupColor(RxReduction *reduction, RxPalette *accel, COLOR32 color, RxYiqColor *scratch);
+static RxStatus RxiPalettePrepareCache(RxReduction *reduction, RxPalette *accel);
 static void RxiPaletteFree(RxPalette *palette);
 
 
@@ -189,6 +209,44 @@ void RX_API RxConvertRgbToYiq(COLOR32 rgb, RxYiqColor *yiq) {
 #endif
 }
 
+void RX_API RxConvertRowToYiq(const COLOR32 *rgb, RxYiqColor *yiq, unsigned int nPx, unsigned int yiqPitch) {
+	unsigned int i = 0;
+
+#ifdef RX_SIMD
+	//convert 4 colors at a time with each channel in its own vector. The operations are the same as in
+	//RxConvertRgbToYiq, so the results are identical.
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	for (; (i + 4) <= nPx; i += 4) {
+		__m128i px = _mm_loadu_si128((const __m128i *) (rgb + i));
+		__m128 r = _mm_cvtepi32_ps(_mm_and_si128(px, mask));
+		__m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask));
+		__m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask));
+		__m128 a = _mm_div_ps(_mm_cvtepi32_ps(_mm_srli_epi32(px, 24)), _mm_set1_ps(255.0f));
+
+		//matrix transform
+		__m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps( 0.5146329f)), _mm_mul_ps(g, _mm_set1_ps( 1.2303905f))), _mm_mul_ps(b, _mm_set1_ps(0.2588982f)));
+		__m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(-0.5885085f)), _mm_mul_ps(g, _mm_set1_ps(-0.3060195f))), _mm_mul_ps(b, _mm_set1_ps(0.8945280f)));
+		__m128 q = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps( 0.7227111f)), _mm_mul_ps(g, _mm_set1_ps(-1.3898515f))), _mm_mul_ps(b, _mm_set1_ps(0.6671403f)));
+
+		//alpha premultiplication
+		y = _mm_mul_ps(y, a);
+		c = _mm_mul_ps(c, a);
+		q = _mm_mul_ps(q, a);
+
+		//back to one color per vector
+		_MM_TRANSPOSE4_PS(y, c, q, a);
+		yiq[(i + 0) * yiqPitch].yiq = y;
+		yiq[(i + 1) * yiqPitch].yiq = c;
+		yiq[(i + 2) * yiqPitch].yiq = q;
+		yiq[(i + 3) * yiqPitch].yiq = a;
+	}
+#endif
+
+	for (; i < nPx; i++) {
+		RxConvertRgbToYiq(rgb[i], &yiq[i * yiqPitch]);
+	}
+}
+
 COLOR32 RX_API RxConvertYiqToRgb(const RxYiqColor *yiq) {
 	//scalar and SIMD versions
 #ifndef RX_SIMD
@@ -708,6 +766,10 @@ RxReduction *RX_API RxNew(const RxBalanceSetting *balance) {
 	return reduction;
 }
 
+void RX_API RxSetThreadCount(RxReduction *reduction, unsigned int nThreads) {
+	reduction->nThreads = nThreads;
+}
+
 void RX_API RxApplyFlags(RxReduction *reduction, RxFlag flag) {
 	//set alpha mode
 	switch (flag & RX_FLAG_ALPHA_MODE_MASK) {
@@ -726,12 +788,54 @@ void RX_API RxSetProgressCallback(RxReduction *reduction, RxProgressCallback cal
 	reduction->progressCallbackData = userData;
 }
 
+void RX_API RxSetPaletteCallback(RxReduction *reduction, RxPaletteCallback callback, void *userData) {
+	reduction->paletteCallback = callback;
+	reduction->paletteCallbackData = userData;
+}
+
+RxStatus RX_API RxEnableStats(RxReduction *reduction, RxBool enable) {
+	if (!enable) {
+		free(reduction->stats);
+		reduction->stats = NULL;
+		return RX_STATUS_OK;
+	}
+
+	if (reduction->stats == NULL) {
+		reduction->stats = (RxStats *) malloc(sizeof(RxStats));
+		if (reduction->stats == NULL) return RX_STATUS_NOMEM;
+	}
+	memset(reduction->stats, 0, sizeof(RxStats));
+	return RX_STATUS_OK;
+}
+
+RxStatus RX_API RxGetStats(RxReduction *reduction, RxStats *stats) {
+	if (reduction->stats == NULL) return RX_STATUS_INCORRECT_STATE;
+
+	memcpy(stats, reduction->stats, sizeof(RxStats));
+	stats->nHistogramEntries = (reduction->histogram != NULL) ? reduction->histogram->nEntries : 0;
+	return RX_STATUS_OK;
+}
+
+static double RxiStatsGetTime(RxReduction *reduction) {
+	//the clock is only read when counters are enabled.
+	return (reduction->stats != NULL) ? ThGetTime() : 0.0;
+}
+
 static void RxiUpdateProgress(RxReduction *reduction, unsigned int progress, unsigned int progressMax) {
 	if (reduction->progressCallback != NULL) {
 		reduction->progressCallback(reduction, progress, progressMax, reduction->progressCallbackData);
 	}
 }
 
+static unsigned int RxiGetThreadCount(RxReduction *reduction, unsigned int nTasks) {
+	unsigned int nThreads = reduction->nThreads;
+	if (nThreads == 0) nThreads = ThGetProcessorCount();
+	if (nThreads > TH_MAX_WORKERS) nThreads = TH_MAX_WORKERS;
+	if (nThreads > nTasks) nThreads = nTasks;
+	if (nThreads < 1) nThreads = 1;
+	return nThreads;
+}
+
 int RxColorLightnessComparator(const void *d1, const void *d2) {
 	COLOR32 c1 = *(COLOR32 *) d1;
 	COLOR32 c2 = *(COLOR32 *) d2;
@@ -792,6 +896,13 @@ static void *RxiSlabAlloc(RxSlab *allocator, unsigned int size) {
 	return res;
 }
 
+static void RxiSlabReset(RxSlab *allocator) {
+	//keep the slabs for reuse
+	for (; allocator != NULL; allocator = allocator->next) {
+		allocator->pos = 0;
+	}
+}
+
 static void RxiSlabFreeAll(RxSlab *allocator) {
 	if (allocator->allocation != NULL) RxMemFree(allocator->allocation);
 	allocator->allocation = NULL;
@@ -809,136 +920,198 @@ static void RxiSlabFreeAll(RxSlab *allocator) {
 //hash a color for use in the histogram
 static inline unsigned int RxiHistHashColor(const RxYiqColor *yiq) {
 #ifndef RX_SIMD
-	double yi = yiq->y * 256.0, ii = yiq->i * 1.0, qi = yiq->q * 4.0, ai = 255.0f * yiq->a;
-	return ((int) (yi + ii + qi + ai + 0.5)) & (RX_HISTOGRAM_SIZE - 1);
+	int comps[4];
+	comps[0] = (int) (yiq->y * 256.0f + 0.5f);
+	comps[1] = (int) (yiq->i * 1.0f + 0.5f);
+	comps[2] = (int) (yiq->q * 4.0f + 0.5f);
+	comps[3] = (int) (yiq->a * 255.0f + 0.5f);
 #else
-	__m128i yiqI = _mm_cvtps_epi32(_mm_mul_ps(yiq->yiq, _mm_set_ps(255.0f, 1.0f, 4.0f, 256.0f)));
-	__m128i sum = _mm_add_epi32(yiqI, _mm_shuffle_epi32(yiqI, _MM_SHUFFLE(2, 3, 0, 1)));
-	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(0, 1, 2, 3)));
-	return _mm_cvtsi128_si32(sum) & (RX_HISTOGRAM_SIZE - 1);
+	int comps[4];
+	_mm_storeu_si128((__m128i *) comps, _mm_cvtps_epi32(_mm_mul_ps(yiq->yiq, _mm_set_ps(255.0f, 4.0f, 1.0f, 256.0f))));
 #endif
+
+	//mix the components, since nearby colors would otherwise fill runs of adjacent slots
+	unsigned int hash = comps[0] * 0x9E3779B1u + comps[1] * 0x85EBCA77u + comps[2] * 0xC2B2AE3Du + comps[3] * 0x27D4EB2Fu;
+	hash ^= hash >> 15;
+	hash *= 0x2C1B3C6Du;
+	hash ^= hash >> 12;
+	return hash;
 }
 
-RxStatus RxHistInit(RxReduction *reduction) {
-	if (reduction->histogram != NULL) RxHistClear(reduction);
+static RxStatus RxiHistGrow(RxHistogram *histogram) {
+	unsigned int nSlots = histogram->nSlots ? (histogram->nSlots * 2) : RX_HISTOGRAM_MIN_SLOTS;
 
-	reduction->histogram = (RxHistogram *) calloc(1, sizeof(RxHistogram));
-	if (reduction->histogram == NULL) return RX_STATUS_NOMEM;
+	unsigned int *slotHashes = (unsigned int *) malloc(nSlots * sizeof(unsigned int));
+	RxHistEntry **slotEntries = (RxHistEntry **) calloc(nSlots, sizeof(RxHistEntry *));
+	unsigned int *usedSlots = (unsigned int *) realloc(histogram->usedSlots, nSlots / 2 * sizeof(unsigned int));
+	if (usedSlots != NULL) histogram->usedSlots = usedSlots;
+	RxHistEntry **entries = (RxHistEntry **) realloc(histogram->entries, nSlots / 2 * sizeof(RxHistEntry *));
+	if (entries != NULL) histogram->entries = entries;
+
+	if (slotHashes == NULL || slotEntries == NULL || usedSlots == NULL || entries == NULL) {
+		free(slotHashes);
+		free(slotEntries);
+		return RX_STATUS_NOMEM;
+	}
+
+	//move the occupied slots to the new table
+	unsigned int mask = nSlots - 1;
+	for (int i = 0; i < histogram->nEntries; i++) {
+		unsigned int oldSlot = usedSlots[i];
+		unsigned int hash = histogram->slotHashes[oldSlot];
 
-	reduction->histogram->firstSlot = RX_HISTOGRAM_SIZE;
+		unsigned int slot = hash & mask;
+		while (slotEntries[slot] != NULL) slot = (slot + 1) & mask;
+
+		slotHashes[slot] = hash;
+		slotEntries[slot] = histogram->slotEntries[oldSlot];
+		usedSlots[i] = slot;
+	}
+
+	free(histogram->slotHashes);
+	free(histogram->slotEntries);
+	histogram->slotHashes = slotHashes;
+	histogram->slotEntries = slotEntries;
+	histogram->nSlots = nSlots;
 	return RX_STATUS_OK;
 }
 
-void RX_API RxHistAddColor(RxReduction *reduction, const RxYiqColor *col, double weight) {
-	RxHistogram *histogram = reduction->histogram;
-	if (reduction->status != RX_STATUS_OK) return;
+static void RxiHistReset(RxHistogram *histogram) {
+	//empty only the occupied slots, so that clearing a large table for a small histogram is cheap.
+	for (int i = 0; i < histogram->nEntries; i++) {
+		histogram->slotEntries[histogram->usedSlots[i]] = NULL;
+	}
 
-	unsigned int nLayer = reduction->paletteLayers;
+	RxiSlabReset(&histogram->allocator);
+	histogram->nEntries = 0;
+	histogram->totalWeight = 0.0;
+}
 
-	//update the first slot index with hash of new color
-	int slotIndex = RxiHistHashColor(col);
-	if (slotIndex < histogram->firstSlot) histogram->firstSlot = slotIndex;
+static void RxiHistFreeTables(RxHistogram *histogram) {
+	RxiSlabFreeAll(&histogram->allocator);
+	free(histogram->slotHashes);
+	free(histogram->slotEntries);
+	free(histogram->usedSlots);
+	free(histogram->entries);
+}
 
-	//find a slot with the same YIQA, or create a new one if none exists.
-	RxHistEntry **ppslot = &histogram->entries[slotIndex];
-	int slotUsed = *ppslot != NULL;
-	while (*ppslot != NULL) {
-		RxHistEntry *slot = *ppslot;
+static void RxiHistFree(RxHistogram *histogram) {
+	RxiHistFreeTables(histogram);
+	free(histogram);
+}
 
-		//matching slot? add weight
-		if (RxiColorVecEqual(slot->color, col, nLayer)) {
-			slot->weight += weight;
-			return;
-		}
+RxStatus RxHistInit(RxReduction *reduction) {
+	if (reduction->histogram != NULL) return RxHistClear(reduction);
+
+	reduction->histogram = (RxHistogram *) calloc(1, sizeof(RxHistogram));
+	if (reduction->histogram == NULL) return RX_STATUS_NOMEM;
 
-		ppslot = &slot->next;
+	return RX_STATUS_OK;
+}
+
+static RxStatus RxiHistAddColor(RxHistogram *histogram, unsigned int nLayer, const RxYiqColor *col, double weight) {
+	//find a slot with the same YIQA, or an empty slot to put the new color in.
+	unsigned int hash = RxiHistHashColor(col);
+	unsigned int mask = histogram->nSlots - 1;
+	unsigned int slot = hash & mask;
+	if (histogram->nSlots > 0) {
+		RxHistEntry *entry;
+		while ((entry = histogram->slotEntries[slot]) != NULL) {
+			//matching slot? add weight
+			if (histogram->slotHashes[slot] == hash && RxiColorVecEqual(entry->color, col, nLayer)) {
+				entry->weight += weight;
+				return RX_STATUS_OK;
+			}
+
+			slot = (slot + 1) & mask;
+		}
 	}
 
-	RxHistEntry *slot = (RxHistEntry *) RxiSlabAlloc(&histogram->allocator, sizeof(RxHistEntry) + nLayer * sizeof(RxYiqColor));
-	if (slot == NULL) {
-		reduction->status = RX_STATUS_NOMEM;
-		return;
+	//grow the table to keep it at most half full
+	if ((unsigned int) (histogram->nEntries + 1) * 2 > histogram->nSlots) {
+		if (RxiHistGrow(histogram) != RX_STATUS_OK) return RX_STATUS_NOMEM;
+
+		mask = histogram->nSlots - 1;
+		slot = hash & mask;
+		while (histogram->slotEntries[slot] != NULL) slot = (slot + 1) & mask;
 	}
 
+	RxHistEntry *entry = (RxHistEntry *) RxiSlabAlloc(&histogram->allocator, sizeof(RxHistEntry) + nLayer * sizeof(RxYiqColor));
+	if (entry == NULL) return RX_STATUS_NOMEM;
+
 	//put new color
-	*ppslot = slot;
-	RxiColorVecCopy(slot->color, col, nLayer);
-	slot->weight = weight;
-	slot->next = NULL;
-	slot->value = 0.0;
+	RxiColorVecCopy(entry->color, col, nLayer);
+	entry->entry = 0;
+	entry->weight = weight;
+	entry->value = 0.0;
+
+	histogram->slotHashes[slot] = hash;
+	histogram->slotEntries[slot] = entry;
+	histogram->usedSlots[histogram->nEntries] = slot;
+	histogram->entries[histogram->nEntries] = entry;
 	histogram->nEntries++;
 	histogram->totalWeight += weight;
+	return RX_STATUS_OK;
+}
 
-	if (!slotUsed) {
-		if (reduction->histogram->nSlotsUsed < RX_HISTOGRAM_SMALL) {
-			reduction->histogram->slotIndices[reduction->histogram->nSlotsUsed] = slotIndex;
-		}
-		reduction->histogram->nSlotsUsed++;
+static RxStatus RxiHistMerge(RxHistogram *dst, const RxHistogram *src, unsigned int nLayer) {
+	//add the entries in the order they were first seen, so the merged order matches a serial pass.
+	for (int i = 0; i < src->nEntries; i++) {
+		const RxHistEntry *entry = src->entries[i];
+
+		RxStatus status = RxiHistAddColor(dst, nLayer, entry->color, entry->weight);
+		if (status != RX_STATUS_OK) return status;
 	}
+	return RX_STATUS_OK;
+}
+
+void RX_API RxHistAddColor(RxReduction *reduction, const RxYiqColor *col, double weight) {
+	//the flat list aliases the entry list, which may be reallocated. It must be finalized again.
+	reduction->histogramFlat = NULL;
+	if (reduction->status != RX_STATUS_OK) return;
+
+	RxStatus status = RxiHistAddColor(reduction->histogram, reduction->paletteLayers, col, weight);
+	if (status != RX_STATUS_OK) reduction->status = status;
 }
 
 RxStatus RX_API RxHistFinalize(RxReduction *reduction) {
 	if (reduction->status != RX_STATUS_OK) return reduction->status;
-	if (reduction->histogramFlat != NULL) free(reduction->histogramFlat);
 
+	//the histogram keeps its entries in a flat list as they are added.
 	if (reduction->histogram == NULL) {
 		reduction->histogramFlat = NULL;
-		return RX_STATUS_OK;
-	}
-
-	reduction->histogramFlat = (RxHistEntry **) calloc(reduction->histogram->nEntries, sizeof(RxHistEntry *));
-	if (reduction->histogramFlat == NULL) {
-		return reduction->status = RX_STATUS_NOMEM;
-	}
-
-	RxHistEntry **pos = reduction->histogramFlat;
-
-	if (reduction->histogram->nSlotsUsed > RX_HISTOGRAM_SMALL) {
-		//check the histogram's slots in order
-		for (int i = reduction->histogram->firstSlot; i < RX_HISTOGRAM_SIZE; i++) {
-			RxHistEntry *entry = reduction->histogram->entries[i];
-
-			while (entry != NULL) {
-				*(pos++) = entry;
-				entry = entry->next;
-			}
-		}
 	} else {
-		//check only slots in the small histogram list
-		for (int i = 0; i < reduction->histogram->nSlotsUsed; i++) {
-			RxHistEntry *entry = reduction->histogram->entries[reduction->histogram->slotIndices[i]];
-
-			while (entry != NULL) {
-				*(pos++) = entry;
-				entry = entry->next;
-			}
-		}
+		reduction->histogramFlat = reduction->histogram->entries;
 	}
-
 	return RX_STATUS_OK;
 }
 
-RxStatus RX_API RxHistAdd(RxReduction *reduction, const COLOR32 *img, unsigned int width, unsigned int height) {
-	if (reduction->histogram == NULL) {
-		RxStatus status = RxHistInit(reduction);
-		if (status != RX_STATUS_OK) return reduction->status = status;
-	}
-	
-	if (width == 0 || height == 0) return reduction->status;
+static RxStatus RxiHistAddImage(
+	RxReduction   *reduction,
+	RxHistogram   *histogram,
+	const COLOR32 *img,
+	unsigned int   width,
+	unsigned int   height,
+	RxYiqColor    *yiqbufStatic,
+	RxYiqColor    *col
+) {
+	//yiqbufStatic may supply a buffer of at least RX_TEMP_IMG_BUF_SIZE colors, and col is a scratch buffer
+	//of paletteLayers colors, so that images may be added to separate histograms on multiple threads.
+	RxStatus status = RX_STATUS_OK;
 
 	//create YIQ data buffer, 1px overhang in all directions where pixels are duplicated
 	unsigned int padWidth = width + 2, padHeight = height + 2, nLayer = reduction->paletteLayers;
 	unsigned int nPxSrc = width * height;
 	
 	unsigned int bufferSize = padWidth * padHeight * nLayer;
-	RxYiqColor *yiqbuf = reduction->imgBuffer;
-	if (bufferSize > RX_TEMP_IMG_BUF_SIZE) {
+	RxYiqColor *yiqbuf = yiqbufStatic;
+	if (yiqbuf == NULL || bufferSize > RX_TEMP_IMG_BUF_SIZE) {
 		//allocate buffer on the heap if large enough
 		yiqbuf = (RxYiqColor *) RxMemAlloc(bufferSize * sizeof(RxYiqColor));
 	}
 
 	if (yiqbuf == NULL) {
-		return reduction->status = RX_STATUS_NOMEM;
+		return RX_STATUS_NOMEM;
 	}
 
 	//convert input data into YIQ space. We rearrange the data to being indexed as
@@ -947,9 +1120,7 @@ RxStatus RX_API RxHistAdd(RxReduction *reduction, const COLOR32 *img, unsigned i
 		const COLOR32 *imgI = img + i * nPxSrc;
 
 		for (unsigned int y = 0; y < height; y++) {
-			for (unsigned int x = 0; x < width; x++) {
-				RxConvertRgbToYiq(imgI[x + y * width], &yiqbuf[((x + 1) + (y + 1) * padWidth) * nLayer + i]);
-			}
+			RxConvertRowToYiq(imgI + y * width, &yiqbuf[(1 + (y + 1) * padWidth) * nLayer + i], width, nLayer);
 		}
 	}
 
@@ -964,7 +1135,7 @@ RxStatus RX_API RxHistAdd(RxReduction *reduction, const COLOR32 *img, unsigned i
 	RxiColorVecCopy(&yiqbuf[(height + 1) * padWidth * nLayer], &yiqbuf[height * padWidth * nLayer], padWidth * nLayer);
 
 
-	for (unsigned int y = 0; y < height; y++) {
+	for (unsigned int y = 0; y < height && status == RX_STATUS_OK; y++) {
 		
 		RxYiqColor *row0 = &yiqbuf[(y + 0) * padWidth * nLayer];
 		RxYiqColor *row1 = &yiqbuf[(y + 1) * padWidth * nLayer];
@@ -980,7 +1151,6 @@ RxStatus RX_API RxHistAdd(RxReduction *reduction, const COLOR32 *img, unsigned i
 
 			//copy the center color to a temporary location as we may modify the color based on the alpha
 			//mode, and do not want this to affect the weighting calculations of other pixels.
-			RxYiqColor *col = reduction->tempLayeredColor;
 			RxiColorVecCopy(col, center, nLayer);
 
 			//when we calculate the weight of multiple colors, we take the weight to be the sum of weights
@@ -1030,13 +1200,113 @@ RxStatus RX_API RxHistAdd(RxReduction *reduction, const COLOR32 *img, unsigned i
 
 			//add the color to the histogram only if its total weight was nonzero.
 			if (totalWeight > 0.0) {
-				RxHistAddColor(reduction, col, totalWeight);
+				status = RxiHistAddColor(histogram, nLayer, col, totalWeight);
+				if (status != RX_STATUS_OK) break;
 			}
 		}
 	}
 
-	if (yiqbuf != reduction->imgBuffer) RxMemFree(yiqbuf);
+	if (yiqbuf != yiqbufStatic) RxMemFree(yiqbuf);
+
+	return status;
+}
+
+RxStatus RX_API RxHistAdd(RxReduction *reduction, const COLOR32 *img, unsigned int width, unsigned int height) {
+	reduction->histogramFlat = NULL;
+	if (reduction->histogram == NULL) {
+		RxStatus status = RxHistInit(reduction);
+		if (status != RX_STATUS_OK) return reduction->status = status;
+	}
+	
+	if (width == 0 || height == 0) return reduction->status;
+	if (reduction->status != RX_STATUS_OK) return reduction->status;
+
+	double start = RxiStatsGetTime(reduction);
+	RxStatus status = RxiHistAddImage(reduction, reduction->histogram, img, width, height, reduction->imgBuffer, reduction->tempLayeredColor);
+	if (status != RX_STATUS_OK) reduction->status = status;
+
+	if (reduction->stats != NULL) reduction->stats->histogramTime += ThGetTime() - start;
+	return reduction->status;
+}
+
+//each image is added to a worker's own histogram, which is then merged into the context's histogram. Merges
+//happen in image order, so the result is the same regardless of the number of threads used.
+typedef struct RxiHistBatchWork_ {
+	RxReduction          *reduction;
+	const COLOR32 *const *images;
+	const unsigned int   *widths;
+	const unsigned int   *heights;
+	unsigned int          nImages;
+	RxHistogram          *partials;   // per-worker histograms
+	volatile long         nextImage;  // next image to be claimed by a worker
+	volatile long         nMerged;    // number of images merged into the context's histogram
+	volatile long         status;     // first error encountered
+} RxiHistBatchWork;
+
+static void RxiHistBatchWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) nWorkers;
+	RxiHistBatchWork *work = (RxiHistBatchWork *) param;
+	RxReduction *reduction = work->reduction;
+	RxHistogram *partial = &work->partials[iWorker];
+	RxYiqColor col[RX_PALETTE_MAX_COUNT];
+
+	for (;;) {
+		long i = ThAtomicIncrement(&work->nextImage) - 1;
+		if (i >= (long) work->nImages) break;
+
+		RxStatus status = RX_STATUS_OK;
+		RxiHistReset(partial);
+		if (ThAtomicLoad(&work->status) == RX_STATUS_OK && work->widths[i] > 0 && work->heights[i] > 0) {
+			status = RxiHistAddImage(reduction, partial, work->images[i], work->widths[i], work->heights[i], NULL, col);
+		}
+
+		//images are claimed in order, so the image before this one is already being worked on.
+		while (ThAtomicLoad(&work->nMerged) != i) ThYield();
+		if (status == RX_STATUS_OK && ThAtomicLoad(&work->status) == RX_STATUS_OK) {
+			status = RxiHistMerge(reduction->histogram, partial, reduction->paletteLayers);
+		}
+		if (status != RX_STATUS_OK) ThAtomicStore(&work->status, status);
+		ThAtomicStore(&work->nMerged, i + 1);
+	}
+}
+
+RxStatus RX_API RxHistAddImages(
+	RxReduction          *reduction,
+	const COLOR32 *const *images,
+	const unsigned int   *widths,
+	const unsigned int   *heights,
+	unsigned int          nImages
+) {
+	reduction->histogramFlat = NULL;
+	if (reduction->histogram == NULL) {
+		RxStatus status = RxHistInit(reduction);
+		if (status != RX_STATUS_OK) return reduction->status = status;
+	}
+	if (reduction->status != RX_STATUS_OK) return reduction->status;
+	if (nImages == 0) return RX_STATUS_OK;
+
+	unsigned int nThreads = RxiGetThreadCount(reduction, nImages);
+
+	RxiHistBatchWork work = { 0 };
+	work.reduction = reduction;
+	work.images = images;
+	work.widths = widths;
+	work.heights = heights;
+	work.nImages = nImages;
+	work.status = RX_STATUS_OK;
+	work.partials = (RxHistogram *) calloc(nThreads, sizeof(RxHistogram));
+	if (work.partials == NULL) return reduction->status = RX_STATUS_NOMEM;
+
+	double start = RxiStatsGetTime(reduction);
+	ThRunWorkers(RxiHistBatchWorker, &work, nThreads);
+	if (reduction->stats != NULL) reduction->stats->histogramTime += ThGetTime() - start;
 
+	for (unsigned int i = 0; i < nThreads; i++) {
+		RxiHistFreeTables(&work.partials[i]);
+	}
+	free(work.partials);
+
+	if (work.status != RX_STATUS_OK) reduction->status = (RxStatus) work.status;
 	return reduction->status;
 }
 
@@ -1455,6 +1725,8 @@ static RxColorNode *RxiTreeNodeAlloc(RxReduction *reduction) {
 }
 
 static void RxiColorNodeInit(RxReduction *reduction, RxColorNode *node, int startIndex, int endIndex) {
+	if (reduction->stats != NULL) reduction->stats->nNodeInits++;
+
 	node->startIndex = startIndex;
 	node->endIndex = endIndex;
 	node->canSplit = RX_TRUE;
@@ -1755,28 +2027,159 @@ static void RxiPaletteToRgb(RxReduction *reduction) {
 	}
 }
 
-static void RxiVoronoiAccumulateClusters(RxReduction *reduction) {
-	RxTotalBuffer *totalsBuffer = reduction->blockTotals;
-	memset(totalsBuffer, 0, sizeof(reduction->blockTotals));
+static RxBool RxiEmitPalette(RxReduction *reduction) {
+	if (reduction->paletteCallback == NULL) return RX_TRUE;
 
-	//remap histogram points to palette colors, and accumulate the error
-	for (int i = 0; i < reduction->histogram->nEntries; i++) {
+	//the cluster totals hold the error of the current palette. Convert the palette to RGB so that the
+	//callback can read it.
+	double error = 0.0;
+	for (unsigned int i = 0; i < reduction->nUsedColors; i++) {
+		error += reduction->blockTotals[i].error;
+	}
+	RxiPaletteToRgb(reduction);
+
+	return reduction->paletteCallback(reduction, reduction->reclusterIteration, error, reduction->paletteCallbackData);
+}
+
+
+//reclustering work is split into chunks of the histogram. Workers compute a value for each histogram
+//entry: its distance to the nearest cluster, or its error to its cluster's new centroid. These are
+//then summed into the cluster totals in histogram order, which is the order a single thread adds
+//them in, so the result is the same regardless of the number of threads used.
+typedef enum RxiVoronoiPhase_ {
+	RX_VORONOI_PHASE_ACCUMULATE,  // assign histogram entries to clusters and accumulate totals
+	RX_VORONOI_PHASE_ERROR        // accumulate the error of histogram entries to new centroids
+} RxiVoronoiPhase;
+
+typedef struct RxiVoronoiWork_ {
+	RxReduction *reduction;
+	RxiVoronoiPhase phase;
+	unsigned int nChunks;
+	unsigned int chunkSize;
+	double *values;                 // per-entry distance (accumulate phase) or error (error phase)
+	volatile long nextChunk;
+} RxiVoronoiWork;
+
+static unsigned int RxiVoronoiGetChunks(RxReduction *reduction, unsigned int *pChunkSize) {
+	unsigned int nEntries = reduction->histogram->nEntries;
+
+	unsigned int chunkSize = (nEntries + RX_VORONOI_CHUNK_MAX - 1) / RX_VORONOI_CHUNK_MAX;
+	if (chunkSize < RX_VORONOI_CHUNK_MIN) chunkSize = RX_VORONOI_CHUNK_MIN;
+
+	*pChunkSize = chunkSize;
+	return (nEntries + chunkSize - 1) / chunkSize;
+}
+
+static double RxiVoronoiAssignEntry(RxReduction *reduction, RxHistEntry *entry, RxYiqColor *scratch) {
+	//find the entry's nearest cluster, returning the distance to it.
+	double bestDistance = RX_LARGE_NUMBER;
+	int bestIndex = 0;
+	if (reduction->accel != NULL) {
+		bestIndex = RxiPaletteFindClosestColorOnAccelEx(reduction, reduction->accel, entry->color, scratch, &bestDistance);
+	}
+
+	entry->entry = bestIndex;
+	return bestDistance;
+}
+
+static void RxiVoronoiAddEntry(RxReduction *reduction, RxTotalBuffer *totalsBuffer, const RxHistEntry *entry, double distance) {
+	//add to total. YIQ colors scaled by alpha to be unscaled later.
+	RxTotalBuffer *total = &totalsBuffer[entry->entry];
+	double weight = entry->weight;
+	total->weight += weight;
+	total->error += weight * distance;
+	total->count++;
+
+	for (unsigned int j = 0; j < reduction->paletteLayers; j++) {
+		RxiAddWeightedLongColor(&total->sum[j], &entry->color[j], weight);
+	}
+}
+
+static double RxiVoronoiEntryError(RxReduction *reduction, const RxHistEntry *entry) {
+	//error of a histogram entry to its cluster's new centroid
+	return entry->weight * RxiComputeLayeredColorDifference(reduction, entry->color, reduction->centroidYiq[entry->entry]);
+}
+
+static void RxiVoronoiComputeChunk(RxiVoronoiWork *work, unsigned int iChunk) {
+	RxReduction *reduction = work->reduction;
+	RxYiqColor scratch[RX_PALETTE_MAX_COUNT];
+
+	unsigned int iStart = iChunk * work->chunkSize;
+	unsigned int iEnd = iStart + work->chunkSize;
+	if (iEnd > (unsigned int) reduction->histogram->nEntries) iEnd = reduction->histogram->nEntries;
+
+	for (unsigned int i = iStart; i < iEnd; i++) {
 		RxHistEntry *entry = reduction->histogramFlat[i];
 
-		double bestDistance;
-		int bestIndex = RxPaletteFindClosestColorYiq(reduction, entry->color, &bestDistance);
+		switch (work->phase) {
+			case RX_VORONOI_PHASE_ACCUMULATE:
+				work->values[i] = RxiVoronoiAssignEntry(reduction, entry, scratch);
+				break;
+			case RX_VORONOI_PHASE_ERROR:
+				if ((unsigned int) entry->entry < reduction->nPinnedClusters) break;
+				work->values[i] = RxiVoronoiEntryError(reduction, entry);
+				break;
+		}
+	}
+}
 
-		//add to total. YIQ colors scaled by alpha to be unscaled later.
-		double weight = entry->weight;
-		totalsBuffer[bestIndex].weight += weight;
-		totalsBuffer[bestIndex].error += weight * bestDistance;
-		totalsBuffer[bestIndex].count++;
+static void RxiVoronoiWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) iWorker;
+	(void) nWorkers;
 
-		for (unsigned int j = 0; j < reduction->paletteLayers; j++) {
-			RxiAddWeightedLongColor(&totalsBuffer[bestIndex].sum[j], &entry->color[j], weight);
+	RxiVoronoiWork *work = (RxiVoronoiWork *) param;
+	while (1) {
+		unsigned int iChunk = (unsigned int) (ThAtomicIncrement(&work->nextChunk) - 1);
+		if (iChunk >= work->nChunks) break;
+
+		RxiVoronoiComputeChunk(work, iChunk);
+	}
+}
+
+static void RxiVoronoiRunPhase(RxReduction *reduction, RxiVoronoiPhase phase, RxTotalBuffer *totals, double *errors) {
+	unsigned int nEntries = reduction->histogram->nEntries;
+
+	RxiVoronoiWork work = { 0 };
+	work.reduction = reduction;
+	work.phase = phase;
+	work.nChunks = RxiVoronoiGetChunks(reduction, &work.chunkSize);
+
+	//compute the per-entry values on multiple threads when the histogram spans multiple chunks.
+	unsigned int nThreads = RxiGetThreadCount(reduction, work.nChunks);
+	if (nThreads > 1) {
+		work.values = (double *) malloc(nEntries * sizeof(double));
+		if (work.values != NULL) ThRunWorkers(RxiVoronoiWorker, &work, nThreads);
+	}
+
+	//sum into the cluster totals in histogram order. If the values were not computed on other threads,
+	//they are computed here as they are summed, which gives the same result.
+	RxYiqColor scratch[RX_PALETTE_MAX_COUNT];
+	for (unsigned int i = 0; i < nEntries; i++) {
+		RxHistEntry *entry = reduction->histogramFlat[i];
+
+		switch (phase) {
+			case RX_VORONOI_PHASE_ACCUMULATE:
+			{
+				double distance = (work.values != NULL) ? work.values[i] : RxiVoronoiAssignEntry(reduction, entry, scratch);
+				RxiVoronoiAddEntry(reduction, totals, entry, distance);
+				break;
+			}
+			case RX_VORONOI_PHASE_ERROR:
+				if ((unsigned int) entry->entry < reduction->nPinnedClusters) break;
+				errors[entry->entry] += (work.values != NULL) ? work.values[i] : RxiVoronoiEntryError(reduction, entry);
+				break;
 		}
-		entry->entry = bestIndex;
 	}
+
+	free(work.values);
+}
+
+static void RxiVoronoiAccumulateClusters(RxReduction *reduction) {
+	RxTotalBuffer *totalsBuffer = reduction->blockTotals;
+	memset(totalsBuffer, 0, sizeof(reduction->blockTotals));
+
+	//remap histogram points to palette colors, and accumulate the error
+	RxiVoronoiRunPhase(reduction, RX_VORONOI_PHASE_ACCUMULATE, totalsBuffer, NULL);
 }
 
 static void RxiVoronoiMoveToCluster(RxReduction *reduction, RxHistEntry *entry, int idxTo, double newDifference, double oldDifference) {
@@ -1813,6 +2216,9 @@ static int RxiVoronoiIterate(RxReduction *reduction) {
 	//map histogram colors to existing clusters and accumulate error.
 	RxiVoronoiAccumulateClusters(reduction);
 
+	//offer the palette from the previous pass (or the initial split) to the caller, who may stop here.
+	if (!RxiEmitPalette(reduction)) return -1;
+
 	//new centroid indexes, when created
 	unsigned int *newCentroidIdxs = reduction->newCentroids;
 	unsigned int nNewCentroids = 0;
@@ -1907,10 +2313,9 @@ static int RxiVoronoiIterate(RxReduction *reduction) {
 	}
 
 	//average out the colors in the new partitions
-	unsigned int nMovedClusters = 0;
 	for (unsigned int i = reduction->nPinnedClusters; i < reduction->nUsedColors; i++) {
 		//compute the final new masked color for the cluster
-		RxYiqColor *yiq = reduction->tempLayeredColor;
+		RxYiqColor *yiq = reduction->centroidYiq[i];
 
 		for (unsigned int j = 0; j < nLayers; j++) {
 			RxiUnweightLongColor(&yiq[j], &totalsBuffer[i].sum[j], totalsBuffer[i].weight);
@@ -1918,23 +2323,21 @@ static int RxiVoronoiIterate(RxReduction *reduction) {
 			//mask color
 			RxiMaskYiq(reduction, &yiq[j], &yiq[j]);
 		}
+	}
 
-		//when color masking is used, it is possible that the new computed centroid may drift
-		//from optimal placement. We will select either the new centroid or the old one, based
-		//on which achieves the least error. If the old centroid achieves a better error, then
-		//we do not update the centroid.
-		//this ensures that the total error is at least monotonically decreasing.
-		double errNewCluster = 0.0;
-		for (int j = 0; j < reduction->histogram->nEntries; j++) {
-			if (reduction->histogramFlat[j]->entry != i) continue;
-
-			RxHistEntry *hist = reduction->histogramFlat[j];
-			errNewCluster += hist->weight * RxiComputeLayeredColorDifference(reduction, hist->color, yiq);
-		}
+	//when color masking is used, it is possible that the new computed centroid may drift
+	//from optimal placement. We will select either the new centroid or the old one, based
+	//on which achieves the least error. If the old centroid achieves a better error, then
+	//we do not update the centroid.
+	//this ensures that the total error is at least monotonically decreasing.
+	double errNewCluster[RX_PALETTE_MAX_SIZE] = { 0 };
+	RxiVoronoiRunPhase(reduction, RX_VORONOI_PHASE_ERROR, NULL, errNewCluster);
 
+	unsigned int nMovedClusters = 0;
+	for (unsigned int i = reduction->nPinnedClusters; i < reduction->nUsedColors; i++) {
 		//if the new cluster is an improvement over the old cluster
-		if (errNewCluster < totalsBuffer[i].error) {
-			RxiColorVecCopy(reduction->paletteYiq[i], yiq, nLayers);
+		if (errNewCluster[i] < totalsBuffer[i].error) {
+			RxiColorVecCopy(reduction->paletteYiq[i], reduction->centroidYiq[i], nLayers);
 			nMovedClusters++;
 		}
 	}
@@ -1956,23 +2359,32 @@ static void RxiVoronoiRecluster(RxReduction *reduction) {
 	//simple termination conditions
 	if (reduction->nReclusters <= 0 || reduction->nPinnedClusters >= reduction->nUsedColors) return;
 
-	//voronoi iteration
+	//voronoi iteration. A pass returns 1 to continue, 0 when the palette is finished, or -1 when the
+	//palette callback stopped the iteration.
+	RxStats *stats = reduction->stats;
+	double start = RxiStatsGetTime(reduction);
+	RxBool stopped = RX_FALSE;
 	reduction->reclusterIteration = 0;
-	while (RxiVoronoiIterate(reduction));
+	for (unsigned int iPass = 0;; iPass++) {
+		double passStart = RxiStatsGetTime(reduction);
+		int more = RxiVoronoiIterate(reduction);
+
+		if (stats != NULL) {
+			if (iPass < RX_STATS_MAX_PASSES) stats->voronoiPassTime[iPass] += ThGetTime() - passStart;
+			stats->nVoronoiPasses++;
+		}
+		if (more <= 0) {
+			stopped = (more < 0);
+			break;
+		}
+	}
 
 	//load palette accelerator
 	RxiPaletteLoadYiq(reduction, &reduction->paletteYiq[0][0], RX_PALETTE_MAX_COUNT, reduction->nUsedColors, RX_TRUE);
 
 	//delete any entries we couldn't use and shrink the palette size.
 	RxTotalBuffer *totalsBuffer = reduction->blockTotals;
-	memset(totalsBuffer, 0, sizeof(reduction->blockTotals));
-	for (int i = 0; i < reduction->histogram->nEntries; i++) {
-		RxYiqColor *histColor = reduction->histogramFlat[i]->color;
-
-		//find nearest, add to total
-		int bestIndex = RxPaletteFindClosestColorYiq(reduction, histColor, NULL);
-		totalsBuffer[bestIndex].weight += reduction->histogramFlat[i]->weight;
-	}
+	RxiVoronoiAccumulateClusters(reduction);
 
 	//weight==0 => delete
 	unsigned int nRemoved = 0;
@@ -1989,6 +2401,12 @@ static void RxiVoronoiRecluster(RxReduction *reduction) {
 
 	memset(reduction->paletteYiq[reduction->nUsedColors], 0, nRemoved * sizeof(reduction->paletteYiq[0]));
 	RxiCreatePaletteUpdateProgress(reduction);
+
+	//the last pass's palette has not been offered yet. The callback's result is not needed here, as the
+	//palette is finished either way.
+	if (!stopped) RxiEmitPalette(reduction);
+
+	if (stats != NULL) stats->voronoiTime += ThGetTime() - start;
 }
 
 static void RxiVoronoiPinRange(RxReduction *reduction, unsigned int nCols) {
@@ -2111,6 +2529,7 @@ RxStatus RX_API RxComputePalette(RxReduction *reduction, unsigned int nColors) {
 	if (nColors > RX_PALETTE_MAX_SIZE) return RX_STATUS_INVALID;
 	
 	//create the root cluster holding all colors
+	double start = RxiStatsGetTime(reduction);
 	RxColorNode *head = RxiTreeNodeAlloc(reduction);
 	RxiColorNodeInit(reduction, head, 0, reduction->histogram->nEntries);
 	reduction->colorNodes[reduction->nUsedColors++] = head;
@@ -2136,6 +2555,7 @@ RxStatus RX_API RxComputePalette(RxReduction *reduction, unsigned int nColors) {
 
 	//mask cluster centroids to palette colors
 	RxiPaletteWriteMasked(reduction);
+	if (reduction->stats != NULL) reduction->stats->splitTime += ThGetTime() - start;
 
 	//perform voronoi iteration
 	RxiVoronoiRecluster(reduction);
@@ -2244,14 +2664,8 @@ RxStatus RX_API RxGetPalette(RxReduction *reduction, COLOR32 *pltt, unsigned int
 }
 
 RxStatus RX_API RxHistClear(RxReduction *reduction) {
-	if (reduction->histogramFlat != NULL) free(reduction->histogramFlat);
 	reduction->histogramFlat = NULL;
-
-	if (reduction->histogram != NULL) {
-		RxiSlabFreeAll(&reduction->histogram->allocator);
-		free(reduction->histogram);
-		reduction->histogram = NULL;
-	}
+	if (reduction->histogram != NULL) RxiHistReset(reduction->histogram);
 
 	reduction->nUsedColors = 0;
 	memset(reduction->paletteRgb, 0, sizeof(reduction->paletteRgb));
@@ -2262,11 +2676,8 @@ static void RxiDestroy(RxReduction *reduction) {
 	RxPaletteFree(reduction);
 	RxiPaletteFree(reduction->maskAccel);
 
-	if (reduction->histogramFlat != NULL) free(reduction->histogramFlat);
-	if (reduction->histogram != NULL) {
-		RxiSlabFreeAll(&reduction->histogram->allocator);
-		free(reduction->histogram);
-	}
+	if (reduction->histogram != NULL) RxiHistFree(reduction->histogram);
+	free(reduction->stats);
 }
 
 void RX_API RxFree(RxReduction *reduction) {
@@ -2285,8 +2696,7 @@ RxStatus RX_API RxGlbCreatePalette(const COLOR32 *img, unsigned int width, unsig
 	return status;
 }
 
-RxStatus RX_API RxCreatePalette(RxReduction *reduction, const COLOR32 *px, unsigned int width, unsigned int height, COLOR32 *pal, unsigned int nColors, RxFlag flag, unsigned int *pOutCols) {
-	RxHistAdd(reduction, px, width, height);
+static RxStatus RxiCreatePaletteFromHistogram(RxReduction *reduction, COLOR32 *pal, unsigned int nColors, RxFlag flag, unsigned int *pOutCols) {
 	RxHistFinalize(reduction);
 	RxComputePalette(reduction, nColors);
 
@@ -2316,10 +2726,33 @@ RxStatus RX_API RxCreatePalette(RxReduction *reduction, const COLOR32 *px, unsig
 	return status;
 }
 
+RxStatus RX_API RxCreatePalette(RxReduction *reduction, const COLOR32 *px, unsigned int width, unsigned int height, COLOR32 *pal, unsigned int nColors, RxFlag flag, unsigned int *pOutCols) {
+	RxHistAdd(reduction, px, width, height);
+	return RxiCreatePaletteFromHistogram(reduction, pal, nColors, flag, pOutCols);
+}
+
+RxStatus RX_API RxCreateSharedPalette(
+	RxReduction          *reduction,
+	const COLOR32 *const *images,
+	const unsigned int   *widths,
+	const unsigned int   *heights,
+	unsigned int          nImages,
+	COLOR32              *pal,
+	unsigned int          nColors,
+	RxFlag                flag,
+	unsigned int         *pOutCols
+) {
+	RxHistAddImages(reduction, images, widths, heights, nImages);
+	return RxiCreatePaletteFromHistogram(reduction, pal, nColors, flag, pOutCols);
+}
+
 
 // ----- character map color reduction routines
 
 #define RX_TILE_PALETTE_COUNT_MAX 16 // max palettes produced
+#define RX_TILE_EXACT_MAX       1024 // max tiles for which every pair of palettes is compared
+#define RX_TILE_NEIGHBORS         16 // candidate merges kept per palette for larger images
+#define RX_TILE_CANDIDATES        64 // palettes compared to find the candidate merges of a palette
 
 typedef struct RxiTile_ {
 	COLOR32 rgb[64];                         // RGBA 8x8 block color
@@ -2406,30 +2839,578 @@ Done:
 	return leastDiff;
 }
 
-static COLOR32 RxiChooseMultiPaletteColor0(RxReduction *reduction) {
-	RxHistFinalize(reduction);
-
-	//get histogram colors
-	RxYiqColor *histCols = (RxYiqColor *) RxMemCalloc(reduction->histogram->nEntries, sizeof(RxYiqColor));
-	double *weights = (double *) calloc(reduction->histogram->nEntries, sizeof(double));
-	unsigned int nCol = RxHistGetTopN(reduction, reduction->histogram->nEntries, histCols, weights);
+static void RxiTileMerge(RxReduction *reduction, RxiTile *tiles, unsigned int nTiles, unsigned int index1, unsigned int index2, int nColsPerPalette) {
+	//find all instances of index2, replace with index1
+	int nSwitched = 0;
+	for (unsigned int i = 0; i < nTiles; i++) {
+		if (tiles[i].palIndex == index2) {
+			tiles[i].palIndex = index1;
+			nSwitched++;
+		}
+	}
 
-	//weighted masked colors (bin by masking and accumulate weights)
+	//build new palette
 	RxHistClear(reduction);
-	RxHistInit(reduction);
-	for (unsigned int i = 0; i < nCol; i++) {
-		RxYiqColor maskYiq;
-		RxConvertRgbToYiq(RxiMaskYiqToRgb(reduction, &histCols[i]), &maskYiq);
-		RxHistAddColor(reduction, &maskYiq, weights[i]);
+	for (unsigned int i = 0; i < nTiles; i++) {
+		if (tiles[i].palIndex == index1) {
+			RxHistAdd(reduction, tiles[i].rgb, 8, 8);
+		}
 	}
 	RxHistFinalize(reduction);
+	RxComputePalette(reduction, nColsPerPalette);
 
-	free(weights);
-	RxMemFree(histCols);
+	//write over the palette of the tile
+	RxiTile *palTile = &tiles[index1];
+	for (int i = 0; i < RX_PALETTE_MAX_SIZE - 1; i++) {
+		RxConvertRgbToYiq(reduction->paletteRgb[i][0], &palTile->palette[i]);
+	}
+	palTile->nUsedColors = reduction->nUsedColors;
+	palTile->nSwallowed += nSwitched;
 
-	//get binned weights
-	RxYiqColor worst;
-	nCol = RxHistGetTopN(reduction, 1, &worst, NULL);
+	//get new use count
+	RxiTile *rep = &tiles[index1];
+	memset(rep->useCounts, 0, sizeof(rep->useCounts));
+	for (unsigned int i = 0; i < nTiles; i++) {
+		RxiTile *tile = &tiles[i];
+		if (tile->palIndex != index1) continue;
+
+		for (int j = 0; j < 64; j++) {
+			COLOR32 col = tile->rgb[j];
+			int index = RxiPaletteFindClosestRgbColor(reduction, tile->palette, tile->nUsedColors, tile->rgb[j], NULL);
+			if ((col >> 24) == 0) index = RX_PALETTE_MAX_SIZE - 1;
+			tile->indices[j] = (uint8_t) index;
+			rep->useCounts[index]++;
+		}
+	}
+}
+
+typedef struct RxiTilePaletteWork_ {
+	RxReduction *reduction;         // reduction context used by worker 0
+	const RxBalanceSetting *balance;
+	const COLOR32 *imgBits;
+	RxiTile *tiles;
+	unsigned int tilesX;
+	unsigned int nTiles;
+	int nColsPerPalette;
+	volatile long nextTile;
+} RxiTilePaletteWork;
+
+static RxReduction *RxiTileGetWorkerReduction(RxReduction *reduction, const RxBalanceSetting *balance, unsigned int iWorker) {
+	//worker 0 runs on the calling thread and uses the caller's context, other workers get their own.
+	if (iWorker == 0) return reduction;
+
+	reduction = RxNew(balance);
+	if (reduction == NULL) return NULL;
+
+	RxSetThreadCount(reduction, 1);
+	return reduction;
+}
+
+static void RxiTileReleaseWorkerReduction(RxReduction *reduction, unsigned int iWorker) {
+	if (iWorker > 0) RxFree(reduction);
+}
+
+static void RxiTilePaletteWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) nWorkers;
+
+	RxiTilePaletteWork *work = (RxiTilePaletteWork *) param;
+
+	//each worker creates the palettes of its tiles on its own reduction context.
+	RxReduction *reduction = RxiTileGetWorkerReduction(work->reduction, work->balance, iWorker);
+	if (reduction == NULL) return;
+
+	while (1) {
+		unsigned int iTile = (unsigned int) (ThAtomicIncrement(&work->nextTile) - 1);
+		if (iTile >= work->nTiles) break;
+
+		unsigned int x = iTile % work->tilesX, y = iTile / work->tilesX;
+		RxiTile *tile = &work->tiles[iTile];
+		const COLOR32 *pxOrigin = work->imgBits + x * 8 + (y * 8 * work->tilesX * 8);
+		RxiTileCopy(tile, pxOrigin, work->tilesX * 8);
+
+		RxHistClear(reduction);
+		RxHistAdd(reduction, tile->rgb, 8, 8);
+		RxHistFinalize(reduction);
+		RxComputePalette(reduction, work->nColsPerPalette);
+		for (unsigned int i = 0; i < RX_PALETTE_MAX_SIZE; i++) {
+			RxiColorCopy(&tile->palette[i], &reduction->paletteYiq[i][0]);
+		}
+
+		tile->nUsedColors = reduction->nUsedColors;
+
+		//match pixels to palette indices
+		for (unsigned int i = 0; i < 64; i++) {
+			unsigned int index = RxiPaletteFindClosestRgbColor(reduction, &tile->palette[0], tile->nUsedColors, tile->rgb[i], NULL);
+			if ((tile->rgb[i] >> 24) == 0) index = RX_PALETTE_MAX_SIZE - 1;
+			tile->indices[i] = (uint8_t) index;
+			tile->useCounts[index]++;
+		}
+		tile->palIndex = iTile;
+		tile->nSwallowed = 1;
+	}
+
+	RxiTileReleaseWorkerReduction(reduction, iWorker);
+}
+
+typedef struct RxiTileDifferenceWork_ {
+	RxReduction *reduction;
+	RxiTile *tiles;
+	unsigned int nTiles;
+	double *diffBuff;
+	volatile int *progress;
+	int progressBase;
+	volatile long nextTile;
+	volatile long nDone;
+} RxiTileDifferenceWork;
+
+static void RxiTileDifferenceWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) nWorkers;
+
+	RxiTileDifferenceWork *work = (RxiTileDifferenceWork *) param;
+	unsigned int nTiles = work->nTiles;
+
+	while (1) {
+		unsigned int i = (unsigned int) (ThAtomicIncrement(&work->nextTile) - 1);
+		if (i >= nTiles) break;
+
+		RxiTile *tile1 = &work->tiles[i];
+		for (unsigned int j = 0; j < nTiles; j++) {
+			RxiTile *tile2 = &work->tiles[j];
+
+			//write difference
+			if (i == j) {
+				work->diffBuff[i + j * nTiles] = 0.0;
+			} else {
+				work->diffBuff[i + j * nTiles] = RxiTileComputePaletteDifference(work->reduction, tile1, tile2);
+			}
+		}
+
+		//progress is written from the calling thread only
+		long nDone = ThAtomicIncrement(&work->nDone);
+		if (iWorker == 0) *work->progress = work->progressBase + nDone;
+	}
+}
+
+static void RxiTileMergeExact(RxReduction *reduction, RxiTile *tiles, unsigned int nTiles, int nPalettes, int nColsPerPalette, volatile int *progress) {
+	// ----- STAGE 2: create difference map
+	// We'll determine candidacy for palette merges using an nxn matrix of differences. Each entry
+	// in the diagonal is necessarily 0 since any palette is merged with itself without cost. The
+	// matrix is not symmetric, however, representing the different directions in which this relation
+	// is calculated.
+	double *diffBuff = (double *) calloc(nTiles * nTiles, sizeof(double));
+
+	RxiTileDifferenceWork work = { 0 };
+	work.reduction = reduction;
+	work.tiles = tiles;
+	work.nTiles = nTiles;
+	work.diffBuff = diffBuff;
+	work.progress = progress;
+	work.progressBase = *progress;
+	ThRunWorkers(RxiTileDifferenceWorker, &work, RxiGetThreadCount(reduction, nTiles));
+	*progress = work.progressBase + nTiles;
+
+	// ----- STAGE 3: merge palettes
+	// We'll select the most highly mergeable two palettes and merge them by creating a new palette
+	// using the combined histograms of represented tiles.
+	int nCurrentPalettes = nTiles;
+	while (nCurrentPalettes > 1) {
+		//find two best palettes to merge
+		unsigned int index1, index2;
+		double cost = RxiTileFindSimilarTiles(tiles, diffBuff, nTiles, &index1, &index2);
+
+		//we will continue to merge palettes even when we have are at or below the target count when
+		//we may merge more palettes at 0 cost, or when there exist palettes which may be merged losslessly
+		//to avoid palette waste.
+		if (cost > 0.0 && (tiles[index1].nUsedColors + tiles[index2].nUsedColors) > (unsigned int) nColsPerPalette) {
+			if (nCurrentPalettes <= nPalettes) break;
+		}
+
+		RxiTileMerge(reduction, tiles, nTiles, index1, index2, nColsPerPalette);
+
+		//recompute differences for index1 and representative tiles
+		RxiTile *rep = &tiles[index1];
+		for (unsigned int i = 0; i < nTiles; i++) {
+			RxiTile *t = &tiles[i];
+			if (t->palIndex != i) continue;
+
+			double diff1 = RxiTileComputePaletteDifference(reduction, t, rep);
+			double diff2 = RxiTileComputePaletteDifference(reduction, rep, t);
+			diffBuff[i + index1 * nTiles] = diff1;
+			diffBuff[index1 + i * nTiles] = diff2;
+		}
+
+		nCurrentPalettes--;
+		(*progress)++;
+	}
+
+	free(diffBuff);
+}
+
+
+// For large images, comparing every pair of palettes takes O(n^2) memory and time. Instead, each
+// palette keeps a short list of its best candidate merges. The candidates of a palette are found
+// by comparing it against the palettes nearest to it in a summary of their colors, and only the
+// lists touched by a merge are updated. Merges are taken in order from a priority queue holding
+// the best candidate of each palette. A merged palette is created from the colors of the two
+// palettes rather than from every pixel of the tiles they represent, and the final palettes are
+// rebuilt from the pixels afterwards.
+
+typedef struct RxiTileCandidate_ {
+	double cost;                  // cost of merging the candidate palette into this one
+	unsigned int index;           // index of the candidate palette's tile
+} RxiTileCandidate;
+
+typedef struct RxiTileQueueEntry_ {
+	double cost;                  // cost of the palette's best candidate merge
+	unsigned int index;           // index of the palette's tile
+	unsigned int version;         // version of the palette's candidate list this entry was made from
+} RxiTileQueueEntry;
+
+typedef struct RxiTileNeighborWork_ {
+	RxReduction *reduction;
+	RxiTile *tiles;
+	unsigned int nTiles;
+	double *features;             // summary of each tile's palette
+	RxiTileCandidate *candidates; // RX_TILE_NEIGHBORS candidates per tile
+	unsigned int *nCandidates;
+	volatile int *progress;
+	int progressBase;
+	volatile long nextTile;
+	volatile long nDone;
+} RxiTileNeighborWork;
+
+static double RxiTileMergeCost(RxReduction *reduction, const RxiTile *tiles, unsigned int index1, unsigned int index2) {
+	//cost of merging the palette of index2 into index1, as compared by RxiTileFindSimilarTiles
+	return RxiTileComputePaletteDifference(reduction, &tiles[index2], &tiles[index1]);
+}
+
+static void RxiTileComputeFeature(RxReduction *reduction, const RxiTile *tile, double *feature) {
+	//weighted mean and deviation of the palette's colors, scaled by the color difference weights
+	double w[3] = { sqrt(reduction->yWeight2), sqrt(reduction->iWeight2), sqrt(reduction->qWeight2) };
+	double sum[3] = { 0.0 }, sum2[3] = { 0.0 }, total = 0.0;
+
+	for (unsigned int i = 0; i < tile->nUsedColors; i++) {
+		double c[3] = { tile->palette[i].y, tile->palette[i].i, tile->palette[i].q };
+		double n = tile->useCounts[i];
+		for (int j = 0; j < 3; j++) {
+			sum[j] += n * c[j];
+			sum2[j] += n * c[j] * c[j];
+		}
+		total += n;
+	}
+
+	for (int j = 0; j < 3; j++) {
+		double mean = 0.0, var = 0.0;
+		if (total > 0.0) {
+			mean = sum[j] / total;
+			var = sum2[j] / total - mean * mean;
+		}
+		feature[j] = w[j] * mean;
+		feature[j + 3] = w[j] * sqrt(var > 0.0 ? var : 0.0);
+	}
+}
+
+static void RxiTileInsertCandidate(RxiTileCandidate *list, unsigned int *pnList, unsigned int maxList, double cost, unsigned int index) {
+	//keep the list sorted by cost, dropping the worst candidate when full
+	unsigned int n = *pnList;
+	if (n == maxList) {
+		if (cost >= list[n - 1].cost) return;
+		n--;
+	}
+
+	while (n > 0 && list[n - 1].cost > cost) {
+		list[n] = list[n - 1];
+		n--;
+	}
+	list[n].cost = cost;
+	list[n].index = index;
+	if (*pnList < maxList) (*pnList)++;
+}
+
+static void RxiTileNeighborWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) nWorkers;
+
+	RxiTileNeighborWork *work = (RxiTileNeighborWork *) param;
+	unsigned int nTiles = work->nTiles;
+
+	while (1) {
+		unsigned int i = (unsigned int) (ThAtomicIncrement(&work->nextTile) - 1);
+		if (i >= nTiles) break;
+
+		//find the tiles nearest in their color summary
+		RxiTileCandidate nearest[RX_TILE_CANDIDATES];
+		unsigned int nNearest = 0;
+		const double *f1 = work->features + i * 6;
+		for (unsigned int j = 0; j < nTiles; j++) {
+			if (j == i) continue;
+
+			const double *f2 = work->features + j * 6;
+			double dist = 0.0;
+			for (int k = 0; k < 6; k++) dist += (f1[k] - f2[k]) * (f1[k] - f2[k]);
+			RxiTileInsertCandidate(nearest, &nNearest, RX_TILE_CANDIDATES, dist, j);
+		}
+
+		//evaluate the merge costs of those
+		RxiTileCandidate *list = work->candidates + i * RX_TILE_NEIGHBORS;
+		for (unsigned int j = 0; j < nNearest; j++) {
+			double cost = RxiTileMergeCost(work->reduction, work->tiles, i, nearest[j].index);
+			RxiTileInsertCandidate(list, &work->nCandidates[i], RX_TILE_NEIGHBORS, cost, nearest[j].index);
+		}
+
+		long nDone = ThAtomicIncrement(&work->nDone);
+		if (iWorker == 0) *work->progress = work->progressBase + nDone;
+	}
+}
+
+static RxStatus RxiTileQueuePush(RxiTileQueueEntry **pQueue, unsigned int *pnQueue, unsigned int *pnMaxQueue, double cost, unsigned int index, unsigned int version) {
+	if (*pnQueue == *pnMaxQueue) {
+		unsigned int nMax = *pnMaxQueue * 2;
+		RxiTileQueueEntry *queue = (RxiTileQueueEntry *) realloc(*pQueue, nMax * sizeof(RxiTileQueueEntry));
+		if (queue == NULL) return RX_STATUS_NOMEM;
+
+		*pQueue = queue;
+		*pnMaxQueue = nMax;
+	}
+
+	//sift up. Ties are ordered by index, so that the result is deterministic.
+	RxiTileQueueEntry *queue = *pQueue;
+	unsigned int i = (*pnQueue)++;
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+		if (queue[parent].cost < cost || (queue[parent].cost == cost && queue[parent].index < index)) break;
+
+		queue[i] = queue[parent];
+		i = parent;
+	}
+	queue[i].cost = cost;
+	queue[i].index = index;
+	queue[i].version = version;
+	return RX_STATUS_OK;
+}
+
+static void RxiTileQueuePop(RxiTileQueueEntry *queue, unsigned int *pnQueue, RxiTileQueueEntry *out) {
+	*out = queue[0];
+	RxiTileQueueEntry last = queue[--(*pnQueue)];
+	unsigned int n = *pnQueue;
+
+	//sift down
+	unsigned int i = 0;
+	while (1) {
+		unsigned int child = i * 2 + 1;
+		if (child >= n) break;
+		if (child + 1 < n && (queue[child + 1].cost < queue[child].cost
+			|| (queue[child + 1].cost == queue[child].cost && queue[child + 1].index < queue[child].index))) child++;
+		if (last.cost < queue[child].cost || (last.cost == queue[child].cost && last.index < queue[child].index)) break;
+
+		queue[i] = queue[child];
+		i = child;
+	}
+	if (n > 0) queue[i] = last;
+}
+
+static void RxiTileMergeSummary(RxReduction *reduction, RxiTile *tiles, unsigned int nTiles, unsigned int index1, unsigned int index2, int nColsPerPalette) {
+	//merge the palette of index2 into index1, building the new palette from the colors of the two
+	//palettes weighted by the number of pixels they represent, rather than from the pixels.
+	int nSwitched = 0;
+	for (unsigned int i = 0; i < nTiles; i++) {
+		if (tiles[i].palIndex == index2) {
+			tiles[i].palIndex = index1;
+			nSwitched++;
+		}
+	}
+
+	RxiTile *rep1 = &tiles[index1], *rep2 = &tiles[index2];
+	RxHistInit(reduction);
+	for (unsigned int i = 0; i < rep1->nUsedColors; i++) {
+		if (rep1->useCounts[i] > 0) RxHistAddColor(reduction, &rep1->palette[i], rep1->useCounts[i]);
+	}
+	for (unsigned int i = 0; i < rep2->nUsedColors; i++) {
+		if (rep2->useCounts[i] > 0) RxHistAddColor(reduction, &rep2->palette[i], rep2->useCounts[i]);
+	}
+	RxHistFinalize(reduction);
+	RxComputePalette(reduction, nColsPerPalette);
+
+	//the colors of the old palettes are counted toward the new colors nearest them.
+	int useCounts[RX_PALETTE_MAX_SIZE] = { 0 };
+	RxYiqColor palette[RX_PALETTE_MAX_SIZE - 1];
+	unsigned int nUsedColors = reduction->nUsedColors;
+	for (unsigned int i = 0; i < RX_PALETTE_MAX_SIZE - 1; i++) {
+		RxConvertRgbToYiq(reduction->paletteRgb[i][0], &palette[i]);
+	}
+	for (unsigned int k = 0; k < 2; k++) {
+		const RxiTile *old = (k == 0) ? rep1 : rep2;
+		for (unsigned int i = 0; i < old->nUsedColors; i++) {
+			if (old->useCounts[i] == 0) continue;
+			useCounts[RxiPaletteFindClosestColor(reduction, palette, nUsedColors, &old->palette[i], NULL)] += old->useCounts[i];
+		}
+		useCounts[RX_PALETTE_MAX_SIZE - 1] += old->useCounts[RX_PALETTE_MAX_SIZE - 1];
+	}
+
+	memcpy(rep1->palette, palette, sizeof(palette));
+	memcpy(rep1->useCounts, useCounts, sizeof(useCounts));
+	rep1->nUsedColors = nUsedColors;
+	rep1->nSwallowed += nSwitched;
+}
+
+static RxStatus RxiTileMergeNeighbors(RxReduction *reduction, RxiTile *tiles, unsigned int nTiles, int nPalettes, int nColsPerPalette, volatile int *progress) {
+	RxStatus status = RX_STATUS_OK;
+	double *features = (double *) calloc(nTiles * 6, sizeof(double));
+	RxiTileCandidate *candidates = (RxiTileCandidate *) calloc(nTiles * RX_TILE_NEIGHBORS, sizeof(RxiTileCandidate));
+	unsigned int *nCandidates = (unsigned int *) calloc(nTiles, sizeof(unsigned int));
+	unsigned int *versions = (unsigned int *) calloc(nTiles, sizeof(unsigned int));
+	unsigned int *reps = (unsigned int *) calloc(nTiles, sizeof(unsigned int));
+	unsigned int *repPos = (unsigned int *) calloc(nTiles, sizeof(unsigned int));
+	unsigned int nMaxQueue = nTiles * 2;
+	RxiTileQueueEntry *queue = (RxiTileQueueEntry *) calloc(nMaxQueue, sizeof(RxiTileQueueEntry));
+	if (features == NULL || candidates == NULL || nCandidates == NULL || versions == NULL || reps == NULL || repPos == NULL || queue == NULL) {
+		status = RX_STATUS_NOMEM;
+		goto Cleanup;
+	}
+
+	// ----- STAGE 2: find the candidate merges of each palette
+	for (unsigned int i = 0; i < nTiles; i++) {
+		RxiTileComputeFeature(reduction, &tiles[i], features + i * 6);
+	}
+
+	RxiTileNeighborWork work = { 0 };
+	work.reduction = reduction;
+	work.tiles = tiles;
+	work.nTiles = nTiles;
+	work.features = features;
+	work.candidates = candidates;
+	work.nCandidates = nCandidates;
+	work.progress = progress;
+	work.progressBase = *progress;
+	ThRunWorkers(RxiTileNeighborWorker, &work, RxiGetThreadCount(reduction, nTiles));
+	*progress = work.progressBase + nTiles;
+
+	// ----- STAGE 3: merge palettes
+	unsigned int nQueue = 0, nReps = nTiles;
+	for (unsigned int i = 0; i < nTiles; i++) {
+		reps[i] = i;
+		repPos[i] = i;
+		if (nCandidates[i] == 0) continue;
+
+		status = RxiTileQueuePush(&queue, &nQueue, &nMaxQueue, candidates[i * RX_TILE_NEIGHBORS].cost, i, 0);
+		if (status != RX_STATUS_OK) goto Cleanup;
+	}
+
+	while (nReps > 1 && nQueue > 0) {
+		//take the best merge, skipping entries made stale by earlier merges
+		RxiTileQueueEntry top;
+		RxiTileQueuePop(queue, &nQueue, &top);
+		unsigned int index1 = top.index;
+		if (tiles[index1].palIndex != index1 || top.version != versions[index1]) continue;
+
+		RxiTileCandidate *list1 = candidates + index1 * RX_TILE_NEIGHBORS;
+		unsigned int index2 = list1[0].index;
+		double cost = list1[0].cost;
+
+		//same stopping condition as when comparing every pair of palettes
+		if (cost > 0.0 && (tiles[index1].nUsedColors + tiles[index2].nUsedColors) > (unsigned int) nColsPerPalette) {
+			if (nReps <= (unsigned int) nPalettes) break;
+		}
+
+		RxiTileMergeSummary(reduction, tiles, nTiles, index1, index2, nColsPerPalette);
+
+		//remove index2 from the palettes
+		unsigned int pos2 = repPos[index2];
+		reps[pos2] = reps[--nReps];
+		repPos[reps[pos2]] = pos2;
+
+		//the merged palette's candidates are those of both palettes merged.
+		RxiTileCandidate merged[2 * RX_TILE_NEIGHBORS];
+		unsigned int nMerged = 0;
+		RxiTileCandidate *list2 = candidates + index2 * RX_TILE_NEIGHBORS;
+		for (unsigned int i = 0; i < nCandidates[index1] + nCandidates[index2]; i++) {
+			unsigned int index = (i < nCandidates[index1]) ? list1[i].index : list2[i - nCandidates[index1]].index;
+			if (index == index1 || index == index2) continue;
+
+			RxBool dup = RX_FALSE;
+			for (unsigned int j = 0; j < nMerged && !dup; j++) dup = merged[j].index == index;
+			if (!dup) merged[nMerged++].index = index;
+		}
+		nCandidates[index2] = 0;
+		nCandidates[index1] = 0;
+
+		if (nMerged == 0) {
+			//no candidates left, compare against all remaining palettes
+			for (unsigned int i = 0; i < nReps; i++) {
+				if (reps[i] == index1) continue;
+				RxiTileInsertCandidate(list1, &nCandidates[index1], RX_TILE_NEIGHBORS, RxiTileMergeCost(reduction, tiles, index1, reps[i]), reps[i]);
+			}
+		} else {
+			for (unsigned int i = 0; i < nMerged; i++) {
+				double mergeCost = RxiTileMergeCost(reduction, tiles, index1, merged[i].index);
+				RxiTileInsertCandidate(list1, &nCandidates[index1], RX_TILE_NEIGHBORS, mergeCost, merged[i].index);
+			}
+		}
+		if (nCandidates[index1] > 0) {
+			status = RxiTileQueuePush(&queue, &nQueue, &nMaxQueue, list1[0].cost, index1, ++versions[index1]);
+			if (status != RX_STATUS_OK) goto Cleanup;
+		}
+
+		//update the palettes that had either merged palette as a candidate
+		for (unsigned int i = 0; i < nReps; i++) {
+			unsigned int index = reps[i];
+			if (index == index1) continue;
+
+			RxiTileCandidate *list = candidates + index * RX_TILE_NEIGHBORS;
+			unsigned int n = 0;
+			RxBool touched = RX_FALSE;
+			for (unsigned int j = 0; j < nCandidates[index]; j++) {
+				if (list[j].index == index1 || list[j].index == index2) {
+					touched = RX_TRUE;
+				} else {
+					list[n++] = list[j];
+				}
+			}
+			if (!touched) continue;
+
+			nCandidates[index] = n;
+			RxiTileInsertCandidate(list, &nCandidates[index], RX_TILE_NEIGHBORS, RxiTileMergeCost(reduction, tiles, index, index1), index1);
+			status = RxiTileQueuePush(&queue, &nQueue, &nMaxQueue, list[0].cost, index, ++versions[index]);
+			if (status != RX_STATUS_OK) goto Cleanup;
+		}
+
+		(*progress)++;
+	}
+
+Cleanup:
+	free(features);
+	free(candidates);
+	free(nCandidates);
+	free(versions);
+	free(reps);
+	free(repPos);
+	free(queue);
+	return status;
+}
+
+static COLOR32 RxiChooseMultiPaletteColor0(RxReduction *reduction) {
+	RxHistFinalize(reduction);
+
+	//get histogram colors
+	RxYiqColor *histCols = (RxYiqColor *) RxMemCalloc(reduction->histogram->nEntries, sizeof(RxYiqColor));
+	double *weights = (double *) calloc(reduction->histogram->nEntries, sizeof(double));
+	unsigned int nCol = RxHistGetTopN(reduction, reduction->histogram->nEntries, histCols, weights);
+
+	//weighted masked colors (bin by masking and accumulate weights)
+	RxHistClear(reduction);
+	RxHistInit(reduction);
+	for (unsigned int i = 0; i < nCol; i++) {
+		RxYiqColor maskYiq;
+		RxConvertRgbToYiq(RxiMaskYiqToRgb(reduction, &histCols[i]), &maskYiq);
+		RxHistAddColor(reduction, &maskYiq, weights[i]);
+	}
+	RxHistFinalize(reduction);
+
+	free(weights);
+	RxMemFree(histCols);
+
+	//get binned weights
+	RxYiqColor worst;
+	nCol = RxHistGetTopN(reduction, 1, &worst, NULL);
 
 	return RxiMaskYiqToRgb(reduction, &worst) | 0xFF000000;
 }
@@ -2466,6 +3447,88 @@ static int RxiPaletteLightnessComparator(const void *e1, const void *e2) {
 	return 0;
 }
 
+typedef struct RxiTileRefineWork_ {
+	RxReduction *reduction;         // reduction context used by worker 0
+	const RxBalanceSetting *balance;
+	const RxiTile *tiles;
+	unsigned int nTiles;
+	const RxYiqColor *yiqPalette;   // palettes to map tiles to
+	int *bestPalettes;              // palette of each tile
+	COLOR32 *palettes;              // palettes to regenerate
+	const RxBool *regenerate;       // palettes whose tiles have changed
+	int nPalettes;
+	int nColsPerPalette;
+	unsigned int nWriteColors;      // colors written to each regenerated palette
+	volatile int *progress;
+	int progressBase;
+	volatile long nextTile;
+	volatile long nextPalette;
+} RxiTileRefineWork;
+
+static void RxiTileMapWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) nWorkers;
+
+	RxiTileRefineWork *work = (RxiTileRefineWork *) param;
+	RxReduction *reduction = RxiTileGetWorkerReduction(work->reduction, work->balance, iWorker);
+	if (reduction == NULL) return;
+
+	while (1) {
+		unsigned int i = (unsigned int) (ThAtomicIncrement(&work->nextTile) - 1);
+		if (i >= work->nTiles) break;
+
+		int best = 0;
+		double bestError = RX_LARGE_NUMBER;
+
+		//compute histogram for the tile
+		RxHistClear(reduction);
+		RxHistAdd(reduction, work->tiles[i].rgb, 8, 8);
+		RxHistFinalize(reduction);
+
+		//determine which palette is best for this tile for remap
+		for (int j = 0; j < work->nPalettes; j++) {
+			double error = RxHistComputePaletteErrorYiq(reduction, work->yiqPalette + (j * RX_PALETTE_MAX_SIZE), work->nColsPerPalette, bestError);
+			if (error < bestError) {
+				bestError = error;
+				best = j;
+			}
+		}
+		work->bestPalettes[i] = best;
+	}
+
+	RxiTileReleaseWorkerReduction(reduction, iWorker);
+}
+
+static void RxiTileRegenerateWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) nWorkers;
+
+	RxiTileRefineWork *work = (RxiTileRefineWork *) param;
+	RxReduction *reduction = RxiTileGetWorkerReduction(work->reduction, work->balance, iWorker);
+	if (reduction == NULL) return;
+
+	while (1) {
+		long nClaimed = ThAtomicIncrement(&work->nextPalette);
+		int i = (int) (nClaimed - 1);
+		if (i >= work->nPalettes) break;
+
+		//progress is written from the calling thread only
+		if (iWorker == 0 && work->progress != NULL) *work->progress = work->progressBase + i;
+		if (!work->regenerate[i]) continue;
+
+		RxHistClear(reduction);
+		for (unsigned int j = 0; j < work->nTiles; j++) {
+			if (work->bestPalettes[j] != i) continue;
+			RxHistAdd(reduction, work->tiles[j].rgb, 8, 8);
+		}
+		RxHistFinalize(reduction);
+		RxComputePalette(reduction, work->nColsPerPalette);
+
+		//write back
+		RxiGetPalette0Rgb(reduction, work->palettes + i * RX_PALETTE_MAX_SIZE, work->nWriteColors);
+	}
+
+	RxiTileReleaseWorkerReduction(reduction, iWorker);
+}
+
 void RX_API RxCreateMultiplePalettes(
 	const COLOR32          *imgBits,
 	unsigned int            tilesX,
@@ -2512,163 +3575,79 @@ void RX_API RxCreateMultiplePalettes(
 	//	2 - map similarities
 	//	3 - palette merging
 
-	// ----- STAGE 1: create tile  data
-
-	unsigned int nTiles = tilesX * tilesY;
-	RxiTile *tiles = (RxiTile *) RxMemCalloc(nTiles, sizeof(RxiTile));
-	RxReduction *reduction = RxNew(balance);
-
-	for (unsigned int y = 0; y < tilesY; y++) {
-		for (unsigned int x = 0; x < tilesX; x++) {
-			RxiTile *tile = &tiles[x + (y * tilesX)];
-			const COLOR32 *pxOrigin = imgBits + x * 8 + (y * 8 * tilesX * 8);
-			RxiTileCopy(tile, pxOrigin, tilesX * 8);
-
-			RxHistClear(reduction);
-			RxHistAdd(reduction, tile->rgb, 8, 8);
-			RxHistFinalize(reduction);
-			RxComputePalette(reduction, nColsPerPalette);
-			for (unsigned int i = 0; i < RX_PALETTE_MAX_SIZE; i++) {
-				RxiColorCopy(&tile->palette[i], &reduction->paletteYiq[i][0]);
-			}
-
-			tile->nUsedColors = reduction->nUsedColors;
-
-			//match pixels to palette indices
-			for (unsigned int i = 0; i < 64; i++) {
-				unsigned int index = RxiPaletteFindClosestRgbColor(reduction, &tile->palette[0], tile->nUsedColors, tile->rgb[i], NULL);
-				if ((tile->rgb[i] >> 24) == 0) index = RX_PALETTE_MAX_SIZE - 1;
-				tile->indices[i] = (uint8_t) index;
-				tile->useCounts[index]++;
-			}
-			tile->palIndex = x + y * tilesX;
-			tile->nSwallowed = 1;
-		}
-	}
-
-	// ----- STAGE 2: create difference map
-	// We'll determine candidacy for palette merges using an nxn matrix of differences. Each entry
-	// in the diagonal is necessarily 0 since any palette is merged with itself without cost. The
-	// matrix is not symmetric, however, representing the different directions in which this relation
-	// is calculated.
-	double *diffBuff = (double *) calloc(nTiles * nTiles, sizeof(double));
-	for (unsigned int i = 0; i < nTiles; i++) {
-		RxiTile *tile1 = &tiles[i];
-		for (unsigned int j = 0; j < nTiles; j++) {
-			RxiTile *tile2 = &tiles[j];
-
-			//write difference
-			if (i == j) {
-				diffBuff[i + j * nTiles] = 0.0;
-			} else {
-				diffBuff[i + j * nTiles] = RxiTileComputePaletteDifference(reduction, tile1, tile2);
-			}
-		}
-		(*progress)++;
-	}
-
-	// ----- STAGE 3: merge palettes
-	// We'll select the most highly mergeable two palettes and merge them by creating a new palette
-	// using the combined histograms of represented tiles.
-	int nCurrentPalettes = nTiles;
-	while (nCurrentPalettes > 1) {
-		//find two best palettes to merge
-		unsigned int index1, index2;
-		double cost = RxiTileFindSimilarTiles(tiles, diffBuff, nTiles, &index1, &index2);
-
-		//we will continue to merge palettes even when we have are at or below the target count when
-		//we may merge more palettes at 0 cost, or when there exist palettes which may be merged losslessly
-		//to avoid palette waste.
-		if (cost > 0.0 && (tiles[index1].nUsedColors + tiles[index2].nUsedColors) > (unsigned int) nColsPerPalette) {
-			if (nCurrentPalettes <= nPalettes) break;
-		}
-
-		//find all instances of index2, replace with index1
-		int nSwitched = 0;
-		for (unsigned int i = 0; i < nTiles; i++) {
-			if (tiles[i].palIndex == index2) {
-				tiles[i].palIndex = index1;
-				nSwitched++;
-			}
-		}
-
-		//build new palette
-		RxHistClear(reduction);
-		for (unsigned int i = 0; i < nTiles; i++) {
-			if (tiles[i].palIndex == index1) {
-				RxHistAdd(reduction, tiles[i].rgb, 8, 8);
-			}
-		}
-		RxHistFinalize(reduction);
-		RxComputePalette(reduction, nColsPerPalette);
-
-		//write over the palette of the tile
-		RxiTile *palTile = &tiles[index1];
-		for (int i = 0; i < RX_PALETTE_MAX_SIZE - 1; i++) {
-			RxConvertRgbToYiq(reduction->paletteRgb[i][0], &palTile->palette[i]);
-		}
-		palTile->nUsedColors = reduction->nUsedColors;
-		palTile->nSwallowed += nSwitched;
-
-		//get new use count
-		RxiTile *rep = &tiles[index1];
-		memset(rep->useCounts, 0, sizeof(rep->useCounts));
-		for (unsigned int i = 0; i < nTiles; i++) {
-			RxiTile *tile = &tiles[i];
-			if (tile->palIndex != index1) continue;
-
-			for (int j = 0; j < 64; j++) {
-				COLOR32 col = tile->rgb[j];
-				int index = RxiPaletteFindClosestRgbColor(reduction, tile->palette, tile->nUsedColors, tile->rgb[j], NULL);
-				if ((col >> 24) == 0) index = RX_PALETTE_MAX_SIZE - 1;
-				tile->indices[j] = (uint8_t) index;
-				rep->useCounts[index]++;
-			}
-		}
+	// ----- STAGE 1: create tile  data
 
-		//recompute differences for index1 and representative tiles
-		for (unsigned int i = 0; i < nTiles; i++) {
-			RxiTile *t = &tiles[i];
-			if (t->palIndex != i) continue;
+	unsigned int nTiles = tilesX * tilesY;
+	RxiTile *tiles = (RxiTile *) RxMemCalloc(nTiles, sizeof(RxiTile));
+	RxReduction *reduction = RxNew(balance);
 
-			double diff1 = RxiTileComputePaletteDifference(reduction, t, rep);
-			double diff2 = RxiTileComputePaletteDifference(reduction, rep, t);
-			diffBuff[i + index1 * nTiles] = diff1;
-			diffBuff[index1 + i * nTiles] = diff2;
+	RxiTilePaletteWork tileWork = { 0 };
+	tileWork.reduction = reduction;
+	tileWork.balance = balance;
+	tileWork.imgBits = imgBits;
+	tileWork.tiles = tiles;
+	tileWork.tilesX = tilesX;
+	tileWork.nTiles = nTiles;
+	tileWork.nColsPerPalette = nColsPerPalette;
+	ThRunWorkers(RxiTilePaletteWorker, &tileWork, RxiGetThreadCount(reduction, nTiles));
+
+	//palette differences are computed for the palette size, which is set here rather than left to
+	//whichever worker ran on this context.
+	reduction->nPaletteColors = nColsPerPalette;
+
+	// ----- STAGES 2 and 3: map similarities and merge palettes
+	if (nTiles <= RX_TILE_EXACT_MAX) {
+		RxiTileMergeExact(reduction, tiles, nTiles, nPalettes, nColsPerPalette, progress);
+	} else {
+		RxStatus status = RxiTileMergeNeighbors(reduction, tiles, nTiles, nPalettes, nColsPerPalette, progress);
+		if (status != RX_STATUS_OK) {
+			RxFree(reduction);
+			RxMemFree(tiles);
+			return;
 		}
-
-		nCurrentPalettes--;
-		(*progress)++;
 	}
 
 	//get palette output from previous step
 	int nPalettesWritten = 0;
 	int outputOffs = max(paletteOffset, 1);
 	COLOR32 *palettes = (COLOR32 *) calloc(RX_TILE_PALETTE_COUNT_MAX * RX_PALETTE_MAX_SIZE, sizeof(COLOR32));
+	int *bestPalettes = (int *) calloc(nTiles, sizeof(int));
+	RxBool regenerate[RX_TILE_PALETTE_COUNT_MAX];
 
+	//rebuild palettes but with masking enabled
 	for (unsigned int i = 0; i < nTiles; i++) {
-		RxiTile *t = &tiles[i];
-		if (t->palIndex != i) continue;
+		if (tiles[i].palIndex != i) continue;
 
-		//rebuild palette but with masking enabled
-		RxHistClear(reduction);
 		for (unsigned int j = 0; j < nTiles; j++) {
-			if (tiles[j].palIndex == t->palIndex) {
-				RxHistAdd(reduction, tiles[j].rgb, 8, 8);
-			}
+			if (tiles[j].palIndex == i) bestPalettes[j] = nPalettesWritten;
 		}
-		RxHistFinalize(reduction);
-		RxComputePalette(reduction, nColsPerPalette);
-		
-		RxiGetPalette0Rgb(reduction, palettes + nPalettesWritten * RX_PALETTE_MAX_SIZE, RX_PALETTE_MAX_SIZE - 1);
-		nPalettesWritten++;
-		(*progress)++;
-	}
+		regenerate[nPalettesWritten++] = RX_TRUE;
+	}
+
+	RxiTileRefineWork refineWork = { 0 };
+	refineWork.reduction = reduction;
+	refineWork.balance = balance;
+	refineWork.tiles = tiles;
+	refineWork.nTiles = nTiles;
+	refineWork.bestPalettes = bestPalettes;
+	refineWork.palettes = palettes;
+	refineWork.regenerate = regenerate;
+	refineWork.nPalettes = nPalettesWritten;
+	refineWork.nColsPerPalette = nColsPerPalette;
+	refineWork.nWriteColors = RX_PALETTE_MAX_SIZE - 1;
+	refineWork.progress = progress;
+	refineWork.progressBase = *progress;
+	ThRunWorkers(RxiTileRegenerateWorker, &refineWork, RxiGetThreadCount(reduction, nPalettesWritten));
+	*progress = refineWork.progressBase + nPalettesWritten;
 
 	//palette refinement
 	int nRefinements = 8;
-	int *bestPalettes = (int *) calloc(nTiles, sizeof(int));
 	RxYiqColor *yiqPalette = (RxYiqColor *) RxMemCalloc(nPalettes, RX_PALETTE_MAX_SIZE * sizeof(RxYiqColor));
+	int *lastPalettes = (int *) calloc(nTiles, sizeof(int));
+	refineWork.yiqPalette = yiqPalette;
+	refineWork.nPalettes = nPalettes;
+	refineWork.nWriteColors = nColsPerPalette;
+	refineWork.progress = NULL;
 	for (int k = 0; k < nRefinements; k++) {
 		//palette to YIQ
 		for (int i = 0; i < nPalettes; i++) {
@@ -2678,44 +3657,28 @@ void RX_API RxCreateMultiplePalettes(
 		}
 
 		//find best palette for each tile again
-		for (unsigned int i = 0; i < nTiles; i++) {
-			RxiTile *t = &tiles[i];
-			COLOR32 *px = t->rgb;
-			int best = 0;
-			double bestError = RX_LARGE_NUMBER;
-
-			//compute histogram for the tile
-			RxHistClear(reduction);
-			RxHistAdd(reduction, px, 8, 8);
-			RxHistFinalize(reduction);
-
-			//determine which palette is best for this tile for remap
-			for (int j = 0; j < nPalettes; j++) {
-				double error = RxHistComputePaletteErrorYiq(reduction, yiqPalette + (j * RX_PALETTE_MAX_SIZE), nColsPerPalette, bestError);
-				if (error < bestError) {
-					bestError = error;
-					best = j;
-				}
-			}
-			bestPalettes[i] = best;
+		memcpy(lastPalettes, bestPalettes, nTiles * sizeof(int));
+		refineWork.nextTile = 0;
+		ThRunWorkers(RxiTileMapWorker, &refineWork, RxiGetThreadCount(reduction, nTiles));
+
+		//now that we have the new best palette indices, begin regenerating the palettes in a way
+		//pretty similar to before. A palette whose tiles are unchanged since it was last generated
+		//would come out the same, so it is kept.
+		RxBool anyChanged = RX_FALSE;
+		for (int i = 0; i < nPalettes; i++) regenerate[i] = (k == 0);
+		for (unsigned int j = 0; j < nTiles; j++) {
+			if (bestPalettes[j] == lastPalettes[j]) continue;
+			regenerate[bestPalettes[j]] = RX_TRUE;
+			regenerate[lastPalettes[j]] = RX_TRUE;
+			anyChanged = RX_TRUE;
 		}
+		if (k > 0 && !anyChanged) break;
 
-		//now that we have the new best palette indices, begin regenerating the palettes
-		//in a way pretty similar to before
-		for (int i = 0; i < nPalettes; i++) {
-			RxHistClear(reduction);
-			for (unsigned int j = 0; j < nTiles; j++) {
-				if (bestPalettes[j] != i) continue;
-				RxHistAdd(reduction, tiles[j].rgb, 8, 8);
-			}
-			RxHistFinalize(reduction);
-			RxComputePalette(reduction, nColsPerPalette);
-
-			//write back
-			RxiGetPalette0Rgb(reduction, palettes + i * RX_PALETTE_MAX_SIZE, nColsPerPalette);
-		}
+		refineWork.nextPalette = 0;
+		ThRunWorkers(RxiTileRegenerateWorker, &refineWork, RxiGetThreadCount(reduction, nPalettes));
 	}
 	RxMemFree(yiqPalette);
+	free(lastPalettes);
 
 	//a second histogram for accumulating per-color error
 	RxReduction *errHist = RxNew(balance);
@@ -2792,7 +3755,6 @@ void RX_API RxCreateMultiplePalettes(
 	RxFree(errHist);
 	RxFree(reduction);
 	RxMemFree(tiles);
-	free(diffBuff);
 }
 
 static inline double RxiDiffuseCurveY(double x) {
@@ -2817,6 +3779,510 @@ static inline double RxiDiffuseCurveA(double x) {
 	return RxiDiffuseCurveY(x * 511.0) * INV_511;
 }
 
+//number of analyzed rows buffered ahead of the error diffusion when dithering on multiple threads
+#define RX_DITHER_RING_ROWS    16
+
+static void RxiDitherConvertRow(RxReduction *reduction, const COLOR32 *img, unsigned int width, unsigned int height, unsigned int y, RxYiqColor *row) {
+	unsigned int nLayers = reduction->paletteLayers;
+	unsigned int nPxSrc = width * height;
+
+	for (unsigned int i = 0; i < nLayers; i++) {
+		const COLOR32 *rgbRow = img + i * nPxSrc + y * width;
+		RxConvertRowToYiq(rgbRow, &row[nLayers * 1 + i], width, nLayers);
+	}
+	RxiColorVecCopy(&row[nLayers * (0)], &row[nLayers * 1], nLayers);
+	RxiColorVecCopy(&row[nLayers * (width + 1)], &row[nLayers * width], nLayers);
+}
+
+static unsigned int RxiDitherSamplePixel(
+	RxReduction      *reduction,
+	const RxYiqColor *thisRow,
+	const RxYiqColor *lastRow,
+	unsigned int      x,
+	int               adaptive,
+	float             diffuse,
+	RxYiqColor       *colorYiq,
+	RxYiqColor       *scratch,
+	int              *pDither
+) {
+	//this part of the dithering depends only on the source image and not on the diffused error, so it may be
+	//computed ahead of the error diffusion. It returns the palette index to use when the pixel is not dithered.
+	unsigned int nLayers = reduction->paletteLayers;
+
+	//take a sample of pixels nearby. This will be a gauge of variance around this pixel, and help
+	//determine if dithering should happen. Weight the sampled pixels with respect to distance from center.
+	if (adaptive) {
+		for (unsigned int i = 0; i < nLayers; i++) {
+#ifndef RX_SIMD
+			colorYiq[i].y = (thisRow[nLayers * (x + 1) + i].y + thisRow[nLayers * (x + 2) + i].y + thisRow[nLayers * x + i].y + lastRow[nLayers * (x + 1) + i].y)
+				* 0.1875f + (lastRow[nLayers * (x + 0) + i].y + lastRow[nLayers * (x + 2) + i].y) * 0.125f;
+			colorYiq[i].i = (thisRow[nLayers * (x + 1) + i].i + thisRow[nLayers * (x + 2) + i].i + thisRow[nLayers * x + i].i + lastRow[nLayers * (x + 1) + i].i)
+				* 0.1875f + (lastRow[nLayers * (x + 0) + i].i + lastRow[nLayers * (x + 2) + i].i) * 0.125f;
+			colorYiq[i].q = (thisRow[nLayers * (x + 1) + i].q + thisRow[nLayers * (x + 2) + i].q + thisRow[nLayers * x + i].q + lastRow[nLayers * (x + 1) + i].q)
+				* 0.1875f + (lastRow[nLayers * (x + 0) + i].q + lastRow[nLayers * (x + 2) + i].q) * 0.125f;
+			colorYiq[i].a = (thisRow[nLayers * (x + 1) + i].a + thisRow[nLayers * (x + 2) + i].a + thisRow[nLayers * x + i].a + lastRow[nLayers * (x + 1) + i].a)
+				* 0.1875f + (lastRow[nLayers * (x + 0) + i].a + lastRow[nLayers * (x + 2) + i].a) * 0.125f;
+#else
+			__m128 vec1 = _mm_add_ps(_mm_add_ps(thisRow[nLayers * (x + 1) + i].yiq, thisRow[nLayers * (x + 2) + i].yiq),
+				_mm_add_ps(thisRow[nLayers * x + i].yiq, lastRow[nLayers * (x + 1) + i].yiq));
+			__m128 vec2 = _mm_add_ps(lastRow[nLayers * x + i].yiq, lastRow[nLayers * (x + 2) + i].yiq);
+
+			colorYiq[i].yiq = _mm_add_ps(_mm_mul_ps(vec1, _mm_set1_ps(0.1875f)), _mm_mul_ps(vec2, _mm_set1_ps(0.125f)));
+#endif
+		}
+	} else {
+		//no adaptive diffuse -> no local noise checking
+		RxiColorVecCopy(colorYiq, &thisRow[nLayers * (x + 1)], nLayers);
+	}
+
+	//match it to a palette color. We'll measure distance to it as well.
+	double paletteDistance = 0.0;
+	RxiPaletteFindClosestColorOnAccelEx(reduction, reduction->accel, colorYiq, scratch, &paletteDistance);
+
+	//now measure distance from the actual color to its average surroundings
+	const RxYiqColor *centerYiq = &thisRow[nLayers * (x + 1)];
+	double centerDistance = RxiComputeLayeredColorDifference(reduction, centerYiq, colorYiq) / nLayers;
+
+	//now test: Should we dither?
+	double yw2 = reduction->yWeight2;
+	if (diffuse > 0.0f && (!adaptive || (centerDistance < 110.0 * yw2 && paletteDistance >  2.0 * yw2))) {
+		*pDither = 1;
+		return 0;
+	}
+
+	//high noise area or dithering disabled, do not diffuse
+	*pDither = 0;
+	return RxiPaletteFindClosestColorOnAccelEx(reduction, reduction->accel, centerYiq, scratch, NULL);
+}
+
+static unsigned int RxiDitherDiffusePixel(
+	RxReduction *reduction,
+	RxYiqColor  *colorYiq,
+	RxYiqColor  *thisDiffuse,
+	RxYiqColor  *nextDiffuse,
+	unsigned int x,
+	int          hDirection,
+	int          adaptive,
+	float        diffuse,
+	RxFlag       flag,
+	RxYiqColor  *scratch
+) {
+	unsigned int nLayers = reduction->paletteLayers;
+
+	RxYiqColor diffuseVec[RX_PALETTE_MAX_COUNT];
+	RxiColorVecCopy(diffuseVec, &thisDiffuse[nLayers * (x + 1)], nLayers);
+
+	for (unsigned int i = 0; i < nLayers; i++) {
+		RxiColorScale(&diffuseVec[i], diffuse);
+
+		//in adaptive diffusion mode, we apply a tapering curve to the diffusion amount. This has the effect
+		//of reducing extreme noise that may result from dithering. The curves limit both the immediate
+		//intensity of diffusion, as well as the distance the diffusion travels. In cases where this would
+		//appear, it's usually unsightly anyways. Adaptive diffusion does not work well when the palette is not
+		//well-fit to the image data however, and color reduction error tends to be larger.
+		if (adaptive) {
+			diffuseVec[i].y = (float) RxiDiffuseCurveY(diffuseVec[i].y);
+			diffuseVec[i].i = (float) RxiDiffuseCurveI(diffuseVec[i].i);
+			diffuseVec[i].q = (float) RxiDiffuseCurveQ(diffuseVec[i].q);
+			diffuseVec[i].a = (float) RxiDiffuseCurveA(diffuseVec[i].a);
+		}
+
+		if (flag & RX_FLAG_NO_ALPHA_DITHER) {
+			//diffuse into the current color. We must unmultiply and remultiply by alpha. Doing this scales the
+			//error diffused by the alpha value of the source pixel (i.e. more transparent pixels diffuse less
+			//error to their neighbors), and the alpha diffusion is canceled.
+			if (colorYiq[i].a != 0.0f) {
+				float aFactor = 1.0f + diffuseVec[i].a / colorYiq[i].a;
+				colorYiq[i].y *= aFactor;
+				colorYiq[i].i *= aFactor;
+				colorYiq[i].q *= aFactor;
+			}
+
+			RxiColorScale(&diffuseVec[i], colorYiq[i].a + diffuseVec[i].a);
+			diffuseVec[i].a = 0.0f;
+		} else {
+			//alpha dithering is enabled, so we diffuse directly without adjustment.
+		}
+
+		//apply the diffusion
+#ifndef RX_SIMD
+		colorYiq[i].y += diffuseVec[i].y;
+		colorYiq[i].i += diffuseVec[i].i;
+		colorYiq[i].q += diffuseVec[i].q;
+		colorYiq[i].a += diffuseVec[i].a;
+#else
+		colorYiq[i].yiq = _mm_add_ps(colorYiq[i].yiq, diffuseVec[i].yiq);
+#endif
+
+		if (colorYiq[i].a < 0.0f) {
+			//normalize to alpha=0
+			RxiColorMakeTransparent(&colorYiq[i]);
+		} else {
+			//clamp Y channel
+			if (colorYiq[i].y < 0.0f) {
+				RxiColorMakeBlack(&colorYiq[i]);
+			} else if (colorYiq[i].y > 511.0f * colorYiq[i].a) {
+				RxiColorMakeWhite(&colorYiq[i]);
+			}
+
+			if (colorYiq[i].a > 1.0f) {
+				//normalize to alpha=1
+				RxiColorMakeOpaque(&colorYiq[i]);
+			}
+		}
+	}
+
+	//match to palette color
+	unsigned int matched = RxiPaletteFindClosestColorOnAccelEx(reduction, reduction->accel, colorYiq, scratch, NULL);
+	RxYiqColor *chosenYiq = &reduction->accel->plttLarge[matched * nLayers];
+
+	//now diffuse to neighbors (mirrored with the scan direction):
+	//        X  7/16
+	// 3/16 5/16 1/16
+	RxYiqColor *diffuse21 = &thisDiffuse[nLayers * (x + 1 + hDirection)];
+	RxYiqColor *diffuse12 = &nextDiffuse[nLayers * (x + 1)];
+	RxYiqColor *diffuse22 = &nextDiffuse[nLayers * (x + 1 + hDirection)];
+	RxYiqColor *diffuse02 = &nextDiffuse[nLayers * (x + 1 - hDirection)];
+
+	for (unsigned int i = 0; i < nLayers; i++) {
+		RxYiqColor off;
+
+		if (flag & RX_FLAG_NO_ALPHA_DITHER) {
+			//alpha is not dithered, so we un-premultiply the colors and scale to palette alpha.
+			if (colorYiq[i].a > 0.0f) {
+				float chosenA = chosenYiq[i].a;
+				off.y = colorYiq[i].y * chosenA / colorYiq[i].a - chosenYiq[i].y;
+				off.i = colorYiq[i].i * chosenA / colorYiq[i].a - chosenYiq[i].i;
+				off.q = colorYiq[i].q * chosenA / colorYiq[i].a - chosenYiq[i].q;
+				off.a = 0.0f;
+			} else {
+				//zero alpha, no color information to dither.
+				RxiColorMakeTransparent(&off);
+			}
+		} else {
+			//alpha is dithered, so we take the straight preultiplied difference to diffuse
+			//signal intensity.
+			RxiColorSubtract(&off, &colorYiq[i], &chosenYiq[i]);
+		}
+
+#ifndef RX_SIMD
+		diffuse21[i].y += off.y * 0.4375f; // 7/16
+		diffuse21[i].i += off.i * 0.4375f;
+		diffuse21[i].q += off.q * 0.4375f;
+		diffuse21[i].a += off.a * 0.4375f;
+		diffuse12[i].y += off.y * 0.3125f; // 5/16
+		diffuse12[i].i += off.i * 0.3125f;
+		diffuse12[i].q += off.q * 0.3125f;
+		diffuse12[i].a += off.a * 0.3125f;
+		diffuse02[i].y += off.y * 0.1875f; // 3/16
+		diffuse02[i].i += off.i * 0.1875f;
+		diffuse02[i].q += off.q * 0.1875f;
+		diffuse02[i].a += off.a * 0.1875f;
+		diffuse22[i].y += off.y * 0.0625f; // 1/16
+		diffuse22[i].i += off.i * 0.0625f;
+		diffuse22[i].q += off.q * 0.0625f;
+		diffuse22[i].a += off.a * 0.0625f;
+#else
+		diffuse21[i].yiq = _mm_add_ps(diffuse21[i].yiq, _mm_mul_ps(off.yiq, _mm_set1_ps(0.4375f))); // 7/16
+		diffuse12[i].yiq = _mm_add_ps(diffuse12[i].yiq, _mm_mul_ps(off.yiq, _mm_set1_ps(0.3125f))); // 5/16
+		diffuse02[i].yiq = _mm_add_ps(diffuse02[i].yiq, _mm_mul_ps(off.yiq, _mm_set1_ps(0.1875f))); // 3/16
+		diffuse22[i].yiq = _mm_add_ps(diffuse22[i].yiq, _mm_mul_ps(off.yiq, _mm_set1_ps(0.0625f))); // 1/16
+#endif
+	}
+
+	return matched;
+}
+
+static void RxiDitherPutPixel(RxReduction *reduction, COLOR32 *img, int *indices, unsigned int width, unsigned int height, unsigned int x, unsigned int y, unsigned int matched, RxFlag flag) {
+	unsigned int nLayers = reduction->paletteLayers;
+	unsigned int nPxSrc = width * height;
+
+	if (!(flag & RX_FLAG_NO_WRITEBACK)) {
+		for (unsigned int i = 0; i < nLayers; i++) {
+			COLOR32 chosen = RxPaletteGetColor(reduction, i, matched);
+
+			COLOR32 *imgI = img + i * nPxSrc;
+			if (flag & RX_FLAG_NO_PRESERVE_ALPHA) imgI[x + y * width] = chosen;
+			else imgI[x + y * width] = (chosen & 0x00FFFFFF) | (imgI[x + y * width] & 0xFF000000);
+		}
+	}
+
+	//put palette index
+	if (indices != NULL) indices[x + y * width] = matched;
+}
+
+typedef struct RxiDitherWork_ {
+	RxReduction   *reduction;
+	COLOR32       *img;
+	int           *indices;
+	unsigned int   width;
+	unsigned int   height;
+	RxFlag         flag;
+	float          diffuse;
+	int            adaptive;
+	unsigned int   nSlots;        // number of rows in the ring of analyzed rows
+	RxYiqColor    *slotColors;    // sampled colors of each ring row
+	unsigned int  *slotMatched;   // undithered matches of each ring row, later the final matches
+	unsigned char *slotDither;    // dither decision of each ring row
+	RxYiqColor    *scratch;       // per-worker row buffers and search scratch
+	unsigned int   scratchSize;   // size of each worker's scratch, in colors
+	RxYiqColor    *diffuseRows;   // the two diffuse vectors
+	volatile long *claimed;       // per-row claim tickets for analysis
+	volatile long *ready;         // per-row analysis completion flags
+	volatile long  nextRow;       // next row to be considered for analysis
+	volatile long  released;      // number of rows written back (their ring rows may be reused)
+} RxiDitherWork;
+
+static void RxiDitherAnalyzeRow(RxiDitherWork *work, unsigned int y, RxYiqColor *scratch) {
+	RxReduction *reduction = work->reduction;
+	unsigned int nLayers = reduction->paletteLayers;
+	unsigned int width = work->width;
+	unsigned int slot = y % work->nSlots;
+
+	RxYiqColor *thisRow = scratch;
+	RxYiqColor *lastRow = thisRow + (width + 2) * nLayers;
+	RxYiqColor *search = lastRow + (width + 2) * nLayers;
+
+	//the first row uses itself as the previous row, as in the serial diffuser.
+	RxiDitherConvertRow(reduction, work->img, width, work->height, y, thisRow);
+	RxiDitherConvertRow(reduction, work->img, width, work->height, y ? (y - 1) : 0, lastRow);
+
+	RxYiqColor *colors = work->slotColors + slot * width * nLayers;
+	unsigned int *matched = work->slotMatched + slot * width;
+	unsigned char *dither = work->slotDither + slot * width;
+	for (unsigned int x = 0; x < width; x++) {
+		int doDither;
+		matched[x] = RxiDitherSamplePixel(reduction, thisRow, lastRow, x, work->adaptive, work->diffuse, &colors[x * nLayers], search, &doDither);
+		dither[x] = doDither;
+	}
+}
+
+static void RxiDitherPutRow(RxiDitherWork *work, unsigned int y) {
+	unsigned int slot = y % work->nSlots;
+	unsigned int *matched = work->slotMatched + slot * work->width;
+
+	for (unsigned int x = 0; x < work->width; x++) {
+		RxiDitherPutPixel(work->reduction, work->img, work->indices, work->width, work->height, x, y, matched[x], work->flag);
+	}
+}
+
+static void RxiDitherWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) nWorkers;
+	RxiDitherWork *work = (RxiDitherWork *) param;
+	RxReduction *reduction = work->reduction;
+	RxYiqColor *scratch = work->scratch + iWorker * work->scratchSize;
+	unsigned int width = work->width, height = work->height;
+
+	if (iWorker > 0) {
+		//workers analyze rows ahead of the error diffusion. A row is only analyzed once its ring row has been
+		//written back, and only by whichever worker claims its ticket first.
+		for (;;) {
+			long y = ThAtomicIncrement(&work->nextRow) - 1;
+			if (y >= (long) height) break;
+
+			while (y >= ThAtomicLoad(&work->released) + (long) work->nSlots) ThYield();
+			if (ThAtomicIncrement(&work->claimed[y]) != 1) continue;
+
+			RxiDitherAnalyzeRow(work, y, scratch);
+			ThAtomicStore(&work->ready[y], 1);
+		}
+		return;
+	}
+
+	//worker 0 runs the error diffusion in the same serpentine order as the serial diffuser. Since the scan
+	//direction alternates, each row depends on the whole of the row before it, so only the analysis runs
+	//concurrently.
+	unsigned int nLayers = reduction->paletteLayers;
+	RxYiqColor *thisDiffuse = work->diffuseRows;
+	RxYiqColor *nextDiffuse = thisDiffuse + (width + 2) * nLayers;
+
+	for (unsigned int y = 0; y < height; y++) {
+		if (!ThAtomicLoad(&work->ready[y])) {
+			if (ThAtomicIncrement(&work->claimed[y]) == 1) {
+				//not yet taken by a worker, analyze it here.
+				RxiDitherAnalyzeRow(work, y, scratch);
+			} else {
+				while (!ThAtomicLoad(&work->ready[y])) ThYield();
+			}
+		}
+
+		//the analysis of this row has read the previous row's source pixels, so it may now be written.
+		if (y > 0) {
+			RxiDitherPutRow(work, y - 1);
+			ThAtomicStore(&work->released, y);
+		}
+
+		unsigned int slot = y % work->nSlots;
+		RxYiqColor *colors = work->slotColors + slot * width * nLayers;
+		unsigned int *matched = work->slotMatched + slot * width;
+		unsigned char *dither = work->slotDither + slot * width;
+
+		int hDirection = (y & 1) ? -1 : 1;
+		unsigned int x = (hDirection == 1) ? 0 : (width - 1);
+		for (unsigned int xPx = 0; xPx < width; xPx++) {
+			if (dither[x]) {
+				matched[x] = RxiDitherDiffusePixel(reduction, &colors[x * nLayers], thisDiffuse, nextDiffuse, x, hDirection,
+					work->adaptive, work->diffuse, work->flag, reduction->tempLayeredColor);
+			}
+			x += hDirection;
+		}
+
+		//swap row buffers
+		RxYiqColor *temp = nextDiffuse;
+		nextDiffuse = thisDiffuse;
+		thisDiffuse = temp;
+		memset(nextDiffuse, 0, nLayers * (width + 2) * sizeof(RxYiqColor));
+		RxiUpdateProgress(reduction, y + 1, height);
+	}
+
+	RxiDitherPutRow(work, height - 1);
+}
+
+static RxStatus RxiReduceImageUndithered(
+	RxReduction *reduction,
+	COLOR32     *img,
+	int         *indices,
+	unsigned int width,
+	unsigned int height,
+	RxFlag       flag,
+	RxYiqColor  *scratch,
+	RxBool       progress
+) {
+	unsigned int nLayers = reduction->paletteLayers;
+	unsigned int nPxSrc = width * height;
+
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) {
+			unsigned int matched;
+			if (nLayers == 1) {
+				//single layer: may be served from the palette's lookup cache
+				matched = RxiPaletteLookupColor(reduction, reduction->accel, img[x + y * width], scratch);
+			} else {
+				RxYiqColor colorYiq[RX_PALETTE_MAX_COUNT];
+				for (unsigned int i = 0; i < nLayers; i++) {
+					RxConvertRgbToYiq(img[i * nPxSrc + x + y * width], &colorYiq[i]);
+				}
+				matched = RxiPaletteFindClosestColorOnAccelEx(reduction, reduction->accel, colorYiq, scratch, NULL);
+			}
+
+			RxiDitherPutPixel(reduction, img, indices, width, height, x, y, matched, flag);
+		}
+		if (progress) RxiUpdateProgress(reduction, y + 1, height);
+	}
+
+	return RX_STATUS_OK;
+}
+
+static RxStatus RxiReduceImageParallel(
+	RxReduction *reduction,
+	COLOR32     *img,
+	int         *indices,
+	unsigned int width,
+	unsigned int height,
+	RxFlag       flag,
+	float        diffuse,
+	unsigned int nThreads
+) {
+	unsigned int nLayers = reduction->paletteLayers;
+
+	RxiDitherWork work = { 0 };
+	work.reduction = reduction;
+	work.img = img;
+	work.indices = indices;
+	work.width = width;
+	work.height = height;
+	work.flag = flag;
+	work.diffuse = diffuse;
+	work.adaptive = !(flag & RX_FLAG_NO_ADAPTIVE_DIFFUSE);
+	work.nSlots = height < RX_DITHER_RING_ROWS ? height : RX_DITHER_RING_ROWS;
+	work.scratchSize = 2 * (width + 2) * nLayers + nLayers;
+
+	work.slotColors = (RxYiqColor *) RxMemCalloc(work.nSlots * width * nLayers, sizeof(RxYiqColor));
+	work.slotMatched = (unsigned int *) RxMemCalloc(work.nSlots * width, sizeof(unsigned int));
+	work.slotDither = (unsigned char *) RxMemCalloc(work.nSlots * width, sizeof(unsigned char));
+	work.scratch = (RxYiqColor *) RxMemCalloc(nThreads * work.scratchSize, sizeof(RxYiqColor));
+	work.diffuseRows = (RxYiqColor *) RxMemCalloc(2 * (width + 2) * nLayers, sizeof(RxYiqColor));
+	work.claimed = (volatile long *) RxMemCalloc(height, sizeof(long));
+	work.ready = (volatile long *) RxMemCalloc(height, sizeof(long));
+
+	RxStatus status = RX_STATUS_NOMEM;
+	if (work.slotColors != NULL && work.slotMatched != NULL && work.slotDither != NULL && work.scratch != NULL
+		&& work.diffuseRows != NULL && work.claimed != NULL && work.ready != NULL) {
+		ThRunWorkers(RxiDitherWorker, &work, nThreads);
+		status = RX_STATUS_OK;
+	}
+
+	RxMemFree(work.slotColors);
+	RxMemFree(work.slotMatched);
+	RxMemFree(work.slotDither);
+	RxMemFree(work.scratch);
+	RxMemFree(work.diffuseRows);
+	RxMemFree((void *) work.claimed);
+	RxMemFree((void *) work.ready);
+	return status;
+}
+
+static void RxiReduceImageSerial(
+	RxReduction *reduction,
+	COLOR32     *img,
+	int         *indices,
+	unsigned int width,
+	unsigned int height,
+	RxFlag       flag,
+	float        diffuse,
+	RxYiqColor  *rowbuf,
+	RxYiqColor  *scratch,
+	RxBool       progress
+) {
+	//rowbuf holds 4 cleared rows of (width+2)*paletteLayers colors, and scratch holds paletteLayers colors.
+	int adaptive = !(flag & RX_FLAG_NO_ADAPTIVE_DIFFUSE);
+	unsigned int nLayers = reduction->paletteLayers;
+
+	//each of the four row buffers:
+	RxYiqColor *thisRow = rowbuf;                                   // the color vector for the current scanline
+	RxYiqColor *lastRow = thisRow + (width + 2) * nLayers;          // the color vector for the previous scanline
+	RxYiqColor *thisDiffuse = lastRow + (width + 2) * nLayers;      // the diffuse vector for the current scanline
+	RxYiqColor *nextDiffuse = thisDiffuse + (width + 2) * nLayers;  // the diffuse vector for the next scanline
+
+	//fill the previous-row buffer with the first row, to make sure we don't run out of bounds
+	RxiDitherConvertRow(reduction, img, width, height, 0, lastRow);
+
+	//start dithering, do so in a serpentine path.
+	for (unsigned int y = 0; y < height; y++) {
+
+		//which direction?
+		int hDirection = (y & 1) ? -1 : 1;
+		RxiDitherConvertRow(reduction, img, width, height, y, thisRow);
+
+		//scan across
+		unsigned int startPos = (hDirection == 1) ? 0 : (width - 1);
+		unsigned int x = startPos;
+		for (unsigned int xPx = 0; xPx < width; xPx++) {
+			RxYiqColor colorYiq[RX_PALETTE_MAX_COUNT];
+
+			int dither;
+			unsigned int matched = RxiDitherSamplePixel(reduction, thisRow, lastRow, x, adaptive, diffuse, colorYiq, scratch, &dither);
+			if (dither) {
+				matched = RxiDitherDiffusePixel(reduction, colorYiq, thisDiffuse, nextDiffuse, x, hDirection, adaptive, diffuse, flag, scratch);
+			}
+
+			//put pixel
+			RxiDitherPutPixel(reduction, img, indices, width, height, x, y, matched, flag);
+			x += hDirection;
+		}
+
+		//swap row buffers
+		RxYiqColor *temp = thisRow;
+		thisRow = lastRow;
+		lastRow = temp;
+		temp = nextDiffuse;
+		nextDiffuse = thisDiffuse;
+		thisDiffuse = temp;
+		memset(nextDiffuse, 0, nLayers * (width + 2) * sizeof(RxYiqColor));
+		if (progress) RxiUpdateProgress(reduction, y + 1, height);
+	}
+}
+
 RxStatus RX_API RxGlbReduceImage(
 	COLOR32                *img,
 	int                    *indices,
@@ -2846,22 +4312,15 @@ RxStatus RX_API RxGlbReduceImage(
 	return status;
 }
 
-RxStatus RX_API RxReduceImage(
+static RxStatus RxiReduceImage(
 	RxReduction *reduction,
 	COLOR32     *img,
 	int         *indices,
 	unsigned int width,
 	unsigned int height,
 	RxFlag       flag,
-	float        diffuse
-) {
-	//decode flags
-	int touchAlpha = (flag & RX_FLAG_NO_PRESERVE_ALPHA);
-	int adaptive = !(flag & RX_FLAG_NO_ADAPTIVE_DIFFUSE);
-
-	//the context must have an active palette.
-	if (reduction->accel == NULL) return RX_STATUS_INCORRECT_STATE;
-
+	float        diffuse
+) {
 	//initial progress
 	RxiUpdateProgress(reduction, 0, height);
 
@@ -2869,8 +4328,20 @@ RxStatus RX_API RxReduceImage(
 	//a 0-line bitmap may be trivially indexed.
 	if (height == 0) return RX_STATUS_OK;
 
+	if (diffuse <= 0.0f) {
+		//without error diffusion, each pixel is mapped to its closest palette color independently.
+		return RxiReduceImageUndithered(reduction, img, indices, width, height, flag, reduction->tempLayeredColor, RX_TRUE);
+	}
+
+	if (flag & RX_FLAG_PARALLEL_DIFFUSE) {
+		//analyze rows on worker threads ahead of the error diffusion. This needs at least two rows in the ring.
+		unsigned int nThreads = RxiGetThreadCount(reduction, height);
+		if (nThreads > 1 && height > 1) {
+			return RxiReduceImageParallel(reduction, img, indices, width, height, flag, diffuse, nThreads);
+		}
+	}
+
 	unsigned int nLayers = reduction->paletteLayers;
-	unsigned int nPxSrc = width * height;
 
 	//allocate the 4 row buffers
 	unsigned int linebufSize = 4 * (width + 2) * nLayers;
@@ -2889,251 +4360,141 @@ RxStatus RX_API RxReduceImage(
 		memset(rowbuf, 0, linebufSize * sizeof(RxYiqColor));
 	}
 
-	//each of the four row buffers:
-	RxYiqColor *thisRow = rowbuf;                                   // the color vector for the current scanline
-	RxYiqColor *lastRow = thisRow + (width + 2) * nLayers;          // the color vector for the previous scanline
-	RxYiqColor *thisDiffuse = lastRow + (width + 2) * nLayers;      // the diffuse vector for the current scanline
-	RxYiqColor *nextDiffuse = thisDiffuse + (width + 2) * nLayers;  // the diffuse vector for the next scanline
-
-	//fill the previous-row buffer with the first row, to make sure we don't run out of bounds
-	for (unsigned int i = 0; i < nLayers; i++) {
-		COLOR32 *rgbRow = img + i * nPxSrc + 0 * width;
-
-		for (unsigned int x = 0; x < width; x++) {
-			RxConvertRgbToYiq(rgbRow[x], &lastRow[nLayers * (x + 1) + i]);
-		}
-	}
-	RxiColorVecCopy(&lastRow[nLayers * (0)], &lastRow[nLayers * 1], nLayers);
-	RxiColorVecCopy(&lastRow[nLayers * (width + 1)], &lastRow[nLayers * width], nLayers);
+	RxiReduceImageSerial(reduction, img, indices, width, height, flag, diffuse, rowbuf, reduction->tempLayeredColor, RX_TRUE);
 
-	//start dithering, do so in a serpentine path.
-	for (unsigned int y = 0; y < height; y++) {
+	if (rowbuf != reduction->imgBuffer) RxMemFree(rowbuf);
+	return RX_STATUS_OK;
+}
 
-		//which direction?
-		int hDirection = (y & 1) ? -1 : 1;
+RxStatus RX_API RxReduceImage(
+	RxReduction *reduction,
+	COLOR32     *img,
+	int         *indices,
+	unsigned int width,
+	unsigned int height,
+	RxFlag       flag,
+	float        diffuse
+) {
+	//the context must have an active palette.
+	if (reduction->accel == NULL) return RX_STATUS_INCORRECT_STATE;
 
-		for (unsigned int i = 0; i < nLayers; i++) {
-			COLOR32 *rgbRow = img + i * nPxSrc + y * width;
+	double start = RxiStatsGetTime(reduction);
+	RxStatus status = RxiReduceImage(reduction, img, indices, width, height, flag, diffuse);
+	if (reduction->stats != NULL) reduction->stats->ditherTime += ThGetTime() - start;
+	return status;
+}
 
-			for (unsigned int x = 0; x < width; x++) {
-				RxConvertRgbToYiq(rgbRow[x], &thisRow[nLayers * (x + 1) + i]);
-			}
-		}
-		RxiColorVecCopy(&thisRow[nLayers * (0)], &thisRow[nLayers * 1], nLayers);
-		RxiColorVecCopy(&thisRow[nLayers * (width + 1)], &thisRow[nLayers * width], nLayers);
+//images of a batch are reduced concurrently, one image per worker at a time. Each image is reduced exactly
+//as RxReduceImage would, so the result does not depend on the number of threads.
+typedef struct RxiReduceBatchWork_ {
+	RxReduction         *reduction;
+	COLOR32 *const      *images;
+	int *const          *indices;
+	const unsigned int  *widths;
+	const unsigned int  *heights;
+	unsigned int         nImages;
+	RxFlag               flag;
+	float                diffuse;
+	volatile long        nextImage;  // next image to be claimed by a worker
+	volatile long        nDone;      // number of images completed
+	volatile long        status;     // first error encountered
+} RxiReduceBatchWork;
+
+static void RxiReduceBatchWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) nWorkers;
+	RxiReduceBatchWork *work = (RxiReduceBatchWork *) param;
+	RxReduction *reduction = work->reduction;
+	unsigned int nLayers = reduction->paletteLayers;
+	RxYiqColor scratch[RX_PALETTE_MAX_COUNT];
 
-		//scan across
-		unsigned int startPos = (hDirection == 1) ? 0 : (width - 1);
-		unsigned int x = startPos;
-		for (unsigned int xPx = 0; xPx < width; xPx++) {
-			//take a sample of pixels nearby. This will be a gauge of variance around this pixel, and help
-			//determine if dithering should happen. Weight the sampled pixels with respect to distance from center.
+	for (;;) {
+		long i = ThAtomicIncrement(&work->nextImage) - 1;
+		if (i >= (long) work->nImages) break;
 
-			RxYiqColor colorYiq[RX_PALETTE_MAX_COUNT];
-			if (adaptive) {
-				for (unsigned int i = 0; i < nLayers; i++) {
-#ifndef RX_SIMD
-					colorYiq[i].y = (thisRow[nLayers * (x + 1) + i].y + thisRow[nLayers * (x + 2) + i].y + thisRow[nLayers * x + i].y + lastRow[nLayers * (x + 1) + i].y)
-						* 0.1875f + (lastRow[nLayers * (x + 0) + i].y + lastRow[nLayers * (x + 2) + i].y) * 0.125f;
-					colorYiq[i].i = (thisRow[nLayers * (x + 1) + i].i + thisRow[nLayers * (x + 2) + i].i + thisRow[nLayers * x + i].i + lastRow[nLayers * (x + 1) + i].i)
-						* 0.1875f + (lastRow[nLayers * (x + 0) + i].i + lastRow[nLayers * (x + 2) + i].i) * 0.125f;
-					colorYiq[i].q = (thisRow[nLayers * (x + 1) + i].q + thisRow[nLayers * (x + 2) + i].q + thisRow[nLayers * x + i].q + lastRow[nLayers * (x + 1) + i].q)
-						* 0.1875f + (lastRow[nLayers * (x + 0) + i].q + lastRow[nLayers * (x + 2) + i].q) * 0.125f;
-					colorYiq[i].a = (thisRow[nLayers * (x + 1) + i].a + thisRow[nLayers * (x + 2) + i].a + thisRow[nLayers * x + i].a + lastRow[nLayers * (x + 1) + i].a)
-						* 0.1875f + (lastRow[nLayers * (x + 0) + i].a + lastRow[nLayers * (x + 2) + i].a) * 0.125f;
-#else
-					__m128 vec1 = _mm_add_ps(_mm_add_ps(thisRow[nLayers * (x + 1) + i].yiq, thisRow[nLayers * (x + 2) + i].yiq),
-						_mm_add_ps(thisRow[nLayers * x + i].yiq, lastRow[nLayers * (x + 1) + i].yiq));
-					__m128 vec2 = _mm_add_ps(lastRow[nLayers * x + i].yiq, lastRow[nLayers * (x + 2) + i].yiq);
+		COLOR32 *img = work->images[i];
+		int *indices = work->indices != NULL ? work->indices[i] : NULL;
+		unsigned int width = work->widths[i], height = work->heights[i];
 
-					colorYiq[i].yiq = _mm_add_ps(_mm_mul_ps(vec1, _mm_set1_ps(0.1875f)), _mm_mul_ps(vec2, _mm_set1_ps(0.125f)));
-#endif
-				}
+		if (width > 0 && height > 0 && ThAtomicLoad(&work->status) == RX_STATUS_OK) {
+			if (work->diffuse <= 0.0f) {
+				RxiReduceImageUndithered(reduction, img, indices, width, height, work->flag, scratch, RX_FALSE);
 			} else {
-				//no adaptive diffuse -> no local noise checking
-				RxiColorVecCopy(colorYiq, &thisRow[nLayers * (x + 1)], nLayers);
-			}
-
-			//match it to a palette color. We'll measure distance to it as well.
-			double paletteDistance = 0.0;
-			unsigned int matched = RxPaletteFindClosestColorYiq(reduction, colorYiq, &paletteDistance);
-
-			//now measure distance from the actual color to its average surroundings
-			RxYiqColor *centerYiq = &thisRow[nLayers * (x + 1)];
-			double centerDistance = RxiComputeLayeredColorDifference(reduction, centerYiq, colorYiq) / nLayers;
-
-			//now test: Should we dither?
-			double yw2 = reduction->yWeight2;
-			if (diffuse > 0.0f && (!adaptive || (centerDistance < 110.0 * yw2 && paletteDistance >  2.0 * yw2))) {
-				RxYiqColor diffuseVec[RX_PALETTE_MAX_COUNT];
-				RxiColorVecCopy(diffuseVec, &thisDiffuse[nLayers * (x + 1)], nLayers);
-
-				for (unsigned int i = 0; i < nLayers; i++) {
-					RxiColorScale(&diffuseVec[i], diffuse);
-
-					//in adaptive diffusion mode, we apply a tapering curve to the diffusion amount. This has the effect
-					//of reducing extreme noise that may result from dithering. The curves limit both the immediate
-					//intensity of diffusion, as well as the distance the diffusion travels. In cases where this would
-					//appear, it's usually unsightly anyways. Adaptive diffusion does not work well when the palette is not
-					//well-fit to the image data however, and color reduction error tends to be larger.
-					if (adaptive) {
-						diffuseVec[i].y = (float) RxiDiffuseCurveY(diffuseVec[i].y);
-						diffuseVec[i].i = (float) RxiDiffuseCurveI(diffuseVec[i].i);
-						diffuseVec[i].q = (float) RxiDiffuseCurveQ(diffuseVec[i].q);
-						diffuseVec[i].a = (float) RxiDiffuseCurveA(diffuseVec[i].a);
-					}
-
-					if (flag & RX_FLAG_NO_ALPHA_DITHER) {
-						//diffuse into the current color. We must unmultiply and remultiply by alpha. Doing this scales the
-						//error diffused by the alpha value of the source pixel (i.e. more transparent pixels diffuse less
-						//error to their neighbors), and the alpha diffusion is canceled.
-						if (colorYiq[i].a != 0.0f) {
-							float aFactor = 1.0f + diffuseVec[i].a / colorYiq[i].a;
-							colorYiq[i].y *= aFactor;
-							colorYiq[i].i *= aFactor;
-							colorYiq[i].q *= aFactor;
-						}
-
-						RxiColorScale(&diffuseVec[i], colorYiq[i].a + diffuseVec[i].a);
-						diffuseVec[i].a = 0.0f;
-					} else {
-						//alpha dithering is enabled, so we diffuse directly without adjustment.
-					}
-
-					//apply the diffusion
-#ifndef RX_SIMD
-					colorYiq[i].y += diffuseVec[i].y;
-					colorYiq[i].i += diffuseVec[i].i;
-					colorYiq[i].q += diffuseVec[i].q;
-					colorYiq[i].a += diffuseVec[i].a;
-#else
-					colorYiq[i].yiq = _mm_add_ps(colorYiq[i].yiq, diffuseVec[i].yiq);
-#endif
-
-					if (colorYiq[i].a < 0.0f) {
-						//normalize to alpha=0
-						RxiColorMakeTransparent(&colorYiq[i]);
-					} else {
-						//clamp Y channel
-						if (colorYiq[i].y < 0.0f) {
-							RxiColorMakeBlack(&colorYiq[i]);
-						} else if (colorYiq[i].y > 511.0f * colorYiq[i].a) {
-							RxiColorMakeWhite(&colorYiq[i]);
-						}
-
-						if (colorYiq[i].a > 1.0f) {
-							//normalize to alpha=1
-							RxiColorMakeOpaque(&colorYiq[i]);
-						}
-					}
-				}
-
-				//match to palette color
-				matched = RxPaletteFindClosestColorYiq(reduction, colorYiq, NULL);
-				RxYiqColor *chosenYiq = &reduction->accel->plttLarge[matched * nLayers];
-
-				//now diffuse to neighbors (mirrored with the scan direction):
-				//        X  7/16
-				// 3/16 5/16 1/16
-				RxYiqColor *diffuse21 = &thisDiffuse[nLayers * (x + 1 + hDirection)];
-				RxYiqColor *diffuse12 = &nextDiffuse[nLayers * (x + 1)];
-				RxYiqColor *diffuse22 = &nextDiffuse[nLayers * (x + 1 + hDirection)];
-				RxYiqColor *diffuse02 = &nextDiffuse[nLayers * (x + 1 - hDirection)];
-
-				for (unsigned int i = 0; i < nLayers; i++) {
-					RxYiqColor off;
-
-					if (flag & RX_FLAG_NO_ALPHA_DITHER) {
-						//alpha is not dithered, so we un-premultiply the colors and scale to palette alpha.
-						if (colorYiq[i].a > 0.0f) {
-							float chosenA = chosenYiq[i].a;
-							off.y = colorYiq[i].y * chosenA / colorYiq[i].a - chosenYiq[i].y;
-							off.i = colorYiq[i].i * chosenA / colorYiq[i].a - chosenYiq[i].i;
-							off.q = colorYiq[i].q * chosenA / colorYiq[i].a - chosenYiq[i].q;
-							off.a = 0.0f;
-						} else {
-							//zero alpha, no color information to dither.
-							RxiColorMakeTransparent(&off);
-						}
-					} else {
-						//alpha is dithered, so we take the straight preultiplied difference to diffuse
-						//signal intensity.
-						RxiColorSubtract(&off, &colorYiq[i], &chosenYiq[i]);
-					}
-
-#ifndef RX_SIMD
-					diffuse21[i].y += off.y * 0.4375f; // 7/16
-					diffuse21[i].i += off.i * 0.4375f;
-					diffuse21[i].q += off.q * 0.4375f;
-					diffuse21[i].a += off.a * 0.4375f;
-					diffuse12[i].y += off.y * 0.3125f; // 5/16
-					diffuse12[i].i += off.i * 0.3125f;
-					diffuse12[i].q += off.q * 0.3125f;
-					diffuse12[i].a += off.a * 0.3125f;
-					diffuse02[i].y += off.y * 0.1875f; // 3/16
-					diffuse02[i].i += off.i * 0.1875f;
-					diffuse02[i].q += off.q * 0.1875f;
-					diffuse02[i].a += off.a * 0.1875f;
-					diffuse22[i].y += off.y * 0.0625f; // 1/16
-					diffuse22[i].i += off.i * 0.0625f;
-					diffuse22[i].q += off.q * 0.0625f;
-					diffuse22[i].a += off.a * 0.0625f;
-#else
-					diffuse21[i].yiq = _mm_add_ps(diffuse21[i].yiq, _mm_mul_ps(off.yiq, _mm_set1_ps(0.4375f))); // 7/16
-					diffuse12[i].yiq = _mm_add_ps(diffuse12[i].yiq, _mm_mul_ps(off.yiq, _mm_set1_ps(0.3125f))); // 5/16
-					diffuse02[i].yiq = _mm_add_ps(diffuse02[i].yiq, _mm_mul_ps(off.yiq, _mm_set1_ps(0.1875f))); // 3/16
-					diffuse22[i].yiq = _mm_add_ps(diffuse22[i].yiq, _mm_mul_ps(off.yiq, _mm_set1_ps(0.0625f))); // 1/16
-#endif
+				RxYiqColor *rowbuf = (RxYiqColor *) RxMemCalloc(4 * (width + 2) * nLayers, sizeof(RxYiqColor));
+				if (rowbuf != NULL) {
+					RxiReduceImageSerial(reduction, img, indices, width, height, work->flag, work->diffuse, rowbuf, scratch, RX_FALSE);
+					RxMemFree(rowbuf);
+				} else {
+					ThAtomicStore(&work->status, RX_STATUS_NOMEM);
 				}
-			} else {
-				//high noise area or dithering disabled, do not diffuse
-				matched = RxPaletteFindClosestColorYiq(reduction, centerYiq, NULL);
 			}
+		}
 
-			//put pixel
-			if (!(flag & RX_FLAG_NO_WRITEBACK)) {
-				for (unsigned int i = 0; i < nLayers; i++) {
-					COLOR32 chosen = RxPaletteGetColor(reduction, i, matched);
-
-					COLOR32 *imgI = img + i * nPxSrc;
-					if (touchAlpha) imgI[x + y * width] = chosen;
-					else imgI[x + y * width] = (chosen & 0x00FFFFFF) | (imgI[x + y * width] & 0xFF000000);
-				}
-			}
+		//progress is only reported from the calling thread.
+		long nDone = ThAtomicIncrement(&work->nDone);
+		if (iWorker == 0) RxiUpdateProgress(reduction, nDone, work->nImages);
+	}
+}
 
-			//put palette index
-			if (indices != NULL) indices[x + y * width] = matched;
+RxStatus RX_API RxReduceImages(
+	RxReduction         *reduction,
+	COLOR32 *const      *images,
+	int *const          *indices,
+	const unsigned int  *widths,
+	const unsigned int  *heights,
+	unsigned int         nImages,
+	RxFlag               flag,
+	float                diffuse
+) {
+	//the context must have an active palette.
+	if (reduction->accel == NULL) return RX_STATUS_INCORRECT_STATE;
 
-			x += hDirection;
+	unsigned int nThreads = RxiGetThreadCount(reduction, nImages);
+	if (nThreads < 2) {
+		//one image at a time
+		for (unsigned int i = 0; i < nImages; i++) {
+			RxStatus status = RxReduceImage(reduction, images[i], indices != NULL ? indices[i] : NULL, widths[i], heights[i], flag, diffuse);
+			if (status != RX_STATUS_OK) return status;
 		}
+		return RX_STATUS_OK;
+	}
 
-		//swap row buffers
-		RxYiqColor *temp = thisRow;
-		thisRow = lastRow;
-		lastRow = temp;
-		temp = nextDiffuse;
-		nextDiffuse = thisDiffuse;
-		thisDiffuse = temp;
-		memset(nextDiffuse, 0, nLayers * (width + 2) * sizeof(RxYiqColor));
-		RxiUpdateProgress(reduction, y + 1, height);
+	//the palette's lookup cache is filled before the palette is shared, so workers only read it.
+	double start = RxiStatsGetTime(reduction);
+	if (reduction->paletteLayers == 1) {
+		RxStatus status = RxiPalettePrepareCache(reduction, reduction->accel);
+		if (status != RX_STATUS_OK) return status;
 	}
 
-	if (rowbuf != reduction->imgBuffer) RxMemFree(rowbuf);
-	return RX_STATUS_OK;
+	RxiReduceBatchWork work = { 0 };
+	work.reduction = reduction;
+	work.images = images;
+	work.indices = indices;
+	work.widths = widths;
+	work.heights = heights;
+	work.nImages = nImages;
+	work.flag = flag;
+	work.diffuse = diffuse;
+	work.status = RX_STATUS_OK;
+
+	RxiUpdateProgress(reduction, 0, nImages);
+	ThRunWorkers(RxiReduceBatchWorker, &work, nThreads);
+	RxiUpdateProgress(reduction, nImages, nImages);
+
+	if (reduction->stats != NULL) reduction->stats->ditherTime += ThGetTime() - start;
+	return (RxStatus) work.status;
 }
 
 
 // ----- palette accelerator routines
 
-static inline double RxiAccelGetChannelN(RxReduction *reduction, const RxYiqColor *color, unsigned int n) {
+static inline double RxiAccelGetChannelWeight(RxReduction *reduction, unsigned int n) {
 	RX_ASSUME(n < 4 * reduction->paletteLayers);
 
-	double ch = color[n / 4].vec[n % 4];
 	switch (n % 4) {
-		case 0: return ch * reduction->yWeight;
-		case 1: return ch * reduction->iWeight;
-		case 2: return ch * reduction->qWeight;
-		case 3: return ch * reduction->aWeight;
+		case 0: return reduction->yWeight;
+		case 1: return reduction->iWeight;
+		case 2: return reduction->qWeight;
+		case 3: return reduction->aWeight;
 		default: RX_ASSUME(0); // does not reach here
 	}
 
@@ -3141,6 +4502,10 @@ static inline double RxiAccelGetChannelN(RxReduction *reduction, const RxYiqColo
 	return 0.0;
 }
 
+static inline double RxiAccelGetChannelN(RxReduction *reduction, const RxYiqColor *color, unsigned int n) {
+	return color[n / 4].vec[n % 4] * RxiAccelGetChannelWeight(reduction, n);
+}
+
 static int RxiAccelSortPalette(const void *p1, const void *p2) {
 	const RxiPaletteMapEntry *e1 = (const RxiPaletteMapEntry *) p1;
 	const RxiPaletteMapEntry *e2 = (const RxiPaletteMapEntry *) p2;
@@ -3154,215 +4519,258 @@ static RxiPaletteAccelNode *RxiAccelSplit(
 	RxiPaletteAccelNode *accel,
 	RxiPaletteAccelNode *nodebuf,
 	RxiPaletteMapEntry  *plttFull,
-	unsigned int         nextSplit
+	unsigned int        *pnSlots
 ) {
 	RX_ASSUME(accel->nCol > 0);
 
 	RxiPaletteMapEntry *pltt = plttFull + accel->start;
+	accel->pLeft = NULL;
+	accel->pRight = NULL;
 
-	//we split the node if it has more than one node.
-	accel->mid = &pltt[0]; // set to first color in the trvial/degenerate case
-	if (accel->nCol <= 1) {
-		//put split values for the node
-		accel->splitDir = nextSplit;
-		accel->splitVal = RxiAccelGetChannelN(reduction, accel->mid->color, nextSplit);
-		return nodebuf;
-	}
+	//nodes small enough become leaves. Leaves are padded to a multiple of 4 colors for the search.
+	if (accel->nCol <= RX_ACCEL_LEAF_SIZE) goto MakeLeaf;
 
-	//sort by
+	//split along the color channel of greatest spread. Alpha channels cannot be used in the K-D tree.
 	unsigned int nChannel = 4 * reduction->paletteLayers;
+	unsigned int splitDir = 0;
+	double maxSpread = 0.0;
 	for (unsigned int i = 0; i < nChannel; i++) {
-		//skip alpha channels (cannot be used in the K-D tree)
 		if ((i % 4) == 3) continue;
 
-		//test sort
-		for (unsigned int i = 0; i < accel->nCol; i++) {
-			pltt[i].sortVal = RxiAccelGetChannelN(reduction, pltt[i].color, nextSplit);
+		double chMin = RX_LARGE_NUMBER, chMax = -RX_LARGE_NUMBER;
+		for (unsigned int j = 0; j < accel->nCol; j++) {
+			double ch = RxiAccelGetChannelN(reduction, pltt[j].color, i);
+			if (ch < chMin) chMin = ch;
+			if (ch > chMax) chMax = ch;
 		}
-		qsort(pltt, accel->nCol, sizeof(RxiPaletteMapEntry), RxiAccelSortPalette);
-
-		//split test
-		double f1 = pltt[0].sortVal;
-		double f2 = pltt[accel->nCol - 1].sortVal;
-		if (f1 != f2) break;
-
-		//else
-		nextSplit = (nextSplit + 1) % nChannel;
-		if (i == nChannel - 2) return nodebuf; // not split (all axes degenerate)
-	}
-
-	//find split (subtract 1 for the median color)
-	unsigned int iSplit = (accel->nCol - 1) / 2;
 
-	//given the chance of identical sorting values at the median point, we bucket those values
-	//equal to the median in the greater bucket. This allows exact matches to be searched
-	//more quickly.
-	double medVal = pltt[iSplit].sortVal;
-	for (unsigned int i = 0; i < accel->nCol; i++) {
-		if (pltt[i].sortVal == medVal) {
-			iSplit = i;
-			break;
+		if ((chMax - chMin) > maxSpread) {
+			maxSpread = chMax - chMin;
+			splitDir = i;
 		}
 	}
 
-	unsigned int nLeft = iSplit;
-	unsigned int nRight = accel->nCol - nLeft - 1;
-	accel->mid = pltt + iSplit;
+	//all colors identical: they can't be split.
+	if (maxSpread == 0.0) goto MakeLeaf;
 
-	if (nLeft > 0) {
-		RxiPaletteAccelNode *childL = nodebuf++;
-		childL->start = accel->start;
-		childL->nCol = nLeft;
-		childL->parent = accel;
-		accel->pLeft = childL;
-		nodebuf = RxiAccelSplit(reduction, childL, nodebuf, plttFull, (nextSplit + 1) % nChannel);
+	for (unsigned int i = 0; i < accel->nCol; i++) {
+		pltt[i].sortVal = RxiAccelGetChannelN(reduction, pltt[i].color, splitDir);
 	}
+	qsort(pltt, accel->nCol, sizeof(RxiPaletteMapEntry), RxiAccelSortPalette);
 
-	if (nRight > 0) {
-		RxiPaletteAccelNode *childR = nodebuf++;
-		childR->start = accel->start + iSplit + 1;
-		childR->nCol = nRight;
-		childR->parent = accel;
-		accel->pRight = childR;
-		nodebuf = RxiAccelSplit(reduction, childR, nodebuf, plttFull, (nextSplit + 1) % nChannel);
+	//split at the median. Colors equal to the split value all go to the right, so if that would leave
+	//the left empty, split after the run of colors equal to the median instead.
+	unsigned int iSplit = accel->nCol / 2;
+	double medVal = pltt[iSplit].sortVal;
+	while (iSplit > 0 && pltt[iSplit - 1].sortVal == medVal) iSplit--;
+	if (iSplit == 0) {
+		while (pltt[iSplit].sortVal == medVal) iSplit++;
 	}
 
 	//put split
-	accel->splitDir = nextSplit;
-	accel->splitVal = medVal;
+	accel->splitDir = splitDir;
+	accel->splitVal = pltt[iSplit].sortVal;
+	accel->splitWeight = RxiAccelGetChannelWeight(reduction, splitDir);
+
+	RxiPaletteAccelNode *childL = nodebuf++;
+	childL->start = accel->start;
+	childL->nCol = iSplit;
+	accel->pLeft = childL;
+	nodebuf = RxiAccelSplit(reduction, childL, nodebuf, plttFull, pnSlots);
+
+	RxiPaletteAccelNode *childR = nodebuf++;
+	childR->start = accel->start + iSplit;
+	childR->nCol = accel->nCol - iSplit;
+	accel->pRight = childR;
+	nodebuf = RxiAccelSplit(reduction, childR, nodebuf, plttFull, pnSlots);
+	return nodebuf;
+
+MakeLeaf:
+	accel->slot = *pnSlots;
+	accel->nSlots = (accel->nCol + 3) & ~3;
+	*pnSlots += accel->nSlots;
 	return nodebuf;
 }
 
-static void RxiAccelRecurseTreeInternal(
-	RxReduction         *reduction,
-	RxiPaletteAccelNode *accel,
-	const RxYiqColor    *color,
-	double              *pBestDiff,
-	unsigned int        *piBest
-) {
-	//distance of color to the root node
-	RxBool intersectPlane = RX_FALSE;
-	double projColor = RxiAccelGetChannelN(reduction, color, accel->splitDir);
-	double diffFromSplit = accel->splitVal - projColor;
-	diffFromSplit *= diffFromSplit;
+static void RxiAccelFillLeaves(RxReduction *reduction, RxPalette *accel, RxiPaletteAccelNode *node) {
+	if (node->pLeft != NULL) {
+		RxiAccelFillLeaves(reduction, accel, node->pLeft);
+		RxiAccelFillLeaves(reduction, accel, node->pRight);
+		return;
+	}
 
-	if (diffFromSplit < *pBestDiff) {
-		intersectPlane = RX_TRUE;
+	//store the leaf colors with each channel contiguous. Padding repeats the first color of the leaf.
+	unsigned int nChannel = 4 * reduction->paletteLayers;
+	float *soa = accel->leafColors + node->slot * nChannel;
+	for (unsigned int i = 0; i < node->nSlots; i++) {
+		const RxiPaletteMapEntry *entry = &accel->pltt[node->start + (i < node->nCol ? i : 0)];
 
-		double diff = RxiComputeLayeredColorDifference(reduction, color, accel->mid->color);
-		if (diff < *pBestDiff) {
-			*pBestDiff = diff;
-			*piBest = accel->mid->index;
+		accel->leafIndices[node->slot + i] = entry->index;
+		for (unsigned int j = 0; j < nChannel; j++) {
+			soa[j * node->nSlots + i] = entry->color[j / 4].vec[j % 4];
 		}
 	}
+}
 
-	//based on the difference from the split, we may only need to search one child.
-	//left/right nodes, if they exist, and are within the search space
-	RxiPaletteAccelNode *nodeL = accel->pLeft;
-	if (nodeL != NULL) {
-		//left node: lesser values (search only if the splitting plane is greater)
-		if (intersectPlane || projColor <= accel->splitVal) {
-			RxiAccelRecurseTreeInternal(reduction, nodeL, color, pBestDiff, piBest);
-		}
+//work done by a search, counted when performance counters are enabled.
+typedef struct RxiSearchCounts_ {
+	unsigned int nVisits;  // tree nodes visited
+	unsigned int nEvals;   // color differences computed
+} RxiSearchCounts;
+
+#ifdef RX_SIMD
+static inline __m128 RxiAccelScoreLeafColors(RxReduction *reduction, const RxYiqColor *color, const float *ch, unsigned int nSlots) {
+	//scores 4 colors of a leaf, with the same arithmetic as RxiComputeColorDifference.
+	__m128 wy = _mm_shuffle_ps(reduction->yiqaWeight2, reduction->yiqaWeight2, _MM_SHUFFLE(0, 0, 0, 0));
+	__m128 wi = _mm_shuffle_ps(reduction->yiqaWeight2, reduction->yiqaWeight2, _MM_SHUFFLE(1, 1, 1, 1));
+	__m128 wq = _mm_shuffle_ps(reduction->yiqaWeight2, reduction->yiqaWeight2, _MM_SHUFFLE(2, 2, 2, 2));
+	__m128 wa = _mm_shuffle_ps(reduction->yiqaWeight2, reduction->yiqaWeight2, _MM_SHUFFLE(3, 3, 3, 3));
+	__m128 iy = _mm_shuffle_ps(reduction->interactionYIQA, reduction->interactionYIQA, _MM_SHUFFLE(0, 0, 0, 0));
+	__m128 ii = _mm_shuffle_ps(reduction->interactionYIQA, reduction->interactionYIQA, _MM_SHUFFLE(1, 1, 1, 1));
+	__m128 iq = _mm_shuffle_ps(reduction->interactionYIQA, reduction->interactionYIQA, _MM_SHUFFLE(2, 2, 2, 2));
+	__m128 ia = _mm_shuffle_ps(reduction->interactionYIQA, reduction->interactionYIQA, _MM_SHUFFLE(3, 3, 3, 3));
+
+	__m128 dy = _mm_sub_ps(_mm_set1_ps(color->y), _mm_load_ps(ch + 0 * nSlots));
+	__m128 di = _mm_sub_ps(_mm_set1_ps(color->i), _mm_load_ps(ch + 1 * nSlots));
+	__m128 dq = _mm_sub_ps(_mm_set1_ps(color->q), _mm_load_ps(ch + 2 * nSlots));
+	__m128 da = _mm_sub_ps(_mm_set1_ps(color->a), _mm_load_ps(ch + 3 * nSlots));
+
+	//squared components, minus alpha interaction
+	__m128 ty = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dy, wy), _mm_mul_ps(da, iy)), dy);
+	__m128 ti = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(di, wi), _mm_mul_ps(da, ii)), di);
+	__m128 tq = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dq, wq), _mm_mul_ps(da, iq)), dq);
+	__m128 ta = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(da, wa), _mm_mul_ps(da, ia)), da);
+	return _mm_add_ps(_mm_add_ps(ty, ti), _mm_add_ps(tq, ta));
+}
+#endif
+
+//state of a closest color search in the palette accelerator.
+typedef struct RxiAccelQuery_ {
+	RxReduction      *reduction;
+	const RxPalette  *accel;
+	const RxYiqColor *color;      // color to search for
+	double            bestDiff;   // distance to the closest color found so far
+	unsigned int      iBest;      // index of the closest color found so far
+	RxiSearchCounts  *counts;     // work counters (NULL when performance counters are disabled)
+} RxiAccelQuery;
+
+static inline void RxiAccelUpdateBest(RxiAccelQuery *query, double diff, unsigned int index) {
+	//ties are broken by the lowest index, so the result does not depend on the shape of the tree.
+	if (diff < query->bestDiff || (diff == query->bestDiff && index < query->iBest)) {
+		query->bestDiff = diff;
+		query->iBest = index;
 	}
+}
+
+static void RxiAccelSearchLeaf(RxiAccelQuery *query, const RxiPaletteAccelNode *node) {
+	RxReduction *reduction = query->reduction;
+	const RxYiqColor *color = query->color;
+	unsigned int nLayers = reduction->paletteLayers;
+	unsigned int nSlots = node->nSlots;
+	if (query->counts != NULL) query->counts->nEvals += nSlots;
+	const float *soa = query->accel->leafColors + node->slot * 4 * nLayers;
+	const unsigned int *indices = query->accel->leafIndices + node->slot;
 
-	RxiPaletteAccelNode *nodeR = accel->pRight;
-	if (nodeR != NULL) {
-		//right node: greater values (seeach only if the splitting plane is lesser)
-		if (intersectPlane || projColor >= accel->splitVal) {
-			RxiAccelRecurseTreeInternal(reduction, nodeR, color, pBestDiff, piBest);
+#ifdef RX_SIMD
+	if (nLayers == 1) {
+		//with one layer the distances are exact in single precision, so a group of 4 colors with none
+		//as close as the best so far is rejected with one comparison.
+		for (unsigned int i = 0; i < nSlots; i += 4) {
+			__m128 d2 = RxiAccelScoreLeafColors(reduction, color, soa + i, nSlots);
+			int mask = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_set1_ps((float) query->bestDiff)));
+			if (mask == 0) continue;
+
+			float diff[4];
+			_mm_storeu_ps(diff, d2);
+			for (unsigned int k = 0; k < 4; k++) {
+				if (mask & (1 << k)) RxiAccelUpdateBest(query, (double) diff[k], indices[i + k]);
+			}
 		}
+		return;
 	}
-}
+#endif
 
-static void RxiAccelRecurseTree(
-	RxReduction         *reduction,
-	RxiPaletteAccelNode *accel,
-	const RxYiqColor    *color,
-	double              *pBestDiff,
-	unsigned int        *piBest,
-	int                  lrbit
-) {
-	//test the root and then recurse down (only the half not explored)
-	double diffFromSplit = accel->splitVal - RxiAccelGetChannelN(reduction, color, accel->splitDir);
-	diffFromSplit *= diffFromSplit;
+	//score 4 colors at a time, summing the layers in double precision like RxiComputeLayeredColorDifference.
+	for (unsigned int i = 0; i < nSlots; i += 4) {
+		double diff[4] = { 0.0, 0.0, 0.0, 0.0 };
 
-	//the axis-aligned difference to split (i.e. difference to cutting plane) is within the search
-	//radius, thus we must search the other sub-tree.
-	if (diffFromSplit < *pBestDiff) {
-		//because the plane is within the search radius, its point must be checked too.
-		double diff = RxiComputeLayeredColorDifference(reduction, color, accel->mid->color);
-		if (diff < *pBestDiff) {
-			*pBestDiff = diff;
-			*piBest = accel->mid->index;
+		for (unsigned int j = 0; j < nLayers; j++) {
+			const float *ch = soa + j * 4 * nSlots + i;
+#ifdef RX_SIMD
+			float d2[4];
+			_mm_storeu_ps(d2, RxiAccelScoreLeafColors(reduction, &color[j], ch, nSlots));
+			for (unsigned int k = 0; k < 4; k++) diff[k] += (double) d2[k];
+#else
+			for (unsigned int k = 0; k < 4; k++) {
+				RxYiqColor pltt;
+				pltt.y = ch[0 * nSlots + k];
+				pltt.i = ch[1 * nSlots + k];
+				pltt.q = ch[2 * nSlots + k];
+				pltt.a = ch[3 * nSlots + k];
+				diff[k] += RxiComputeColorDifference(reduction, &color[j], &pltt);
+			}
+#endif
 		}
 
-		//choose the sub tree opposite the way we came, search down
-		RxiPaletteAccelNode *sub = lrbit ? accel->pLeft : accel->pRight;
-		if (sub != NULL) RxiAccelRecurseTreeInternal(reduction, sub, color, pBestDiff, piBest);
+		for (unsigned int k = 0; k < 4; k++) {
+			RxiAccelUpdateBest(query, diff[k], indices[i + k]);
+		}
 	}
 }
 
-static unsigned int RxiPaletteFindClosestColorAccelerated(
-	RxReduction      *reduction,
-	RxPalette        *accel,
-	const RxYiqColor *color,
-	double           *outDiff
-) {
-	unsigned int nLayer = reduction->paletteLayers;
+static void RxiAccelSearch(RxiAccelQuery *query, const RxiPaletteAccelNode *node) {
+	const RxYiqColor *color = query->color;
 
-	//traverse down
-	RxiPaletteAccelNode *nodep = &accel->root;
-	while (1) {
-		double split = nodep->splitVal;
-		double val = RxiAccelGetChannelN(reduction, color, nodep->splitDir);
-		RxYiqColor *nodeCol = nodep->mid->color;
-
-		//if this is a leaf node or the split value matches, check for a matching color
-		if ((nodep->pLeft == NULL && nodep->pRight == NULL) || (split == val)) {
-			//compare color
-			if (RxiColorVecEqual(nodeCol, color, nLayer)) {
-				if (outDiff != NULL) *outDiff = 0.0; // identical match
-				return nodep->mid->index;
-			}
-		}
+	while (node->pLeft != NULL) {
+		if (query->counts != NULL) query->counts->nVisits++;
 
-		//no child nodes, no check split
-		if (nodep->pLeft == NULL && nodep->pRight == NULL) break;
+		//search the side of the split containing the color first. The other side only needs to be searched if
+		//the splitting plane is within the search radius, and is searched by continuing the loop.
+		unsigned int splitDir = node->splitDir;
+		double diffFromSplit = color[splitDir / 4].vec[splitDir % 4] * node->splitWeight - node->splitVal;
+		const RxiPaletteAccelNode *nodeNear = (diffFromSplit < 0.0) ? node->pLeft : node->pRight;
+		const RxiPaletteAccelNode *nodeFar = (diffFromSplit < 0.0) ? node->pRight : node->pLeft;
 
-		//choose left/right. We choose the only available path if only one (to ensure we reach the tree's bottom)
-		if (nodep->pLeft == NULL) nodep = nodep->pRight;
-		else if (nodep->pRight == NULL) nodep = nodep->pLeft;
-		else if (val < split) nodep = nodep->pLeft;
-		else nodep = nodep->pRight;
+		RxiAccelSearch(query, nodeNear);
+		if (diffFromSplit * diffFromSplit > query->bestDiff) return;
+		node = nodeFar;
 	}
 
-	//we're at the bottom of the tree, and there were no exact matches. We recurse the tree
-	//to find closer candidate points.
-	unsigned int iBest = nodep->mid->index;
-	double bestDiff = RxiComputeLayeredColorDifference(reduction, color, nodep->mid->color);
+	if (query->counts != NULL) query->counts->nVisits++;
+	RxiAccelSearchLeaf(query, node);
+}
 
-	//traverse up
-	while (nodep->parent != NULL) {
-		int lrbit = (nodep == nodep->parent->pRight); // index of child, to avoid recursing the tree we've already checked
-		nodep = nodep->parent;
-		RxiAccelRecurseTree(reduction, nodep, color, &bestDiff, &iBest, lrbit);
-	}
+static unsigned int RxiPaletteFindClosestColorAccelerated(
+	RxReduction      *reduction,
+	RxPalette        *accel,
+	const RxYiqColor *color,
+	double           *outDiff,
+	RxiSearchCounts  *counts
+) {
+	RxiAccelQuery query;
+	query.reduction = reduction;
+	query.accel = accel;
+	query.color = color;
+	query.bestDiff = RX_LARGE_NUMBER;
+	query.iBest = 0;
+	query.counts = counts;
+	RxiAccelSearch(&query, &accel->root);
 
 	//best index
-	if (outDiff != NULL) *outDiff = bestDiff;
-	return iBest;
+	if (outDiff != NULL) *outDiff = query.bestDiff;
+	return query.iBest;
 }
 
-static unsigned int RxiPaletteFindClosestColorOnAccel(
+static unsigned int RxiPaletteFindClosestColorOnAccelEx(
 	RxReduction      *reduction,
 	RxPalette        *accel,
 	const RxYiqColor *color,
+	RxYiqColor       *cpy,
 	double           *outDiff
 ) {
+	//cpy is a scratch buffer of paletteLayers colors, so that searches may run on multiple threads.
 	RX_ASSUME(accel != NULL);
 
-	RxYiqColor *cpy = reduction->tempLayeredColor;
 	RxiColorVecCopy(cpy, color, reduction->paletteLayers);
 
 	//processing for alpha mode
@@ -3396,14 +4804,45 @@ static unsigned int RxiPaletteFindClosestColorOnAccel(
 			break;
 	}
 
+	if (reduction->stats == NULL) {
+		if (accel->useAccelerator) {
+			//accelerated search
+			return RxiPaletteFindClosestColorAccelerated(reduction, accel, cpy, outDiff, NULL) + plttStart;
+		} else {
+			//slow search
+			RxYiqColor *pltt = &accel->plttLarge[plttStart * reduction->paletteLayers];
+			return RxiPaletteFindClosestColor(reduction, pltt, accel->nPltt - plttStart, cpy, outDiff) + plttStart;
+		}
+	}
+
+	//same searches, counting their work. Searches may run on worker threads, so the counters are added atomically.
+	RxiSearchCounts counts = { 0 };
+	unsigned int index;
 	if (accel->useAccelerator) {
-		//accelerated search
-		return RxiPaletteFindClosestColorAccelerated(reduction, accel, cpy, outDiff) + plttStart;
+		index = RxiPaletteFindClosestColorAccelerated(reduction, accel, cpy, outDiff, &counts);
 	} else {
-		//slow search
+		//the unaccelerated search stops at the first exact match.
+		double diff;
 		RxYiqColor *pltt = &accel->plttLarge[plttStart * reduction->paletteLayers];
-		return RxiPaletteFindClosestColor(reduction, pltt, accel->nPltt - plttStart, cpy, outDiff) + plttStart;
+		index = RxiPaletteFindClosestColor(reduction, pltt, accel->nPltt - plttStart, cpy, &diff);
+		counts.nEvals = (diff == 0.0) ? (index + 1) : (accel->nPltt - plttStart);
+		if (outDiff != NULL) *outDiff = diff;
 	}
+
+	RxStats *stats = reduction->stats;
+	ThAtomicAdd64(&stats->nSearches, 1);
+	ThAtomicAdd64(&stats->nDistanceEvals, counts.nEvals);
+	ThAtomicAdd64(&stats->nNodeVisits, counts.nVisits);
+	return index + plttStart;
+}
+
+static unsigned int RxiPaletteFindClosestColorOnAccel(
+	RxReduction      *reduction,
+	RxPalette        *accel,
+	const RxYiqColor *color,
+	double           *outDiff
+) {
+	return RxiPaletteFindClosestColorOnAccelEx(reduction, accel, color, reduction->tempLayeredColor, outDiff);
 }
 
 unsigned int RX_API RxPaletteFindClosestColorYiq(RxReduction *reduction, const RxYiqColor *color, double *outDiff) {
@@ -3417,7 +4856,103 @@ unsigned int RX_API RxPaletteFindClosestColorYiq(RxReduction *reduction, const R
 	return RxiPaletteFindClosestColorOnAccel(reduction, accel, color, outDiff);
 }
 
+static RxStatus RxiPaletteInitCache(RxReduction *reduction, RxPalette *accel) {
+	if (accel->cache == NULL) {
+		accel->cache = (unsigned short *) malloc(RX_PALETTE_CACHE_SIZE * sizeof(unsigned short));
+		if (accel->cache == NULL) return RX_STATUS_NOMEM;
+	}
+
+	//the cached indices are only valid for the color weights they were computed with.
+	memset(accel->cache, 0xFF, RX_PALETTE_CACHE_SIZE * sizeof(unsigned short));
+	accel->cacheWeights[0] = reduction->yWeight;
+	accel->cacheWeights[1] = reduction->iWeight;
+	accel->cacheWeights[2] = reduction->qWeight;
+	accel->cacheWeights[3] = reduction->aWeight;
+	return RX_STATUS_OK;
+}
+
+typedef struct RxiPaletteCacheWork_ {
+	RxReduction *reduction;
+	RxPalette   *accel;
+	volatile long nextBlock;   // next block of cache entries to be claimed by a worker
+} RxiPaletteCacheWork;
+
+static void RxiPaletteFillCacheWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) iWorker;
+	(void) nWorkers;
+
+	RxiPaletteCacheWork *work = (RxiPaletteCacheWork *) param;
+	RxPalette *accel = work->accel;
+	RxYiqColor scratch[RX_PALETTE_MAX_COUNT];
+
+	while (1) {
+		unsigned int start = (unsigned int) (ThAtomicIncrement(&work->nextBlock) - 1) * RX_PALETTE_CACHE_BLOCK;
+		if (start >= RX_PALETTE_CACHE_SIZE) break;
+
+		for (unsigned int i = start; i < start + RX_PALETTE_CACHE_BLOCK; i++) {
+			if (accel->cache[i] != RX_PALETTE_CACHE_EMPTY) continue;
+
+			RxYiqColor yiq;
+			RxConvertRgbToYiq(ColorConvertFromDS((COLOR) i) | 0xFF000000, &yiq);
+			accel->cache[i] = (unsigned short) RxiPaletteFindClosestColorOnAccelEx(work->reduction, accel, &yiq, scratch, NULL);
+		}
+	}
+}
+
+static RxStatus RxiPalettePrepareCache(RxReduction *reduction, RxPalette *accel) {
+	//fill every entry of the cache, so that lookups only read it and may run on multiple threads.
+	if (accel->cache == NULL || accel->cacheWeights[0] != reduction->yWeight || accel->cacheWeights[1] != reduction->iWeight
+		|| accel->cacheWeights[2] != reduction->qWeight || accel->cacheWeights[3] != reduction->aWeight) {
+		RxStatus status = RxiPaletteInitCache(reduction, accel);
+		if (status != RX_STATUS_OK) return status;
+	}
+
+	RxiPaletteCacheWork work = { 0 };
+	work.reduction = reduction;
+	work.accel = accel;
+	ThRunWorkers(RxiPaletteFillCacheWorker, &work, RxiGetThreadCount(reduction, RX_PALETTE_CACHE_SIZE / RX_PALETTE_CACHE_BLOCK));
+	return RX_STATUS_OK;
+}
+
+static unsigned int RxiPaletteLookupColor(RxReduction *reduction, RxPalette *accel, COLOR32 color, RxYiqColor *scratch) {
+	//opaque colors that are exactly representable in RGB555 can be served from a 32K-entry cache of
+	//closest palette indices. The cache is built once the palette has seen enough such lookups, and is
+	//filled on demand, so that it costs nothing for images that are only searched a few times.
+	if (reduction->paletteLayers == 1 && (color >> 24) == 0xFF && ColorRoundToDS15(color) == (color & 0xFFFFFF)) {
+		if (accel->cache == NULL && ++accel->nLookups >= RX_PALETTE_CACHE_MIN_LOOKUPS) {
+			RxiPaletteInitCache(reduction, accel);
+		}
+
+		if (accel->cache != NULL) {
+			if (accel->cacheWeights[0] != reduction->yWeight || accel->cacheWeights[1] != reduction->iWeight
+				|| accel->cacheWeights[2] != reduction->qWeight || accel->cacheWeights[3] != reduction->aWeight) {
+				//weights changed since the cache was filled
+				RxiPaletteInitCache(reduction, accel);
+			}
+
+			COLOR c15 = ColorConvertToDS(color);
+			unsigned int index = accel->cache[c15];
+			if (index == RX_PALETTE_CACHE_EMPTY) {
+				RxYiqColor yiq;
+				RxConvertRgbToYiq(color, &yiq);
+				index = RxiPaletteFindClosestColorOnAccelEx(reduction, accel, &yiq, scratch, NULL);
+				accel->cache[c15] = (unsigned short) index;
+			}
+			return index;
+		}
+	}
+
+	RxYiqColor yiq;
+	RxConvertRgbToYiq(color, &yiq);
+	return RxiPaletteFindClosestColorOnAccelEx(reduction, accel, &yiq, scratch, NULL);
+}
+
 unsigned int RX_API RxPaletteFindClosestColor(RxReduction *reduction, COLOR32 color, double *outDiff) {
+	if (outDiff == NULL && reduction->accel != NULL) {
+		//no distance needed: the lookup cache may be used
+		return RxiPaletteLookupColor(reduction, reduction->accel, color, reduction->tempLayeredColor);
+	}
+
 	RxYiqColor yiq;
 	RxConvertRgbToYiq(color, &yiq);
 	return RxPaletteFindClosestColorYiq(reduction, &yiq, outDiff);
@@ -3469,6 +5004,7 @@ static RxStatus RxiPaletteLoadAccelerated(RxReduction *reduction, RxPalette *acc
 
 	if (nColors == 0) return RX_STATUS_INVALID; // empty palette
 
+	double start = RxiStatsGetTime(reduction);
 	if (alphaMode != RX_ALPHA_PIXEL) {
 		//in the per-pixel alpha mode, we'll force all palette alpha values to full. Otherwise, we use
 		//the alpha from the palette and must check it for validity.
@@ -3478,9 +5014,10 @@ static RxStatus RxiPaletteLoadAccelerated(RxReduction *reduction, RxPalette *acc
 		}
 	}
 
-	//working memory for accelerator
+	//working memory for accelerator. Every split leaves at least one color on each side, so there are
+	//fewer than 2 nodes per color.
 	accel->pltt = (RxiPaletteMapEntry *) RxMemCalloc(nColors, sizeof(RxiPaletteMapEntry));
-	accel->nodebuf = (RxiPaletteAccelNode *) calloc(nColors, sizeof(RxiPaletteAccelNode));
+	accel->nodebuf = (RxiPaletteAccelNode *) calloc(2 * nColors, sizeof(RxiPaletteAccelNode));
 
 	if (accel->pltt == NULL || accel->nodebuf == NULL) {
 		//no memory
@@ -3500,13 +5037,30 @@ static RxStatus RxiPaletteLoadAccelerated(RxReduction *reduction, RxPalette *acc
 		}
 	}
 
-	accel->useAccelerator = RX_TRUE;
-	accel->root.parent = NULL;
 	accel->root.start = 0;
 	accel->root.nCol = nColors;
-	accel->root.pLeft = NULL;
-	accel->root.pRight = NULL;
-	RxiAccelSplit(reduction, &accel->root, accel->nodebuf, accel->pltt, 0);
+
+	unsigned int nSlots = 0;
+	RxiAccelSplit(reduction, &accel->root, accel->nodebuf, accel->pltt, &nSlots);
+
+	accel->leafColors = (float *) RxMemAlloc(nSlots * 4 * reduction->paletteLayers * sizeof(float));
+	accel->leafIndices = (unsigned int *) calloc(nSlots, sizeof(unsigned int));
+	if (accel->leafColors == NULL || accel->leafIndices == NULL) {
+		//no memory: fall back to the unaccelerated search
+		RxMemFree(accel->leafColors);
+		free(accel->leafIndices);
+		accel->leafColors = NULL;
+		accel->leafIndices = NULL;
+		return reduction->status = RX_STATUS_NOMEM;
+	}
+	RxiAccelFillLeaves(reduction, accel, &accel->root);
+
+	accel->useAccelerator = RX_TRUE;
+
+	if (reduction->stats != NULL) {
+		reduction->stats->accelTime += ThGetTime() - start;
+		reduction->stats->nAccelBuilds++;
+	}
 
 	return RX_STATUS_OK;
 }
@@ -3644,6 +5198,9 @@ static void RxiPaletteFree(RxPalette *palette) {
 	if (palette->plttLarge != palette->plttSmall) RxMemFree(palette->plttLarge);
 	RxMemFree(palette->pltt);
 	free(palette->nodebuf);
+	RxMemFree(palette->leafColors);
+	free(palette->leafIndices);
+	free(palette->cache);
 	RxMemFree(palette);
 }
 
@@ -3652,6 +5209,23 @@ void RX_API RxPaletteFree(RxReduction *reduction) {
 	reduction->accel = NULL;
 }
 
+RxPalette *RX_API RxPaletteDetach(RxReduction *reduction) {
+	RxPalette *palette = reduction->accel;
+	reduction->accel = NULL;
+	return palette;
+}
+
+void RX_API RxPaletteAttach(RxReduction *reduction, RxPalette *palette) {
+	if (reduction->accel == palette) return;
+
+	RxiPaletteFree(reduction->accel);
+	reduction->accel = palette;
+}
+
+void RX_API RxPaletteDestroy(RxPalette *palette) {
+	RxiPaletteFree(palette);
+}
+
 double RX_API RxComputePaletteError(RxReduction *reduction, const COLOR32 *px, unsigned int width, unsigned int height, const COLOR32 *pal, unsigned int nColors, double nMaxError) {
 	if (nMaxError == 0) nMaxError = RX_LARGE_NUMBER;
 	double error = 0;
@@ -3662,25 +5236,32 @@ double RX_API RxComputePaletteError(RxReduction *reduction, const COLOR32 *px, u
 	}
 
 	//palette to YIQ
-	for (unsigned int i = 0; i < nColors; i++) {
-		RxConvertRgbToYiq(pal[i], &paletteYiq[i]);
-	}
-
-	for (unsigned int i = 0; i < (width * height); i++) {
-		COLOR32 p = px[i];
-		unsigned int a = (p >> 24) & 0xFF;
-		if (a < 0x80) continue;
-		p |= 0xFF000000;
+	RxConvertRowToYiq(pal, paletteYiq, nColors, 1);
+
+	//convert opaque pixels in batches. Translucent pixels are skipped.
+	unsigned int nPx = width * height;
+	for (unsigned int i = 0; i < nPx && error < nMaxError; i += RX_CONVERT_BATCH_SIZE) {
+		COLOR32 batchRgb[RX_CONVERT_BATCH_SIZE];
+		RxYiqColor batchYiq[RX_CONVERT_BATCH_SIZE];
+
+		unsigned int nBatch = 0;
+		for (unsigned int j = i; j < nPx && j < (i + RX_CONVERT_BATCH_SIZE); j++) {
+			COLOR32 p = px[j];
+			unsigned int a = (p >> 24) & 0xFF;
+			if (a < 0x80) continue;
+			batchRgb[nBatch++] = p | 0xFF000000;
+		}
+		RxConvertRowToYiq(batchRgb, batchYiq, nBatch, 1);
 
-		RxYiqColor yiq;
-		RxConvertRgbToYiq(p, &yiq);
-		double bestDiff;
-		(void) RxiPaletteFindClosestColor(reduction, paletteYiq, nColors, &yiq, &bestDiff);
+		for (unsigned int j = 0; j < nBatch; j++) {
+			double bestDiff;
+			(void) RxiPaletteFindClosestColor(reduction, paletteYiq, nColors, &batchYiq[j], &bestDiff);
 
-		error += bestDiff;
-		if (error >= nMaxError) {
-			error = nMaxError;
-			break;
+			error += bestDiff;
+			if (error >= nMaxError) {
+				error = nMaxError;
+				break;
+			}
 		}
 	}
 
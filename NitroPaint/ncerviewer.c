@@ -3033,6 +3033,33 @@ static LRESULT CALLBACK NcerCreateCellWndProc(HWND hWnd, UINT msg, WPARAM wParam
 				OBJ_IMAGE_SLICE *slices = CellgenSliceImage(px, width, height, bounds, nObj, !affine);
 				free(bounds);
 
+				//buffers for indexing all OBJ at once, allocated before the cell is modified
+				int *indicesAll = (int *) calloc(nObj * 64 * 64, sizeof(int));
+				COLOR32 **slicePx = (COLOR32 **) calloc(nObj, sizeof(COLOR32 *));
+				int **sliceIndices = (int **) calloc(nObj, sizeof(int *));
+				unsigned int *sliceWidths = (unsigned int *) calloc(nObj, sizeof(unsigned int));
+				unsigned int *sliceHeights = (unsigned int *) calloc(nObj, sizeof(unsigned int));
+				RxReduction *reduction = RxNew(&balance);
+				if (slices == NULL || indicesAll == NULL || slicePx == NULL || sliceIndices == NULL || sliceWidths == NULL
+					|| sliceHeights == NULL || reduction == NULL) {
+					MessageBox(hWnd, L"Not enough memory.", L"Error", MB_ICONERROR);
+					if (reduction != NULL) RxFree(reduction);
+					free(indicesAll);
+					free(slicePx);
+					free(sliceIndices);
+					free(sliceWidths);
+					free(sliceHeights);
+					free(slices);
+					break;
+				}
+
+				for (int i = 0; i < nObj; i++) {
+					slicePx[i] = slices[i].px;
+					sliceIndices[i] = indicesAll + i * 64 * 64;
+					sliceWidths[i] = slices[i].bounds.width;
+					sliceHeights[i] = slices[i].bounds.height;
+				}
+
 				//get NCER, NCGR, NCLR
 				HWND hWndMain = (HWND) GetWindowLongPtr(hWnd, GWL_HWNDPARENT);
 				NITROPAINTSTRUCT *npStruct = NpGetData(hWndMain);
@@ -3134,16 +3161,20 @@ static LRESULT CALLBACK NcerCreateCellWndProc(HWND hWnd, UINT msg, WPARAM wParam
 					}
 				}
 
+				//index all OBJ against the palette at once
+				RxFlag reduceFlag = RX_FLAG_ALPHA_MODE_NONE | RX_FLAG_PRESERVE_ALPHA | RX_FLAG_NO_ALPHA_DITHER;
+				RxApplyFlags(reduction, reduceFlag);
+				RxPaletteLoad(reduction, palette + paletteOffset, paletteLength);
+				RxReduceImages(reduction, slicePx, sliceIndices, sliceWidths, sliceHeights, nObj, reduceFlag, diffuse);
+				RxFree(reduction);
+
 				//fill out character
-				int *indicesBuffer = (int *) calloc(64 * 64, sizeof(int));
 				unsigned char *indicesBuffer8 = (unsigned char *) calloc(64 * 64, sizeof(unsigned char));
 				for (int i = 0; i < nObj; i++) {
 					OBJ_IMAGE_SLICE *slice = slices + i;
 					int width = slice->bounds.width, height = slice->bounds.height;
 					int nChars = slice->bounds.width * slice->bounds.height / 8 / 8;
-
-					RxGlbReduceImage(slice->px, indicesBuffer, width, height, palette + paletteOffset, paletteLength, 
-						RX_FLAG_ALPHA_MODE_NONE | RX_FLAG_PRESERVE_ALPHA | RX_FLAG_NO_ALPHA_DITHER, diffuse, &balance);
+					int *indicesBuffer = sliceIndices[i];
 
 					//convert to character array in indicesBuffer8
 					for (int j = 0; j < nChars; j++) {
@@ -3246,7 +3277,11 @@ static LRESULT CALLBACK NcerCreateCellWndProc(HWND hWnd, UINT msg, WPARAM wParam
 				}
 
 				free(indicesBuffer8);
-				free(indicesBuffer);
+				free(indicesAll);
+				free(slicePx);
+				free(sliceIndices);
+				free(sliceWidths);
+				free(sliceHeights);
 				free(palette);
 				free(slices);
 
@@ -560,20 +560,36 @@ static int ChrReadGhostTrick(NCGR *ncgr, const unsigned char *buffer, unsigned i
 	CHAR_SLICE *slices = NULL;
 
 	while (pos < end) {
-		unsigned int chunkSize;
-		unsigned char *p = CxDecompressLZX(pos, end - pos, &chunkSize);
+		//read the chunk header, then decode the chunk directly to the end of the graphics data
+		CxDecoder decoder;
+		CxDecoderInit(&decoder, COMPRESSION_LZ11);
+		CxDecoderFeed(&decoder, pos, end - pos);
+		CxDecoderDrain(&decoder, NULL, 0);
+
+		unsigned int chunkSize = decoder.uncompSize;
+		unsigned char *newUncomp = (unsigned char *) realloc(uncomp, uncompSize + chunkSize);
+		if (newUncomp == NULL) {
+			free(uncomp);
+			free(slices);
+			return OBJ_STATUS_NO_MEMORY;
+		}
+		uncomp = newUncomp;
 
+		CxDecoderDrain(&decoder, uncomp + uncompSize, chunkSize);
+		if (!CxDecoderFinish(&decoder, NULL)) {
+			free(uncomp);
+			free(slices);
+			return OBJ_STATUS_INVALID;
+		}
 		uncompSize += chunkSize;
-		uncomp = (unsigned char *) realloc(uncomp, uncompSize);
-		memcpy(uncomp + uncompSize - chunkSize, p, chunkSize);
 
 		nSlices++;
 		slices = realloc(slices, nSlices * sizeof(CHAR_SLICE));
 		slices[nSlices - 1].offset = uncompSize - chunkSize;
 		slices[nSlices - 1].size = chunkSize;
 
-		//advance LZ. If failure, invalid
-		pos = CxAdvanceLZX(pos, end - pos);
+		//the rest of the file was fed as one chunk, so the decoder stopped at the end of this chunk
+		pos += decoder.srcPos;
 
 		//advance 0 bytes until we reach another chunk
 		while (pos < end && *pos == '\0') {
@@ -2153,25 +2153,33 @@ static LRESULT CALLBACK PaletteGeneratorDialogProc(HWND hWnd, UINT msg, WPARAM w
 				int index = data->contextHoverX + data->contextHoverY * 16;
 				COLOR32 *paletteCopy = (COLOR32 *) calloc(nColors, sizeof(COLOR32));
 
-				//compute histogram
-				RxReduction *reduction = RxNew(&balanceSetting);
+				//read images
+				COLOR32 **images = (COLOR32 **) calloc(nPaths, sizeof(COLOR32 *));
+				unsigned int *widths = (unsigned int *) calloc(nPaths, sizeof(unsigned int));
+				unsigned int *heights = (unsigned int *) calloc(nPaths, sizeof(unsigned int));
+				int nImages = 0;
 				for (int i = 0; i < nPaths; i++) {
 					getPathFromPaths(paths, i, bf);
 					COLOR32 *bits = ImgRead(bf, &width, &height);
-					RxHistAdd(reduction, bits, width, height);
-					free(bits);
+					if (bits == NULL) continue;
+
+					images[nImages] = bits;
+					widths[nImages] = width;
+					heights[nImages] = height;
+					nImages++;
 				}
-				RxHistFinalize(reduction);
 				free(paths);
 
-				//create and write palette
-				RxComputePalette(reduction, nColors - reserveFirst);
-				for (int i = 0; i < nColors - reserveFirst; i++) {
-					(paletteCopy + reserveFirst)[i] = reduction->paletteRgb[i][0];
-				}
-				qsort(paletteCopy + reserveFirst, nColors - reserveFirst, sizeof(COLOR32), RxColorLightnessComparator);
+				//create palette from the histogram of all images
+				RxReduction *reduction = RxNew(&balanceSetting);
+				RxCreateSharedPalette(reduction, (const COLOR32 *const *) images, widths, heights, nImages, paletteCopy + reserveFirst, nColors - reserveFirst, 0, NULL);
 				RxFree(reduction);
 
+				for (int i = 0; i < nImages; i++) free(images[i]);
+				free(images);
+				free(widths);
+				free(heights);
+
 				//convert to 15bpp
 				COLOR *as15 = (COLOR *) calloc(nColors, sizeof(COLOR));
 				for (int i = 0; i < nColors; i++) {
@@ -31,6 +31,8 @@
 #include "mesgeditor.h"
 #include "combo2d.h"
 #include "scene.h"
+#include "cxbench.h"
+#include "rxbench.h"
 
 #pragma comment(linker, "\"/manifestdependency:type='win32' \
 name='Microsoft.Windows.Common-Controls' version='6.0.0.0' \
@@ -1452,14 +1454,17 @@ static void CompressFileDialog(HWND hWndParent, const unsigned char *buf, unsign
 }
 
 static void DecompressFileDialog(HWND hWndParent, const unsigned char *buf, unsigned int size) {
-	int compression = CxGetCompressionType(buf, size);
+	int compression;
+	unsigned int uncompSize;
+	unsigned char *uncomp = CxDecompressAuto(buf, size, &compression, &uncompSize);
 	if (compression == COMPRESSION_NONE) {
 		MessageBox(hWndParent, L"The file is not of a recognized compression format.", L"Error", MB_ICONERROR);
 		return;
 	}
-
-	unsigned int uncompSize;
-	unsigned char *uncomp = CxDecompress(buf, size, compression, &uncompSize);
+	if (uncomp == NULL) {
+		MessageBox(hWndParent, L"The file could not be decompressed.", L"Error", MB_ICONERROR);
+		return;
+	}
 
 	//save
 	LPWSTR path = saveFileDialog(hWndParent, L"Save File", L"All Files\0*.*\0", L"");
@@ -1743,7 +1748,9 @@ VOID OpenFileByName(HWND hWnd, LPCWSTR path) {
 
 	//identify the kind of object
 	int compression, format;
-	int type = ObjIdentify(buffer, dwSize, objpath, FILE_TYPE_INVALID, &compression, &format);
+	unsigned char *uncomp;
+	unsigned int uncompSize;
+	int type = ObjIdentifyDecompress(buffer, dwSize, objpath, FILE_TYPE_INVALID, &compression, &format, &uncomp, &uncompSize);
 
 	switch (type) {
 		case FILE_TYPE_IMAGE:
@@ -1764,8 +1771,14 @@ VOID OpenFileByName(HWND hWnd, LPCWSTR path) {
 		case FILE_TYPE_NMCR:
 		case FILE_TYPE_COMBO2D:
 		{
+			//read from the buffer decompressed during identification
 			ObjHeader *obj = NULL;
-			int status = ObjReadBuffer(&obj, buffer, dwSize, type, format, compression);
+			int status;
+			if (uncomp != NULL) {
+				status = ObjReadUncompressedBuffer(&obj, uncomp, uncompSize, type, format, compression);
+			} else {
+				status = ObjReadUncompressedBuffer(&obj, buffer, dwSize, type, format, compression);
+			}
 			if (OBJ_SUCCEEDED(status)) {
 				if (obj->type == FILE_TYPE_COMBO2D) {
 					NpOpenCombo(hWnd, (COMBO2D *) obj, objpath);
@@ -1783,6 +1796,7 @@ VOID OpenFileByName(HWND hWnd, LPCWSTR path) {
 			break;
 		}
 	}
+	free(uncomp);
 
 cleanup:
 	free(objpath);
@@ -1917,6 +1931,54 @@ VOID HandleSwitch(LPWSTR lpSwitch) {
 	}
 }
 
+static BOOL RunBenchmarkFromCommandLine(int *pStatus) {
+	//headless compression benchmark: /CXBENCH:<corpus directory> [/CXBENCHOUT:<output file>]. The LZ
+	//match length kernels are compared instead with /CXBENCHMATCH, the color reduction thread
+	//scaling with /RXBENCH, and the batch YIQ conversion with /RXBENCHYIQ.
+	int argc;
+	wchar_t **argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+
+	LPCWSTR dir = NULL, out = NULL;
+	BOOL matchKernels = FALSE, reduction = FALSE, convert = FALSE;
+	for (int i = 1; i < argc; i++) {
+		if (!wcsncmp(argv[i], L"/CXBENCH:", 9)) {
+			dir = argv[i] + 9;
+		} else if (!wcsncmp(argv[i], L"/CXBENCHOUT:", 12)) {
+			out = argv[i] + 12;
+		} else if (!wcscmp(argv[i], L"/CXBENCHMATCH")) {
+			matchKernels = TRUE;
+		} else if (!wcscmp(argv[i], L"/RXBENCH")) {
+			reduction = TRUE;
+		} else if (!wcscmp(argv[i], L"/RXBENCHYIQ")) {
+			reduction = TRUE;
+			convert = TRUE;
+		}
+	}
+	if (out == NULL) out = reduction ? L"rxbench.csv" : L"cxbench.csv";
+
+	if (reduction) {
+		int json;
+		FILE *fp = CxBenchOpenOutput(out, &json);
+		*pStatus = 1;
+		if (fp != NULL) {
+			*pStatus = convert ? RxBenchRunConvert(fp, json) : RxBenchRunThreads(fp, json);
+			fclose(fp);
+		}
+	} else if (matchKernels) {
+		int json;
+		FILE *fp = CxBenchOpenOutput(out, &json);
+		*pStatus = 1;
+		if (fp != NULL) {
+			*pStatus = CxBenchRunMatchKernels(fp, json);
+			fclose(fp);
+		}
+	} else if (dir != NULL) {
+		*pStatus = CxBenchRunCorpus(dir, out);
+	}
+	LocalFree(argv);
+	return reduction || matchKernels || dir != NULL;
+}
+
 VOID OpenFileByNameRemote(HWND hWnd, LPCWSTR szFile) {
 	COPYDATASTRUCT cds = { 0 };
 	cds.dwData = NPMSG_OPENFILE;
@@ -1951,7 +2013,7 @@ VOID ProcessCommandLine(HWND hWnd, BOOL remoteWindow) {
 		}
 	}
 
-	GlobalFree(argv);
+	LocalFree(argv);
 
 	//exit the process if the command line overrides the remote flag
 	if (remoteWindow) {
@@ -3426,6 +3488,9 @@ LRESULT CALLBACK ConvertFormatDialogProc(HWND hWnd, UINT msg, WPARAM wParam, LPA
 
 				UiCbAddString(hWndCompressionCombobox, buf);
 			}
+			UiCbAddString(hWndCompressionCombobox, L"Auto");
+
+			//Auto follows the compression types in the list
 			UiCbSetCurSel(hWndCompressionCombobox, editorData->file->compression);
 
 			data->hWndFormatCombobox = hWndFormatCombobox;
@@ -3440,6 +3505,9 @@ LRESULT CALLBACK ConvertFormatDialogProc(HWND hWnd, UINT msg, WPARAM wParam, LPA
 				int comp = UiCbGetCurSel(data->hWndCompressionCombobox);
 				EDITOR_DATA *editorData = data->editor;
 				editorData->file->format = fmt;
+
+				//Auto picks the type that compresses the object smallest in its new format
+				if (comp == COMPRESSION_MAX) comp = ObjGetBestCompression(editorData->file, COMPRESSION_AUTO_MASK);
 				editorData->file->compression = comp;
 
 				UiDlgEnd(hWnd);
@@ -4676,8 +4744,14 @@ static void CompressDialogUpdate(CompressFileData *data) {
 
 	free(data->comp);
 
+	//the last entry picks the smallest of the automatic types
 	unsigned int compSize;
-	unsigned char *comp = CxCompress(data->buffer, data->size, sel, &compSize);
+	unsigned char *comp;
+	if (sel == COMPRESSION_MAX) {
+		comp = CxCompressBest(data->buffer, data->size, COMPRESSION_AUTO_MASK, &sel, &compSize);
+	} else {
+		comp = CxCompress(data->buffer, data->size, sel, &compSize);
+	}
 
 	data->compSize = compSize;
 	data->comp = comp;
@@ -4696,7 +4770,7 @@ static void CompressDialogUpdate(CompressFileData *data) {
 
 	//put label
 	WCHAR buf[128];
-	wsprintfW(buf, L"Compressed to %d bytes (%d.%d%% %S)", compSize, permille / 10, permille % 10,
+	wsprintfW(buf, L"%S: %d bytes (%d.%d%% %S)", g_ObjCompressionNames[sel], compSize, permille / 10, permille % 10,
 		compSize <= data->size ? "reduction" : "inflation");
 	SendMessage(data->hWndStatus, WM_SETTEXT, 0, (LPARAM) buf);
 }
@@ -4721,6 +4795,7 @@ static LRESULT CALLBACK CompressFileProc(HWND hWnd, UINT msg, WPARAM wParam, LPA
 				mbstowcs(buf, g_ObjCompressionNames[i], sizeof(buf) / sizeof(buf[0]));
 				UiCbAddString(data->hWndCompressionFormats, buf);
 			}
+			UiCbAddString(data->hWndCompressionFormats, L"Auto");
 			UiCbSetCurSel(data->hWndCompressionFormats, 0);
 			break;
 		}
@@ -5380,6 +5455,10 @@ static void CheckAvailableProcessorFeatures(void) {
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
 	CheckAvailableProcessorFeatures();
 
+	//run the compression benchmark without creating any windows
+	int benchStatus;
+	if (RunBenchmarkFromCommandLine(&benchStatus)) return benchStatus;
+
 	//fetch version
 	(void) NpGetVersion();
 
@@ -102,9 +102,9 @@
 #define RX_PALETTE_MAX_SIZE      256  // Maximum created color palette size
 #define RX_PALETTE_MAX_COUNT      16  // Maximum simultaneously generated palettes
 
-#define RX_HISTOGRAM_SIZE    0x20000  // size of the histogram in slots
-#define RX_HISTOGRAM_SMALL       256  // size of a "small" histogram
+#define RX_HISTOGRAM_MIN_SLOTS    64  // initial number of slots in the histogram hash table
 #define RX_TEMP_IMG_BUF_SIZE (10*10)  // buffer for holding YIQ image color data
+#define RX_STATS_MAX_PASSES       16  // number of Voronoi passes timed individually in RxStats
 
 
 typedef struct RxReduction_ RxReduction;
@@ -127,6 +127,9 @@ typedef enum RxBool_ {
 	RX_TRUE
 } RxBool;
 
+//intermediate palette callback function. Returns RX_TRUE to continue refining the palette.
+typedef RxBool (RX_CALLBACK *RxPaletteCallback) (RxReduction *reduction, unsigned int iteration, double error, void *data);
+
 // -----------------------------------------------------------------------------------------------
 // Name: enum RxStatus
 //
@@ -192,6 +195,9 @@ typedef enum RxStatus_ {
 //   RX_FLAG_NO_ADAPTIVE_DIFFUSE Do not use adaptive error diffusion. The adaptive error diffusion
 //                               will reduce the amount of noise from dithering, but may at times
 //                               be undesirable.
+//   RX_FLAG_PARALLEL_DIFFUSE    Run color reduction on multiple threads. Rows are analyzed on
+//                               worker threads ahead of the error diffusion, which itself remains
+//                               serial. The output is identical to the single-threaded result.
 // -----------------------------------------------------------------------------------------------
 typedef enum RxFlag_ {
 	RX_FLAG_SORT_ALL            = (0x00<< 0), // sort the entire output palette
@@ -213,6 +219,7 @@ typedef enum RxFlag_ {
 	RX_FLAG_NO_WRITEBACK        = (0x01<< 6), // suppresses writeback of RGB pixel data in color reduction
 	RX_FLAG_NO_ALPHA_DITHER     = (0x01<< 7), // the alpha channel will not be dithered
 	RX_FLAG_NO_ADAPTIVE_DIFFUSE = (0x01<< 8), // do not use the adaptive error diffusion
+	RX_FLAG_PARALLEL_DIFFUSE    = (0x01<< 9), // run color reduction on multiple threads
 } RxFlag;
 
 typedef enum RxAlphaMode_ {
@@ -268,10 +275,9 @@ typedef union RxLongColor_ {
 #endif
 } RxLongColor;
 
-//histogram linked list entry as secondary sorting
+//histogram entry
 typedef struct RxHistEntry_ {
 	int entry;                    // nearest cluster index mapped to
-	struct RxHistEntry_ *next;    // pointer to the next histogram entry in the bucket
 	double weight;                // weight of this histogram entry
 	double value;                 // used for PCA: dot product with PC1
 	RxYiqColor color[];           // color of this histogram node
@@ -288,22 +294,26 @@ typedef struct RxColorNode_ {
 	RxYiqColor color[];            // this node's color information
 } RxColorNode;
 
-//allocator for allocating the linked lists
+//allocator for allocating histogram entries
 typedef struct RxSlab_ {
 	void *allocation;
 	unsigned int pos;
 	struct RxSlab_ *next;
 } RxSlab;
 
-//histogram structure
+//histogram structure. Colors are looked up in an open-addressing hash table that is kept at most
+//half full. The table grows with the histogram and is kept when the histogram is cleared. Entries
+//are listed in the order they were added rather than in slot order, which can change the rounding
+//of sums taken over the histogram.
 typedef struct RxHistogram_ {
-	RxSlab allocator;
-	RxHistEntry *entries[RX_HISTOGRAM_SIZE];
+	RxSlab allocator;             // storage of entries, reused when the histogram is cleared
+	unsigned int *slotHashes;     // color hash of each slot
+	RxHistEntry **slotEntries;    // entry of each slot, or NULL if the slot is empty
+	unsigned int nSlots;          // number of slots (a power of 2)
+	unsigned int *usedSlots;      // indices of the occupied slots (nSlots/2 capacity)
+	RxHistEntry **entries;        // entries in the order they were added (nSlots/2 capacity)
 	double totalWeight;
 	int nEntries;
-	int firstSlot;
-	int nSlotsUsed;
-	int slotIndices[RX_HISTOGRAM_SMALL];
 } RxHistogram;
 
 typedef struct RxPcaWork_ {
@@ -326,6 +336,25 @@ typedef struct {
 
 typedef struct RxPalette_ RxPalette;
 
+//performance counters of a color reduction context. Times are in seconds, and accumulate over all
+//operations since the counters were enabled. Accelerators built during Voronoi iteration count
+//toward both voronoiTime and accelTime.
+typedef struct RxStats_ {
+	double histogramTime;                              // time spent adding images to the histogram
+	double splitTime;                                  // time spent splitting the histogram into clusters
+	double voronoiTime;                                // time spent in Voronoi iteration
+	double voronoiPassTime[RX_STATS_MAX_PASSES];       // time spent in Voronoi passes, by pass index
+	double accelTime;                                  // time spent building palette accelerators
+	double ditherTime;                                 // time spent mapping images to the palette
+	long long nHistogramEntries;                       // number of colors in the histogram
+	long long nNodeInits;                              // number of clusters initialized while splitting
+	long long nVoronoiPasses;                          // number of Voronoi passes run
+	long long nAccelBuilds;                            // number of palette accelerators built
+	long long nSearches;                               // number of closest color searches
+	long long nDistanceEvals;                          // number of color differences computed in searches
+	long long nNodeVisits;                             // number of accelerator tree nodes visited in searches
+} RxStats;
+
 //reduction workspace structure
 struct RxReduction_ {
 	double yWeight;
@@ -384,12 +413,17 @@ struct RxReduction_ {
 	RxPalette *maskAccel;
 	unsigned int newCentroids[RX_PALETTE_MAX_SIZE];
 	RxTotalBuffer blockTotals[RX_PALETTE_MAX_SIZE];
+	RxYiqColor centroidYiq[RX_PALETTE_MAX_SIZE][RX_PALETTE_MAX_COUNT];
 	RxYiqColor imgBuffer[RX_TEMP_IMG_BUF_SIZE];
 	RxColorNode *colorNodes[RX_PALETTE_MAX_SIZE];
 	COLOR32 paletteRgb[RX_PALETTE_MAX_SIZE][RX_PALETTE_MAX_COUNT];
 	RxYiqColor paletteYiq[RX_PALETTE_MAX_SIZE][RX_PALETTE_MAX_COUNT];
 	RxProgressCallback progressCallback;
 	void *progressCallbackData;
+	RxPaletteCallback paletteCallback;
+	void *paletteCallbackData;
+	unsigned int nThreads;
+	RxStats *stats;          // performance counters, or NULL when disabled
 	double meanY;
 	double meanI;
 	double meanQ;
@@ -432,6 +466,26 @@ void RX_API RxConvertRgbToYiq(
 	RxYiqColor *yiq
 );
 
+// -----------------------------------------------------------------------------------------------
+// Name: RxConvertRowToYiq
+//
+// Encode a run of RGBA colors to YIQA colors. The result is identical to calling
+// RxConvertRgbToYiq for each color, but several colors are converted at a time.
+//
+// Parameters:
+//   rgb           The input RGB colors.
+//   yiq           The output YIQ colors.
+//   nPx           The number of colors to convert.
+//   yiqPitch      The distance between output colors, in colors. The color rgb[i] is written
+//                 to yiq[i * yiqPitch].
+// -----------------------------------------------------------------------------------------------
+void RX_API RxConvertRowToYiq(
+	const COLOR32 *rgb,
+	RxYiqColor    *yiq,
+	unsigned int   nPx,
+	unsigned int   yiqPitch
+);
+
 // -----------------------------------------------------------------------------------------------
 // Name: RxConvertYiqToRgb
 //
@@ -571,6 +625,87 @@ void RX_API RxSetProgressCallback(
 	void              *userData
 );
 
+// -----------------------------------------------------------------------------------------------
+// Name: RxSetPaletteCallback
+//
+// Sets a callback that receives intermediate palettes from RxComputePalette. It is called once
+// the initial palette has been split from the histogram, and again after each pass of Voronoi
+// iteration, with the palette produced so far. Unless the callback stopped the iteration, it is
+// called once more with the final palette, after colors left without any histogram colors have
+// been removed. The palette may be read from inside the callback with RxGetPalette, and the
+// number of colors in it from the nUsedColors field.
+//
+// The callback receives the index of the pass (0 for the initial palette) and the total error of
+// the palette over the histogram. It returns RX_TRUE to continue refining the palette, or
+// RX_FALSE to finish with the palette it was given. A caller may use this to stop at a deadline,
+// or once the error improves by less than some threshold. The result of the final call is
+// ignored. When Voronoi iteration is disabled, the callback is not called.
+//
+// Parameters:
+//   reduction     The color reduction context
+//   callback      The new palette callback, or NULL to clear it
+//   userData      A user pointer passed to the callback function
+// -----------------------------------------------------------------------------------------------
+void RX_API RxSetPaletteCallback(
+	RxReduction       *reduction,
+	RxPaletteCallback  callback,
+	void              *userData
+);
+
+// -----------------------------------------------------------------------------------------------
+// Name: RxSetThreadCount
+//
+// Sets the number of threads the color reduction context may use. By default, or when set to 0,
+// one thread is used per logical processor. The result of an operation does not depend on the
+// number of threads used.
+//
+// Parameters:
+//   reduction     The color reduction context
+//   nThreads      The maximum number of threads, or 0 to use one per logical processor
+// -----------------------------------------------------------------------------------------------
+void RX_API RxSetThreadCount(
+	RxReduction *reduction,
+	unsigned int nThreads
+);
+
+// -----------------------------------------------------------------------------------------------
+// Name: RxEnableStats
+//
+// Enables or disables the performance counters of a color reduction context. When enabled, the
+// context records the time spent in each phase of palette creation and color reduction, and
+// counts the work done by closest color searches. Enabling the counters resets them. While
+// disabled, which is the default, no counting is done.
+//
+// Parameters:
+//   reduction     The color reduction context
+//   enable        RX_TRUE to enable the counters, or RX_FALSE to disable them
+//
+// Returns:
+//   RX_STATUS_OK on success, or RX_STATUS_NOMEM if the counters could not be allocated.
+// -----------------------------------------------------------------------------------------------
+RxStatus RX_API RxEnableStats(
+	RxReduction *reduction,
+	RxBool       enable
+);
+
+// -----------------------------------------------------------------------------------------------
+// Name: RxGetStats
+//
+// Gets the performance counters of a color reduction context. The counters must have been enabled
+// with RxEnableStats.
+//
+// Parameters:
+//   reduction     The color reduction context
+//   stats         The structure that receives the counters
+//
+// Returns:
+//   RX_STATUS_OK on success, or RX_STATUS_INCORRECT_STATE if the counters are not enabled.
+// -----------------------------------------------------------------------------------------------
+RxStatus RX_API RxGetStats(
+	RxReduction *reduction,
+	RxStats     *stats
+);
+
 // -----------------------------------------------------------------------------------------------
 // Name: RxHistAddColor
 //
@@ -606,6 +741,28 @@ RxStatus RX_API RxHistAdd(
 	unsigned int   height
 );
 
+// -----------------------------------------------------------------------------------------------
+// Name: RxHistAddImages
+//
+// Add the color data of a set of images to the histogram of a color reduction context, such as
+// the frames of an animation. The images are processed on multiple threads, and the result does
+// not depend on the number of threads used.
+//
+// Parameters:
+//   reduction     The color reduction context.
+//   images        The pixels of each image.
+//   widths        The width of each image.
+//   heights       The height of each image.
+//   nImages       The number of images.
+// -----------------------------------------------------------------------------------------------
+RxStatus RX_API RxHistAddImages(
+	RxReduction          *reduction,
+	const COLOR32 *const *images,
+	const unsigned int   *widths,
+	const unsigned int   *heights,
+	unsigned int          nImages
+);
+
 // -----------------------------------------------------------------------------------------------
 // Name: RxHistSort
 //
@@ -671,6 +828,7 @@ unsigned int RX_API RxHistGetTopN(
 // Name: RxHistClear
 //
 // Clears out a color reduction context's histogram. Can be used to create multiple palettes.
+// The memory held by the histogram is kept, so that clearing and refilling it is inexpensive.
 //
 // Parameters:
 //   reduction     The color reduction context.
@@ -683,8 +841,8 @@ RxStatus RX_API RxHistClear(
 // Name: RxHistFinalize
 //
 // Finalizes the histogram of a color reduction context. Call this function once all of the colors
-// to be added to the histogram have been added to the histogram. Colors may not be added after
-// calling this function.
+// to be added to the histogram have been added to the histogram. Adding colors after calling this
+// function discards the finalized histogram until this function is called again.
 //
 // Parameters:
 //   reduction     The color reduction context.
@@ -786,6 +944,39 @@ RxStatus RX_API RxCreatePalette(
 	unsigned int  *pOutCols
 );
 
+// -----------------------------------------------------------------------------------------------
+// Name: RxCreateSharedPalette
+//
+// Creates one color palette shared by a set of images, such as the frames of an animation or a
+// set of sprites. This behaves like RxCreatePalette, with the histogram built by
+// RxHistAddImages.
+//
+// Parameters:
+//   reduction     The color reduction context.
+//   images        The pixels of each image.
+//   widths        The width of each image.
+//   heights       The height of each image.
+//   nImages       The number of images.
+//   pal           The output palette buffer.
+//   nColors       The size of the color palette to create.
+//   flag          Color reduction flags for palette sorting (see enum RxFlag).
+//   pOutCols      Pointer to output number of colors (may be NULL).
+//
+// Returns:
+//   The completed operation status.
+// -----------------------------------------------------------------------------------------------
+RxStatus RX_API RxCreateSharedPalette(
+	RxReduction          *reduction,
+	const COLOR32 *const *images,
+	const unsigned int   *widths,
+	const unsigned int   *heights,
+	unsigned int          nImages,
+	COLOR32              *pal,
+	unsigned int          nColors,
+	RxFlag                flag,
+	unsigned int         *pOutCols
+);
+
 // -----------------------------------------------------------------------------------------------
 // Name: RxComputeColorDifference
 //
@@ -919,6 +1110,35 @@ RxStatus RX_API RxReduceImage(
 	float          diffuse
 );
 
+// -----------------------------------------------------------------------------------------------
+// Name: RxReduceImages
+//
+// Reduce the colors of a set of images according to the palette loaded in the color reduction
+// context. Each image is reduced as by RxReduceImage, and the images are processed concurrently
+// on multiple threads. When multiple threads are used, progress is reported per image.
+//
+// Parameters:
+//   reduction     The color reduction context.
+//   images        The pixels of each image.
+//   indices       The output indexed buffer of each image (optional). This may be set to NULL,
+//                 and individual buffers may also be NULL.
+//   widths        The width of each image.
+//   heights       The height of each image.
+//   nImages       The number of images.
+//   flag          Color reduction flag.
+//   diffuse       The error diffusion amount, from 0 to 1. Set to 0 to disable dithering.
+// -----------------------------------------------------------------------------------------------
+RxStatus RX_API RxReduceImages(
+	RxReduction         *reduction,
+	COLOR32 *const      *images,
+	int *const          *indices,
+	const unsigned int  *widths,
+	const unsigned int  *heights,
+	unsigned int         nImages,
+	RxFlag               flag,
+	float                diffuse
+);
+
 // -----------------------------------------------------------------------------------------------
 // Name: RxPaletteLoad
 //
@@ -1044,6 +1264,56 @@ void RX_API RxPaletteFree(
 	RxReduction *reduction
 );
 
+// -----------------------------------------------------------------------------------------------
+// Name: RxPaletteDetach
+//
+// Detaches the palette loaded in the current reduction context, so that it may be kept and later
+// attached again with RxPaletteAttach. This avoids reloading palettes that are switched between
+// often, and keeps the palette's lookup cache. After this call, the context has no palette
+// loaded, and the caller must free the palette with RxPaletteDestroy.
+//
+// Opaque colors exactly representable in RGB555 are mapped through a cache of closest palette
+// indices, which is built once a palette has been searched enough times.
+//
+// Parameters:
+//   reduction     The color reduction context.
+//
+// Returns:
+//   The detached palette, or NULL if no palette is loaded.
+// -----------------------------------------------------------------------------------------------
+RxPalette *RX_API RxPaletteDetach(
+	RxReduction *reduction
+);
+
+// -----------------------------------------------------------------------------------------------
+// Name: RxPaletteAttach
+//
+// Makes a palette detached with RxPaletteDetach the loaded palette of a reduction context. Any
+// palette previously loaded is freed. The context takes ownership of the palette until it is
+// detached again. The palette must have been loaded on a context with the same palette layer count
+// and alpha mode.
+//
+// Parameters:
+//   reduction     The color reduction context.
+//   palette       The palette to attach.
+// -----------------------------------------------------------------------------------------------
+void RX_API RxPaletteAttach(
+	RxReduction *reduction,
+	RxPalette   *palette
+);
+
+// -----------------------------------------------------------------------------------------------
+// Name: RxPaletteDestroy
+//
+// Frees a palette detached with RxPaletteDetach.
+//
+// Parameters:
+//   palette       The palette to free. This may be NULL.
+// -----------------------------------------------------------------------------------------------
+void RX_API RxPaletteDestroy(
+	RxPalette *palette
+);
+
 // -----------------------------------------------------------------------------------------------
 // Name: RxFree
 //
@@ -1135,6 +1405,12 @@ RxStatus RX_API RxGlbReduceImage(
 // Creates multiple palettes for an image for character map color reduction with user-provided
 // balance, color balance, and color enhancement settings.
 //
+// Palettes are created by repeatedly merging the two most similar palettes of tiles. For images
+// larger than 1024 tiles, only a few of the most similar palettes are considered as merge
+// candidates for each palette, which keeps the time and memory required manageable. The result
+// for those images is approximate, with slightly higher error (about 0.3-0.7%) than comparing
+// every pair of palettes.
+//
 // Parameters:
 //   px              The image pixels.
 //   tilesX          The image width, in 8-pixel units.
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "rxbench.h"
+#include "palette.h"
+#include "thread.h"
+
+
+static COLOR32 *RxiBenchMakeImage(unsigned int width, unsigned int height) {
+	//smooth gradients with noise, so that the histogram holds many distinct colors
+	COLOR32 *px = (COLOR32 *) malloc(width * height * sizeof(COLOR32));
+	if (px == NULL) return NULL;
+
+	uint32_t seed = 0x12345678;
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) {
+			seed = seed * 1103515245 + 12345;
+			unsigned int noise = (seed >> 16) & 0x3F;
+
+			unsigned int r = (x * 255 / width + noise) & 0xFF;
+			unsigned int g = (y * 255 / height + noise * 3) & 0xFF;
+			unsigned int b = ((x ^ y) + noise) & 0xFF;
+			px[x + y * width] = 0xFF000000 | (b << 16) | (g << 8) | r;
+		}
+	}
+	return px;
+}
+
+static double RxiBenchCreatePalette(const COLOR32 *px, unsigned int nThreads, COLOR32 *pal, unsigned int *pnColors) {
+	//time palette creation, repeating short runs
+	unsigned int nRuns = 0;
+	double start = ThGetTime(), elapsed;
+	do {
+		RxReduction *reduction = RxNew(NULL);
+		if (reduction == NULL) return 0.0;
+
+		RxSetThreadCount(reduction, nThreads);
+		RxCreatePalette(reduction, px, RX_BENCH_IMAGE_SIZE, RX_BENCH_IMAGE_SIZE, pal, RX_BENCH_COLORS, RX_FLAG_SORT_ALL, NULL);
+		*pnColors = reduction->histogram->nEntries;
+		RxFree(reduction);
+
+		nRuns++;
+		elapsed = ThGetTime() - start;
+	} while (elapsed < RX_BENCH_MIN_TIME);
+	return elapsed / nRuns;
+}
+
+static void RxiBenchGetStats(const COLOR32 *px, unsigned int nThreads, RxStats *stats) {
+	//the performance counters are collected on a separate run, so that they don't affect the timing
+	memset(stats, 0, sizeof(*stats));
+	RxReduction *reduction = RxNew(NULL);
+	if (reduction == NULL) return;
+
+	RxSetThreadCount(reduction, nThreads);
+	if (RxEnableStats(reduction, RX_TRUE) == RX_STATUS_OK) {
+		COLOR32 pal[RX_BENCH_COLORS];
+		RxCreatePalette(reduction, px, RX_BENCH_IMAGE_SIZE, RX_BENCH_IMAGE_SIZE, pal, RX_BENCH_COLORS, RX_FLAG_SORT_ALL, NULL);
+		RxGetStats(reduction, stats);
+	}
+	RxFree(reduction);
+}
+
+static void RxiBenchWriteResult(FILE *fp, int json, int index, const RxBenchResult *result) {
+	const RxStats *stats = &result->stats;
+	if (json) {
+		if (index > 0) fprintf(fp, ",\n");
+		fprintf(fp, "\t{ \"threads\": %u, \"colors\": %u, \"seconds\": %.4f, \"speedup\": %.3f, \"identical\": %s, "
+			"\"histogram_seconds\": %.4f, \"split_seconds\": %.4f, \"voronoi_seconds\": %.4f, \"accel_seconds\": %.4f, "
+			"\"voronoi_passes\": %lld, \"searches\": %lld, \"distance_evals\": %lld, \"node_visits\": %lld }",
+			result->nThreads, result->nColors, result->time, result->speedup, result->identical ? "true" : "false",
+			stats->histogramTime, stats->splitTime, stats->voronoiTime, stats->accelTime,
+			stats->nVoronoiPasses, stats->nSearches, stats->nDistanceEvals, stats->nNodeVisits);
+	} else {
+		fprintf(fp, "%u,%u,%.4f,%.3f,%d,%.4f,%.4f,%.4f,%.4f,%lld,%lld,%lld,%lld\n", result->nThreads, result->nColors,
+			result->time, result->speedup, result->identical, stats->histogramTime, stats->splitTime, stats->voronoiTime,
+			stats->accelTime, stats->nVoronoiPasses, stats->nSearches, stats->nDistanceEvals, stats->nNodeVisits);
+	}
+}
+
+int RxBenchRunThreads(FILE *fp, int json) {
+	COLOR32 *px = RxiBenchMakeImage(RX_BENCH_IMAGE_SIZE, RX_BENCH_IMAGE_SIZE);
+	if (px == NULL) return 1;
+
+	if (json) fprintf(fp, "[\n");
+	else fprintf(fp, "threads,colors,seconds,speedup,identical,histogram_seconds,split_seconds,voronoi_seconds,"
+		"accel_seconds,voronoi_passes,searches,distance_evals,node_visits\n");
+
+	COLOR32 refPal[RX_BENCH_COLORS], pal[RX_BENCH_COLORS];
+	double refTime = 0.0;
+
+	int status = 0, index = 0;
+	unsigned int nProcessors = ThGetProcessorCount();
+	for (unsigned int nThreads = 1; ; nThreads *= 2) {
+		//end on the processor count, when it isn't a power of 2
+		if (nThreads > nProcessors) nThreads = nProcessors;
+
+		RxBenchResult result = { 0 };
+		result.nThreads = nThreads;
+		result.time = RxiBenchCreatePalette(px, nThreads, pal, &result.nColors);
+		RxiBenchGetStats(px, nThreads, &result.stats);
+		if (nThreads == 1) {
+			memcpy(refPal, pal, sizeof(pal));
+			refTime = result.time;
+		}
+
+		result.speedup = result.time > 0.0 ? (refTime / result.time) : 0.0;
+		result.identical = memcmp(pal, refPal, sizeof(pal)) == 0;
+		if (!result.identical) status = 1;
+
+		RxiBenchWriteResult(fp, json, index++, &result);
+		if (nThreads >= nProcessors) break;
+	}
+
+	if (json) fprintf(fp, "\n]\n");
+	free(px);
+	return status;
+}
+
+static double RxiBenchConvert(const COLOR32 *px, unsigned int width, unsigned int height, RxYiqColor *yiq, int byRow) {
+	//time conversion of the whole image, repeating short runs
+	unsigned int nRuns = 0;
+	double start = ThGetTime(), elapsed;
+	do {
+		for (unsigned int y = 0; y < height; y++) {
+			if (byRow) {
+				RxConvertRowToYiq(px + y * width, yiq + y * width, width, 1);
+			} else {
+				for (unsigned int x = 0; x < width; x++) {
+					RxConvertRgbToYiq(px[x + y * width], &yiq[x + y * width]);
+				}
+			}
+		}
+
+		nRuns++;
+		elapsed = ThGetTime() - start;
+	} while (elapsed < RX_BENCH_MIN_TIME);
+	return elapsed / nRuns;
+}
+
+int RxBenchRunConvert(FILE *fp, int json) {
+	if (json) fprintf(fp, "[\n");
+	else fprintf(fp, "pixels,pixel_seconds,row_seconds,speedup,identical\n");
+
+	int status = 0;
+	for (unsigned int i = 0; i < 3; i++) {
+		unsigned int width = 1024 << ((i + 1) / 2), height = 1024 << (i / 2);
+
+		COLOR32 *px = RxiBenchMakeImage(width, height);
+		RxYiqColor *yiqPixel = (RxYiqColor *) RxMemAlloc(width * height * sizeof(RxYiqColor));
+		RxYiqColor *yiqRow = (RxYiqColor *) RxMemAlloc(width * height * sizeof(RxYiqColor));
+		if (px == NULL || yiqPixel == NULL || yiqRow == NULL) {
+			free(px);
+			RxMemFree(yiqPixel);
+			RxMemFree(yiqRow);
+			status = 1;
+			break;
+		}
+
+		RxBenchConvertResult result = { 0 };
+		result.nPixels = width * height;
+		result.timePixel = RxiBenchConvert(px, width, height, yiqPixel, 0);
+		result.timeRow = RxiBenchConvert(px, width, height, yiqRow, 1);
+		result.speedup = result.timeRow > 0.0 ? (result.timePixel / result.timeRow) : 0.0;
+		result.identical = memcmp(yiqPixel, yiqRow, width * height * sizeof(RxYiqColor)) == 0;
+		if (!result.identical) status = 1;
+
+		if (json) {
+			if (i > 0) fprintf(fp, ",\n");
+			fprintf(fp, "\t{ \"pixels\": %u, \"pixel_seconds\": %.4f, \"row_seconds\": %.4f, \"speedup\": %.3f, \"identical\": %s }",
+				result.nPixels, result.timePixel, result.timeRow, result.speedup, result.identical ? "true" : "false");
+		} else {
+			fprintf(fp, "%u,%.4f,%.4f,%.3f,%d\n", result.nPixels, result.timePixel, result.timeRow, result.speedup, result.identical);
+		}
+
+		free(px);
+		RxMemFree(yiqPixel);
+		RxMemFree(yiqRow);
+	}
+
+	if (json) fprintf(fp, "\n]\n");
+	return status;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "palette.h"
+
+//
+// Headless benchmark of the color reduction code. Palettes are created for generated image data
+// with increasing numbers of threads, to measure how the work scales and to check that the result
+// does not depend on the number of threads. The performance counters of each palette (see
+// RxEnableStats) are reported with it. The batch RGB to YIQ conversion is also compared with
+// the per-pixel conversion. Results are written as CSV or JSON.
+//
+
+#define RX_BENCH_MIN_TIME   0.25  // minimum time (seconds) spent timing each operation
+#define RX_BENCH_IMAGE_SIZE 512   // width and height of the generated image
+#define RX_BENCH_COLORS     256   // size of the palettes created
+
+
+typedef struct RxBenchResult_ {
+	unsigned int nThreads;        // number of threads used
+	unsigned int nColors;         // number of distinct colors in the input
+	double time;                  // seconds per palette
+	double speedup;               // speedup relative to one thread
+	int identical;                // palette matched the one created with one thread
+	RxStats stats;                // performance counters of one palette creation
+} RxBenchResult;
+
+typedef struct RxBenchConvertResult_ {
+	unsigned int nPixels;         // number of pixels converted
+	double timePixel;             // seconds to convert the image one pixel at a time
+	double timeRow;               // seconds to convert the image one row at a time
+	double speedup;               // speedup of the row conversion
+	int identical;                // row conversion matched the per-pixel conversion
+} RxBenchConvertResult;
+
+
+//
+// Benchmarks palette creation with 1, 2, 4, ... threads up to the number of logical processors.
+// Returns 0 on success, or 1 if a palette differed from the one created with one thread.
+// Cluster totals are summed in histogram order for any thread count, so the one-thread palette
+// is also the one the serial reduction code creates.
+//
+int RxBenchRunThreads(FILE *fp, int json);
+
+//
+// Benchmarks RGB to YIQ conversion of 1, 2 and 4 megapixel images, per pixel and per row. Returns
+// 0 on success, or 1 if the two conversions differed.
+//
+int RxBenchRunConvert(FILE *fp, int json);
@@ -25,6 +25,7 @@
 #include "palette.h"
 #include "color.h"
 #include "texconv.h"
+#include "thread.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -171,7 +172,7 @@ static int TxiConvertDirect(TxConversionParameters *params, RxReduction *reducti
 	RxApplyFlags(reduction, flag);
 	RxSetProgressCallback(reduction, TxiConvertProgressUpdate, params);
 	RxPaletteLoad(reduction, pltt, 32769);
-	RxReduceImage(reduction, params->px, idxs, params->width, params->height, flag, diffuse);
+	RxReduceImage(reduction, params->px, idxs, params->width, params->height, flag | RX_FLAG_PARALLEL_DIFFUSE, diffuse);
 
 	for (unsigned int i = 0; i < params->width * params->height; i++) {
 		if (idxs[i] == 0) txel[i] = 0; // transparent
@@ -254,7 +255,7 @@ static int TxiConvertPlttN(TxConversionParameters *params, RxReduction *reductio
 
 	RxSetProgressCallback(reduction, TxiConvertProgressUpdate2, params);
 	RxPaletteLoad(reduction, palette, nColors);
-	RxReduceImage(reduction, params->px, idxs, width, height, flag | RX_FLAG_NO_PRESERVE_ALPHA, diffuse);
+	RxReduceImage(reduction, params->px, idxs, width, height, flag | RX_FLAG_NO_PRESERVE_ALPHA | RX_FLAG_PARALLEL_DIFFUSE, diffuse);
 
 	TEXCONV_CHECK_ABORT(params->terminate);
 
@@ -360,14 +361,14 @@ static int TxiConvertAxIy(TxConversionParameters *params, RxReduction *reduction
 
 		//when color and alpha not jointly dithered, we fall back to a simplified model.
 		RxPaletteLoad(reduction, palette + (alphaMax << alphaShift), nColors);
-		RxReduceImage(reduction, params->px, idxs, width, height, flag, diffuse);
+		RxReduceImage(reduction, params->px, idxs, width, height, flag | RX_FLAG_PARALLEL_DIFFUSE, diffuse);
 	} else {
 		RxFlag flag = RX_FLAG_ALPHA_MODE_PALETTE | RX_FLAG_PRESERVE_ALPHA;
 		RxApplyFlags(reduction, flag);
 
 		//dithering with alpha: use alpha dithered mode
 		RxPaletteLoad(reduction, palette, 256);
-		RxReduceImage(reduction, params->px, idxs, width, height, flag, diffuse);
+		RxReduceImage(reduction, params->px, idxs, width, height, flag | RX_FLAG_PARALLEL_DIFFUSE, diffuse);
 	}
 
 	//write texel data.
@@ -417,8 +418,56 @@ typedef struct TxiTileErrorMpEntry_ {
 	double error;          // error value for tile
 } TxiTileErrorMapEntry;
 
+// Marks the absence of a palette or block in the palette merging structures.
+#define TXC_NO_PALETTE    ((unsigned int) -1)
+
+typedef struct TxiPaletteGroup_ {
+	uint16_t mode;                   // the palette's mode
+	uint16_t alive;                  // marks a palette in use (added, and not merged into another)
+	unsigned int nUses;              // number of blocks the palette was created for
+	unsigned int firstTile;          // first block using the palette
+	unsigned int lastTile;           // last block using the palette
+	unsigned int prev;               // previous palette in use of the same mode
+	unsigned int next;               // next palette in use of the same mode
+	unsigned int nearest;            // most similar later palette in use of the same mode
+	double nearestDistance;          // merge distance to the nearest palette
+	unsigned int stamp;              // changed with the nearest palette, invalidating older merge candidates
+} TxiPaletteGroup;
+
+typedef struct TxiMergeCandidate_ {
+	double distance;                 // merge distance of the pair
+	unsigned int group;              // first palette of the pair (the second is its nearest palette)
+	unsigned int stamp;              // stamp of the first palette when the candidate was added
+} TxiMergeCandidate;
+
+typedef struct TxiPaletteSearchEntry_ {
+	RxYiqColor pltt[4];              // the effective palette in YIQ
+	unsigned int nColors;            // the size of the effective palette
+	float min[3];                    // least Y, I and Q of the palette's colors
+	float max[3];                    // greatest Y, I and Q of the palette's colors
+	unsigned int order;              // position in the order of an exhaustive search (from 1)
+	uint16_t pidx;                   // palette index data unit (mode and palette address)
+} TxiPaletteSearchEntry;
+
+typedef struct TxiPaletteSearchNode_ {
+	float min[3];                    // least Y, I and Q of the palettes under the node
+	float max[3];                    // greatest Y, I and Q of the palettes under the node
+	unsigned int first;              // first palette under the node
+	unsigned int count;              // number of palettes under the node
+	unsigned int left;               // left child node, or 0 for a leaf
+	unsigned int right;              // right child node, or 0 for a leaf
+} TxiPaletteSearchNode;
+
+typedef struct TxiPaletteTree_ {
+	TxiPaletteSearchEntry *entries;  // palettes to search, partitioned by the nodes
+	TxiPaletteSearchNode *nodes;     // k-d tree nodes over the palettes (the first is the root)
+	unsigned int nEntries;           // number of palettes
+	unsigned int nNodes;             // number of nodes
+} TxiPaletteTree;
+
 typedef struct TxiConversionWork_ {
 	RxReduction *reduction;          // the color reduction context
+	const RxBalanceSetting *balance; // balance setting, for creating color reduction contexts on worker threads
 	float diffuse;                   // error diffusion amount
 	double threshold;                // 4x4 conversion threshold setting (0-1)
 
@@ -427,15 +476,29 @@ typedef struct TxiConversionWork_ {
 	unsigned char *useMap;           // the texture palette usage map
 	unsigned int nTiles;             // the number of total tiles
 
+	unsigned int *blockHash;         // hash table of tile indices (plus 1) by pixel data
+	unsigned int *sameBlock;         // per tile, the last earlier tile with the same pixels (plus 1), or 0. Once
+	                                 // added, a duplicate tile's is the tile whose palette it uses (plus 1)
+	unsigned int *paletteHash;       // hash table of tile indices (plus 1) by palette and mode
+	unsigned int hashSize;           // the number of slots in each hash table (a power of 2)
+
 	const COLOR *fixedPalette;       // fixed palette (if used)
 
 	const COLOR32 *px;               // source pixel buffer
 	unsigned int width;              // source width
 	unsigned int height;             // source height
 
-	RxYiqColor *plttYiq;             // YIQ palette buffer
-	int *colorTable;                 // table holding the mode associated with each palette color
-	unsigned int *useTable;          // table holding the number of uses associated with each color
+	TxiPaletteGroup *groups;         // palettes of the blocks, in the order they are added
+	RxYiqColor *plttYiq;             // YIQ colors of each palette (4 per palette)
+	unsigned int *tileNext;          // next block using the same palette, in block order
+	unsigned int modeHead[4];        // first palette in use of each mode
+	unsigned int modeTail[4];        // last palette in use of each mode
+	TxiMergeCandidate *mergeHeap;    // min-heap of the nearest pairs of palettes
+	unsigned int nMergeCandidates;   // number of candidates in the heap
+	unsigned int mergeHeapSize;      // capacity of the heap
+
+	TxiPaletteTree opaqueSearch;     // palettes for blocks without transparent pixels
+	TxiPaletteTree translucentSearch;// palettes for blocks with transparent pixels
 
 	uint32_t *txel;                  // output: texel data
 	uint16_t *pidx;                  // output: palette index data
@@ -466,6 +529,9 @@ typedef struct TxiConversionWork_ {
 // diminishing returns.
 #define TXC_PALETTE_REFINEMENTS           4
 
+// Defines the maximum number of palettes held by a leaf node of the palette search tree.
+#define TXC_SEARCH_LEAF_SIZE              8
+
 
 
 
@@ -901,14 +967,16 @@ static double Txi4x4ComputeMSE(
 // 
 // Parameters:
 //   work          The tex4x4 conversion context.
+//   reduction     The color reduction context to use. Blocks may be processed concurrently on
+//                 separate contexts.
 //   tile          The block to decide on the palette and palette index setting for.
 // -----------------------------------------------------------------------------------------------
 static void Txi4x4ChooseTilePaletteAndMode(
 	TxiConversionWork *work,
+	RxReduction       *reduction,
 	TxTileData        *tile
 ) {
 	//add pixels to histogram
-	RxReduction *reduction = work->reduction;
 	RxHistClear(reduction);
 	RxHistAdd(reduction, tile->rgb, 4, 4);
 	RxHistFinalize(reduction);
@@ -973,24 +1041,125 @@ static void Txi4x4ChooseTilePaletteAndMode(
 }
 
 // -----------------------------------------------------------------------------------------------
-// Name: Txi4x4AddTile
-// 
-// This routine selects an initial palette and mode for a 4x4 pixel block, and searches for any
-// duplicate data found previously, merging data if possible. 
+// Name: Txi4x4HashWords
 //
-// When the fixed palette is used, this function skips creating palettes and selecting the mode.
+// Computes a hash of a sequence of 32-bit words, for looking up blocks in the conversion
+// context's hash tables.
+//
+// Parameters:
+//   words         The words to hash
+//   nWords        The number of words
+//
+// Returns:
+//   The hash value.
+// -----------------------------------------------------------------------------------------------
+static uint32_t Txi4x4HashWords(const uint32_t *words, unsigned int nWords) {
+	uint32_t h = 0;
+	for (unsigned int i = 0; i < nWords; i++) {
+		h = (h ^ words[i]) * 0x9E3779B1;
+		h ^= h >> 15;
+	}
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+	return h;
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4PaletteEquals
+//
+// Determines whether two blocks have the same mode and palette. Interpolated modes are compared
+// by their two endpoints only.
+//
+// Parameters:
+//   tile1         The first block
+//   tile2         The second block
+//
+// Returns:
+//   1 if the modes and palettes are the same, or 0 otherwise.
+// -----------------------------------------------------------------------------------------------
+static int Txi4x4PaletteEquals(const TxTileData *tile1, const TxTileData *tile2) {
+	if (tile1->mode != tile2->mode) return 0;
+
+	if (tile1->palette32[0] != tile2->palette32[0] || tile1->palette32[1] != tile2->palette32[1]) return 0;
+	if (!(tile1->mode & GX_TEX4x4_PIDX_PTY_INTERPOLATE)) {
+		if (tile1->palette32[2] != tile2->palette32[2] || tile1->palette32[3] != tile2->palette32[3]) return 0;
+	}
+	return 1;
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4LookupBlock
+//
+// Looks up the last block added with the same pixel data as a block. The returned slot holds
+// the index of that block plus 1, or 0 if there is none, in which case the slot is free to hold
+// the block being looked up.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   tile          The block to look up
+//
+// Returns:
+//   The hash table slot of the block.
+// -----------------------------------------------------------------------------------------------
+static unsigned int *Txi4x4LookupBlock(TxiConversionWork *work, const TxTileData *tile) {
+	unsigned int mask = work->hashSize - 1;
+	unsigned int slot = Txi4x4HashWords(tile->rgb, 16) & mask;
+
+	//linear probing. The table is kept at most half full, so an empty slot is always found.
+	while (work->blockHash[slot] != 0) {
+		const TxTileData *tile1 = &work->tiles[work->blockHash[slot] - 1];
+		if (!memcmp(tile1->rgb, tile->rgb, sizeof(tile->rgb))) break;
+		slot = (slot + 1) & mask;
+	}
+	return &work->blockHash[slot];
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4LookupPalette
+//
+// Looks up the last non-duplicate block added with the same mode and palette as a block. The
+// returned slot holds the index of that block plus 1, or 0 if there is none, in which case the
+// slot is free to hold the block being looked up.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   tile          The block to look up
+//
+// Returns:
+//   The hash table slot of the block.
+// -----------------------------------------------------------------------------------------------
+static unsigned int *Txi4x4LookupPalette(TxiConversionWork *work, const TxTileData *tile) {
+	//the key holds only the colors compared by Txi4x4PaletteEquals.
+	uint32_t key[5];
+	key[0] = tile->mode;
+	key[1] = tile->palette32[0];
+	key[2] = tile->palette32[1];
+	key[3] = (tile->mode & GX_TEX4x4_PIDX_PTY_INTERPOLATE) ? 0 : tile->palette32[2];
+	key[4] = (tile->mode & GX_TEX4x4_PIDX_PTY_INTERPOLATE) ? 0 : tile->palette32[3];
+
+	unsigned int mask = work->hashSize - 1;
+	unsigned int slot = Txi4x4HashWords(key, 5) & mask;
+	while (work->paletteHash[slot] != 0) {
+		if (Txi4x4PaletteEquals(&work->tiles[work->paletteHash[slot] - 1], tile)) break;
+		slot = (slot + 1) & mask;
+	}
+	return &work->paletteHash[slot];
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4LoadTile
+// 
+// This routine initializes a 4x4 pixel block with its pixels, binarizing the alpha channel.
 //
 // Parameters:
 //   work          The tex4x4 conversion context
 //   index         The index of the block being initialized
 //   pxBlock       The 4x4 block of pixels this block is to be initialized with
-//   pPlttIndex    A pointer to the current accumulated palette index
 // -----------------------------------------------------------------------------------------------
-static void Txi4x4AddTile(
+static void Txi4x4LoadTile(
 	TxiConversionWork *work,
 	unsigned int       index,
-	const COLOR32     *pxBlock,
-	unsigned int      *pPlttIndex
+	const COLOR32     *pxBlock
 ) {
 	TxTileData *tile = &work->tiles[index];
 	tile->duplicate = 0;
@@ -1011,6 +1180,28 @@ static void Txi4x4AddTile(
 			tile->rgb[i] = c | 0xFF000000; // set alpha=1 (over threshold)
 		}
 	}
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4AddTile
+// 
+// This routine searches for any duplicate data found previously for a 4x4 pixel block, merging
+// data if possible. The block must already be loaded, and unless it duplicates the pixels of an
+// earlier block, have its initial palette and mode selected.
+//
+// When the fixed palette is used, this function skips creating palettes and selecting the mode.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   index         The index of the block being initialized
+//   pPlttIndex    A pointer to the current accumulated palette index
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4AddTile(
+	TxiConversionWork *work,
+	unsigned int       index,
+	unsigned int      *pPlttIndex
+) {
+	TxTileData *tile = &work->tiles[index];
 
 	//is fully transparent?
 	if (tile->nTransparent == 16) {
@@ -1020,45 +1211,41 @@ static void Txi4x4AddTile(
 		tile->mode = GX_TEX4x4_PIDX_A_XPNT | GX_TEX4x4_PIDX_PTY_FULL;
 		tile->palette32[0] = 0xFF000000;
 		tile->palette32[1] = 0xFF000000;
+
+		//this is not a duplicate, so later blocks may take its palette.
+		if (work->fixedPalette == NULL) *Txi4x4LookupPalette(work, tile) = index + 1;
 		return;
 	}
 	
-	//is it a duplicate?
-	for (unsigned int i = index; i > 0; i--) {
-		COLOR32 *px1 = work->tiles[i - 1].rgb;
-
-		if (!memcmp(px1, tile->rgb, 16 * sizeof(COLOR32))) {
-			//tile pixels are duplicate
-			memcpy(tile, &work->tiles[i - 1], sizeof(TxTileData));
-			tile->paletteIndex = work->tiles[i - 1].paletteIndex;
-			tile->duplicate = 1;
-			work->tiles[i - 1].nDuplicates++;
-			return;
-		}
+	//is it a duplicate? Duplicates are matched to the last block with the same pixels.
+	if (work->sameBlock[index] != 0) {
+		//tile pixels are duplicate. If the earlier tile is itself a duplicate, take the palette it uses.
+		unsigned int index1 = work->sameBlock[index] - 1;
+		TxTileData *tile1 = &work->tiles[index1];
+		memcpy(tile, tile1, sizeof(TxTileData));
+		tile->paletteIndex = tile1->paletteIndex;
+		tile->duplicate = 1;
+		tile1->nDuplicates++;
+		if (tile1->duplicate) work->sameBlock[index] = work->sameBlock[index1];
+		return;
 	}
 
 	if (work->fixedPalette == NULL) {
-		//generate a palette and determine the mode.
-		Txi4x4ChooseTilePaletteAndMode(work, tile);
+		//the palette and mode were selected ahead of time.
 		tile->paletteIndex = *pPlttIndex;
 
 		//is the palette and mode identical to a non-duplicate tile?
-		for (unsigned int i = index; i > 0; i--) {
-			TxTileData *tile1 = &work->tiles[i - 1];
-			if (tile1->duplicate) continue;
-			if (tile1->mode != tile->mode) continue;
-
-			if (tile1->palette32[0] != tile->palette32[0] || tile1->palette32[1] != tile->palette32[1]) continue;
-			if (!(tile1->mode & GX_TEX4x4_PIDX_PTY_INTERPOLATE)) {
-				if (tile1->palette32[2] != tile->palette32[2] || tile1->palette32[3] != tile->palette32[3]) continue;
-			}
-
+		unsigned int *paletteSlot = Txi4x4LookupPalette(work, tile);
+		if (*paletteSlot != 0) {
 			//palettes and modes are the same, mark as duplicate.
+			TxTileData *tile1 = &work->tiles[*paletteSlot - 1];
 			tile->duplicate = 1;
 			tile->paletteIndex = tile1->paletteIndex;
 			tile1->nDuplicates++;
+			work->sameBlock[index] = *paletteSlot;
 			return;
 		}
+		*paletteSlot = index + 1;
 	} else {
 		//do not create a palette.
 		tile->paletteIndex = 0;
@@ -1069,12 +1256,116 @@ static void Txi4x4AddTile(
 	*pPlttIndex += Txi4x4GetPaletteSizeForMode(tile->mode) / 2;
 }
 
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4GetWorkerCount
+// 
+// This routine gets the number of worker threads to use for processing 4x4 pixel blocks in
+// parallel. This follows the thread count setting of the color reduction context.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//
+// Returns:
+//   The number of worker threads.
+// -----------------------------------------------------------------------------------------------
+static unsigned int Txi4x4GetWorkerCount(TxiConversionWork *work) {
+	unsigned int nThreads = ThGetProcessorCount();
+	if (work->reduction->nThreads != 0 && work->reduction->nThreads < nThreads) nThreads = work->reduction->nThreads;
+	return nThreads;
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4GetWorkerReduction
+// 
+// This routine gets a color reduction context for a worker thread. Worker 0 runs on the calling
+// thread, and uses the conversion's color reduction context. Other workers create their own,
+// which must be freed with Txi4x4ReleaseWorkerReduction.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   iWorker       The index of the worker
+//
+// Returns:
+//   The color reduction context, or NULL if one could not be created.
+// -----------------------------------------------------------------------------------------------
+static RxReduction *Txi4x4GetWorkerReduction(TxiConversionWork *work, unsigned int iWorker) {
+	if (iWorker == 0) return work->reduction;
+
+	RxReduction *reduction = RxNew(work->balance);
+	if (reduction != NULL) RxSetThreadCount(reduction, 1);
+	return reduction;
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4ReleaseWorkerReduction
+// 
+// This routine frees a color reduction context obtained with Txi4x4GetWorkerReduction.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   reduction     The color reduction context
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4ReleaseWorkerReduction(TxiConversionWork *work, RxReduction *reduction) {
+	if (reduction != NULL && reduction != work->reduction) RxFree(reduction);
+}
+
+typedef struct TxiTilePaletteWork_ {
+	TxiConversionWork *work;
+	int progressBase;                // progress level at the start of palette selection
+	volatile long nextTile;          // next tile to be claimed by a worker
+} TxiTilePaletteWork;
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4TilePaletteWorker
+// 
+// This routine is run on each worker thread to select the initial palettes and modes of 4x4
+// pixel blocks. Each worker uses its own color reduction context, and blocks are claimed one at
+// a time. A block's palette depends only on its pixels, so the result is the same however the
+// blocks are distributed.
+//
+// Parameters:
+//   param         The TxiTilePaletteWork structure
+//   iWorker       The index of the worker
+//   nWorkers      The number of workers
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4TilePaletteWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) nWorkers;
+	TxiTilePaletteWork *tileWork = (TxiTilePaletteWork *) param;
+	TxiConversionWork *work = tileWork->work;
+
+	RxReduction *reduction = Txi4x4GetWorkerReduction(work, iWorker);
+	if (reduction == NULL) return; // the remaining workers take over this worker's blocks
+
+	while (!*work->terminate) {
+		unsigned int i = (unsigned int) (ThAtomicIncrement(&tileWork->nextTile) - 1);
+		if (i >= work->nTiles) break;
+
+		//only blocks that are not transparent or duplicates of earlier blocks need a palette.
+		TxTileData *tile = &work->tiles[i];
+		if (tile->nTransparent == 16 || work->sameBlock[i] != 0) continue;
+
+		Txi4x4ChooseTilePaletteAndMode(work, reduction, tile);
+
+		//only the calling thread reports progress, by the number of claimed blocks.
+		if (iWorker == 0) {
+			unsigned int nClaimed = (unsigned int) ThAtomicLoad(&tileWork->nextTile);
+			if (nClaimed > work->nTiles) nClaimed = work->nTiles;
+			*work->progress = tileWork->progressBase + nClaimed;
+		}
+	}
+
+	Txi4x4ReleaseWorkerReduction(work, reduction);
+}
+
 // -----------------------------------------------------------------------------------------------
 // Name: Txi4x4CreateTileData
 // 
 // This routine splits the input bitmap into 4x4 pixel blocks, binarizes the alpha channel,
 // and selects an initial palette mode and palette colors for the blocks. 
 //
+// Palettes are selected on worker threads. Duplicate blocks are then resolved in block order, so
+// the result does not depend on the number of threads.
+//
 // When the fixed palette is used, this function skips creating palettes and selecting modes.
 //
 // Parameters:
@@ -1087,8 +1378,8 @@ static void Txi4x4CreateTileData(
 	unsigned int tilesX = work->width / 4;
 	unsigned int tilesY = work->height / 4;
 
-	//initialize the tile info for each pixel block in the image
-	unsigned int paletteIndex = 0, i = 0;
+	//load the pixels of each block, and find the blocks that duplicate the pixels of an earlier block.
+	unsigned int i = 0;
 	for (unsigned int y = 0; y < tilesY; y++) {
 		for (unsigned int x = 0; x < tilesX; x++) {
 			unsigned int offs = x * 4 + y * 4 * tilesX * 4;
@@ -1099,15 +1390,37 @@ static void Txi4x4CreateTileData(
 			memcpy(pxBlock +  8, px + offs + tilesX *  8, 4 * sizeof(COLOR32));
 			memcpy(pxBlock + 12, px + offs + tilesX * 12, 4 * sizeof(COLOR32));
 
-			Txi4x4AddTile(work, i, pxBlock, &paletteIndex);
+			Txi4x4LoadTile(work, i, pxBlock);
 
-			work->tiles[i].initMode = work->tiles[i].mode;
+			work->sameBlock[i] = 0;
+			if (work->tiles[i].nTransparent < 16) {
+				unsigned int *blockSlot = Txi4x4LookupBlock(work, &work->tiles[i]);
+				work->sameBlock[i] = *blockSlot;
+				*blockSlot = i + 1;
+			}
 			i++;
-
-			(*work->progress)++;
-			if (*work->terminate) return; // terminate check
 		}
 	}
+
+	//select the palettes and modes of the blocks. This is where the time is spent, so progress is
+	//reported here.
+	int progressBase = *work->progress;
+	if (work->fixedPalette == NULL) {
+		TxiTilePaletteWork tileWork = { 0 };
+		tileWork.work = work;
+		tileWork.progressBase = progressBase;
+		ThRunWorkers(Txi4x4TilePaletteWorker, &tileWork, Txi4x4GetWorkerCount(work));
+		if (*work->terminate) return; // terminate check
+	}
+
+	//resolve duplicates, and assign the initial palette indices.
+	unsigned int paletteIndex = 0;
+	for (i = 0; i < work->nTiles; i++) {
+		Txi4x4AddTile(work, i, &paletteIndex);
+		work->tiles[i].initMode = work->tiles[i].mode;
+		if (*work->terminate) return; // terminate check
+	}
+	*work->progress = progressBase + work->nTiles;
 }
 
 // -----------------------------------------------------------------------------------------------
@@ -1170,95 +1483,245 @@ static double Txi4x4ComputePaletteDifference(
 }
 
 // -----------------------------------------------------------------------------------------------
-// Name: Txi4x4FindClosestPalettes
-// 
-// This routine identifies the best matching palettes to merge. Candidate palette pairs must have
-// the same mode bits (PTY and A flags). 2-color palettes have differences doubled to compensate
-// for being smaller than 4-color palettes.
+// Name: Txi4x4ComputeMergeDistance
 //
-// Parameers:
+// This routine computes the cost of merging two palettes of the same mode. This is their
+// difference weighted by the number of blocks using them.
+//
+// Parameters:
 //   work          The tex4x4 conversion context
-//   nColors       The size of the color palette to search
-//   colorIndex1   A pointer receiving the address of the first palette
-//   colorIndex2   A pointer receiving the address of the second palette
+//   group1        The first palette
+//   group2        The second palette
 //
 // Returns:
-//   The dissimilarity measure between the two most similar palettes.
+//   The merge distance of the two palettes.
 // -----------------------------------------------------------------------------------------------
-static double Txi4x4FindClosestPalettes(
-	TxiConversionWork  *work,
-	unsigned int        nColors,
-	int                *colorIndex1,
-	int                *colorIndex2
+static double Txi4x4ComputeMergeDistance(
+	TxiConversionWork *work,
+	unsigned int       group1,
+	unsigned int       group2
 ) {
-	//determine which two palettes are the most similar. For 2-color palettes, multiply difference by 2.
-	double leastDistance = 1e32;
-	unsigned int idx1 = 0;
-
-	while (idx1 < nColors) {
-		int type1 = work->colorTable[idx1];
-		unsigned int nColorsInThisPalette = Txi4x4GetPaletteSizeForMode(type1);
-		unsigned int use1 = work->useTable[idx1];
-
-		//start searching forward.
-		unsigned int idx2 = idx1 + nColorsInThisPalette;
-		while (idx2 + nColorsInThisPalette <= nColors) {
-			int type2 = work->colorTable[idx2];
-			unsigned int nColorsInSecondPalette = Txi4x4GetPaletteSizeForMode(type2);
-			unsigned int use2 = work->useTable[idx2];
-
-			if (type2 != type1) {
-				idx2 += nColorsInSecondPalette;
-				continue;
-			}
+	const TxiPaletteGroup *g1 = &work->groups[group1], *g2 = &work->groups[group2];
+	unsigned int nColors = Txi4x4GetPaletteSizeForMode(g1->mode);
 
-			//same type, let's compare.
-			double dst = Txi4x4ComputePaletteDifference(work->reduction, &work->plttYiq[idx1], &work->plttYiq[idx2], nColorsInThisPalette)
-				* (double) (use1 + use2);
-			if (dst < leastDistance) {
-				leastDistance = dst;
-				*colorIndex1 = idx1;
-				*colorIndex2 = idx2;
-				if (leastDistance == 0.0) return 0.0;
-			}
+	return Txi4x4ComputePaletteDifference(work->reduction, &work->plttYiq[group1 * 4], &work->plttYiq[group2 * 4], nColors)
+		* (double) (g1->nUses + g2->nUses);
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4MergeCandidateLess
+//
+// This routine orders merge candidates by distance. Ties are broken by the first palette of the
+// pair, so that the earliest pair of palettes is merged first.
+//
+// Parameters:
+//   c1            The first merge candidate
+//   c2            The second merge candidate
+//
+// Returns:
+//   1 if c1 is merged before c2, or 0 otherwise.
+// -----------------------------------------------------------------------------------------------
+static int Txi4x4MergeCandidateLess(const TxiMergeCandidate *c1, const TxiMergeCandidate *c2) {
+	if (c1->distance != c2->distance) return c1->distance < c2->distance;
+	return c1->group < c2->group;
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4SiftDownMergeCandidate
+//
+// This routine restores the heap order below a merge candidate of the heap.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   i             The index of the candidate in the heap
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4SiftDownMergeCandidate(
+	TxiConversionWork *work,
+	unsigned int       i
+) {
+	TxiMergeCandidate *heap = work->mergeHeap;
+	unsigned int n = work->nMergeCandidates;
+
+	while (2 * i + 1 < n) {
+		unsigned int child = 2 * i + 1;
+		if (child + 1 < n && Txi4x4MergeCandidateLess(&heap[child + 1], &heap[child])) child++;
+		if (!Txi4x4MergeCandidateLess(&heap[child], &heap[i])) break;
+
+		TxiMergeCandidate tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4IsMergeCandidateValid
+//
+// This routine determines whether a merge candidate still describes the nearest pair of its
+// palette. Candidates are not removed from the heap when palettes change, and are instead
+// discarded once they reach the top.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   candidate     The merge candidate
+//
+// Returns:
+//   1 if the candidate is valid, or 0 otherwise.
+// -----------------------------------------------------------------------------------------------
+static int Txi4x4IsMergeCandidateValid(
+	TxiConversionWork       *work,
+	const TxiMergeCandidate *candidate
+) {
+	const TxiPaletteGroup *group = &work->groups[candidate->group];
+	return group->alive && group->stamp == candidate->stamp && group->nearest != TXC_NO_PALETTE;
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4PushMergeCandidate
+//
+// This routine adds the nearest pair of a palette to the merge candidate heap. When the heap is
+// full, candidates that are no longer valid are removed first.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   group         The palette whose nearest pair is added
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4PushMergeCandidate(
+	TxiConversionWork *work,
+	unsigned int       group
+) {
+	TxiMergeCandidate *heap = work->mergeHeap;
 
-			idx2 += nColorsInThisPalette;
+	if (work->nMergeCandidates == work->mergeHeapSize) {
+		//there is at most one valid candidate per palette, so this always frees enough space.
+		unsigned int nValid = 0;
+		for (unsigned int i = 0; i < work->nMergeCandidates; i++) {
+			if (Txi4x4IsMergeCandidateValid(work, &heap[i])) heap[nValid++] = heap[i];
 		}
-		idx1 += nColorsInThisPalette;
+		work->nMergeCandidates = nValid;
+		for (unsigned int i = nValid / 2; i > 0; i--) Txi4x4SiftDownMergeCandidate(work, i - 1);
+	}
+
+	TxiMergeCandidate candidate;
+	candidate.distance = work->groups[group].nearestDistance;
+	candidate.group = group;
+	candidate.stamp = work->groups[group].stamp;
 
+	//sift up
+	unsigned int i = work->nMergeCandidates++;
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+		if (!Txi4x4MergeCandidateLess(&candidate, &heap[parent])) break;
+		heap[i] = heap[parent];
+		i = parent;
 	}
-	return leastDistance;
+	heap[i] = candidate;
 }
 
 // -----------------------------------------------------------------------------------------------
-// Name: Txi4x4MergePalettes
-// 
-// This routine merges palettes together. Before calling, set tiles using the palettes to be
-// merged to the same palette index, and pass that palette index to this function. The result is
-// that the palette is reconstructed for all blocks using that index.
+// Name: Txi4x4PeekMergeCandidate
+//
+// This routine finds the pair of palettes with the least merge distance, discarding invalid
+// candidates from the top of the heap.
 //
 // Parameters:
 //   work          The tex4x4 conversion context
-//   paletteIndex  The address of the palette that is to be recomputed
-//   mode          The mode used by the palette being recomputed
+//
+// Returns:
+//   The first palette of the pair, or TXC_NO_PALETTE if no palettes can be merged.
 // -----------------------------------------------------------------------------------------------
-static void Txi4x4MergePalettes(
+static unsigned int Txi4x4PeekMergeCandidate(
+	TxiConversionWork *work
+) {
+	while (work->nMergeCandidates > 0) {
+		if (Txi4x4IsMergeCandidateValid(work, &work->mergeHeap[0])) return work->mergeHeap[0].group;
+
+		//pop
+		work->mergeHeap[0] = work->mergeHeap[--work->nMergeCandidates];
+		Txi4x4SiftDownMergeCandidate(work, 0);
+	}
+	return TXC_NO_PALETTE;
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4SetNearestPalette
+//
+// This routine sets the nearest pair of a palette and adds it to the merge candidate heap.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   group         The palette
+//   nearest       The nearest later palette of the same mode, or TXC_NO_PALETTE
+//   distance      The merge distance to the nearest palette
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4SetNearestPalette(
+	TxiConversionWork *work,
+	unsigned int       group,
+	unsigned int       nearest,
+	double             distance
+) {
+	TxiPaletteGroup *g = &work->groups[group];
+	g->nearest = nearest;
+	g->nearestDistance = distance;
+	g->stamp++;
+
+	if (nearest != TXC_NO_PALETTE) Txi4x4PushMergeCandidate(work, group);
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4FindNearestPalette
+//
+// This routine finds the nearest pair of a palette among the later palettes of its mode. Ties
+// are broken by the earliest palette, which makes the pair chosen for merging the same as that
+// of a search over all pairs in palette order.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   group         The palette
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4FindNearestPalette(
 	TxiConversionWork *work,
-	unsigned int       paletteIndex,
-	uint16_t           mode
+	unsigned int       group
+) {
+	unsigned int nearest = TXC_NO_PALETTE;
+	double leastDistance = 0.0;
+
+	for (unsigned int g = work->groups[group].next; g != TXC_NO_PALETTE; g = work->groups[g].next) {
+		double distance = Txi4x4ComputeMergeDistance(work, group, g);
+		if (nearest == TXC_NO_PALETTE || distance < leastDistance) {
+			nearest = g;
+			leastDistance = distance;
+			if (leastDistance == 0.0) break;
+		}
+	}
+
+	Txi4x4SetNearestPalette(work, group, nearest, leastDistance);
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4ComputeGroupPalette
+//
+// This routine recomputes the colors of a palette from the blocks using it.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   group         The palette to be recomputed
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4ComputeGroupPalette(
+	TxiConversionWork *work,
+	unsigned int       group
 ) {
 	//create histogram
 	RxHistClear(work->reduction);
-	for (unsigned int i = 0; i < work->nTiles; i++) {
-		if (work->tiles[i].paletteIndex == paletteIndex && work->tiles[i].used) {
-			RxHistAdd(work->reduction, work->tiles[i].rgb, 4, 4);
-		}
+	for (unsigned int i = work->groups[group].firstTile; i != TXC_NO_PALETTE; i = work->tileNext[i]) {
+		RxHistAdd(work->reduction, work->tiles[i].rgb, 4, 4);
 	}
 	RxHistFinalize(work->reduction);
 
 	//use the mode to determine the appropriate method of creating the palette.
 	COLOR32 pltt32[4];
-	RxYiqColor *yiqPalette = &work->plttYiq[paletteIndex * 2];
+	uint16_t mode = work->groups[group].mode;
+	RxYiqColor *yiqPalette = &work->plttYiq[group * 4];
 	if (mode == (GX_TEX4x4_PIDX_A_XPNT | GX_TEX4x4_PIDX_PTY_FULL)) {
 		//transparent, full color
 		unsigned int nFull = Txi4x4CreatePaletteFromHistogram(work->reduction, 3, pltt32);
@@ -1286,13 +1749,153 @@ static void Txi4x4MergePalettes(
 	}
 }
 
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4AddPalette
+//
+// This routine adds the palette of a block to the palettes in use, after all palettes added
+// before it.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   group         The palette being added
+//   tile          The block the palette was created for
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4AddPalette(
+	TxiConversionWork *work,
+	unsigned int       group,
+	const TxTileData  *tile
+) {
+	TxiPaletteGroup *g = &work->groups[group];
+	unsigned int nColors = Txi4x4GetPaletteSizeForMode(tile->mode);
+	for (unsigned int i = 0; i < nColors; i++) {
+		RxConvertRgbToYiq(tile->palette32[i], &work->plttYiq[group * 4 + i]);
+	}
+	g->nUses = tile->nDuplicates + 1;
+	g->alive = 1;
+
+	//the new palette may be nearer to earlier palettes than their current pairs. On a tie, the
+	//current pair is kept since it comes first.
+	unsigned int iMode = g->mode >> 14;
+	for (unsigned int i = work->modeHead[iMode]; i != TXC_NO_PALETTE; i = work->groups[i].next) {
+		double distance = Txi4x4ComputeMergeDistance(work, i, group);
+		if (work->groups[i].nearest == TXC_NO_PALETTE || distance < work->groups[i].nearestDistance) {
+			Txi4x4SetNearestPalette(work, i, group, distance);
+		}
+	}
+
+	//append to the palettes of this mode
+	g->prev = work->modeTail[iMode];
+	g->next = TXC_NO_PALETTE;
+	if (g->prev != TXC_NO_PALETTE) work->groups[g->prev].next = group;
+	else work->modeHead[iMode] = group;
+	work->modeTail[iMode] = group;
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4MergePalettes
+//
+// This routine merges a palette into an earlier palette of the same mode. The blocks of both
+// palettes use the first palette, which is reconstructed from all of them. Only the nearest
+// pairs that involve either palette are searched again.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   group1        The palette kept
+//   group2        The later palette merged into it
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4MergePalettes(
+	TxiConversionWork *work,
+	unsigned int       group1,
+	unsigned int       group2
+) {
+	TxiPaletteGroup *g1 = &work->groups[group1], *g2 = &work->groups[group2];
+	unsigned int *tileNext = work->tileNext;
+
+	//merge the block lists, keeping them in block order.
+	unsigned int first = TXC_NO_PALETTE, last = TXC_NO_PALETTE;
+	unsigned int t1 = g1->firstTile, t2 = g2->firstTile;
+	while (t1 != TXC_NO_PALETTE || t2 != TXC_NO_PALETTE) {
+		unsigned int t;
+		if (t2 == TXC_NO_PALETTE || (t1 != TXC_NO_PALETTE && t1 < t2)) {
+			t = t1;
+			t1 = tileNext[t1];
+		} else {
+			t = t2;
+			t2 = tileNext[t2];
+		}
+
+		if (last == TXC_NO_PALETTE) first = t;
+		else tileNext[last] = t;
+		last = t;
+	}
+	g1->firstTile = first;
+	g1->lastTile = last;
+	g1->nUses += g2->nUses;
+
+	//remove the second palette
+	unsigned int iMode = g2->mode >> 14;
+	g2->alive = 0;
+	if (g2->prev != TXC_NO_PALETTE) work->groups[g2->prev].next = g2->next;
+	else work->modeHead[iMode] = g2->next;
+	if (g2->next != TXC_NO_PALETTE) work->groups[g2->next].prev = g2->prev;
+	else work->modeTail[iMode] = g2->prev;
+
+	Txi4x4ComputeGroupPalette(work, group1);
+
+	//update the nearest pairs of this mode.
+	for (unsigned int i = work->modeHead[iMode]; i != TXC_NO_PALETTE; i = work->groups[i].next) {
+		TxiPaletteGroup *g = &work->groups[i];
+
+		if (i == group1 || g->nearest == group1 || g->nearest == group2) {
+			//the pair no longer exists or became more distant.
+			Txi4x4FindNearestPalette(work, i);
+		} else if (i < group1) {
+			//the changed palette may now be nearer than the current pair.
+			double distance = Txi4x4ComputeMergeDistance(work, i, group1);
+			if (distance < g->nearestDistance || (distance == g->nearestDistance && group1 < g->nearest)) {
+				Txi4x4SetNearestPalette(work, i, group1, distance);
+			}
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4FindGroupByTile
+//
+// This routine finds the palette created for a non-duplicate block. Palettes are created in
+// block order, so their first blocks increase and a binary search is used.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   nGroups       The number of palettes created so far
+//   index         The index of the block
+//
+// Returns:
+//   The palette, or TXC_NO_PALETTE if it was not found.
+// -----------------------------------------------------------------------------------------------
+static unsigned int Txi4x4FindGroupByTile(
+	TxiConversionWork *work,
+	unsigned int       nGroups,
+	unsigned int       index
+) {
+	unsigned int lo = 0, hi = nGroups;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if (work->groups[mid].firstTile < index) lo = mid + 1;
+		else hi = mid;
+	}
+
+	if (lo < nGroups && work->groups[lo].firstTile == index) return lo;
+	return TXC_NO_PALETTE;
+}
+
 // -----------------------------------------------------------------------------------------------
 // Name: Txi4x4BuildPalette
-// 
+//
 // This routine computes the initial global palette during 4x4 compression. The initial palette
 // and mode are constructed ahead of time, this routine prefers to keep the initial values, using
 // compression when the space is insufficient. Compression is done by merging palettes on the
-// basis of similarity. 
+// basis of similarity.
 //
 // Palettes are permitted to be merged at this stage only if they share the same mode (PTY and A
 // flags are the same). Of the palettes of the same mode, the corresponding colors are compared,
@@ -1304,6 +1907,10 @@ static void Txi4x4MergePalettes(
 // threshold. Setting it to a nonzero value causes this routine to always search for pairs of
 // palettes that fit within the similarity threshold to merge.
 //
+// Each palette keeps its nearest later palette of the same mode, and these pairs are kept in a
+// heap, so that the most similar pair is found without comparing all pairs of palettes. Palettes
+// are laid out in the order they were added once merging is complete.
+//
 // Parameters:
 //   work          The tex4x4 conversion context
 //
@@ -1313,16 +1920,12 @@ static void Txi4x4MergePalettes(
 static unsigned int Txi4x4BuildPalette(
 	TxiConversionWork *work
 ) {
-	//the main palette loop must be able to accommadate at least 16 colors. If the requested palette
-	//size is below this, we will still make a best effort, truncating if needed.
-	//16 colors is the sum of sizes of all 4 types (4+4+2+2) plus the largest size again (+4).
+	//only palettes of the same mode can be merged, so a palette of fewer than 16 colors (the sum of
+	//sizes of all 4 types plus the largest size again) may not fit all palettes. We will still make a
+	//best effort, truncating if needed.
 	unsigned int outPlttSize = work->plttSize;
-	unsigned int plttSize = outPlttSize;
-	if (plttSize < 16) plttSize = 16;
 
-	RxYiqColor *plttYiq = work->plttYiq;
-	int *colorTable = work->colorTable;
-	unsigned int *useTable = work->useTable;
+	TxiPaletteGroup *groups = work->groups;
 	TxTileData *tiles = work->tiles;
 	unsigned int nTiles = work->nTiles;
 
@@ -1330,12 +1933,39 @@ static unsigned int Txi4x4BuildPalette(
 	double th = work->threshold * (511.0 / 2.0);                         // normalized to half max Y diff
 	double diffThreshold = (th * th) * work->reduction->yWeight2 * 4.0;  // squared+weighted, scaled 4x (for 4 colors)
 
+	//create a palette for each non-duplicate tile, and list the tiles that use it. A duplicate tile
+	//uses the palette of the earlier tile recorded for it by Txi4x4AddTile.
+	unsigned int nGroups = 0;
+	for (unsigned int i = 0; i < nTiles; i++) {
+		TxTileData *tile = &tiles[i];
+		work->tileNext[i] = TXC_NO_PALETTE;
+		if (!tile->used) continue;
+
+		if (!tile->duplicate) {
+			TxiPaletteGroup *group = &groups[nGroups++];
+			memset(group, 0, sizeof(TxiPaletteGroup));
+			group->mode = tile->mode;
+			group->firstTile = group->lastTile = i;
+			group->nearest = TXC_NO_PALETTE;
+		} else {
+			unsigned int g = Txi4x4FindGroupByTile(work, nGroups, work->sameBlock[i] - 1);
+			if (g == TXC_NO_PALETTE) continue;
+
+			work->tileNext[groups[g].lastTile] = i;
+			groups[g].lastTile = i;
+		}
+	}
+
+	for (unsigned int i = 0; i < 4; i++) {
+		work->modeHead[i] = work->modeTail[i] = TXC_NO_PALETTE;
+	}
+	work->nMergeCandidates = 0;
+
 	//iterate over all non-duplicate tiles, adding the palettes.
-	unsigned int nextSlot = 0;
+	unsigned int nextSlot = 0, nextGroup = 0;
 	for (unsigned int i = 0; i < nTiles; i++) {
 		TxTileData *tile = &tiles[i];
 		if (tile->duplicate || !tile->used) {
-			//the paletteIndex field of a duplicate tile is first set to the tile index it is a duplicate of.
 			(*work->progress)++;
 			continue;
 		}
@@ -1347,57 +1977,38 @@ static unsigned int Txi4x4BuildPalette(
 		//are within merge threshold.
 		while ((nextSlot + nConsumed) > outPlttSize || th > 0.0) {
 			//determine which two palettes are the most similar.
-			int colorIndex1 = -1, colorIndex2 = -1;
-			double distance = Txi4x4FindClosestPalettes(work, nextSlot, &colorIndex1, &colorIndex2);
-			if (colorIndex1 == -1) break;
-			if ((nextSlot + nConsumed) <= outPlttSize && distance > diffThreshold) break;
-
-			int palettesMode = colorTable[colorIndex1];
-			unsigned int nColsRemove = Txi4x4GetPaletteSizeForMode(palettesMode);
-
-			//find tiles that use colorIndex2. Set them to use colorIndex1. 
-			//then subtract from all palette indices > colorIndex2. Then we can
-			//shift over all the palette colors. Then regenerate the palette.
-			for (unsigned int j = 0; j < nTiles; j++) {
-				if (tiles[j].paletteIndex == colorIndex2 / 2) {
-					tiles[j].paletteIndex = colorIndex1 / 2;
-				} else if (tiles[j].paletteIndex > colorIndex2 / 2) {
-					tiles[j].paletteIndex -= nColsRemove / 2;
-				}
-			}
-
-			//move entries in palette and colorTable.
-			unsigned int nToShift = plttSize - colorIndex2 - nColsRemove;
-			memmove(plttYiq + colorIndex2, plttYiq + colorIndex2 + nColsRemove, nToShift * sizeof(RxYiqColor));
-			memmove(colorTable + colorIndex2, colorTable + colorIndex2 + nColsRemove, nToShift * sizeof(int));
-			memmove(useTable + colorIndex2, colorTable + colorIndex2 + nColsRemove, nToShift * sizeof(unsigned int));
-
-			//add use counts
-			for (unsigned int j = 0; j < nToShift; j++) {
-				useTable[colorIndex1 + j] += useTable[colorIndex2 + j];
-			}
+			unsigned int group1 = Txi4x4PeekMergeCandidate(work);
+			if (group1 == TXC_NO_PALETTE) break;
+			if ((nextSlot + nConsumed) <= outPlttSize && groups[group1].nearestDistance > diffThreshold) break;
 
-			//merge those palettes that we've just combined.
-			Txi4x4MergePalettes(work, colorIndex1 / 2, palettesMode);
+			unsigned int nColsRemove = Txi4x4GetPaletteSizeForMode(groups[group1].mode);
+			Txi4x4MergePalettes(work, group1, groups[group1].nearest);
 			nextSlot -= nColsRemove;
 		}
 
-		//now add this tile's colors
-		for (unsigned int j = 0; j < nConsumed; j++) {
-			RxConvertRgbToYiq(tile->palette32[j], &plttYiq[nextSlot + j]);
-			colorTable[nextSlot + j] = tile->mode;
-			useTable[nextSlot + j] = tile->nDuplicates + 1;
-		}
-		tile->paletteIndex = nextSlot / 2;
+		//now add this tile's palette
+		Txi4x4AddPalette(work, nextGroup++, tile);
 		nextSlot += nConsumed;
 
 		(*work->progress)++;
 		if (*work->terminate) break;
 	}
 
-	//copy palette out
-	for (unsigned int i = 0; i < outPlttSize; i++) {
-		work->pltt[i] = ColorConvertToDS(RxConvertYiqToRgb(&plttYiq[i]));
+	//lay out the palettes in the order they were added, and point their tiles to them.
+	unsigned int address = 0;
+	for (unsigned int i = 0; i < nextGroup; i++) {
+		TxiPaletteGroup *group = &groups[i];
+		if (!group->alive) continue;
+
+		unsigned int nColors = Txi4x4GetPaletteSizeForMode(group->mode);
+		for (unsigned int j = 0; j < nColors && (address + j) < outPlttSize; j++) {
+			work->pltt[address + j] = ColorConvertToDS(RxConvertYiqToRgb(&work->plttYiq[i * 4 + j]));
+		}
+
+		for (unsigned int j = group->firstTile; j != TXC_NO_PALETTE; j = work->tileNext[j]) {
+			tiles[j].paletteIndex = address / 2;
+		}
+		address += nColors;
 	}
 
 	//if the output palette data was less than the internal buffer size, we reassign palette
@@ -1428,6 +2039,7 @@ static unsigned int Txi4x4BuildPalette(
 //
 // Parameters:
 //   work          The tex4x4 conversion context
+//   reduction     The color reduction context
 //   px            A 4x4 pixel block as RGB
 //   mode          The palette index unit for the block.
 //   maxError      The greatest error to accumulate. If quantization error were to exceed this,
@@ -1438,25 +2050,372 @@ static unsigned int Txi4x4BuildPalette(
 // -----------------------------------------------------------------------------------------------
 static double Txi4x4ComputeTilePidxError(
 	TxiConversionWork *work,
+	RxReduction       *reduction,
 	const COLOR32     *px,
 	uint16_t           mode,
 	double             maxError
 ) {
 	COLOR32 effPltt[4];
 	unsigned int nColors = Txi4x4ExpandPalette(work->pltt + GX_TEX4x4_PIDX_ADDR(mode), mode, effPltt);
-	return RxComputePaletteError(work->reduction, px, 4, 4, effPltt, nColors, maxError);
+	return RxComputePaletteError(reduction, px, 4, 4, effPltt, nColors, maxError);
 }
 
 // -----------------------------------------------------------------------------------------------
-// Name: Txi4x4FindOptimalPidx
+// Name: Txi4x4GetSearchCenter
+// 
+// This routine gets the center of a palette search entry along one axis, scaled by 2.
+// -----------------------------------------------------------------------------------------------
+static float Txi4x4GetSearchCenter(const TxiPaletteSearchEntry *entry, unsigned int axis) {
+	return entry->min[axis] + entry->max[axis];
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4PartitionSearchEntries
+// 
+// This routine partially sorts a range of palette search entries by their center along one axis,
+// such that the entry at the specified position is placed where a full sort would place it.
+//
+// Parameters:
+//   entries       The palette search entries
+//   count         The number of entries
+//   axis          The axis to sort on (0=Y, 1=I, 2=Q)
+//   k             The position of the entry to select
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4PartitionSearchEntries(
+	TxiPaletteSearchEntry *entries,
+	unsigned int           count,
+	unsigned int           axis,
+	unsigned int           k
+) {
+	unsigned int lo = 0, hi = count - 1;
+	while (lo < hi) {
+		float pivot = Txi4x4GetSearchCenter(&entries[(lo + hi) / 2], axis);
+
+		//Hoare partition of [lo, hi]
+		unsigned int i = lo, j = hi;
+		while (i <= j) {
+			while (Txi4x4GetSearchCenter(&entries[i], axis) < pivot) i++;
+			while (Txi4x4GetSearchCenter(&entries[j], axis) > pivot) j--;
+			if (i <= j) {
+				TxiPaletteSearchEntry tmp = entries[i];
+				entries[i] = entries[j];
+				entries[j] = tmp;
+				i++;
+				if (j == 0) break;
+				j--;
+			}
+		}
+
+		//continue in the side containing k
+		if (k <= j) hi = j;
+		else if (k >= i) lo = i;
+		else break;
+	}
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4BuildSearchNode
+// 
+// This routine builds a node of the palette search tree over a range of its palettes, and its
+// child nodes. Palettes are split at the median of their centers along the axis of greatest
+// spread.
+//
+// Parameters:
+//   tree          The palette search tree
+//   first         The first palette under the node
+//   count         The number of palettes under the node
+//
+// Returns:
+//   The index of the created node.
+// -----------------------------------------------------------------------------------------------
+static unsigned int Txi4x4BuildSearchNode(
+	TxiPaletteTree *tree,
+	unsigned int    first,
+	unsigned int    count
+) {
+	unsigned int nodeIndex = tree->nNodes++;
+	TxiPaletteSearchNode *node = &tree->nodes[nodeIndex];
+	node->first = first;
+	node->count = count;
+	node->left = 0;
+	node->right = 0;
+
+	//bounds of the palettes, and of their centers
+	float centerMin[3], centerMax[3];
+	for (unsigned int i = 0; i < 3; i++) {
+		node->min[i] = tree->entries[first].min[i];
+		node->max[i] = tree->entries[first].max[i];
+		centerMin[i] = centerMax[i] = Txi4x4GetSearchCenter(&tree->entries[first], i);
+	}
+	for (unsigned int i = first + 1; i < first + count; i++) {
+		const TxiPaletteSearchEntry *entry = &tree->entries[i];
+		for (unsigned int j = 0; j < 3; j++) {
+			float center = Txi4x4GetSearchCenter(entry, j);
+			if (entry->min[j] < node->min[j]) node->min[j] = entry->min[j];
+			if (entry->max[j] > node->max[j]) node->max[j] = entry->max[j];
+			if (center < centerMin[j]) centerMin[j] = center;
+			if (center > centerMax[j]) centerMax[j] = center;
+		}
+	}
+
+	if (count <= TXC_SEARCH_LEAF_SIZE) return nodeIndex;
+
+	//split on the axis of greatest spread
+	unsigned int axis = 0;
+	for (unsigned int i = 1; i < 3; i++) {
+		if ((centerMax[i] - centerMin[i]) > (centerMax[axis] - centerMin[axis])) axis = i;
+	}
+	if (centerMax[axis] == centerMin[axis]) return nodeIndex; // cannot be split
+
+	unsigned int nLeft = count / 2;
+	Txi4x4PartitionSearchEntries(tree->entries + first, count, axis, nLeft);
+
+	//node pointer may not be held across the recursion
+	unsigned int left = Txi4x4BuildSearchNode(tree, first, nLeft);
+	unsigned int right = Txi4x4BuildSearchNode(tree, first + nLeft, count - nLeft);
+	tree->nodes[nodeIndex].left = left;
+	tree->nodes[nodeIndex].right = right;
+	return nodeIndex;
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4BuildSearchTree
 // 
-// This routine searches for the optimal combination of palette address and mode (PTY and A).
+// This routine builds a palette search tree over every palette address and mode that may be used
+// by either opaque blocks or blocks with transparent pixels.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   tree          The palette search tree to build
+//   transparent   Set to build the tree for blocks with transparent pixels.
+//   nColors       The size of the global palette to search.
+//   startIdx      The minimum palette address to search.
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4BuildSearchTree(
+	TxiConversionWork *work,
+	TxiPaletteTree    *tree,
+	int                transparent,
+	unsigned int       nColors,
+	unsigned int       startIdx
+) {
+	tree->nEntries = 0;
+	tree->nNodes = 0;
+
+	//enumerate palettes in the order of an exhaustive search.
+	for (unsigned int i = startIdx; i < nColors; i += 2) {
+		for (unsigned int j = 0; j < 4; j++) {
+			//check that we don't run off the end of the palette
+			unsigned int nConsumed = 2;
+			if (j == 0 || j == 2) nConsumed = 4;
+			if ((i + nConsumed) > nColors) continue;
+
+			//nothing to gain from these modes sometimes
+			if (!transparent && j == 0) continue;
+			if (transparent && j >= 2) break;
+
+			TxiPaletteSearchEntry *entry = &tree->entries[tree->nEntries++];
+			entry->pidx = (j << 14) | (i >> 1);
+			entry->order = ((i >> 1) << 2) + j + 1;
+
+			//effective palette and its bounds
+			COLOR32 effPltt[4];
+			entry->nColors = Txi4x4ExpandPalette(work->pltt + i, entry->pidx, effPltt);
+			RxConvertRowToYiq(effPltt, entry->pltt, entry->nColors, 1);
+			for (unsigned int k = 0; k < 3; k++) {
+				entry->min[k] = entry->max[k] = entry->pltt[0].vec[k];
+				for (unsigned int l = 1; l < entry->nColors; l++) {
+					if (entry->pltt[l].vec[k] < entry->min[k]) entry->min[k] = entry->pltt[l].vec[k];
+					if (entry->pltt[l].vec[k] > entry->max[k]) entry->max[k] = entry->pltt[l].vec[k];
+				}
+			}
+		}
+	}
+
+	if (tree->nEntries > 0) Txi4x4BuildSearchNode(tree, 0, tree->nEntries);
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4BuildPaletteSearch
+// 
+// This routine builds the palette search trees used by Txi4x4FindOptimalPidx. They must be
+// rebuilt whenever the searched range of the palette changes.
 //
 // Parameters:
 //   work          The tex4x4 conversion context
-//   tile          The tile to query the optimal palette index setting for.
 //   nColors       The size of the global palette to search.
 //   startIdx      The minimum palette address to search.
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4BuildPaletteSearch(
+	TxiConversionWork *work,
+	unsigned int       nColors,
+	unsigned int       startIdx
+) {
+	Txi4x4BuildSearchTree(work, &work->opaqueSearch, 0, nColors, startIdx);
+	Txi4x4BuildSearchTree(work, &work->translucentSearch, 1, nColors, startIdx);
+}
+
+typedef struct TxiPaletteSearch_ {
+	RxReduction *reduction;          // the color reduction context
+	const TxiPaletteTree *tree;      // the palette search tree
+	RxYiqColor yiq[16];              // the block's opaque pixels in YIQ
+	double mean[3];                  // mean YIQ of the block's opaque pixels
+	unsigned int nOpaque;            // number of opaque pixels
+	uint16_t bestPidx;               // best palette found so far
+	unsigned int bestOrder;          // order of the best palette in an exhaustive search
+	double bestError;                // error of the best palette found so far
+} TxiPaletteSearch;
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4ComputeSearchError
+// 
+// This routine computes the quantization error of the block against a palette of the search tree.
+// This is computed in the same way as RxComputePaletteError, but from colors already converted.
+//
+// Parameters:
+//   search        The palette search
+//   entry         The palette to compute the error against
+//   maxError      The greatest error to accumulate. If quantization error were to exceed this,
+//                 then maxError is returned instead.
+//
+// Returns:
+//   The quantization error for the block against the palette.
+// -----------------------------------------------------------------------------------------------
+static double Txi4x4ComputeSearchError(
+	const TxiPaletteSearch      *search,
+	const TxiPaletteSearchEntry *entry,
+	double                       maxError
+) {
+	double error = 0.0;
+	for (unsigned int i = 0; i < search->nOpaque; i++) {
+		double leastDiff = 1e32;
+		for (unsigned int j = 0; j < entry->nColors; j++) {
+			double diff = RxComputeColorDifference(search->reduction, &search->yiq[i], &entry->pltt[j]);
+			if (diff < leastDiff) leastDiff = diff;
+		}
+
+		error += leastDiff;
+		if (error >= maxError) return maxError;
+	}
+	return error;
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4ComputeBoxDistance
+// 
+// This routine computes the weighted squared distance from a YIQ color to a box.
+// -----------------------------------------------------------------------------------------------
+static double Txi4x4ComputeBoxDistance(
+	RxReduction  *reduction,
+	const double *yiq,
+	const float  *min,
+	const float  *max
+) {
+	double d[3];
+	for (unsigned int i = 0; i < 3; i++) {
+		d[i] = 0.0;
+		if (yiq[i] < min[i]) d[i] = min[i] - yiq[i];
+		else if (yiq[i] > max[i]) d[i] = yiq[i] - max[i];
+	}
+	return reduction->yWeight2 * d[0] * d[0] + reduction->iWeight2 * d[1] * d[1] + reduction->qWeight2 * d[2] * d[2];
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4ComputeMeanBound
+// 
+// This routine computes a lower bound on the quantization error of the block against any palette
+// whose colors lie within a box. Squared distance to a box is convex, so it is bounded by the
+// distance of the block's mean color.
+// -----------------------------------------------------------------------------------------------
+static double Txi4x4ComputeMeanBound(
+	const TxiPaletteSearch *search,
+	const float            *min,
+	const float            *max
+) {
+	return search->nOpaque * Txi4x4ComputeBoxDistance(search->reduction, search->mean, min, max);
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4CanImprove
+// 
+// This routine determines whether a palette with the specified lower bound on its quantization
+// error could be chosen over the best palette found so far. The bound is given some slack for the
+// rounding of the exact error computation, since the result must match an exhaustive search.
+// -----------------------------------------------------------------------------------------------
+static int Txi4x4CanImprove(const TxiPaletteSearch *search, double bound) {
+	return (bound * 0.9999 - 0.001) <= search->bestError;
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4TestSearchEntry
+// 
+// This routine tests one palette against the best palette found so far. Of palettes with equal
+// error, the one earliest in an exhaustive search is kept, as an exhaustive search would.
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4TestSearchEntry(
+	TxiPaletteSearch            *search,
+	const TxiPaletteSearchEntry *entry
+) {
+	if (!Txi4x4CanImprove(search, Txi4x4ComputeMeanBound(search, entry->min, entry->max))) return;
+
+	//an earlier palette also replaces the best palette when its error is equal.
+	double maxError = search->bestError;
+	if (entry->order < search->bestOrder) maxError = nextafter(maxError, 1e32);
+
+	//the error is only exact when it is less than maxError.
+	double error = Txi4x4ComputeSearchError(search, entry, maxError);
+	if (error < maxError) {
+		search->bestPidx = entry->pidx;
+		search->bestOrder = entry->order;
+		search->bestError = error;
+	}
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4SearchNode
+// 
+// This routine searches a node of the palette search tree for a better palette, visiting the
+// closer child node first.
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4SearchNode(
+	TxiPaletteSearch *search,
+	unsigned int      nodeIndex,
+	double            bound
+) {
+	if (!Txi4x4CanImprove(search, bound)) return;
+
+	const TxiPaletteSearchNode *node = &search->tree->nodes[nodeIndex];
+	if (node->left == 0) {
+		for (unsigned int i = 0; i < node->count; i++) {
+			Txi4x4TestSearchEntry(search, &search->tree->entries[node->first + i]);
+		}
+		return;
+	}
+
+	const TxiPaletteSearchNode *left = &search->tree->nodes[node->left];
+	const TxiPaletteSearchNode *right = &search->tree->nodes[node->right];
+	double leftBound = Txi4x4ComputeMeanBound(search, left->min, left->max);
+	double rightBound = Txi4x4ComputeMeanBound(search, right->min, right->max);
+	if (leftBound <= rightBound) {
+		Txi4x4SearchNode(search, node->left, leftBound);
+		Txi4x4SearchNode(search, node->right, rightBound);
+	} else {
+		Txi4x4SearchNode(search, node->right, rightBound);
+		Txi4x4SearchNode(search, node->left, leftBound);
+	}
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4FindOptimalPidx
+// 
+// This routine searches for the optimal combination of palette address and mode (PTY and A). The
+// palettes searched are those of the last call to Txi4x4BuildPaletteSearch. The search trees are
+// only read, so blocks may be searched concurrently on separate color reduction contexts. The
+// result is the same as that of an exhaustive search in palette order.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   reduction     The color reduction context
+//   tile          The tile to query the optimal palette index setting for.
 //   pError        A pointer receiving the quantization error for the optimal palette index
 //                 setting.
 //
@@ -1465,45 +2424,44 @@ static double Txi4x4ComputeTilePidxError(
 // -----------------------------------------------------------------------------------------------
 static uint16_t Txi4x4FindOptimalPidx(
 	TxiConversionWork *work,
+	RxReduction       *reduction,
 	const TxTileData  *tile,
-	unsigned int       nColors,
-	unsigned int       startIdx,
 	double            *pError
 ) {
-	const COLOR32 *px = tile->rgb;
-	int hasTransparent = tile->nTransparent;
+	TxiPaletteSearch search;
+	search.reduction = reduction;
+	search.tree = tile->nTransparent ? &work->translucentSearch : &work->opaqueSearch;
 
 	//start with default values
-	uint16_t leastPidx = tile->mode | tile->paletteIndex;
-	double leastError = Txi4x4ComputeTilePidxError(work, px, leastPidx, 1e32);
-	if (tile->nTransparent == 16 || leastError == 0.0) {
+	search.bestPidx = tile->mode | tile->paletteIndex;
+	search.bestOrder = 0;
+	search.bestError = Txi4x4ComputeTilePidxError(work, reduction, tile->rgb, search.bestPidx, 1e32);
+	if (tile->nTransparent == 16 || search.bestError == 0.0) {
 		//if the tile is fully transparent or has no quantization error, no search is needed
-		return leastPidx;
+		return search.bestPidx;
 	}
 
-	//yes, iterate over every possible palette and mode.
-	for (unsigned int i = startIdx; i < nColors; i += 2) {
-		for (unsigned int j = 0; j < 4; j++) {
-			//check that we don't run off the end of the palette
-			unsigned int nConsumed = 2;
-			if (j == 0 || j == 2) nConsumed = 4;
-			if ((i + nConsumed) > nColors) continue;
+	//opaque pixels in YIQ, and their mean
+	COLOR32 opaque[16];
+	search.nOpaque = 0;
+	for (unsigned int i = 0; i < 16; i++) {
+		if ((tile->rgb[i] >> 24) >= 0x80) opaque[search.nOpaque++] = tile->rgb[i] | 0xFF000000;
+	}
+	RxConvertRowToYiq(opaque, search.yiq, search.nOpaque, 1);
 
-			//nothing to gain from these modes sometimes
-			if (!hasTransparent && j == 0) continue;
-			if (hasTransparent && j >= 2) break;
-			
-			uint16_t mode = (j << 14) | (i >> 1);
-			double dst = Txi4x4ComputeTilePidxError(work, px, mode, leastError);
-			if (dst < leastError) {
-				leastPidx = mode;
-				leastError = dst;
-			}
-		}
+	for (unsigned int i = 0; i < 3; i++) {
+		search.mean[i] = 0.0;
+		for (unsigned int j = 0; j < search.nOpaque; j++) search.mean[i] += search.yiq[j].vec[i];
+		search.mean[i] /= search.nOpaque;
+	}
+
+	if (search.tree->nNodes > 0) {
+		const TxiPaletteSearchNode *root = &search.tree->nodes[0];
+		Txi4x4SearchNode(&search, 0, Txi4x4ComputeMeanBound(&search, root->min, root->max));
 	}
 
-	if (pError != NULL) *pError = leastError;
-	return leastPidx;
+	if (pError != NULL) *pError = search.bestError;
+	return search.bestPidx;
 }
 
 // -----------------------------------------------------------------------------------------------
@@ -1545,6 +2503,7 @@ static TxiTileErrorMapEntry *Txi4x4FindGreatestErrorTile(TxiConversionWork *work
 //
 // Parameters:
 //   work          The tex4x4 conversion context
+//   reduction     The color reduction context
 //   tile          The 4x4 pixel block to index
 //   effPltt       The effective (expanded) palette to index against.
 //   nEffPltt      The size of the effective palette allowed for use.
@@ -1552,6 +2511,7 @@ static TxiTileErrorMapEntry *Txi4x4FindGreatestErrorTile(TxiConversionWork *work
 // -----------------------------------------------------------------------------------------------
 static void Txi4x4IndexTile(
 	TxiConversionWork *work,
+	RxReduction       *reduction,
 	TxTileData        *tile,
 	const COLOR32     *effPltt,
 	unsigned int       nEffPltt,
@@ -1559,8 +2519,8 @@ static void Txi4x4IndexTile(
 ) {
 	//load the effective palette and index into the index buffer.
 	int idxbuf[16];
-	RxPaletteLoad(work->reduction, effPltt, nEffPltt);
-	RxReduceImage(work->reduction, tile->rgb, idxbuf, 4, 4, RX_FLAG_ALPHA_MODE_NONE | RX_FLAG_NO_WRITEBACK, work->diffuse);
+	RxPaletteLoad(reduction, effPltt, nEffPltt);
+	RxReduceImage(reduction, tile->rgb, idxbuf, 4, 4, RX_FLAG_ALPHA_MODE_NONE | RX_FLAG_NO_WRITEBACK, work->diffuse);
 
 	//build the texel pattern
 	uint32_t texel = 0;
@@ -1581,43 +2541,152 @@ static void Txi4x4IndexTile(
 }
 
 // -----------------------------------------------------------------------------------------------
-// Name: Txi4x4IndexTilesByPalette
+// Name: Txi4x4IndexTileByPalette
 // 
-// This routine indexes all 4x4 pixel blocks by the constructed palette. This searches for the 
-// best fitting palette and mode (PTY and A combination).
+// This routine indexes a 4x4 pixel block by the constructed palette, searching for the best
+// fitting palette and mode (PTY and A combination).
 //
 // Parameters:
 //   work          The tex4x4 conversion context
+//   reduction     The color reduction context
+//   index         The index of the block
 // -----------------------------------------------------------------------------------------------
-static void Txi4x4IndexTilesByPalette(
-	TxiConversionWork *work
+static void Txi4x4IndexTileByPalette(
+	TxiConversionWork *work,
+	RxReduction       *reduction,
+	unsigned int       index
 ) {
-	for (unsigned int i = 0; i < work->nTiles; i++) {
-		//double check that these settings are the most optimal for this tile.
-		double err = 0.0;
-		uint16_t idx = Txi4x4FindOptimalPidx(work, &work->tiles[i], work->plttSize, 0, &err);
-		uint16_t mode  = idx & GX_TEX4x4_PIDX_MODE_MASK;
-		uint16_t index = idx & GX_TEX4x4_PIDX_ADDR_MASK;
-		const COLOR *thisPalette = work->pltt + (index << 1);
+	TxTileData *tile = &work->tiles[index];
 
-		work->tiles[i].mode = mode;
-		work->tiles[i].paletteIndex = index;
+	//double check that these settings are the most optimal for this tile.
+	double err = 0.0;
+	uint16_t idx = Txi4x4FindOptimalPidx(work, reduction, tile, &err);
+	uint16_t mode  = idx & GX_TEX4x4_PIDX_MODE_MASK;
+	uint16_t pltt  = idx & GX_TEX4x4_PIDX_ADDR_MASK;
+	const COLOR *thisPalette = work->pltt + (pltt << 1);
 
-		COLOR32 palette[4];
-		unsigned int paletteSize = Txi4x4ExpandPalette(thisPalette, mode, palette);
+	tile->mode = mode;
+	tile->paletteIndex = pltt;
 
-		//store palette error
-		work->errorMap[i].tile = &work->tiles[i];
-		work->errorMap[i].error = err;
+	COLOR32 palette[4];
+	unsigned int paletteSize = Txi4x4ExpandPalette(thisPalette, mode, palette);
 
-		//index this tile
-		Txi4x4IndexTile(work, &work->tiles[i], palette, paletteSize, 0);
+	//store palette error
+	work->errorMap[index].tile = tile;
+	work->errorMap[index].error = err;
 
-		(*work->progress)++;
+	//index this tile
+	Txi4x4IndexTile(work, reduction, tile, palette, paletteSize, 0);
+}
 
-		//check termination
-		if (*work->terminate) break;
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4ReindexTile
+// 
+// This routine re-indexes a 4x4 pixel block after palette refinement, if a better palette and
+// mode are found for it.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+//   reduction     The color reduction context
+//   entry         The error map entry of the block
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4ReindexTile(
+	TxiConversionWork    *work,
+	RxReduction          *reduction,
+	TxiTileErrorMapEntry *entry
+) {
+	TxTileData *tile = entry->tile;
+	if (entry->error == 0.0) return;
+
+	double newerr = 0.0;
+	uint16_t newpidx = Txi4x4FindOptimalPidx(work, reduction, tile, &newerr);
+	uint16_t newIdx  = newpidx & GX_TEX4x4_PIDX_ADDR_MASK;
+	uint16_t newMode = newpidx & GX_TEX4x4_PIDX_MODE_MASK;
+
+	//if it's the same pidx as before or no improvement, do nothing
+	if (newpidx == (tile->mode | tile->paletteIndex)) return;
+	if (newerr >= entry->error) return;
+
+	//store error
+	entry->error = newerr;
+
+	COLOR32 tilepal[4] = { 0 };
+	unsigned int nOpaque = Txi4x4ExpandPalette(work->pltt + GX_TEX4x4_PIDX_ADDR(newpidx), newMode, tilepal);
+
+	tile->mode = newMode;
+	tile->paletteIndex = newIdx;
+	Txi4x4IndexTile(work, reduction, tile, tilepal, nOpaque, 0);
+}
+
+typedef struct TxiIndexWork_ {
+	TxiConversionWork *work;
+	RxBool reindex;                  // re-index blocks by error map entry after refinement
+	int progressBase;                // progress level at the start of indexing
+	volatile long nextTile;          // next block to be claimed by a worker
+} TxiIndexWork;
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4IndexWorker
+// 
+// This routine is run on each worker thread to index 4x4 pixel blocks by the palette. Each worker
+// uses its own color reduction context, and blocks are claimed one at a time. Blocks only read
+// the palette, so the result is the same however the blocks are distributed.
+//
+// Parameters:
+//   param         The TxiIndexWork structure
+//   iWorker       The index of the worker
+//   nWorkers      The number of workers
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4IndexWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) nWorkers;
+	TxiIndexWork *indexWork = (TxiIndexWork *) param;
+	TxiConversionWork *work = indexWork->work;
+
+	RxReduction *reduction = Txi4x4GetWorkerReduction(work, iWorker);
+	if (reduction == NULL) return; // the remaining workers take over this worker's blocks
+
+	while (!*work->terminate) {
+		unsigned int i = (unsigned int) (ThAtomicIncrement(&indexWork->nextTile) - 1);
+		if (i >= work->nTiles) break;
+
+		if (indexWork->reindex) {
+			Txi4x4ReindexTile(work, reduction, &work->errorMap[i]);
+		} else {
+			Txi4x4IndexTileByPalette(work, reduction, i);
+
+			//only the calling thread reports progress, by the number of claimed blocks.
+			if (iWorker == 0) {
+				unsigned int nClaimed = (unsigned int) ThAtomicLoad(&indexWork->nextTile);
+				if (nClaimed > work->nTiles) nClaimed = work->nTiles;
+				*work->progress = indexWork->progressBase + nClaimed;
+			}
+		}
 	}
+
+	Txi4x4ReleaseWorkerReduction(work, reduction);
+}
+
+// -----------------------------------------------------------------------------------------------
+// Name: Txi4x4IndexTilesByPalette
+// 
+// This routine indexes all 4x4 pixel blocks by the constructed palette. This searches for the 
+// best fitting palette and mode (PTY and A combination). Blocks are indexed on worker threads.
+//
+// Parameters:
+//   work          The tex4x4 conversion context
+// -----------------------------------------------------------------------------------------------
+static void Txi4x4IndexTilesByPalette(
+	TxiConversionWork *work
+) {
+	Txi4x4BuildPaletteSearch(work, work->plttSize, 0);
+
+	TxiIndexWork indexWork = { 0 };
+	indexWork.work = work;
+	indexWork.reindex = RX_FALSE;
+	indexWork.progressBase = *work->progress;
+	ThRunWorkers(Txi4x4IndexWorker, &indexWork, Txi4x4GetWorkerCount(work));
+
+	if (!*work->terminate) *work->progress = indexWork.progressBase + work->nTiles;
 }
 
 // -----------------------------------------------------------------------------------------------
@@ -2121,7 +3190,7 @@ static int Txi4x4RefineIteration(TxiConversionWork *work) {
 		entry->error = 0.0; // no way to improve this tile
 		tile->mode = mode;
 		tile->paletteIndex = foundIndex >> 1;
-		Txi4x4IndexTile(work, tile, temp, 1, foundIndex & 1);
+		Txi4x4IndexTile(work, work->reduction, tile, temp, 1, foundIndex & 1);
 	}
 
 	//repeat until we can't
@@ -2196,7 +3265,7 @@ static int Txi4x4RefineIteration(TxiConversionWork *work) {
 			//index tile with palette
 			tile->mode = mode;
 			tile->paletteIndex = slottedIndex >> 1;
-			Txi4x4IndexTile(work, tile, tilepal, nOpaque, slottedIndex & 1);
+			Txi4x4IndexTile(work, work->reduction, tile, tilepal, nOpaque, slottedIndex & 1);
 
 			errorEntry->error = 0.0; // ignore now
 
@@ -2216,7 +3285,7 @@ static int Txi4x4RefineIteration(TxiConversionWork *work) {
 					entry->error = err;
 					tile2->mode = tile->mode;
 					tile2->paletteIndex = slottedIndex >> 1;
-					Txi4x4IndexTile(work, tile2, tilepal, nOpaque, slottedIndex & 1);
+					Txi4x4IndexTile(work, work->reduction, tile2, tilepal, nOpaque, slottedIndex & 1);
 				}
 			}
 		}
@@ -2225,30 +3294,12 @@ static int Txi4x4RefineIteration(TxiConversionWork *work) {
 	//try re-indexing tiles with the new palettes
 	int reindexBase = enclaveStart - 2;
 	if (reindexBase < 0) reindexBase = 0;
-	for (unsigned int i = 0; i < work->nTiles; i++) {
-		TxiTileErrorMapEntry *entry = &work->errorMap[i];
-		TxTileData *tile = entry->tile;
-		if (entry->error == 0.0) continue;
+	Txi4x4BuildPaletteSearch(work, nUsedColors, reindexBase);
 
-		double newerr = 0.0;
-		uint16_t newpidx = Txi4x4FindOptimalPidx(work, tile, nUsedColors, reindexBase, &newerr);
-		uint16_t newIdx  = newpidx & GX_TEX4x4_PIDX_ADDR_MASK;
-		uint16_t newMode = newpidx & GX_TEX4x4_PIDX_MODE_MASK;
-
-		//if it's the same pidx as before or no improvement, do nothing
-		if (newpidx == (tile->mode | tile->paletteIndex)) continue;
-		if (newerr >= entry->error) continue;
-
-		//store error
-		entry->error = newerr;
-
-		COLOR32 tilepal[4] = { 0 };
-		unsigned int nOpaque = Txi4x4ExpandPalette(work->pltt + GX_TEX4x4_PIDX_ADDR(newpidx), newMode, tilepal);
-
-		tile->mode = newMode;
-		tile->paletteIndex = newIdx;
-		Txi4x4IndexTile(work, tile, tilepal, nOpaque, 0);
-	}
+	TxiIndexWork indexWork = { 0 };
+	indexWork.work = work;
+	indexWork.reindex = RX_TRUE;
+	ThRunWorkers(Txi4x4IndexWorker, &indexWork, Txi4x4GetWorkerCount(work));
 
 	return nUsedColors;
 }
@@ -2301,12 +3352,9 @@ static int Txi4x4InitWork(TxConversionParameters *params, RxReduction *reduction
 	unsigned int tilesX = params->width / 4, tilesY = params->height / 4;
 	unsigned int nTiles = tilesX * tilesY;
 
-	//palette working size
-	unsigned int plttWorkSize = params->colorEntries;
-	if (plttWorkSize < 16) plttWorkSize = 16;
-
 	//basic parameters
 	work->reduction = reduction;
+	work->balance = &params->balance;
 	work->diffuse = params->dither ? params->diffuseAmount : 0.0f;
 	work->threshold = ((double) params->threshold) / 100.0;
 	work->nTiles = nTiles;
@@ -2333,15 +3381,36 @@ static int Txi4x4InitWork(TxConversionParameters *params, RxReduction *reduction
 	work->tiles = (TxTileData *) calloc(nTiles, sizeof(TxTileData));
 	work->errorMap = (TxiTileErrorMapEntry *) calloc(nTiles, sizeof(TxiTileErrorMapEntry));
 
-	//working structures for palette creation
-	work->plttYiq = (RxYiqColor *) RxMemCalloc(plttWorkSize, sizeof(RxYiqColor));
-	work->colorTable = (int *) calloc(plttWorkSize, sizeof(int));
-	work->useTable = (unsigned int *) calloc(plttWorkSize, sizeof(unsigned int));
+	//duplicate block lookup, kept at most half full
+	work->hashSize = 16;
+	while (work->hashSize < 2 * nTiles) work->hashSize <<= 1;
+	work->blockHash = (unsigned int *) calloc(work->hashSize, sizeof(unsigned int));
+	work->sameBlock = (unsigned int *) calloc(nTiles, sizeof(unsigned int));
+	work->paletteHash = (unsigned int *) calloc(work->hashSize, sizeof(unsigned int));
+
+	//working structures for palette creation. There is at most one palette per tile, and at most one
+	//valid merge candidate per palette.
+	work->mergeHeapSize = 2 * nTiles + 16;
+	work->groups = (TxiPaletteGroup *) calloc(nTiles, sizeof(TxiPaletteGroup));
+	work->plttYiq = (RxYiqColor *) RxMemCalloc(nTiles * 4, sizeof(RxYiqColor));
+	work->tileNext = (unsigned int *) calloc(nTiles, sizeof(unsigned int));
+	work->mergeHeap = (TxiMergeCandidate *) calloc(work->mergeHeapSize, sizeof(TxiMergeCandidate));
+
+	//palette search trees. Each palette address is searched with up to 3 modes for opaque blocks, and
+	//up to 2 modes for blocks with transparency.
+	unsigned int nAddresses = (work->plttSize + 1) / 2;
+	work->opaqueSearch.entries = (TxiPaletteSearchEntry *) RxMemCalloc(nAddresses * 3 + 1, sizeof(TxiPaletteSearchEntry));
+	work->opaqueSearch.nodes = (TxiPaletteSearchNode *) calloc(nAddresses * 6 + 1, sizeof(TxiPaletteSearchNode));
+	work->translucentSearch.entries = (TxiPaletteSearchEntry *) RxMemCalloc(nAddresses * 2 + 1, sizeof(TxiPaletteSearchEntry));
+	work->translucentSearch.nodes = (TxiPaletteSearchNode *) calloc(nAddresses * 4 + 1, sizeof(TxiPaletteSearchNode));
 
 	//all allocations must succeed
 	return work->pidx != NULL && work->txel != NULL && work->pltt != NULL
 		&& work->tiles != NULL && work->errorMap != NULL && work->plttYiq != NULL
-		&& work->colorTable != NULL && work->useTable != NULL;
+		&& work->blockHash != NULL && work->sameBlock != NULL && work->paletteHash != NULL
+		&& work->groups != NULL && work->tileNext != NULL && work->mergeHeap != NULL
+		&& work->opaqueSearch.entries != NULL && work->opaqueSearch.nodes != NULL
+		&& work->translucentSearch.entries != NULL && work->translucentSearch.nodes != NULL;
 }
 
 // -----------------------------------------------------------------------------------------------
@@ -2362,12 +3431,20 @@ static void Txi4x4FreeWork(TxiConversionWork *work, RxBool freeTex) {
 	}
 
 	//free work structures
+	free(work->groups);
 	RxMemFree(work->plttYiq);
-	free(work->colorTable);
-	free(work->useTable);
+	free(work->tileNext);
+	free(work->mergeHeap);
+	RxMemFree(work->opaqueSearch.entries);
+	free(work->opaqueSearch.nodes);
+	RxMemFree(work->translucentSearch.entries);
+	free(work->translucentSearch.nodes);
 	free(work->tiles);
 	free(work->errorMap);
 	free(work->useMap);
+	free(work->blockHash);
+	free(work->sameBlock);
+	free(work->paletteHash);
 }
 
 // -----------------------------------------------------------------------------------------------
@@ -2,6 +2,18 @@
 #include <stdio.h>
 #include "texture.h"
 #include "nns.h"
+#include "thread.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#define TX_SIMD
+#include <emmintrin.h>
+#endif
+
+// Number of rows of the output rendered at a time by a render worker.
+#define TX_RENDER_BAND_HEIGHT         32
+
+// Minimum number of pixels in a rendered rectangle for rendering to be multi-threaded.
+#define TX_RENDER_MT_THRESHOLD    (256*256)
 
 int ilog2(int x);
 
@@ -105,150 +117,293 @@ static COLOR32 TxiSamplePltt(const COLOR *pltt, unsigned int nPltt, unsigned int
 	return ColorConvertFromDS(pltt[i]);
 }
 
-static COLOR32 TxiSamplePlttN_Common(const COLOR *pltt, unsigned int nPltt, unsigned int index, int c0xp) {
-	COLOR32 col = TxiSamplePltt(pltt, nPltt, index);
-
-	if (index == 0 && c0xp) return col;
-	return col | 0xFF000000;
+static void TxiConvertColorsFromDS(const COLOR *src, COLOR32 *dest, unsigned int n, int alpha) {
+	//convert colors, taking alpha from bit 15 if requested.
+	unsigned int i = 0;
+#ifdef TX_SIMD
+	const __m128i mask5 = _mm_set1_epi16(0x1F);
+	const __m128i mul = _mm_set1_epi16(527);
+	const __m128i add = _mm_set1_epi16(23);
+	const __m128i alphaMask = _mm_set1_epi16(alpha ? (short) 0xFF00 : 0);
+	for (; (i + 8) <= n; i += 8) {
+		__m128i c = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i r = _mm_and_si128(c, mask5);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(c, 5), mask5);
+		__m128i b = _mm_and_si128(_mm_srli_epi16(c, 10), mask5);
+		__m128i a = _mm_and_si128(_mm_srai_epi16(c, 15), alphaMask);
+
+		//(x * 527 + 23) >> 6 matches the 5-bit to 8-bit conversion of ColorConvertFromDS
+		r = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(r, mul), add), 6);
+		g = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(g, mul), add), 6);
+		b = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(b, mul), add), 6);
+
+		//interleave RG and BA halves
+		__m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+		__m128i ba = _mm_or_si128(b, a);
+		_mm_storeu_si128((__m128i *) (dest + i + 0), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i *) (dest + i + 4), _mm_unpackhi_epi16(rg, ba));
+	}
+#endif
+	for (; i < n; i++) {
+		COLOR32 c = ColorConvertFromDS(src[i]);
+		if (alpha && (src[i] & 0x8000)) c |= 0xFF000000;
+		dest[i] = c;
+	}
 }
 
-static COLOR32 TxiSampleDirect(const unsigned char *txel, const uint16_t *pidx, unsigned int texW, int c0xp, unsigned int x, unsigned int y, const COLOR *pltt, unsigned int nPltt) {
-	(void) pidx;
-	(void) c0xp;
-	(void) pltt;
-	(void) nPltt;
+typedef struct TxiRenderContext_ TxiRenderContext;
+
+//renders rows of the output within the texture's bounds
+typedef void (*TxiRenderRowsProc) (const TxiRenderContext *ctx, unsigned int y0, unsigned int y1);
+
+struct TxiRenderContext_ {
+	COLOR32 *px;                 // output pixels
+	unsigned int srcX;           // X of the rendered rectangle in the texture
+	unsigned int srcY;           // Y of the rendered rectangle in the texture
+	unsigned int srcW;           // width of the rendered rectangle
+	unsigned int srcH;           // height of the rendered rectangle
+	unsigned int nCols;          // number of columns of the output rendered from the texture
+	unsigned int nRows;          // number of rows of the output rendered from the texture
+	const unsigned char *txel;   // texel data
+	const uint16_t *pidx;        // palette index data (tex4x4)
+	unsigned int texW;           // texture width
+	const COLOR *pltt;           // palette
+	unsigned int nPltt;          // palette size
+	COLOR32 plttRgb[256];        // palette converted for the index range of the format
+	TxiRenderRowsProc render;    // format row renderer
+	volatile long nextBand;      // next band of rows to be claimed by a render worker
+};
 
-	unsigned int iPx = x + y * texW;
-	COLOR colSrc = ((COLOR *) txel)[iPx];
+static void TxiLoadRenderPalette(TxiRenderContext *ctx, unsigned int nEntries, int opaque, int c0xp) {
+	//convert the palette for all indices representable by the format. Out of range colors are black.
+	unsigned int nConvert = nEntries < ctx->nPltt ? nEntries : ctx->nPltt;
+	TxiConvertColorsFromDS(ctx->pltt, ctx->plttRgb, nConvert, 0);
+	for (unsigned int i = nConvert; i < nEntries; i++) ctx->plttRgb[i] = 0;
 
-	COLOR32 c = ColorConvertFromDS(colSrc);
-	if (colSrc & 0x8000) c |= 0xFF000000;
-	return c;
+	if (opaque) {
+		for (unsigned int i = 0; i < nEntries; i++) ctx->plttRgb[i] |= 0xFF000000;
+		if (c0xp) ctx->plttRgb[0] &= 0x00FFFFFF;
+	}
 }
 
-static COLOR32 TxiSamplePltt4(const unsigned char *txel, const uint16_t *pidx, unsigned int texW, int c0xp, unsigned int x, unsigned int y, const COLOR *pltt, unsigned int nPltt) {
-	(void) pidx;
-
-	unsigned int iPx = x + y * texW;
-	unsigned int index = (txel[iPx >> 2] >> ((iPx & 3) * 2)) & 0x3;
-	return TxiSamplePlttN_Common(pltt, nPltt, index, c0xp);
+static void TxiRenderDirect(const TxiRenderContext *ctx, unsigned int y0, unsigned int y1) {
+	for (unsigned int y = y0; y < y1; y++) {
+		const COLOR *src = ((const COLOR *) ctx->txel) + ctx->srcX + (ctx->srcY + y) * ctx->texW;
+		TxiConvertColorsFromDS(src, ctx->px + y * ctx->srcW, ctx->nCols, 1);
+	}
 }
 
-static COLOR32 TxiSamplePltt16(const unsigned char *txel, const uint16_t *pidx, unsigned int texW, int c0xp, unsigned int x, unsigned int y, const COLOR *pltt, unsigned int nPltt) {
-	(void) pidx;
-
-	unsigned int iPx = x + y * texW;
-	unsigned int index = (txel[iPx >> 1] >> ((iPx & 1) * 4)) & 0xF;
-	return TxiSamplePlttN_Common(pltt, nPltt, index, c0xp);
+static void TxiRenderPltt4(const TxiRenderContext *ctx, unsigned int y0, unsigned int y1) {
+	for (unsigned int y = y0; y < y1; y++) {
+		COLOR32 *dest = ctx->px + y * ctx->srcW;
+		unsigned int iPx = ctx->srcX + (ctx->srcY + y) * ctx->texW;
+		for (unsigned int x = 0; x < ctx->nCols; x++, iPx++) {
+			dest[x] = ctx->plttRgb[(ctx->txel[iPx >> 2] >> ((iPx & 3) * 2)) & 0x3];
+		}
+	}
 }
 
-static COLOR32 TxiSamplePltt256(const unsigned char *txel, const uint16_t *pidx, unsigned int texW, int c0xp, unsigned int x, unsigned int y, const COLOR *pltt, unsigned int nPltt) {
-	(void) pidx;
-
-	unsigned int iPx = x + y * texW;
-	unsigned int index = txel[iPx];
-	return TxiSamplePlttN_Common(pltt, nPltt, index, c0xp);
+static void TxiRenderPltt16(const TxiRenderContext *ctx, unsigned int y0, unsigned int y1) {
+	for (unsigned int y = y0; y < y1; y++) {
+		COLOR32 *dest = ctx->px + y * ctx->srcW;
+		unsigned int iPx = ctx->srcX + (ctx->srcY + y) * ctx->texW;
+		for (unsigned int x = 0; x < ctx->nCols; x++, iPx++) {
+			dest[x] = ctx->plttRgb[(ctx->txel[iPx >> 1] >> ((iPx & 1) * 4)) & 0xF];
+		}
+	}
 }
 
-static COLOR32 TxiSampleA3I5(const unsigned char *txel, const uint16_t *pidx, unsigned int texW, int c0xp, unsigned int x, unsigned int y, const COLOR *pltt, unsigned int nPltt) {
-	(void) c0xp;
-	(void) pidx;
-
-	uint8_t d = txel[x + y * texW];
-	unsigned int index = (d & 0x1F) >> 0;
-	unsigned int alpha = (d & 0xE0) >> 5;
-
-	alpha = GX_A3I5_A3_TO_A5(alpha);      // 3-bit -> 5-bit alpha
-	alpha = (alpha * 510 + 31) / 62;      // scale to 8-bit
-
-	return TxiSamplePltt(pltt, nPltt, index) | (alpha << 24);
+static void TxiRenderPltt256(const TxiRenderContext *ctx, unsigned int y0, unsigned int y1) {
+	for (unsigned int y = y0; y < y1; y++) {
+		COLOR32 *dest = ctx->px + y * ctx->srcW;
+		const unsigned char *src = ctx->txel + ctx->srcX + (ctx->srcY + y) * ctx->texW;
+		for (unsigned int x = 0; x < ctx->nCols; x++) {
+			dest[x] = ctx->plttRgb[src[x]];
+		}
+	}
 }
 
-static COLOR32 TxiSampleA5I3(const unsigned char *txel, const uint16_t *pidx, unsigned int texW, int c0xp, unsigned int x, unsigned int y, const COLOR *pltt, unsigned int nPltt) {
-	(void) pidx;
-	(void) c0xp;
-
-	uint8_t d = txel[x + y * texW];
-	unsigned int index = (d & 0x07) >> 0;
-	unsigned int alpha = (d & 0xF8) >> 3;
-
-	alpha = (alpha * 510 + 31) / 62;      // scale to 8-bit
+static void TxiRenderA3I5(const TxiRenderContext *ctx, unsigned int y0, unsigned int y1) {
+	//alpha for each 3-bit alpha value
+	COLOR32 alphas[8];
+	for (unsigned int i = 0; i < 8; i++) {
+		unsigned int alpha = GX_A3I5_A3_TO_A5(i); // 3-bit -> 5-bit alpha
+		alpha = (alpha * 510 + 31) / 62;          // scale to 8-bit
+		alphas[i] = alpha << 24;
+	}
 
-	return TxiSamplePltt(pltt, nPltt, index) | (alpha << 24);
+	for (unsigned int y = y0; y < y1; y++) {
+		COLOR32 *dest = ctx->px + y * ctx->srcW;
+		const unsigned char *src = ctx->txel + ctx->srcX + (ctx->srcY + y) * ctx->texW;
+		for (unsigned int x = 0; x < ctx->nCols; x++) {
+			uint8_t d = src[x];
+			dest[x] = ctx->plttRgb[d & 0x1F] | alphas[(d & 0xE0) >> 5];
+		}
+	}
 }
 
-static COLOR32 TxiSampleTex4x4(const unsigned char *txel, const uint16_t *pidx, unsigned int texW, int c0xp, unsigned int x, unsigned int y, const COLOR *pltt, unsigned int nPltt) {
-	(void) c0xp;
-
-	unsigned int i = (x / 4) + (y / 4) * (texW / 4);
+static void TxiRenderA5I3(const TxiRenderContext *ctx, unsigned int y0, unsigned int y1) {
+	//alpha for each 5-bit alpha value
+	COLOR32 alphas[32];
+	for (unsigned int i = 0; i < 32; i++) {
+		alphas[i] = ((i * 510 + 31) / 62) << 24; // scale to 8-bit
+	}
 
-	uint32_t texel = *(const uint32_t *) (txel + (i << 2));
-	uint16_t index = pidx[i];
+	for (unsigned int y = y0; y < y1; y++) {
+		COLOR32 *dest = ctx->px + y * ctx->srcW;
+		const unsigned char *src = ctx->txel + ctx->srcX + (ctx->srcY + y) * ctx->texW;
+		for (unsigned int x = 0; x < ctx->nCols; x++) {
+			uint8_t d = src[x];
+			dest[x] = ctx->plttRgb[d & 0x07] | alphas[(d & 0xF8) >> 3];
+		}
+	}
+}
 
+static void TxiDecodeTex4x4Palette(const TxiRenderContext *ctx, uint16_t index, COLOR32 *colors) {
+	const COLOR *pltt = ctx->pltt;
+	unsigned int nPltt = ctx->nPltt;
 	unsigned int address = GX_TEX4x4_PIDX_ADDR(index);
 
-	COLOR32 colors[4] = { 0 };
 	colors[0] = TxiSamplePltt(pltt, nPltt, address + 0) | 0xFF000000;
 	colors[1] = TxiSamplePltt(pltt, nPltt, address + 1) | 0xFF000000;
+	colors[2] = 0;
+	colors[3] = 0;
 
 	if (!(index & GX_TEX4x4_PIDX_PTY_INTERPOLATE)) {
 		colors[2] = TxiSamplePltt(pltt, nPltt, address + 2) | 0xFF000000;
 		if (index & GX_TEX4x4_PIDX_A_OPAQUE) {
 			colors[3] = TxiSamplePltt(pltt, nPltt, address + 3) | 0xFF000000;
 		}
+	} else if (index & GX_TEX4x4_PIDX_A_OPAQUE) {
+		//blend colors 0,1 to 2,3
+		colors[2] = TxiBlend(colors[0], colors[1], 3);
+		colors[3] = TxiBlend(colors[0], colors[1], 5);
+	} else {
+		//blend colors 0,1 to 2
+		colors[2] = TxiBlend(colors[0], colors[1], 4);
 	}
+}
 
-	if (index & GX_TEX4x4_PIDX_PTY_INTERPOLATE) {
-		if (index & GX_TEX4x4_PIDX_A_OPAQUE) {
-			//blend colors 0,1 to 2,3
-			colors[2] = TxiBlend(colors[0], colors[1], 3);
-			colors[3] = TxiBlend(colors[0], colors[1], 5);
-		} else {
-			//blend colors 0,1 to 2
-			colors[2] = TxiBlend(colors[0], colors[1], 4);
+static void TxiRenderTex4x4(const TxiRenderContext *ctx, unsigned int y0, unsigned int y1) {
+	unsigned int tilesX = ctx->texW / 4;
+
+	//render a row of blocks at a time, decoding the palette once for each block.
+	unsigned int y = y0;
+	while (y < y1) {
+		unsigned int ty = ctx->srcY + y;
+		unsigned int yEnd = y + 4 - (ty & 3);
+		if (yEnd > y1) yEnd = y1;
+
+		unsigned int x = 0;
+		while (x < ctx->nCols) {
+			unsigned int tx = ctx->srcX + x;
+			unsigned int xEnd = x + 4 - (tx & 3);
+			if (xEnd > ctx->nCols) xEnd = ctx->nCols;
+
+			unsigned int i = (tx / 4) + (ty / 4) * tilesX;
+			uint32_t texel = *(const uint32_t *) (ctx->txel + (i << 2));
+
+			COLOR32 colors[4];
+			TxiDecodeTex4x4Palette(ctx, ctx->pidx[i], colors);
+
+			for (unsigned int y2 = y; y2 < yEnd; y2++) {
+				COLOR32 *dest = ctx->px + y2 * ctx->srcW;
+				uint32_t row = texel >> (((ctx->srcY + y2) & 3) * 8);
+				for (unsigned int x2 = x; x2 < xEnd; x2++) {
+					dest[x2] = colors[(row >> (((ctx->srcX + x2) & 3) * 2)) & 0x3];
+				}
+			}
+			x = xEnd;
 		}
+		y = yEnd;
 	}
+}
+
+static void TxiRenderBand(const TxiRenderContext *ctx, unsigned int y0, unsigned int y1) {
+	//render rows within the texture
+	unsigned int yTex = y1 < ctx->nRows ? y1 : ctx->nRows;
+	if (ctx->render != NULL && y0 < yTex) ctx->render(ctx, y0, yTex);
 
-	unsigned int j = (x & 3) + ((y & 3) << 2);
-	unsigned int pVal = (texel >> (2 * j)) & 0x3;
-	return colors[pVal];
+	//clear pixels outside of the texture
+	for (unsigned int y = y0; y < y1; y++) {
+		unsigned int x = (y < yTex) ? ctx->nCols : 0;
+		memset(ctx->px + y * ctx->srcW + x, 0, (ctx->srcW - x) * sizeof(COLOR32));
+	}
+}
+
+static void TxiRenderWorker(void *param, unsigned int iWorker, unsigned int nWorkers) {
+	(void) iWorker;
+	(void) nWorkers;
+	TxiRenderContext *ctx = (TxiRenderContext *) param;
+
+	while (1) {
+		unsigned int iBand = (unsigned int) (ThAtomicIncrement(&ctx->nextBand) - 1);
+		if (iBand >= (ctx->srcH + TX_RENDER_BAND_HEIGHT - 1) / TX_RENDER_BAND_HEIGHT) break;
+
+		unsigned int y0 = iBand * TX_RENDER_BAND_HEIGHT;
+		unsigned int y1 = y0 + TX_RENDER_BAND_HEIGHT;
+		if (y1 > ctx->srcH) y1 = ctx->srcH;
+		TxiRenderBand(ctx, y0, y1);
+	}
 }
 
 void TxRenderRect(COLOR32 *px, unsigned int srcX, unsigned int srcY, unsigned int srcW, unsigned int srcH, TEXELS *texels, PALETTE *palette) {
 	unsigned int width = TEXW(texels->texImageParam);
 	unsigned int height = texels->height;
-
-	COLOR *pltt = NULL;
-	unsigned int plttSize = 0;
+	int c0xp = COL0TRANS(texels->texImageParam);
+
+	TxiRenderContext context = { 0 };
+	TxiRenderContext *ctx = &context;
+	ctx->px = px;
+	ctx->srcX = srcX;
+	ctx->srcY = srcY;
+	ctx->srcW = srcW;
+	ctx->srcH = srcH;
+	ctx->nCols = srcW < width ? srcW : width;
+	ctx->nRows = srcH < height ? srcH : height;
+	ctx->txel = texels->texel;
+	ctx->pidx = texels->cmp;
+	ctx->texW = width;
 	if (palette != NULL) {
-		pltt = palette->pal;
-		plttSize = palette->nColors;
-	}
-
-	typedef COLOR32(*pfnSample) (const unsigned char *texel, const uint16_t *pidx, unsigned int texW, int c0xp,
-		unsigned int x, unsigned int y, const COLOR *pltt, unsigned int nPltt);
-
-	static const pfnSample pfnSamples[8] = {
-		NULL,
-		TxiSampleA3I5,
-		TxiSamplePltt4,
-		TxiSamplePltt16,
-		TxiSamplePltt256,
-		TxiSampleTex4x4,
-		TxiSampleA5I3,
-		TxiSampleDirect
-	};
-	pfnSample sample = pfnSamples[FORMAT(texels->texImageParam)];
-	
-	for (unsigned int y = 0; y < srcH; y++) {
-		for (unsigned int x = 0; x < srcW; x++) {
-			COLOR32 c = 0;
-			if (sample != NULL && x < width && y < height) {
-				c = sample(texels->texel, texels->cmp, width, COL0TRANS(texels->texImageParam), srcX + x, srcY + y, pltt, plttSize);
-			}
+		ctx->pltt = palette->pal;
+		ctx->nPltt = palette->nColors;
+	}
 
-			px[x + y * srcW] = c;
-		}
+	//select the row renderer, and convert the palette it indexes.
+	switch (FORMAT(texels->texImageParam)) {
+		case GX_TEXFMT_A3I5:
+			ctx->render = TxiRenderA3I5;
+			TxiLoadRenderPalette(ctx, 32, 0, 0);
+			break;
+		case GX_TEXFMT_PLTT4:
+			ctx->render = TxiRenderPltt4;
+			TxiLoadRenderPalette(ctx, 4, 1, c0xp);
+			break;
+		case GX_TEXFMT_PLTT16:
+			ctx->render = TxiRenderPltt16;
+			TxiLoadRenderPalette(ctx, 16, 1, c0xp);
+			break;
+		case GX_TEXFMT_PLTT256:
+			ctx->render = TxiRenderPltt256;
+			TxiLoadRenderPalette(ctx, 256, 1, c0xp);
+			break;
+		case GX_TEXFMT_TEX4x4:
+			ctx->render = TxiRenderTex4x4;
+			break;
+		case GX_TEXFMT_A5I3:
+			ctx->render = TxiRenderA5I3;
+			TxiLoadRenderPalette(ctx, 8, 0, 0);
+			break;
+		case GX_TEXFMT_DIRECT:
+			ctx->render = TxiRenderDirect;
+			break;
+	}
+
+	//large textures are rendered in bands of rows on worker threads.
+	if (srcW * srcH >= TX_RENDER_MT_THRESHOLD) {
+		ThRunWorkers(TxiRenderWorker, ctx, ThGetProcessorCount());
+	} else {
+		TxiRenderBand(ctx, 0, srcH);
 	}
 }
 
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+
+#include "thread.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+
+typedef struct ThiWorker_ {
+	ThWorkerProc proc;
+	void *param;
+	unsigned int iWorker;
+	unsigned int nWorkers;
+} ThiWorker;
+
+#ifdef _WIN32
+
+static DWORD CALLBACK ThiWorkerEntry(LPVOID lpParam) {
+	ThiWorker *worker = (ThiWorker *) lpParam;
+	worker->proc(worker->param, worker->iWorker, worker->nWorkers);
+	return 0;
+}
+
+unsigned int ThGetProcessorCount(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+}
+
+long ThAtomicIncrement(volatile long *p) {
+	return InterlockedIncrement(p);
+}
+
+long ThAtomicLoad(volatile long *p) {
+	return InterlockedCompareExchange(p, 0, 0);
+}
+
+void ThAtomicStore(volatile long *p, long val) {
+	InterlockedExchange(p, val);
+}
+
+long long ThAtomicAdd64(volatile long long *p, long long val) {
+	return InterlockedExchangeAdd64(p, val) + val;
+}
+
+double ThGetTime(void) {
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double) count.QuadPart / (double) freq.QuadPart;
+}
+
+void ThYield(void) {
+	SwitchToThread();
+}
+
+#else // _WIN32
+
+static void *ThiWorkerEntry(void *param) {
+	ThiWorker *worker = (ThiWorker *) param;
+	worker->proc(worker->param, worker->iWorker, worker->nWorkers);
+	return NULL;
+}
+
+unsigned int ThGetProcessorCount(void) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : (unsigned int) n;
+}
+
+long ThAtomicIncrement(volatile long *p) {
+	return __sync_add_and_fetch(p, 1);
+}
+
+long ThAtomicLoad(volatile long *p) {
+	return __sync_val_compare_and_swap(p, 0, 0);
+}
+
+void ThAtomicStore(volatile long *p, long val) {
+	//__sync_lock_test_and_set is only an acquire barrier, so it would not publish the writes before it.
+	__atomic_store_n(p, val, __ATOMIC_SEQ_CST);
+}
+
+long long ThAtomicAdd64(volatile long long *p, long long val) {
+	return __sync_add_and_fetch(p, val);
+}
+
+double ThGetTime(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void ThYield(void) {
+	sched_yield();
+}
+
+#endif // _WIN32
+
+unsigned int ThRunWorkers(ThWorkerProc proc, void *param, unsigned int nWorkers) {
+	if (nWorkers < 1) nWorkers = 1;
+	if (nWorkers > TH_MAX_WORKERS) nWorkers = TH_MAX_WORKERS;
+
+	ThiWorker workers[TH_MAX_WORKERS];
+#ifdef _WIN32
+	HANDLE hThreads[TH_MAX_WORKERS];
+#else
+	pthread_t threads[TH_MAX_WORKERS];
+#endif
+
+	//start workers 1 through n-1 on new threads. If a thread can't be created, stop there and run
+	//with the workers started so far.
+	unsigned int nStarted = 1;
+	for (unsigned int i = 1; i < nWorkers; i++) {
+		workers[i].proc = proc;
+		workers[i].param = param;
+		workers[i].iWorker = i;
+		workers[i].nWorkers = nWorkers;
+
+#ifdef _WIN32
+		hThreads[i] = CreateThread(NULL, 0, ThiWorkerEntry, &workers[i], 0, NULL);
+		if (hThreads[i] == NULL) break;
+#else
+		if (pthread_create(&threads[i], NULL, ThiWorkerEntry, &workers[i]) != 0) break;
+#endif
+		nStarted++;
+	}
+
+	//worker 0 runs on the calling thread
+	proc(param, 0, nWorkers);
+
+	for (unsigned int i = 1; i < nStarted; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(hThreads[i], INFINITE);
+		CloseHandle(hThreads[i]);
+#else
+		pthread_join(threads[i], NULL);
+#endif
+	}
+	return nStarted;
+}
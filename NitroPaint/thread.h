@@ -0,0 +1,57 @@
+#pragma once
+
+//
+// Minimal worker thread routines used by the compression and color reduction code. Work is run
+// on a group of workers, where worker 0 runs on the calling thread. Fewer workers than requested
+// may run (for example, when a thread cannot be created), so workers should claim their work
+// dynamically (e.g. with ThAtomicIncrement) rather than assuming a fixed partition.
+//
+
+#define TH_MAX_WORKERS    64  // maximum number of workers run at once
+
+
+//worker function, called once per worker
+typedef void (*ThWorkerProc) (void *param, unsigned int iWorker, unsigned int nWorkers);
+
+
+//
+// Gets the number of logical processors available.
+//
+unsigned int ThGetProcessorCount(void);
+
+//
+// Runs a worker function on nWorkers workers and waits for all of them to finish. Returns the
+// number of workers that were run, which is at least 1.
+//
+unsigned int ThRunWorkers(ThWorkerProc proc, void *param, unsigned int nWorkers);
+
+//
+// Atomically increments a value and returns the incremented value.
+//
+long ThAtomicIncrement(volatile long *p);
+
+//
+// Atomically reads a value.
+//
+long ThAtomicLoad(volatile long *p);
+
+//
+// Atomically writes a value.
+//
+void ThAtomicStore(volatile long *p, long val);
+
+//
+// Atomically adds to a 64-bit value and returns the new value.
+//
+long long ThAtomicAdd64(volatile long long *p, long long val);
+
+//
+// Gets the time in seconds from a monotonic clock. Only differences between two calls are
+// meaningful.
+//
+double ThGetTime(void);
+
+//
+// Yields the remainder of the calling thread's time slice.
+//
+void ThYield(void);